@@ -4,6 +4,10 @@
  * Example program for demonstrating how the trackfile.device
  * calculates the disk image file track and disk checksums.
  *
+ * The checksums can also be stored in a manifest file, which
+ * can be updated incrementally and used for verifying that the
+ * disk image files are still intact.
+ *
  * Written by Olaf Barthel (2020-07-11)
  * Public domain
  */
@@ -36,6 +40,35 @@ extern struct Library * DOSBase;
 
 #define ZERO ((BPTR)NULL)
 #define OK (0)
+#define SAME (0)
+#define NOT !
+#define CANNOT !
+
+/****************************************************************************/
+
+/* Both 3.5" double density and high density disks have 80 cylinders
+ * and 2 heads, which makes for 160 tracks each.
+ */
+#define NUM_TRACKS 160
+
+/* Each checksum is stored in the manifest in the 11 character text
+ * form produced by checksum_to_text().
+ */
+#define CHECKSUM_TEXT_LENGTH 11
+
+/* Maximum length of a single manifest line: the disk checksum, the
+ * file size, the modification date (three numbers), all the track
+ * checksums and finally the path name.
+ */
+#define MAX_PATH_NAME_SIZE 1024
+#define MANIFEST_LINE_SIZE (CHECKSUM_TEXT_LENGTH + 1 + 4 * (10 + 1) + \
+	NUM_TRACKS * CHECKSUM_TEXT_LENGTH + 1 + MAX_PATH_NAME_SIZE + 2)
+
+/* The manifest file starts with this line, which identifies it. */
+#define MANIFEST_HEADER "; DAChecksum manifest 1\n"
+
+/* Manifest entries are looked up by path name through a hash table. */
+#define MANIFEST_HASH_SIZE 257
 
 /****************************************************************************/
 
@@ -50,6 +83,28 @@ struct fletcher64_checksum
 
 /****************************************************************************/
 
+/* This is what the manifest file records for each disk image file. */
+struct manifest_entry
+{
+	struct manifest_entry *		me_Next;		/* Next entry, in manifest file order */
+	struct manifest_entry *		me_HashNext;	/* Next entry in the same hash chain */
+	BOOL						me_Keep;		/* Entry will be written to the manifest file */
+	LONG						me_Size;		/* Disk image file size */
+	struct DateStamp			me_Date;		/* Disk image file modification date */
+	struct fletcher64_checksum	me_DiskChecksum;
+	struct fletcher64_checksum	me_TrackChecksums[NUM_TRACKS];
+	TEXT						me_Path[1];		/* Full path name, NUL-terminated */
+};
+
+struct manifest
+{
+	struct manifest_entry *		m_First;
+	struct manifest_entry *		m_Last;
+	struct manifest_entry *		m_HashTable[MANIFEST_HASH_SIZE];
+};
+
+/****************************************************************************/
+
 /* Calculates the 64 bit checksum for a series of 32 bit words.
  *
  * The basic workings of this algorithm come from: J.G. Fletcher. An arithmetic
@@ -96,6 +151,17 @@ fletcher64_checksum(APTR data, size_t size, struct fletcher64_checksum * checksu
 
 /****************************************************************************/
 
+/* We break down the 64 bit checksum integer into groups of six bits
+ * each, with the last four bits having two zero bits. Each 6 bit value
+ * then gets mapped to a character from the following table. Note that
+ * the 0 and O are both replaced with different characters to as to
+ * avoid mistaking one for the other.
+ */
+static const char checksum_mapping[64+1] = \
+	".abcdefghijklmnopqrstuvwxyz%123456789ABCDEFGHIJKLMN/PQRSTUVWXYZ:";
+
+/****************************************************************************/
+
 /* Convert the track file checksum (a 64 bit integer) into a short
  * text representation. This will require a text buffer which can
  * hold at least 11 characters plus a terminating NUL byte.
@@ -103,23 +169,13 @@ fletcher64_checksum(APTR data, size_t size, struct fletcher64_checksum * checksu
 void
 checksum_to_text(struct fletcher64_checksum * f64c, TEXT * text_form)
 {
-	/* We break down the 64 bit integer into groups of six bits
-	 * each, with the last four bits having two zero bits.
-	 * Each 6 bit value then gets mapped to a character from
-	 * the following table. Note that the 0 and O are both
-	 * replaced with different characters to as to avoid mistaking
-	 * one for the other.
-	 */
-	static const char mapping[64+1] = \
-		".abcdefghijklmnopqrstuvwxyz%123456789ABCDEFGHIJKLMN/PQRSTUVWXYZ:";
-
 	ULONG high = f64c->f64c_high;
 	ULONG low = f64c->f64c_low;
 	int i;
 
 	for(i = 0 ; i < 11 ; i++)
 	{
-		(*text_form++) = mapping[low % 64];
+		(*text_form++) = checksum_mapping[low % 64];
 
 		/* Shift the 64 bit integer right by 6 bits. */
 		low = (high << (32 - 6)) | (low >> 6);
@@ -159,11 +215,583 @@ da_checksum(
 
 /****************************************************************************/
 
+
+/* Convert the text representation produced by checksum_to_text() back
+ * into the 64 bit checksum. Returns FALSE if the text does not contain
+ * a valid checksum.
+ */
+BOOL
+text_to_checksum(const TEXT * text_form, struct fletcher64_checksum * f64c)
+{
+	ULONG high = 0;
+	ULONG low = 0;
+	const char * found;
+	ULONG value;
+	int shift;
+	int i;
+
+	for(i = 0 ; i < CHECKSUM_TEXT_LENGTH ; i++)
+	{
+		if(text_form[i] == '\0')
+			return(FALSE);
+
+		found = strchr(checksum_mapping, text_form[i]);
+		if(found == NULL)
+			return(FALSE);
+
+		value = found - checksum_mapping;
+
+		/* Each character stands for the next 6 bits of the
+		 * 64 bit integer, starting with the least significant
+		 * bits. The 6 bits may straddle the two halves.
+		 */
+		shift = 6 * i;
+
+		if(shift < 32)
+		{
+			low |= value << shift;
+
+			if(shift + 6 > 32)
+				high |= value >> (32 - shift);
+		}
+		else
+		{
+			high |= value << (shift - 32);
+		}
+	}
+
+	f64c->f64c_high	= high;
+	f64c->f64c_low	= low;
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* AmigaDOS path names are not case sensitive, which is why we fold
+ * both ASCII and ISO 8859-1 characters to upper case before they are
+ * compared or hashed.
+ */
+TEXT
+fold_character(TEXT c)
+{
+	if((c >= 'a' && c <= 'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7))
+		c -= 0x20;
+
+	return(c);
+}
+
+/****************************************************************************/
+
+ULONG
+hash_path_name(const TEXT * path)
+{
+	ULONG hash = 0;
+
+	while((*path) != '\0')
+		hash = hash * 31 + fold_character(*path++);
+
+	return(hash % MANIFEST_HASH_SIZE);
+}
+
+/****************************************************************************/
+
+BOOL
+same_path_name(const TEXT * a, const TEXT * b)
+{
+	while((*a) != '\0' && fold_character(*a) == fold_character(*b))
+	{
+		a++;
+		b++;
+	}
+
+	return((BOOL)(fold_character(*a) == fold_character(*b)));
+}
+
+/****************************************************************************/
+
+struct manifest_entry *
+find_manifest_entry(struct manifest * m, const TEXT * path)
+{
+	struct manifest_entry * me;
+
+	for(me = m->m_HashTable[hash_path_name(path)] ;
+	    me != NULL ;
+	    me = me->me_HashNext)
+	{
+		if(same_path_name(me->me_Path, path))
+			break;
+	}
+
+	return(me);
+}
+
+/****************************************************************************/
+
+/* Add a new, blank entry to the end of the manifest. */
+struct manifest_entry *
+add_manifest_entry(struct manifest * m, const TEXT * path)
+{
+	struct manifest_entry * me;
+	ULONG hash;
+
+	me = AllocVec(sizeof(*me) + strlen(path), MEMF_ANY|MEMF_CLEAR);
+	if(me != NULL)
+	{
+		strcpy(me->me_Path, path);
+
+		hash = hash_path_name(path);
+
+		me->me_HashNext = m->m_HashTable[hash];
+		m->m_HashTable[hash] = me;
+
+		if(m->m_Last != NULL)
+			m->m_Last->me_Next = me;
+		else
+			m->m_First = me;
+
+		m->m_Last = me;
+	}
+
+	return(me);
+}
+
+/****************************************************************************/
+
+void
+free_manifest(struct manifest * m)
+{
+	struct manifest_entry * me;
+	struct manifest_entry * next;
+
+	if(m != NULL)
+	{
+		for(me = m->m_First ; me != NULL ; me = next)
+		{
+			next = me->me_Next;
+
+			FreeVec(me);
+		}
+
+		FreeVec(m);
+	}
+}
+
+/****************************************************************************/
+
+/* Return the next blank-separated word on a manifest line, and
+ * NUL-terminate it. Returns NULL if there is no such word.
+ */
+STRPTR
+next_manifest_word(STRPTR * position)
+{
+	STRPTR start = (*position);
+	STRPTR end;
+
+	while((*start) == ' ')
+		start++;
+
+	if((*start) == '\0')
+		return(NULL);
+
+	end = start;
+
+	while((*end) != ' ' && (*end) != '\0')
+		end++;
+
+	if((*end) == ' ')
+		(*end++) = '\0';
+
+	(*position) = end;
+
+	return(start);
+}
+
+/****************************************************************************/
+
+/* Read the manifest file and add its contents to the manifest. Each entry
+ * takes up exactly one line, which looks like this:
+ *
+ *    <disk checksum> <size> <days> <minute> <tick> <track checksums> <path>
+ *
+ * The date stamp is that of the disk image file at the time the checksums
+ * were calculated. The track checksums are written as one word, with 11
+ * characters for each of the 160 tracks. Lines which begin with a ';'
+ * character are ignored.
+ */
+LONG
+read_manifest(struct manifest * m, STRPTR name, STRPTR line, LONG line_size)
+{
+	struct manifest_entry * me;
+	BPTR file_handle;
+	LONG line_number = 0;
+	LONG error = OK;
+	STRPTR position;
+	STRPTR words[6];
+	LONG values[4];
+	STRPTR path;
+	int length;
+	int i;
+
+	file_handle = Open(name, MODE_OLDFILE);
+	if(file_handle == ZERO)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	/* Note that FGets() returns NULL both on error and when the
+	 * end of the file has been reached. The error code tells
+	 * the two apart.
+	 */
+	for(SetIoErr(OK) ; FGets(file_handle, line, line_size) != NULL ; SetIoErr(OK))
+	{
+		line_number++;
+
+		/* The very first line must identify the manifest file. */
+		if(line_number == 1)
+		{
+			if(strcmp(line, MANIFEST_HEADER) != SAME)
+			{
+				Printf("%s: File \"%s\" is not a manifest file\n", "DAChecksum", name);
+
+				error = ERROR_OBJECT_WRONG_TYPE;
+				goto out;
+			}
+
+			continue;
+		}
+
+		length = strlen(line);
+		if(length == 0 || line[length-1] != '\n')
+		{
+			Printf("%s: Manifest file \"%s\" line %ld is too long\n", "DAChecksum", name, line_number);
+
+			error = ERROR_LINE_TOO_LONG;
+			goto out;
+		}
+
+		line[--length] = '\0';
+
+		/* Skip blank lines and comments. */
+		if(length == 0 || line[0] == ';')
+			continue;
+
+		position = line;
+
+		for(i = 0 ; i < 6 ; i++)
+		{
+			words[i] = next_manifest_word(&position);
+			if(words[i] == NULL)
+				break;
+		}
+
+		path = position;
+
+		if(i < 6 || path[0] == '\0' || strlen(words[5]) != NUM_TRACKS * CHECKSUM_TEXT_LENGTH)
+		{
+			Printf("%s: Manifest file \"%s\" line %ld is incomplete\n", "DAChecksum", name, line_number);
+
+			error = ERROR_OBJECT_WRONG_TYPE;
+			goto out;
+		}
+
+		for(i = 0 ; i < 4 ; i++)
+		{
+			if(StrToLong(words[1+i], &values[i]) <= 0)
+			{
+				Printf("%s: Manifest file \"%s\" line %ld is corrupt\n", "DAChecksum", name, line_number);
+
+				error = ERROR_OBJECT_WRONG_TYPE;
+				goto out;
+			}
+		}
+
+		/* Ignore duplicate entries, just in case. */
+		if(find_manifest_entry(m, path) != NULL)
+			continue;
+
+		me = add_manifest_entry(m, path);
+		if(me == NULL)
+		{
+			error = ERROR_NO_FREE_STORE;
+			goto out;
+		}
+
+		me->me_Size					= values[0];
+		me->me_Date.ds_Days			= values[1];
+		me->me_Date.ds_Minute		= values[2];
+		me->me_Date.ds_Tick			= values[3];
+
+		if(CANNOT text_to_checksum(words[0], &me->me_DiskChecksum))
+		{
+			Printf("%s: Manifest file \"%s\" line %ld is corrupt\n", "DAChecksum", name, line_number);
+
+			error = ERROR_OBJECT_WRONG_TYPE;
+			goto out;
+		}
+
+		for(i = 0 ; i < NUM_TRACKS ; i++)
+		{
+			if(CANNOT text_to_checksum(&words[5][i * CHECKSUM_TEXT_LENGTH], &me->me_TrackChecksums[i]))
+			{
+				Printf("%s: Manifest file \"%s\" line %ld is corrupt\n", "DAChecksum", name, line_number);
+
+				error = ERROR_OBJECT_WRONG_TYPE;
+				goto out;
+			}
+		}
+	}
+
+	/* Did reading stop due to an error? */
+	error = IoErr();
+
+ out:
+
+	if(file_handle != ZERO)
+		Close(file_handle);
+
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Write all the manifest entries which are to be kept to the manifest
+ * file. The new manifest file replaces the old one only after it has
+ * been written in full.
+ */
+LONG
+write_manifest(struct manifest * m, STRPTR name)
+{
+	struct manifest_entry * me;
+	TEXT checksum_text[16];
+	STRPTR new_name;
+	BPTR file_handle = ZERO;
+	LONG error = OK;
+	int i;
+
+	new_name = AllocVec(strlen(name) + strlen(".new") + 1, MEMF_ANY);
+	if(new_name == NULL)
+	{
+		error = ERROR_NO_FREE_STORE;
+		goto out;
+	}
+
+	strcpy(new_name, name);
+	strcat(new_name, ".new");
+
+	file_handle = Open(new_name, MODE_NEWFILE);
+	if(file_handle == ZERO)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	if(FPuts(file_handle, MANIFEST_HEADER) != OK)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	for(me = m->m_First ; me != NULL ; me = me->me_Next)
+	{
+		if(NOT me->me_Keep)
+			continue;
+
+		checksum_to_text(&me->me_DiskChecksum, checksum_text);
+
+		if(FPrintf(file_handle, "%s %ld %ld %ld %ld ", checksum_text, me->me_Size,
+			me->me_Date.ds_Days, me->me_Date.ds_Minute, me->me_Date.ds_Tick) < 0)
+		{
+			error = IoErr();
+			goto out;
+		}
+
+		for(i = 0 ; i < NUM_TRACKS ; i++)
+		{
+			checksum_to_text(&me->me_TrackChecksums[i], checksum_text);
+
+			if(FPuts(file_handle, checksum_text) != OK)
+			{
+				error = IoErr();
+				goto out;
+			}
+		}
+
+		if(FPrintf(file_handle, " %s\n", me->me_Path) < 0)
+		{
+			error = IoErr();
+			goto out;
+		}
+	}
+
+	/* Closing the file will flush the buffered output,
+	 * which may fail, too.
+	 */
+	if(CANNOT Close(file_handle))
+	{
+		file_handle = ZERO;
+
+		error = IoErr();
+		goto out;
+	}
+
+	file_handle = ZERO;
+
+	/* Replace the old manifest file, if there is one. */
+	if(CANNOT DeleteFile(name))
+	{
+		error = IoErr();
+		if(error != ERROR_OBJECT_NOT_FOUND)
+			goto out;
+
+		error = OK;
+	}
+
+	if(CANNOT Rename(new_name, name))
+		error = IoErr();
+
+ out:
+
+	if(file_handle != ZERO)
+	{
+		Close(file_handle);
+
+		DeleteFile(new_name);
+	}
+
+	if(new_name != NULL)
+		FreeVec(new_name);
+
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Compare the track checksums recorded in the manifest against the ones
+ * just calculated and print the numbers of all the tracks which differ.
+ * Returns the number of tracks which differ.
+ */
+LONG
+compare_track_checksums(
+	const struct manifest_entry *		me,
+	const struct fletcher64_checksum *	track_checksums,
+	STRPTR								reason)
+{
+	LONG num_mismatches = 0;
+	int i;
+
+	for(i = 0 ; i < NUM_TRACKS ; i++)
+	{
+		if(me->me_TrackChecksums[i].f64c_high != track_checksums[i].f64c_high ||
+		   me->me_TrackChecksums[i].f64c_low != track_checksums[i].f64c_low)
+		{
+			if(num_mismatches == 0)
+				Printf("%s: %s, tracks differ:", me->me_Path, reason);
+
+			Printf(" %ld", i);
+
+			num_mismatches++;
+		}
+	}
+
+	if(num_mismatches > 0)
+		Printf("\n");
+
+	return(num_mismatches);
+}
+
+/****************************************************************************/
+
+/* Read the entire disk image file and calculate its checksums. Returns
+ * FALSE if this did not work out, in which case an error message
+ * will have been printed.
+ */
+BOOL
+checksum_disk_image_file(
+	BPTR							file_handle,
+	STRPTR							name,
+	LONG							file_size,
+	APTR							disk_data,
+	struct fletcher64_checksum *	track_checksums,
+	struct fletcher64_checksum *	disk_checksum)
+{
+	LONG num_bytes_read;
+
+	num_bytes_read = Read(file_handle, disk_data, file_size);
+	if(num_bytes_read == -1)
+	{
+		/* This was a read error. */
+		PrintFault(IoErr(), name);
+		return(FALSE);
+	}
+
+	/* Make sure that we read exactly as much data
+	 * as requested and that the file has not been
+	 * truncated since we learned of its size.
+	 */
+	if(num_bytes_read != file_size)
+	{
+		Printf("%s: File \"%s\" was truncated (expected %ld bytes, read only %ld)\n",
+			"DAChecksum", name, file_size, num_bytes_read);
+
+		return(FALSE);
+	}
+
+	da_checksum(disk_data, num_bytes_read, track_checksums, disk_checksum);
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Decide whether a file whose size and modification date have not changed
+ * since the manifest was written should be read again anyway, as a spot
+ * check. The files are picked at random, using Marsaglia's xorshift
+ * pseudo-random number generator.
+ */
+BOOL
+file_is_sampled(ULONG * state, LONG sample_percent)
+{
+	ULONG x;
+
+	if(sample_percent <= 0)
+		return(FALSE);
+
+	if(sample_percent >= 100)
+		return(TRUE);
+
+	x = (*state);
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	(*state) = x;
+
+	return((BOOL)((x % 100) < (ULONG)sample_percent));
+}
+
+/****************************************************************************/
+
 /* Read all Amiga disk image files, calculate their respective track and
  * disk checksums and print these along with the path names of these
  * files. Directories and soft links are ignored, as are files whose
  * sizes do not match those of Amiga 3.5" floppy disk image files
  * of double or high density disks.
+ *
+ * With the MANIFEST option the track and disk checksums, the file size
+ * and the modification date of each file are stored in a manifest file
+ * instead. The next time the manifest is updated only those files will
+ * be read again whose size or modification date has changed, or which
+ * have been picked as a random sample (SAMPLE=<percentage>). The manifest
+ * always covers exactly the files matched by the FILES option.
+ *
+ * With the VERIFY option all the files listed in the manifest file are
+ * checked against their recorded checksums. By default all files are
+ * read, but SAMPLE=<percentage> restricts this to a random sample of the
+ * files whose size and modification date have not changed. The numbers
+ * of the tracks which differ are printed for each file.
  */
 int
 main(int argc, char ** argv)
@@ -174,19 +802,39 @@ main(int argc, char ** argv)
 	 */
 	int size_dd_disk = TD_SECTOR *     NUMSECS * 2 * 80;
 	int size_hd_disk = TD_SECTOR * 2 * NUMSECS * 2 * 80;
-	int max_path_name = 1024;
+	int max_path_name = MAX_PATH_NAME_SIZE;
+
+	struct
+	{
+		STRPTR *	Files;
+		STRPTR		Manifest;
+		LONG		Verify;
+		LONG *		Sample;
+	} args;
 
 	struct fletcher64_checksum * track_checksums = NULL;
 	struct fletcher64_checksum disk_checksum;
+	struct FileInfoBlock * fib = NULL;
+	struct manifest * manifest = NULL;
+	struct manifest_entry * me;
 	struct RDArgs * rda = NULL;
 	struct AnchorPath * ap = NULL;
+	struct DateStamp now;
 	TEXT checksum_text[16];
 	BOOL matched = FALSE;
 	int result = RETURN_ERROR;
-	STRPTR * files = NULL;
+	STRPTR * files;
+	STRPTR line = NULL;
 	BPTR file_handle = ZERO;
 	APTR disk_data = NULL;
-	LONG num_bytes_read;
+	ULONG sample_state;
+	LONG sample_percent;
+	LONG num_files = 0;
+	LONG num_read = 0;
+	LONG num_changed = 0;
+	LONG num_failed = 0;
+	BOOL unchanged;
+	STRPTR status;
 	STRPTR file_name;
 	BPTR old_dir;
 	LONG error;
@@ -216,101 +864,330 @@ main(int argc, char ** argv)
 		goto out;
 	}
 
-	rda = ReadArgs("FILES/A/M", (LONG *)&files, NULL);
+	memset(&args, 0, sizeof(args));
+
+	rda = ReadArgs("FILES/M,MANIFEST/K,VERIFY/S,SAMPLE/K/N", (LONG *)&args, NULL);
 	if(rda == NULL)
 	{
 		PrintFault(IoErr(), "DAChecksum");
 		goto out;
 	}
 
-	/* Process all the arguments as the "List" command would by
-	 * apply pattern matching to them.
+	/* Verification works only with a manifest and will
+	 * check only the files listed in it.
 	 */
-	while((file_name = (*files++)) != NULL)
+	if((args.Manifest == NULL && (args.Verify || args.Sample != NULL)) ||
+	   (args.Verify == FALSE && args.Files == NULL))
 	{
-		/* Set up the directory scanner to stop on Ctrl+C and also
-		 * make it build the full path to the respective disk image
-		 * file.
+		PrintFault(ERROR_REQUIRED_ARG_MISSING, "DAChecksum");
+		goto out;
+	}
+
+	if(args.Verify && args.Files != NULL)
+	{
+		PrintFault(ERROR_TOO_MANY_ARGS, "DAChecksum");
+		goto out;
+	}
+
+	if(args.Manifest != NULL)
+	{
+		manifest = AllocVec(sizeof(*manifest), MEMF_ANY|MEMF_CLEAR);
+		line = AllocVec(MANIFEST_LINE_SIZE, MEMF_ANY);
+
+		if(manifest == NULL || line == NULL)
+		{
+			PrintFault(ERROR_NO_FREE_STORE, "DAChecksum");
+			goto out;
+		}
+
+		/* A missing manifest file is fine if we are
+		 * about to create it.
 		 */
-		memset(ap, 0, sizeof(*ap));
+		error = read_manifest(manifest, args.Manifest, line, MANIFEST_LINE_SIZE);
+		if(error != OK && (args.Verify || error != ERROR_OBJECT_NOT_FOUND))
+		{
+			PrintFault(error, args.Manifest);
+			goto out;
+		}
+	}
+
+	/* By default, verification reads all the files listed
+	 * in the manifest whereas updating the manifest reads
+	 * only those files which have changed.
+	 */
+	if(args.Sample != NULL)
+		sample_percent = (*args.Sample);
+	else if (args.Verify)
+		sample_percent = 100;
+	else
+		sample_percent = 0;
+
+	DateStamp(&now);
 
-		ap->ap_Strlen		= max_path_name;
-		ap->ap_BreakBits	= SIGBREAKF_CTRL_C;
+	sample_state = (ULONG)now.ds_Days * 86400 * 50 + (ULONG)now.ds_Minute * 60 * 50 + now.ds_Tick;
+	if(sample_state == 0)
+		sample_state = 1;
 
-		for(error = MatchFirst(file_name, ap), matched = TRUE ;
-		    error == OK ;
-		    error = MatchNext(ap))
+	if(args.Verify)
+	{
+		fib = AllocDosObject(DOS_FIB, NULL);
+		if(fib == NULL)
 		{
-			/* This should be a plain file and not a soft link. */
-			if(ap->ap_Info.fib_DirEntryType >= 0 || ap->ap_Info.fib_DirEntryType == ST_SOFTLINK)
-				continue;
+			PrintFault(ERROR_NO_FREE_STORE, "DAChecksum");
+			goto out;
+		}
 
-			/* We only support 3.5" double density and
-			 * high density disk image files.
-			 */
-			if(ap->ap_Info.fib_Size != size_dd_disk &&
-			   ap->ap_Info.fib_Size != size_hd_disk)
+		for(me = manifest->m_First ; me != NULL ; me = me->me_Next)
+		{
+			if(CheckSignal(SIGBREAKF_CTRL_C))
 			{
-				continue;
+				PrintFault(ERROR_BREAK, "DAChecksum");
+				goto out;
 			}
 
-			/* Attempt to open the given file for reading. */
-			old_dir = CurrentDir(ap->ap_Current->an_Lock);
+			num_files++;
 
-			file_handle = Open(ap->ap_Info.fib_FileName, MODE_OLDFILE);
-			error = IoErr();
+			file_handle = Open(me->me_Path, MODE_OLDFILE);
+			if(file_handle == ZERO)
+			{
+				error = IoErr();
+				if(error != ERROR_OBJECT_NOT_FOUND)
+				{
+					PrintFault(error, me->me_Path);
+					goto out;
+				}
 
-			CurrentDir(old_dir);
+				Printf("%s: file is missing\n", me->me_Path);
 
-			/* Abort if this didn't work out. */
-			if(file_handle == NULL)
-			{
-				PrintFault(error, ap->ap_Buf);
-				goto out;
+				num_failed++;
+				continue;
 			}
 
-			/* Read the entire disk image file. */
-			num_bytes_read = Read(file_handle, disk_data, ap->ap_Info.fib_Size);
-			if(num_bytes_read == -1)
+			if(CANNOT ExamineFH(file_handle, fib))
 			{
-				/* This was a read error. */
-				PrintFault(error, ap->ap_Buf);
+				PrintFault(IoErr(), me->me_Path);
 				goto out;
 			}
 
-			/* Make sure that we read exactly as much data
-			 * as requested and that the file has not been
-			 * truncated since we learned of its size.
+			unchanged = (BOOL)(fib->fib_Size == me->me_Size && CompareDates(&fib->fib_Date, &me->me_Date) == SAME);
+
+			/* Skip the files which have not changed and which
+			 * were not picked for a spot check.
 			 */
-			if(num_bytes_read != ap->ap_Info.fib_Size)
+			if(unchanged && NOT file_is_sampled(&sample_state, sample_percent))
 			{
-				Printf("%s: File \"%s\" was truncated (expected %ld bytes, read only %ld)\n",
-					"DAChecksum", ap->ap_Buf, ap->ap_Info.fib_Size, num_bytes_read);
+				Close(file_handle);
+				file_handle = ZERO;
 
-				goto out;
+				continue;
+			}
+
+			if(fib->fib_Size != me->me_Size)
+			{
+				Printf("%s: file size changed from %ld to %ld bytes\n", me->me_Path, me->me_Size, fib->fib_Size);
+
+				Close(file_handle);
+				file_handle = ZERO;
+
+				num_changed++;
+				continue;
 			}
 
+			if(CANNOT checksum_disk_image_file(file_handle, me->me_Path, me->me_Size, disk_data, track_checksums, &disk_checksum))
+				goto out;
+
 			Close(file_handle);
 			file_handle = ZERO;
 
-			da_checksum(disk_data, num_bytes_read, track_checksums, &disk_checksum);
+			num_read++;
+
+			/* A file which differs from the manifest in spite of having
+			 * the same size and modification date is likely damaged.
+			 */
+			if(unchanged)
+			{
+				if(compare_track_checksums(me, track_checksums, "checksum mismatch") > 0)
+					num_failed++;
+			}
+			else
+			{
+				if(compare_track_checksums(me, track_checksums, "file was modified") > 0)
+					num_changed++;
+			}
+		}
+	}
+	else
+	{
+		/* Process all the arguments as the "List" command would by
+		 * apply pattern matching to them.
+		 */
+		files = args.Files;
+
+		while((file_name = (*files++)) != NULL)
+		{
+			/* Set up the directory scanner to stop on Ctrl+C and also
+			 * make it build the full path to the respective disk image
+			 * file.
+			 */
+			memset(ap, 0, sizeof(*ap));
+
+			ap->ap_Strlen		= max_path_name;
+			ap->ap_BreakBits	= SIGBREAKF_CTRL_C;
+
+			for(error = MatchFirst(file_name, ap), matched = TRUE ;
+			    error == OK ;
+			    error = MatchNext(ap))
+			{
+				/* This should be a plain file and not a soft link. */
+				if(ap->ap_Info.fib_DirEntryType >= 0 || ap->ap_Info.fib_DirEntryType == ST_SOFTLINK)
+					continue;
+
+				/* We only support 3.5" double density and
+				 * high density disk image files.
+				 */
+				if(ap->ap_Info.fib_Size != size_dd_disk &&
+				   ap->ap_Info.fib_Size != size_hd_disk)
+				{
+					continue;
+				}
+
+				me = NULL;
+				unchanged = FALSE;
+
+				/* If the manifest already covers this file and neither
+				 * its size nor its modification date have changed, we
+				 * may skip it, unless it was picked for a spot check.
+				 */
+				if(manifest != NULL)
+				{
+					me = find_manifest_entry(manifest, ap->ap_Buf);
+					if(me != NULL)
+					{
+						/* Did we see this file before? */
+						if(me->me_Keep)
+							continue;
+
+						unchanged = (BOOL)(me->me_Size == ap->ap_Info.fib_Size &&
+						                   CompareDates(&me->me_Date, &ap->ap_Info.fib_Date) == SAME);
+
+						if(unchanged && NOT file_is_sampled(&sample_state, sample_percent))
+						{
+							me->me_Keep = TRUE;
+
+							num_files++;
+							continue;
+						}
+					}
+				}
+
+				/* Attempt to open the given file for reading. */
+				old_dir = CurrentDir(ap->ap_Current->an_Lock);
+
+				file_handle = Open(ap->ap_Info.fib_FileName, MODE_OLDFILE);
+				error = IoErr();
+
+				CurrentDir(old_dir);
+
+				/* Abort if this didn't work out. */
+				if(file_handle == ZERO)
+				{
+					PrintFault(error, ap->ap_Buf);
+					goto out;
+				}
+
+				/* Read the entire disk image file. */
+				if(CANNOT checksum_disk_image_file(file_handle, ap->ap_Buf, ap->ap_Info.fib_Size, disk_data, track_checksums, &disk_checksum))
+					goto out;
+
+				Close(file_handle);
+				file_handle = ZERO;
+
+				checksum_to_text(&disk_checksum, checksum_text);
+
+				if(manifest == NULL)
+				{
+					Printf("%s  %s\n", checksum_text, ap->ap_Buf);
+					continue;
+				}
+
+				num_files++;
+				num_read++;
+
+				if(me == NULL)
+				{
+					me = add_manifest_entry(manifest, ap->ap_Buf);
+					if(me == NULL)
+					{
+						PrintFault(ERROR_NO_FREE_STORE, "DAChecksum");
+						goto out;
+					}
+
+					status = "new";
+				}
+				else if (unchanged)
+				{
+					/* If the spot check failed, we keep the manifest
+					 * entry as it is so that the next verification
+					 * will flag this file again.
+					 */
+					if(compare_track_checksums(me, track_checksums, "checksum mismatch") > 0)
+					{
+						me->me_Keep = TRUE;
+
+						num_failed++;
+						continue;
+					}
+
+					status = "verified";
+				}
+				else
+				{
+					status = "updated";
+
+					num_changed++;
+				}
+
+				me->me_Keep		= TRUE;
+				me->me_Size		= ap->ap_Info.fib_Size;
+				me->me_Date		= ap->ap_Info.fib_Date;
+
+				me->me_DiskChecksum = disk_checksum;
+				memcpy(me->me_TrackChecksums, track_checksums, sizeof(me->me_TrackChecksums));
+
+				Printf("%s  %s (%s)\n", checksum_text, ap->ap_Buf, status);
+			}
 
-			checksum_to_text(&disk_checksum, checksum_text);
+			if(error != OK && error != ERROR_NO_MORE_ENTRIES)
+			{
+				PrintFault(error, "DAChecksum");
+				goto out;
+			}
 
-			Printf("%s  %s\n", checksum_text, ap->ap_Buf);
+			MatchEnd(ap);
+			matched = FALSE;
 		}
 
-		if(error != OK && error != ERROR_NO_MORE_ENTRIES)
+		if(manifest != NULL)
 		{
-			PrintFault(error, "DAChecksum");
-			goto out;
+			error = write_manifest(manifest, args.Manifest);
+			if(error != OK)
+			{
+				PrintFault(error, args.Manifest);
+				goto out;
+			}
 		}
+	}
 
-		MatchEnd(ap);
-		matched = FALSE;
+	if(manifest != NULL)
+	{
+		Printf("%ld files, %ld read, %ld changed, %ld failed\n",
+			num_files, num_read, num_changed, num_failed);
 	}
 
-	result = RETURN_OK;
+	if(num_failed > 0 || (args.Verify && num_changed > 0))
+		result = RETURN_WARN;
+	else
+		result = RETURN_OK;
 
  out:
 
@@ -325,6 +1202,14 @@ main(int argc, char ** argv)
 		FreeVec(ap);
 	}
 
+	if(fib != NULL)
+		FreeDosObject(DOS_FIB, fib);
+
+	free_manifest(manifest);
+
+	if(line != NULL)
+		FreeVec(line);
+
 	if(track_checksums != NULL)
 		FreeVec(track_checksums);
 
@@ -71,6 +71,12 @@
 #include "start_unit.h"
 #include "tools.h"
 #include "cache.h"
+#include "daemon.h"
+#include "trackfile_extensions.h"
+#include "track_statistics.h"
+#include "memory_statistics.h"
+#include "warmup_profile.h"
+#include "file_system_registry.h"
 #include "cmd_main.h"
 
 /****************************************************************************/
@@ -108,7 +114,8 @@ static int compare_by_unit_number(const struct Node *a, const struct Node *b);
 *	[CREATE [BOOTABLE] [DISKTYPE <DD|HD>] [LABEL <name>] [OVERWRITE]
 *	[FILESYSTEM <name>] [FILESYSTEMTYPE [<OFS|FFS>][+INTERNATIONAL]
 *	[+<LONGNAME|DIRCACHE>]]] [INFO [SHOWCHECKSUMS] [SHOWVOLUMES]
-*	[SHOWBOOTBLOCKS]] [SETENV] [SETVAR] [QUIET|VERBOSE] [IGNORE]
+*	[SHOWBOOTBLOCKS]] [TRACKSTATS <TABLE|CSV>] [RESETTRACKSTATS]
+*	[MEMORYSTATS] [SETENV] [SETVAR] [QUIET|VERBOSE] [IGNORE] [DAEMON]
 *	[[FILE] {<name|pattern>}]
 *
 *   TEMPLATE
@@ -116,8 +123,9 @@ static int compare_by_unit_number(const struct Node *a, const struct Node *b);
 *	USECHECKSUMS/K,SAFEEJECT/K,BOOTABLE=INSTALL/S,FILESYSTEM/K,
 *	FILESYSTEMTYPE/K,OVERWRITE/S,DISKTYPE/K,LABEL/K,
 *	PROTECT=WRITEPROTECTED/K,UNIT=DEVICE/K,INFO/S,SHOWCHECKSUMS/S,
-*	SHOWVOLUMES/S,SHOWBOOTBLOCKS/S,SETENV/S,SETVAR/S,QUIET/S,
-*	VERBOSE/S,IGNORE/S,FILE/M
+*	SHOWVOLUMES/S,SHOWBOOTBLOCKS/S,TRACKSTATS/K,RESETTRACKSTATS/S,
+*	MEMORYSTATS/S,SETENV/S,SETVAR/S,QUIET/S,VERBOSE/S,IGNORE/S,DAEMON/S,
+*	FILE/M
 *
 *   PATH
 *	C/DACONTROL
@@ -199,6 +207,33 @@ static int compare_by_unit_number(const struct Node *a, const struct Node *b);
 *	    mounted as read-only. To make the image writable instead, use the
 *	    WRITEPROTECTED=NO option.
 *
+*	BLOCKSERVER
+*	    If you use the LOAD or CHANGE options, the disk image file will be
+*	    read and written by the block server process whose public message
+*	    port has the name given, such as the one started by the
+*	    DABlockServer command, rather than by the trackfile.device unit
+*	    itself. This only works for plain disk image files; extended ADF
+*	    files and packed disk image files are always read directly.
+*
+*	CHECKPOINT
+*	    Used together with the CHANGE and DEVICE options, this takes a
+*	    checkpoint of the disk contents, to which you can return later
+*	    with the ROLLBACK option. Nothing is copied when the checkpoint
+*	    is taken. Instead, the unit keeps a copy of each track in memory
+*	    which is changed afterwards, and the more tracks are changed,
+*	    the more memory is used. Taking another checkpoint replaces the
+*	    previous one, and ejecting the disk image file discards it.
+*	    Extended ADF files and packed disk image files cannot be changed
+*	    and do not support checkpoints.
+*
+*	ROLLBACK
+*	    Used together with the CHANGE and DEVICE options, this restores
+*	    the disk contents as of the last CHECKPOINT. Only the tracks which
+*	    were changed since then are written back to the disk image file.
+*	    The file system is inhibited while this happens, so that it will
+*	    read the restored disk contents afterwards. The checkpoint stays
+*	    in effect, and you can roll back to it again.
+*
 *	CREATE
 *	    Creates a "blank" disk image file when it starts up and has it
 *	    formatted and mounted. This image file will always be writable,
@@ -248,10 +283,10 @@ static int compare_by_unit_number(const struct Node *a, const struct Node *b);
 *	    older or newer Amiga filesystems, rather than the filesystem software
 *	    your system starts with.
 *
-*	    Please note that DAControl will load this filesystem software every
-*	    time you use the FILESYSTEM option, even if you used it before with
-*	    the same option and filesystem name. You may want to keep an eye on
-*	    how much memory this will consume!
+*	    The filesystem software is loaded only once and then reused every
+*	    time you use the FILESYSTEM option with the same file again, for
+*	    as long as the file remains unchanged. It stays in memory until
+*	    the PURGEFILESYSTEMS option unloads it, unless it is in use.
 *
 *	FILESYSTEMTYPE
 *	    This option will change the file system type or mode of operation
@@ -347,6 +382,66 @@ static int compare_by_unit_number(const struct Node *a, const struct Node *b);
 *	    Boot block and file system signature information is updated in
 *	    real time as the contents of a disk image are modified.
 *
+*	TRACKSTATS
+*	    Show how often each track of a loaded disk image was read and
+*	    written, and how many of these reads had to access the disk
+*	    image file rather than the cache. With TRACKSTATS=TABLE the
+*	    numbers are shown as a heat map with one column per cylinder
+*	    and one line per head: a blank stands for a track which was not
+*	    accessed at all, and "@" for the most frequently accessed one.
+*	    With TRACKSTATS=CSV one line per track is printed, which is
+*	    suitable for processing by spreadsheet or plotting software.
+*
+*	    If you use the DEVICE option, only the statistics for this
+*	    unit will be shown, otherwise those of all units which have a
+*	    medium loaded are shown.
+*
+*	    The counters start from zero each time a medium is loaded.
+*
+*	MEMORYSTATS
+*	    Show how much memory each unit uses for its data structures, its
+*	    track buffer, its disk checksum table, its process stack and its
+*	    CHECKPOINT, and how many cache nodes hold tracks of its disk image
+*	    file. Units which use the same disk image file share these cache
+*	    nodes. The totals for all units and for the cache follow, with
+*	    the cache memory split into track data and the overhead of
+*	    managing it.
+*
+*	    If you use the DEVICE option, only the memory used by this unit
+*	    will be shown.
+*
+*	PURGEFILESYSTEMS
+*	    Unload the filesystem software which was loaded through the
+*	    FILESYSTEM option and which is not currently in use. A filesystem
+*	    which was used for mounting a disk image file remains in use
+*	    for as long as the AmigaDOS device exists.
+*
+*	RESETTRACKSTATS
+*	    Reset the track statistics counters to zero, either for the
+*	    unit given by the DEVICE option, or for all units. If you
+*	    combine RESETTRACKSTATS with TRACKSTATS, the statistics will
+*	    be shown first and then reset.
+*
+*	WARMUP
+*	    When a disk image file is ejected, remember which of its tracks
+*	    were read, and in which order, by storing this information in a
+*	    file next to the disk image file, under the same name with
+*	    ".warmup" added. The next time the same disk image file is loaded
+*	    with the WARMUP option, these tracks will be loaded into the
+*	    cache in the same order while the unit is idle, so that they do
+*	    not have to be read from the file when they are needed. This
+*	    requires the cache to be enabled for the unit.
+*
+*	PREDICT
+*	    While a disk image file loaded with the PREDICT option is in use,
+*	    the unit learns which tracks tend to be read after which other
+*	    tracks, such as when the file system moves from a directory to a
+*	    file header and then to the file data, which are often stored on
+*	    different tracks. Whenever a track is read, the tracks which are
+*	    likely to be read next are loaded into the cache while the unit
+*	    is idle. The TRACKSTATS option shows how often these predictions
+*	    were correct. This requires the cache to be enabled for the unit.
+*
 *	SETVAR and SETENV
 *	    If you use one of these options, then DACONTROL will store the
 *	    name of the last AmigaDOS device it used in the environment
@@ -377,6 +472,24 @@ static int compare_by_unit_number(const struct Node *a, const struct Node *b);
 *	    problem is more serious than missing files or unsuitable
 *	    files.
 *
+*	DAEMON
+*	    DACONTROL keeps running in the background and executes the
+*	    commands of all the DACONTROL commands started after it, which
+*	    will send their command lines to it. Because "trackfile.device"
+*	    remains open, each of these commands completes faster, which
+*	    helps in scripts which use DACONTROL many times over. The
+*	    command output still appears in the shell window in which the
+*	    command was started.
+*
+*	    The daemon can also be controlled through ARexx, using the
+*	    host name "DACONTROL", e.g. ADDRESS DACONTROL 'EJECT DEVICE DA0:'
+*	    The RC variable will hold the return code of the command.
+*
+*	    Stop the daemon with Ctrl+C or the "Break" command. Note that
+*	    a SETVAR option sent to the daemon sets a local variable of the
+*	    daemon, not of the shell in which DACONTROL was started. Use
+*	    SETENV instead.
+*
 *	FILE
 *	    The LOAD and CREATE options require the name of a disk image file
 *	    which should be loaded or created. You may use wildcards when
@@ -464,6 +577,8 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		"ENABLECACHE/K,"
 		"PREFILLCACHE/K,"
 		"CACHESIZE/K/N,"
+		"WARMUP/S,"
+		"PREDICT/S,"
 	#endif /* ENABLE_CACHE */
 		"SAFEEJECT/K,"
 		"FILESYSTEM/K,"
@@ -472,6 +587,9 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		"DISKTYPE/K,"
 		"LABEL/K,"
 		"PROTECT=WRITEPROTECTED/K,"
+		"BLOCKSERVER/K,"
+		"CHECKPOINT/S,"
+		"ROLLBACK/S,"
 		"UNIT=DEVICE/K,"
 		"INFO/S,"
 		"SHOWCHECKSUMS/S,"
@@ -480,11 +598,16 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	#if defined(ENABLE_CACHE)
 		"SHOWCACHES/S,"
 	#endif /* ENABLE_CACHE */
+		"TRACKSTATS/K,"
+		"RESETTRACKSTATS/S,"
+		"MEMORYSTATS/S,"
+		"PURGEFILESYSTEMS/S,"
 		"SETENV/S,"
 		"SETVAR/S,"
 		"QUIET/S,"
 		"VERBOSE/S,"
 		"IGNORE/S,"
+		"DAEMON/S,"
 		"FILE/M"
 		VERSTAG;
 
@@ -505,6 +628,8 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		KEY		EnableCache;
 		KEY		PrefillCache;
 		NUMBER	CacheSize;
+		SWITCH	Warmup;
+		SWITCH	Predict;
 	#endif /* ENABLE_CACHE */
 		KEY		SafeEject;
 		KEY		FileSystem;
@@ -514,6 +639,10 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		KEY		Label;
 
 		KEY		WriteProtected;
+		KEY		BlockServer;
+
+		SWITCH	Checkpoint;
+		SWITCH	Rollback;
 
 		KEY		Device;
 
@@ -525,6 +654,11 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		SWITCH	ShowCaches;
 	#endif /* ENABLE_CACHE */
 
+		KEY		TrackStats;
+		SWITCH	ResetTrackStats;
+		SWITCH	MemoryStats;
+		SWITCH	PurgeFileSystems;
+
 		SWITCH	SetEnv;
 		SWITCH	SetVar;
 
@@ -532,6 +666,8 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		SWITCH	Verbose;
 		SWITCH	Ignore;
 
+		SWITCH	Daemon;
+
 		KEY *	File;
 	} options;
 
@@ -540,6 +676,7 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	LONG error;
 	struct Library * TrackFileBase = NULL;
 	struct RDArgs * rda = NULL;
+	struct RDArgs * daemon_rda = NULL;
 	struct AnchorPath * ap = NULL;
 	BOOL use_next_available_unit = FALSE;
 	TEXT dos_device_name[260]; /* <- Large enough for a BCPL string, plus a ":" character and NUL termination. */
@@ -549,6 +686,7 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	BOOL unit_is_valid = FALSE;
 	BOOL write_protected = TRUE;
 	BOOL safe_eject = FALSE;
+	BOOL track_stats_csv = FALSE;
 	LONG timeout = 0;
 	ULONG * cylinder_data = NULL;
 	BPTR cylinder_file = ZERO;
@@ -573,16 +711,31 @@ cmd_main(REG(a0, struct GlobalData * gd))
 
 	memset(&options, 0, sizeof(options));
 
-	/* Open the control unit for "trackfile.device",
-	 * which is unit -1 (TFUNIT_CONTROL).
+	/* If a DAControl daemon is running, it will execute this
+	 * command for us. It already has "trackfile.device" open.
 	 */
-	error = OpenDevice(TRACKFILENAME, TFUNIT_CONTROL, (struct IORequest *)&gd->gd_TrackFileDevice, 0);
-	if(error != OK)
+	if(NOT gd->gd_IsDaemon && forward_command_to_daemon(gd, &rc))
 	{
-		Error(gd, "Cannot open \"%s\".", TRACKFILENAME);
+		SHOWMSG("command was executed by the daemon");
+
+		error = OK;
 		goto out;
 	}
 
+	/* Open the control unit for "trackfile.device",
+	 * which is unit -1 (TFUNIT_CONTROL). The daemon
+	 * keeps it open between commands.
+	 */
+	if(NOT gd->gd_IsDaemon)
+	{
+		error = OpenDevice(TRACKFILENAME, TFUNIT_CONTROL, (struct IORequest *)&gd->gd_TrackFileDevice, 0);
+		if(error != OK)
+		{
+			Error(gd, "Cannot open \"%s\".", TRACKFILENAME);
+			goto out;
+		}
+	}
+
 	/* Version 2.15 of trackfile.device introduced the TFChangeUnitTagList()
 	 * and TFExamineFileSize() functions, which we need.
 	 */
@@ -609,7 +762,28 @@ cmd_main(REG(a0, struct GlobalData * gd))
 
 	ap->ap_BreakBits = SIGBREAKF_CTRL_C;
 
-	rda = ReadArgs((STRPTR)template, (LONG *)&options, NULL);
+	/* The daemon parses the command line sent to it
+	 * rather than its own.
+	 */
+	if(gd->gd_DaemonArguments != NULL)
+	{
+		daemon_rda = AllocDosObject(DOS_RDARGS, NULL);
+		if(daemon_rda == NULL)
+		{
+			error = ERROR_NO_FREE_STORE;
+
+			PrintFault(error, "DAControl");
+			goto out;
+		}
+
+		daemon_rda->RDA_Source.CS_Buffer	= gd->gd_DaemonArguments;
+		daemon_rda->RDA_Source.CS_Length	= gd->gd_DaemonArgumentsLength;
+		daemon_rda->RDA_Source.CS_CurChr	= 0;
+
+		SET_FLAG(daemon_rda->RDA_Flags, RDAF_NOPROMPT);
+	}
+
+	rda = ReadArgs((STRPTR)template, (LONG *)&options, daemon_rda);
 	if(rda == NULL)
 	{
 		error = IoErr();
@@ -622,6 +796,26 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	if(options.Quiet)
 		options.Verbose = FALSE;
 
+	/* Keep running and execute the commands which other
+	 * DAControl commands send us, until stopped.
+	 */
+	if(options.Daemon)
+	{
+		if(gd->gd_IsDaemon)
+		{
+			Error(gd, "DAControl is already running as a daemon.");
+
+			error = ERROR_OBJECT_IN_USE;
+			goto out;
+		}
+
+		error = run_daemon(gd, options.Quiet);
+		if(error == OK)
+			rc = RETURN_OK;
+
+		goto out;
+	}
+
 	/* We need to know what to do, and that either
 	 * requires an action to perform (load, eject or
 	 * change a medium, start or stop a unit, create
@@ -634,7 +828,11 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	   NOT options.Start &&
 	   NOT options.Stop &&
 	   NOT options.Create &&
-	   NOT options.Info)
+	   NOT options.Info &&
+	   NOT options.TrackStats &&
+	   NOT options.ResetTrackStats &&
+	   NOT options.MemoryStats &&
+	   NOT options.PurgeFileSystems)
 	{
 		error = ERROR_REQUIRED_ARG_MISSING;
 
@@ -642,6 +840,24 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		goto out;
 	}
 
+	/* Show the track statistics as a heat map or in
+	 * CSV format?
+	 */
+	if(options.TrackStats != NULL)
+	{
+		if(Stricmp(options.TrackStats, "csv") == SAME)
+		{
+			track_stats_csv = TRUE;
+		}
+		else if (Stricmp(options.TrackStats, "table") != SAME)
+		{
+			Error(gd, "The TRACKSTATS option must be either TABLE or CSV.");
+
+			error = ERROR_REQUIRED_ARG_MISSING;
+			goto out;
+		}
+	}
+
 	/* Disable the write protection for media? */
 	if(options.WriteProtected != NULL)
 	{
@@ -778,6 +994,17 @@ cmd_main(REG(a0, struct GlobalData * gd))
 
 	#if defined(ENABLE_CACHE)
 	{
+		/* Load the tracks which were read the last time a disk image
+		 * file was used into the cache, and remember which tracks
+		 * were read before a disk image file is ejected?
+		 */
+		gd->gd_UseWarmupProfiles = options.Warmup;
+
+		/* Learn which tracks tend to be read after which other
+		 * tracks, and load the likely next tracks into the cache?
+		 */
+		gd->gd_PredictTracks = options.Predict;
+
 		/* Enable the cache for a disk image file, once it's loaded? */
 		if(options.EnableCache != NULL)
 		{
@@ -841,6 +1068,9 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	}
 	#endif /* ENABLE_CACHE */
 
+	/* Have a block server access the disk image files? */
+	gd->gd_BlockServerName = options.BlockServer;
+
 	/* Use disk and track checksums to detect disks with
 	 * the same contents?
 	 */
@@ -893,11 +1123,12 @@ cmd_main(REG(a0, struct GlobalData * gd))
 
 		D(("trying to load file system '%s'", options.FileSystem));
 
-		gd->gd_LoadedFileSystem = LoadSeg(options.FileSystem);
-		if(gd->gd_LoadedFileSystem == ZERO)
+		/* The file system is mounted with the default
+		 * DosType, as chosen by mount_floppy_file().
+		 */
+		error = obtain_file_system(gd, options.FileSystem, ID_DOS_DISK, &gd->gd_LoadedFileSystem);
+		if(error != OK)
 		{
-			error = IoErr();
-
 			D(("that didn't work (error=%ld)", error));
 
 			Error(gd, "Could not load file system \"%s\" (%s)",
@@ -1811,6 +2042,7 @@ cmd_main(REG(a0, struct GlobalData * gd))
 			unit,
 			use_next_available_unit,
 			cache_size,
+			enable_cache,
 			num_cylinders,
 			num_sectors,
 			&new_unit, /* <- This will be filled in */
@@ -1900,6 +2132,16 @@ cmd_main(REG(a0, struct GlobalData * gd))
 					Printf("Ejecting medium from unit %ld with timeout %lds.\n", unit, timeout);
 			}
 
+			/* Remember which tracks were read, and in which order,
+			 * before the unit forgets about it.
+			 */
+			#if defined(ENABLE_CACHE)
+			{
+				if(gd->gd_UseWarmupProfiles)
+					save_warmup_profile(gd, unit, options.Verbose);
+			}
+			#endif /* ENABLE_CACHE */
+
 			/* Try to tell the file system to shut down,
 			 * so we may remove the medium safely.
 			 */
@@ -2022,6 +2264,62 @@ cmd_main(REG(a0, struct GlobalData * gd))
 			}
 		}
 
+		/* We should take a checkpoint of the disk contents,
+		 * or restore them?
+		 */
+		if(options.Checkpoint || options.Rollback)
+		{
+			if(NOT dos_device_name_is_valid)
+			{
+				Error(gd, "File system device for unit %ld is not known.", unit);
+
+				error = ERROR_REQUIRED_ARG_MISSING;
+				goto out;
+			}
+
+			if(options.Verbose)
+			{
+				Printf("%s the contents of the medium in \"%s:\" (unit %ld).\n",
+					options.Rollback ? "Restoring" : "Taking a checkpoint of",
+					dos_device_name, unit);
+			}
+
+			/* The file system has to write back its changes before
+			 * the checkpoint is taken, and it must not be using the
+			 * medium while its contents are restored.
+			 */
+			if(CANNOT inhibit_device(gd, dos_device_name, TRUE))
+			{
+				error = IoErr();
+
+				Error(gd, "Could not inhibit file system on \"%s:\" (unit %ld) (%s).", dos_device_name, unit,
+					get_error_message(gd, error, error_message, sizeof(error_message)));
+
+				goto out;
+			}
+
+			/* Ask for the change to be made. */
+			error = TFChangeUnitTags(unit,
+				TF_Rollback,	options.Rollback,
+				options.Checkpoint ? TF_Checkpoint : TAG_IGNORE, TRUE,
+			TAG_DONE);
+
+			/* Tell the file system to drop the needle on the record again. */
+			inhibit_device(gd, dos_device_name, FALSE);
+
+			if(error != OK)
+			{
+				get_error_message(gd, error, error_message, sizeof(error_message));
+
+				if(options.Rollback)
+					Error(gd, "Could not restore the contents of the medium in \"%s:\" (unit %ld) (%s).", dos_device_name, unit, error_message);
+				else
+					Error(gd, "Could not take a checkpoint of the medium in \"%s:\" (unit %ld) (%s).", dos_device_name, unit, error_message);
+
+				goto out;
+			}
+		}
+
 		#if defined(ENABLE_CACHE)
 		{
 			/* Enable/disable the unit cache? */
@@ -2104,6 +2402,16 @@ cmd_main(REG(a0, struct GlobalData * gd))
 					Printf("Ejecting medium from unit %ld with timeout %lds.\n", unit, timeout);
 			}
 
+			/* Remember which tracks were read, and in which order,
+			 * before the unit forgets about it.
+			 */
+			#if defined(ENABLE_CACHE)
+			{
+				if(gd->gd_UseWarmupProfiles)
+					save_warmup_profile(gd, unit, options.Verbose);
+			}
+			#endif /* ENABLE_CACHE */
+
 			/* Try to tell the file system to shut down,
 			 * so we may remove the medium safely.
 			 */
@@ -2780,6 +3088,65 @@ cmd_main(REG(a0, struct GlobalData * gd))
 			Printf("No units have been started yet.\n");
 	}
 
+	/* Show the track access statistics, either for
+	 * the unit given or for all of them.
+	 */
+	if(options.TrackStats != NULL)
+	{
+		if(options.Info)
+			Printf("\n");
+
+		error = show_track_statistics(gd, (unit_is_valid && NOT use_next_available_unit) ? unit : -1, track_stats_csv);
+		if(error != OK)
+			goto out;
+	}
+
+	if(options.MemoryStats)
+	{
+		if(options.Info || options.TrackStats != NULL)
+			Printf("\n");
+
+		error = show_memory_statistics(gd, (unit_is_valid && NOT use_next_available_unit) ? unit : -1);
+		if(error != OK)
+			goto out;
+	}
+
+	/* Start counting track accesses anew? */
+	if(options.ResetTrackStats)
+	{
+		LONG which_unit = (unit_is_valid && NOT use_next_available_unit) ? unit : TFUNIT_CONTROL;
+
+		error = TFChangeUnitTags(which_unit,
+			TF_ResetTrackStatistics, TRUE,
+		TAG_DONE);
+
+		if(error != OK)
+		{
+			get_error_message(gd, error, error_message, sizeof(error_message));
+
+			if(which_unit == TFUNIT_CONTROL)
+				Error(gd, "Could not reset track statistics (%s).", error_message);
+			else
+				Error(gd, "Could not reset track statistics of unit %ld (%s).", which_unit, error_message);
+
+			goto out;
+		}
+
+		if(options.Verbose)
+			Printf("Track statistics have been reset.\n");
+	}
+
+	/* Unload the file systems which are no longer in use? */
+	if(options.PurgeFileSystems)
+	{
+		LONG num_in_use;
+
+		num_in_use = purge_file_systems(gd, options.Verbose);
+
+		if(options.Verbose && num_in_use > 0)
+			Printf("%ld file system(s) remain loaded because they are in use.\n", num_in_use);
+	}
+
 	/* If requested, save the AmigaDOS device
 	 * name in a dedicated environment variable.
 	 */
@@ -2834,11 +3201,11 @@ cmd_main(REG(a0, struct GlobalData * gd))
 	if(boot_block != NULL)
 		FreeMem(boot_block, boot_block_size);
 
-	if(gd->gd_LoadedFileSystem != ZERO && NOT gd->gd_LoadedFileSystemUsed)
+	if(gd->gd_LoadedFileSystem != ZERO)
 	{
-		SHOWMSG("unloading unused file system");
+		SHOWMSG("releasing file system");
 
-		UnLoadSeg(gd->gd_LoadedFileSystem);
+		release_file_system(gd, gd->gd_LoadedFileSystem, gd->gd_LoadedFileSystemUsed);
 	}
 
 	if(io != NULL)
@@ -2849,12 +3216,19 @@ cmd_main(REG(a0, struct GlobalData * gd))
 		DeleteIORequest((struct IORequest *)io);
 	}
 
-	if(TrackFileBase != NULL)
+	if(TrackFileBase != NULL && NOT gd->gd_IsDaemon)
+	{
 		CloseDevice((struct IORequest *)&gd->gd_TrackFileDevice);
 
+		gd->gd_TrackFileBase = NULL;
+	}
+
 	if(rda != NULL)
 		FreeArgs(rda);
 
+	if(daemon_rda != NULL)
+		FreeDosObject(DOS_RDARGS, daemon_rda);
+
 	if(ap != NULL)
 		FreeVec(ap);
 
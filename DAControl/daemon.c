@@ -0,0 +1,425 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#include <rexx/storage.h>
+
+#include <dos/dosextens.h>
+
+/****************************************************************************/
+
+#define __USE_SYSBASE
+#include <proto/exec.h>
+
+#include <proto/dos.h>
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+#include "compiler.h"
+#include "macros.h"
+#include "global_data.h"
+#include "cmd_main.h"
+#include "daemon.h"
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+/* ARexx messages carry this node name. */
+#define REXX_MESSAGE_NAME "REXX"
+
+/****************************************************************************/
+
+/* Execute a single command on behalf of a client, as if the command line
+ * had been given to DAControl directly. The trackfile.device control unit
+ * remains open between commands.
+ */
+static LONG
+execute_command(struct GlobalData * gd, STRPTR arguments, LONG length)
+{
+	USE_DOS(gd);
+
+	LONG rc;
+
+	ENTER();
+
+	D(("arguments = \"%s\"", arguments));
+
+	/* Each command starts out with the same state as if DAControl
+	 * had just been started.
+	 */
+	gd->gd_LoadedFileSystem		= ZERO;
+	gd->gd_LoadedFileSystemName	= NULL;
+	gd->gd_LoadedFileSystemUsed	= FALSE;
+	gd->gd_UseChecksums			= FALSE;
+	gd->gd_UseWarmupProfiles	= FALSE;
+	gd->gd_PredictTracks		= FALSE;
+	gd->gd_BlockServerName		= NULL;
+	gd->gd_DiskImageFileName	= NULL;
+	gd->gd_DevProc				= NULL;
+
+	gd->gd_DaemonArguments			= arguments;
+	gd->gd_DaemonArgumentsLength	= length;
+
+	SetIoErr(OK);
+
+	rc = cmd_main(gd);
+
+	gd->gd_DaemonArguments			= NULL;
+	gd->gd_DaemonArgumentsLength	= 0;
+
+	RETURN(rc);
+	return(rc);
+}
+
+/****************************************************************************/
+
+/* Handle a command sent by another DAControl command. The output of the
+ * command goes to the client's shell window, and file names are relative
+ * to the client's current directory.
+ */
+static VOID
+process_daemon_message(struct GlobalData * gd, struct DaemonMsg * dm)
+{
+	USE_EXEC(gd);
+	USE_DOS(gd);
+
+	struct Process * this_process = (struct Process *)FindTask(NULL);
+	BPTR old_error_output;
+	BPTR old_output;
+	BPTR old_dir;
+
+	ENTER();
+
+	old_output = SelectOutput(dm->dm_Output);
+	old_dir = CurrentDir(dm->dm_CurrentDir);
+
+	old_error_output = this_process->pr_CES;
+	this_process->pr_CES = dm->dm_ErrorOutput;
+
+	dm->dm_Result	= execute_command(gd, dm->dm_Arguments, dm->dm_ArgumentsLength);
+	dm->dm_Error	= IoErr();
+
+	this_process->pr_CES = old_error_output;
+
+	CurrentDir(old_dir);
+	SelectOutput(old_output);
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Handle a command sent through ARexx, e.g. through
+ *
+ *    ADDRESS DACONTROL 'LOAD Work:Disks/Workbench.adf'
+ *
+ * The command output goes to the daemon's own output stream, and the
+ * return code of the command becomes the ARexx RC variable. No result
+ * string is ever returned.
+ */
+static VOID
+process_rexx_message(struct GlobalData * gd, struct RexxMsg * rm)
+{
+	USE_EXEC(gd);
+
+	STRPTR command = (STRPTR)rm->rm_Args[0];
+	STRPTR arguments = NULL;
+	LONG length;
+
+	ENTER();
+
+	rm->rm_Result1 = RETURN_FAIL;
+	rm->rm_Result2 = 0;
+
+	if((rm->rm_Action & RXCODEMASK) != RXCOMM || command == NULL)
+	{
+		SHOWMSG("not a command");
+		goto out;
+	}
+
+	/* ReadArgs() expects the command line to be terminated
+	 * by a line feed character.
+	 */
+	length = strlen(command);
+
+	arguments = AllocVec(length + 2, MEMF_ANY);
+	if(arguments == NULL)
+	{
+		SHOWMSG("out of memory");
+		goto out;
+	}
+
+	CopyMem(command, arguments, length);
+	arguments[length++]	= '\n';
+	arguments[length]	= '\0';
+
+	rm->rm_Result1 = execute_command(gd, arguments, length);
+
+ out:
+
+	if(arguments != NULL)
+		FreeVec(arguments);
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Run as a daemon which executes the commands sent to it by other DAControl
+ * commands, or through ARexx, until it receives a Ctrl+C signal. Returns
+ * an error code if the daemon could not be started.
+ */
+LONG
+run_daemon(struct GlobalData * gd, BOOL quiet)
+{
+	USE_EXEC(gd);
+	USE_DOS(gd);
+
+	struct MsgPort * port;
+	struct Message * msg;
+	BOOL port_added = FALSE;
+	BOOL done = FALSE;
+	LONG error = OK;
+	ULONG signals;
+
+	ENTER();
+
+	port = CreateMsgPort();
+	if(port == NULL)
+	{
+		error = ERROR_NO_FREE_STORE;
+
+		PrintFault(error, "DAControl");
+		goto out;
+	}
+
+	port->mp_Node.ln_Name	= (char *)DAEMON_PORT_NAME;
+	port->mp_Node.ln_Pri	= 1;
+
+	/* Only a single daemon may be running at a time. */
+	Forbid();
+
+	if(FindPort(DAEMON_PORT_NAME) == NULL)
+	{
+		AddPort(port);
+		port_added = TRUE;
+	}
+
+	Permit();
+
+	if(NOT port_added)
+	{
+		Error(gd, "A DAControl daemon is already running.");
+
+		error = ERROR_OBJECT_IN_USE;
+		goto out;
+	}
+
+	if(NOT quiet)
+		Printf("DAControl daemon is running; stop it with Ctrl+C.\n");
+
+	gd->gd_IsDaemon = TRUE;
+
+	while(NOT done)
+	{
+		signals = Wait(SIGBREAKF_CTRL_C | (1UL << port->mp_SigBit));
+
+		if(FLAG_IS_SET(signals, SIGBREAKF_CTRL_C))
+		{
+			SHOWMSG("received a stop signal");
+
+			done = TRUE;
+		}
+
+		while((msg = GetMsg(port)) != NULL)
+		{
+			if(msg->mn_Node.ln_Name != NULL && strcmp(msg->mn_Node.ln_Name, REXX_MESSAGE_NAME) == SAME)
+			{
+				process_rexx_message(gd, (struct RexxMsg *)msg);
+			}
+			else if (NOT done)
+			{
+				process_daemon_message(gd, (struct DaemonMsg *)msg);
+			}
+			else
+			{
+				struct DaemonMsg * dm = (struct DaemonMsg *)msg;
+
+				dm->dm_Result	= RETURN_FAIL;
+				dm->dm_Error	= ERROR_BREAK;
+			}
+
+			ReplyMsg(msg);
+		}
+	}
+
+	gd->gd_IsDaemon = FALSE;
+
+	/* Any message which arrived after the port was emptied
+	 * gets rejected. Clients look for the port and send their
+	 * message under Forbid(), so after the port has been
+	 * removed no further messages can arrive.
+	 */
+	Forbid();
+
+	RemPort(port);
+	port_added = FALSE;
+
+	while((msg = GetMsg(port)) != NULL)
+	{
+		if(msg->mn_Node.ln_Name != NULL && strcmp(msg->mn_Node.ln_Name, REXX_MESSAGE_NAME) == SAME)
+		{
+			struct RexxMsg * rm = (struct RexxMsg *)msg;
+
+			rm->rm_Result1 = RETURN_FAIL;
+			rm->rm_Result2 = 0;
+		}
+		else
+		{
+			struct DaemonMsg * dm = (struct DaemonMsg *)msg;
+
+			dm->dm_Result	= RETURN_FAIL;
+			dm->dm_Error	= ERROR_BREAK;
+		}
+
+		ReplyMsg(msg);
+	}
+
+	Permit();
+
+	if(NOT quiet)
+		Printf("DAControl daemon has stopped.\n");
+
+ out:
+
+	if(port != NULL)
+	{
+		if(port_added)
+			RemPort(port);
+
+		DeleteMsgPort(port);
+	}
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* If a DAControl daemon is running, send the command line of this
+ * DAControl command to it and wait for the daemon to execute it. Returns
+ * TRUE if the command was executed by the daemon, in which case the
+ * return code will have been stored in *rc_ptr and the secondary error
+ * code will have been set via SetIoErr(). Returns FALSE if the command
+ * needs to be executed locally.
+ */
+BOOL
+forward_command_to_daemon(struct GlobalData * gd, LONG * rc_ptr)
+{
+	USE_EXEC(gd);
+	USE_DOS(gd);
+
+	struct Process * this_process = (struct Process *)FindTask(NULL);
+	struct MsgPort * daemon_port;
+	struct MsgPort * reply_port = NULL;
+	struct DaemonMsg dm;
+	BOOL forwarded = FALSE;
+	STRPTR arguments;
+
+	ENTER();
+
+	/* This only works for the shell. */
+	if(gd->gd_WBenchMsg != NULL)
+		goto out;
+
+	/* Quick test first, which avoids creating the reply port. */
+	if(FindPort(DAEMON_PORT_NAME) == NULL)
+		goto out;
+
+	arguments = GetArgStr();
+	if(arguments == NULL)
+		goto out;
+
+	reply_port = CreateMsgPort();
+	if(reply_port == NULL)
+		goto out;
+
+	memset(&dm, 0, sizeof(dm));
+
+	dm.dm_Message.mn_Node.ln_Type	= NT_MESSAGE;
+	dm.dm_Message.mn_Node.ln_Name	= (char *)DAEMON_PORT_NAME;
+	dm.dm_Message.mn_ReplyPort		= reply_port;
+	dm.dm_Message.mn_Length			= sizeof(dm);
+
+	dm.dm_Arguments			= arguments;
+	dm.dm_ArgumentsLength	= strlen(arguments);
+	dm.dm_Output			= Output();
+	dm.dm_ErrorOutput		= this_process->pr_CES;
+	dm.dm_CurrentDir		= this_process->pr_CurrentDir;
+
+	/* The daemon may have gone away in the mean time. */
+	Forbid();
+
+	daemon_port = FindPort(DAEMON_PORT_NAME);
+	if(daemon_port != NULL)
+	{
+		PutMsg(daemon_port, &dm.dm_Message);
+		forwarded = TRUE;
+	}
+
+	Permit();
+
+	if(forwarded)
+	{
+		SHOWMSG("waiting for the daemon to reply");
+
+		WaitPort(reply_port);
+		GetMsg(reply_port);
+
+		(*rc_ptr) = dm.dm_Result;
+
+		SetIoErr(dm.dm_Error);
+	}
+
+ out:
+
+	if(reply_port != NULL)
+		DeleteMsgPort(reply_port);
+
+	RETURN(forwarded);
+	return(forwarded);
+}
@@ -0,0 +1,75 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+/****************************************************************************/
+
+#ifndef _GLOBAL_DATA_H
+#include "global_data.h"
+#endif /* _GLOBAL_DATA_H */
+
+/****************************************************************************/
+
+/* Name of the public message port which the DAControl daemon listens
+ * to. This is also the name of its ARexx host port.
+ */
+#define DAEMON_PORT_NAME "DACONTROL"
+
+/****************************************************************************/
+
+/* This message is sent by a DAControl command to the daemon, which
+ * will then execute the command on its behalf.
+ */
+struct DaemonMsg
+{
+	struct Message	dm_Message;
+
+	STRPTR			dm_Arguments;		/* Command line arguments, as returned by GetArgStr() */
+	LONG			dm_ArgumentsLength;
+
+	BPTR			dm_Output;			/* Where the output of the command should go */
+	BPTR			dm_ErrorOutput;		/* Where error messages should go; may be ZERO */
+	BPTR			dm_CurrentDir;		/* Current directory of the client */
+
+	LONG			dm_Result;			/* Return code of the command */
+	LONG			dm_Error;			/* Secondary error code, as returned by IoErr() */
+};
+
+/****************************************************************************/
+
+extern BOOL forward_command_to_daemon(struct GlobalData * gd, LONG * rc_ptr);
+extern LONG run_daemon(struct GlobalData * gd, BOOL quiet);
+
+/****************************************************************************/
+
+#endif /* _DAEMON_H */
@@ -0,0 +1,417 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#include <dos/dosextens.h>
+#include <exec/resident.h>
+
+/****************************************************************************/
+
+#define __USE_SYSBASE
+#include <proto/exec.h>
+
+#include <proto/dos.h>
+#include <proto/utility.h>
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "global_data.h"
+#include "file_system_registry.h"
+#include "tools.h"
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+/* File systems loaded through the FILESYSTEM option are kept in a registry
+ * which outlives the DAControl command that loaded them, so that the next
+ * command which asks for the same file system can use it without loading
+ * it again. The registry is found through a public semaphore and it is
+ * never freed once it has been created.
+ */
+#define FILE_SYSTEM_REGISTRY_NAME "DAControl file systems"
+
+struct FileSystemRegistry
+{
+	struct SignalSemaphore	fsr_Semaphore;	/* Hold this to access the list */
+	struct MinList			fsr_Entries;	/* List of FileSystemSegments */
+	TEXT					fsr_Name[sizeof(FILE_SYSTEM_REGISTRY_NAME)];
+};
+
+/* A file system is identified by the full path name of the file it was
+ * loaded from, the modification time of that file and the DosType it is
+ * mounted with. The version number is taken from the file system itself.
+ * The use count includes the file system devices which were mounted
+ * with it, and these are never unmounted.
+ */
+struct FileSystemSegment
+{
+	struct MinNode			fss_Node;
+	BPTR					fss_SegList;	/* As returned by LoadSeg() */
+	ULONG					fss_DosType;	/* Such as ID_DOS_DISK */
+	ULONG					fss_Version;	/* Version (upper 16 bits) and revision */
+	struct DateStamp		fss_Date;		/* File modification time */
+	LONG					fss_UseCount;	/* Number of users; may be unloaded if 0 */
+	TEXT					fss_Path[1];	/* Full path name, NUL-terminated */
+};
+
+/****************************************************************************/
+
+/* Find the registry, or create it if it does not exist yet. Returns NULL
+ * if there is not enough memory.
+ */
+static struct FileSystemRegistry *
+get_file_system_registry(struct GlobalData * gd)
+{
+	struct FileSystemRegistry * fsr;
+
+	USE_EXEC(gd);
+
+	Forbid();
+
+	fsr = (struct FileSystemRegistry *)FindSemaphore((STRPTR)FILE_SYSTEM_REGISTRY_NAME);
+	if(fsr == NULL)
+	{
+		fsr = AllocVec(sizeof(*fsr), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+		if(fsr != NULL)
+		{
+			strcpy(fsr->fsr_Name, FILE_SYSTEM_REGISTRY_NAME);
+
+			NewList((struct List *)&fsr->fsr_Entries);
+
+			fsr->fsr_Semaphore.ss_Link.ln_Name	= fsr->fsr_Name;
+			fsr->fsr_Semaphore.ss_Link.ln_Pri	= 1;
+
+			/* This also initializes the semaphore. */
+			AddSemaphore(&fsr->fsr_Semaphore);
+		}
+	}
+
+	Permit();
+
+	return(fsr);
+}
+
+/****************************************************************************/
+
+/* Figure out the version and revision number of a file system, by looking
+ * at its "$VER: name version.revision" string first and at its resident
+ * tag second. Returns 0 if neither are available.
+ */
+static ULONG
+get_file_system_version(BPTR segment_list)
+{
+	const struct Resident * rt;
+	TEXT version_string[256];
+	ULONG version = 0, revision = 0;
+	const TEXT * s;
+
+	if(find_version_string(segment_list, version_string, sizeof(version_string)) > 0)
+	{
+		/* Skip the name, which is followed by a blank space. */
+		for(s = version_string ; (*s) != '\0' && (*s) != ' ' ; s++)
+			;
+
+		while((*s) == ' ')
+			s++;
+
+		if('0' <= (*s) && (*s) <= '9')
+		{
+			while('0' <= (*s) && (*s) <= '9')
+				version = 10 * version + (*s++) - '0';
+
+			if((*s) == '.')
+			{
+				s++;
+
+				while('0' <= (*s) && (*s) <= '9')
+					revision = 10 * revision + (*s++) - '0';
+			}
+
+			goto out;
+		}
+	}
+
+	rt = find_rom_tag(segment_list);
+	if(rt != NULL)
+		version = rt->rt_Version;
+
+ out:
+
+	return((version << 16) | (revision & 0xFFFF));
+}
+
+/****************************************************************************/
+
+/* Obtain the file system stored in the given file, loading it only if the
+ * registry does not hold a copy of the same file yet. The file system is
+ * to be mounted with the given DosType. Returns an AmigaDOS error code if
+ * the file system could not be loaded. The segment list must be passed to
+ * release_file_system() once it is no longer needed.
+ */
+LONG
+obtain_file_system(struct GlobalData * gd, const TEXT * file_name, ULONG dos_type, BPTR * segment_list_ptr)
+{
+	D_S(struct FileInfoBlock, fib);
+	struct FileSystemRegistry * fsr;
+	struct FileSystemSegment * fss = NULL;
+	struct FileSystemSegment * new_fss = NULL;
+	TEXT path[256];
+	BPTR segment_list = ZERO;
+	BPTR lock;
+	LONG error;
+
+	USE_EXEC(gd);
+	USE_DOS(gd);
+	USE_UTILITY(gd);
+
+	ENTER();
+
+	ASSERT( file_name != NULL && segment_list_ptr != NULL );
+
+	(*segment_list_ptr) = ZERO;
+
+	/* The same file may be known by different names, so we use the
+	 * full path name of the file instead.
+	 */
+	lock = Lock((STRPTR)file_name, SHARED_LOCK);
+	if(lock == ZERO)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	if(CANNOT NameFromLock(lock, path, sizeof(path)) || CANNOT Examine(lock, fib))
+	{
+		error = IoErr();
+
+		UnLock(lock);
+		goto out;
+	}
+
+	UnLock(lock);
+
+	D(("file system '%s' is found at '%s'", file_name, path));
+
+	fsr = get_file_system_registry(gd);
+	if(fsr == NULL)
+	{
+		error = ERROR_NO_FREE_STORE;
+		goto out;
+	}
+
+	ObtainSemaphore(&fsr->fsr_Semaphore);
+
+	for(fss = (struct FileSystemSegment *)fsr->fsr_Entries.mlh_Head ;
+	    fss->fss_Node.mln_Succ != NULL ;
+	    fss = (struct FileSystemSegment *)fss->fss_Node.mln_Succ)
+	{
+		if(fss->fss_DosType == dos_type &&
+		   CompareDates(&fss->fss_Date, &fib->fib_Date) == SAME &&
+		   Stricmp(fss->fss_Path, path) == SAME)
+		{
+			break;
+		}
+	}
+
+	if(fss->fss_Node.mln_Succ != NULL)
+	{
+		D(("reusing file system version %ld.%ld (use count = %ld)",
+			fss->fss_Version >> 16, fss->fss_Version & 0xFFFF, fss->fss_UseCount));
+
+		fss->fss_UseCount++;
+
+		segment_list = fss->fss_SegList;
+	}
+	else
+	{
+		new_fss = AllocVec(sizeof(*new_fss) + strlen(path), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+		if(new_fss == NULL)
+		{
+			ReleaseSemaphore(&fsr->fsr_Semaphore);
+
+			error = ERROR_NO_FREE_STORE;
+			goto out;
+		}
+
+		segment_list = LoadSeg(path);
+		if(segment_list == ZERO)
+		{
+			error = IoErr();
+
+			ReleaseSemaphore(&fsr->fsr_Semaphore);
+
+			FreeVec(new_fss);
+			goto out;
+		}
+
+		new_fss->fss_SegList	= segment_list;
+		new_fss->fss_DosType	= dos_type;
+		new_fss->fss_Version	= get_file_system_version(segment_list);
+		new_fss->fss_Date		= fib->fib_Date;
+		new_fss->fss_UseCount	= 1;
+
+		strcpy(new_fss->fss_Path, path);
+
+		D(("loaded file system version %ld.%ld", new_fss->fss_Version >> 16, new_fss->fss_Version & 0xFFFF));
+
+		AddTail((struct List *)&fsr->fsr_Entries, (struct Node *)new_fss);
+	}
+
+	ReleaseSemaphore(&fsr->fsr_Semaphore);
+
+	(*segment_list_ptr) = segment_list;
+
+	error = OK;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Let go of a file system obtained through obtain_file_system(). If it was
+ * used for mounting a file system device, it remains in use for as long as
+ * the device exists, which is to say forever. Otherwise it stays loaded
+ * so that it may be used again, until purge_file_systems() unloads it.
+ */
+VOID
+release_file_system(struct GlobalData * gd, BPTR segment_list, BOOL mounted)
+{
+	struct FileSystemRegistry * fsr;
+	struct FileSystemSegment * fss;
+
+	USE_EXEC(gd);
+
+	ENTER();
+
+	if(segment_list == ZERO || mounted)
+		goto out;
+
+	fsr = get_file_system_registry(gd);
+	if(fsr == NULL)
+		goto out;
+
+	ObtainSemaphore(&fsr->fsr_Semaphore);
+
+	for(fss = (struct FileSystemSegment *)fsr->fsr_Entries.mlh_Head ;
+	    fss->fss_Node.mln_Succ != NULL ;
+	    fss = (struct FileSystemSegment *)fss->fss_Node.mln_Succ)
+	{
+		if(fss->fss_SegList == segment_list)
+		{
+			ASSERT( fss->fss_UseCount > 0 );
+
+			fss->fss_UseCount--;
+
+			D(("file system use count = %ld", fss->fss_UseCount));
+			break;
+		}
+	}
+
+	ReleaseSemaphore(&fsr->fsr_Semaphore);
+
+ out:
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Unload all the file systems in the registry which are no longer in use.
+ * Returns the number of file systems which remain loaded because they are
+ * still in use.
+ */
+LONG
+purge_file_systems(struct GlobalData * gd, BOOL verbose)
+{
+	struct FileSystemRegistry * fsr;
+	struct FileSystemSegment * fss;
+	struct FileSystemSegment * next_fss;
+	LONG num_in_use = 0;
+
+	USE_EXEC(gd);
+	USE_DOS(gd);
+
+	ENTER();
+
+	Forbid();
+	fsr = (struct FileSystemRegistry *)FindSemaphore((STRPTR)FILE_SYSTEM_REGISTRY_NAME);
+	Permit();
+
+	if(fsr == NULL)
+		goto out;
+
+	ObtainSemaphore(&fsr->fsr_Semaphore);
+
+	for(fss = (struct FileSystemSegment *)fsr->fsr_Entries.mlh_Head ;
+	    (next_fss = (struct FileSystemSegment *)fss->fss_Node.mln_Succ) != NULL ;
+	    fss = next_fss)
+	{
+		if(fss->fss_UseCount > 0)
+		{
+			if(verbose)
+			{
+				Printf("File system \"%s\" (version %ld.%ld) is still in use.\n",
+					fss->fss_Path, fss->fss_Version >> 16, fss->fss_Version & 0xFFFF);
+			}
+
+			num_in_use++;
+			continue;
+		}
+
+		if(verbose)
+		{
+			Printf("Unloading file system \"%s\" (version %ld.%ld).\n",
+				fss->fss_Path, fss->fss_Version >> 16, fss->fss_Version & 0xFFFF);
+		}
+
+		Remove((struct Node *)fss);
+
+		UnLoadSeg(fss->fss_SegList);
+		FreeVec(fss);
+	}
+
+	ReleaseSemaphore(&fsr->fsr_Semaphore);
+
+ out:
+
+	RETURN(num_in_use);
+	return(num_in_use);
+}
@@ -71,10 +71,17 @@ struct GlobalData
 	BOOL				gd_LoadedFileSystemUsed;
 
 	BOOL				gd_UseChecksums;
+	BOOL				gd_UseWarmupProfiles;		/* Load and save the track access order of disk image files */
+	BOOL				gd_PredictTracks;			/* Load the likely next tracks into the cache */
+	STRPTR				gd_BlockServerName;			/* Public message port of the block server, or NULL */
 
 	STRPTR				gd_DiskImageFileName;
 
 	struct DevProc *	gd_DevProc;
+
+	BOOL				gd_IsDaemon;				/* Running as a daemon; keep the device open */
+	STRPTR				gd_DaemonArguments;			/* Command line received by the daemon, or NULL */
+	LONG				gd_DaemonArgumentsLength;
 };
 
 /****************************************************************************/
@@ -54,6 +54,8 @@
 #include "insert_media_by_name.h"
 #include "start_unit.h"
 #include "cache.h"
+#include "trackfile_extensions.h"
+#include "warmup_profile.h"
 #include "tools.h"
 
 /****************************************************************************/
@@ -88,6 +90,10 @@ open_and_mount_disk_image_file(
 	TEXT error_message[256];
 	LONG error;
 	BPTR file;
+	#if defined(ENABLE_CACHE)
+	UBYTE warmup_tracks[TF_MAX_WARMUP_TRACKS];
+	LONG num_warmup_tracks = 0;
+	#endif /* ENABLE_CACHE */
 
 	ENTER();
 
@@ -116,6 +122,7 @@ open_and_mount_disk_image_file(
 			-1,		/* <- Invalid unit number */
 			TRUE,	/* <- Use the next available unit */
 			cache_size,
+			enable_cache,
 			num_cylinders,
 			num_sectors,
 			&unit,
@@ -143,13 +150,32 @@ open_and_mount_disk_image_file(
 			Printf("Inserting disk image file \"%s\" into unit %ld.\n", file_name, unit);
 	}
 
+	/* Which tracks were read the last time this disk image file
+	 * was used, and in which order?
+	 */
+	#if defined(ENABLE_CACHE)
+	{
+		if(gd->gd_UseWarmupProfiles && NOT prefill_cache)
+		{
+			num_warmup_tracks = load_warmup_profile(gd, file_name, warmup_tracks, TF_MAX_WARMUP_TRACKS);
+
+			if(verbose && num_warmup_tracks > 0)
+				Printf("Loading %ld tracks into the cache in the background.\n", num_warmup_tracks);
+		}
+	}
+	#endif /* ENABLE_CACHE */
+
 	error = TFInsertMediaTags(unit,
 		TF_ImageFileHandle,	file,
 		TF_WriteProtected,	write_protected,
+		TF_BlockServer,		gd->gd_BlockServerName,
 
 		#if defined(ENABLE_CACHE)
 			TF_EnableUnitCache,		enable_cache,
 			TF_PrefillUnitCache,	prefill_cache,
+			TF_WarmupTracks,		warmup_tracks,
+			TF_NumWarmupTracks,		num_warmup_tracks,
+			TF_PredictTracks,		gd->gd_PredictTracks,
 		#endif /* ENABLE_CACHE */
 	TAG_DONE);
 
@@ -0,0 +1,186 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#include <dos/dosextens.h>
+
+/****************************************************************************/
+
+#define __USE_SYSBASE
+#include <proto/exec.h>
+
+#include <proto/dos.h>
+
+#include <proto/trackfile.h>
+
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "global_data.h"
+#include "trackfile_extensions.h"
+#include "memory_statistics.h"
+#include "tools.h"
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+/* Show how much memory each unit uses, for one unit or for all units if
+ * unit < 0, followed by the totals. The cache nodes are shared by all the
+ * units which use the same disk image file, which is why the total for
+ * the cache is based upon all the nodes allocated rather than upon the
+ * sum of the units' shares.
+ */
+LONG
+show_memory_statistics(struct GlobalData * gd, LONG unit)
+{
+	struct TrackFileUnitData * first_tfud;
+	struct TrackFileUnitData * tfud;
+	ULONG total_unit_memory = 0;
+	ULONG total_cache_nodes = 0;
+	ULONG node_overhead = 0;
+	ULONG node_payload = 0;
+	LONG num_units = 0;
+	TEXT error_message[256];
+	LONG error = OK;
+
+	USE_DOS(gd);
+	USE_TRACKFILE(gd);
+
+	ENTER();
+
+	first_tfud = TFGetUnitData(unit < 0 ? TFGUD_AllUnits : unit);
+	if(first_tfud == NULL)
+	{
+		error = IoErr();
+		if(error != OK)
+		{
+			Error(gd, "Could not obtain unit information (%s).",
+				get_error_message(gd, error, error_message, sizeof(error_message)));
+		}
+
+		goto out;
+	}
+
+	for(tfud = first_tfud ; tfud != NULL ; tfud = tfud->tfud_Next)
+	{
+		const struct TrackFileMemoryStatistics * tfms;
+		ULONG unit_memory;
+
+		if(CheckSignal(SIGBREAKF_CTRL_C))
+		{
+			error = ERROR_BREAK;
+			break;
+		}
+
+		/* Older versions of trackfile.device do not
+		 * account for the memory used.
+		 */
+		tfms = find_statistics_group(tfud, TFSG_Memory, sizeof(*tfms));
+		if(tfms == NULL)
+			continue;
+
+		unit_memory =
+			tfms->tfms_UnitMemory +
+			tfms->tfms_TrackBufferMemory +
+			tfms->tfms_ChecksumTableMemory +
+			tfms->tfms_MFMCodeMemory +
+			tfms->tfms_StackMemory +
+			tfms->tfms_CheckpointMemory;
+
+		if(num_units > 0)
+			Printf("\n");
+
+		Printf("%s%s(unit %ld) %s\n",
+			tfud->tfud_DeviceName != NULL ? tfud->tfud_DeviceName : (STRPTR)"",
+			tfud->tfud_DeviceName != NULL ? ": " : "",
+			tfud->tfud_UnitNumber,
+			tfud->tfud_FileName != NULL ? tfud->tfud_FileName : (STRPTR)"-");
+
+		Printf("Unit: %lu bytes, track buffer: %lu, checksum table: %lu, MFM encoding: %lu, stack: %lu, checkpoint: %lu\n",
+			tfms->tfms_UnitMemory,
+			tfms->tfms_TrackBufferMemory,
+			tfms->tfms_ChecksumTableMemory,
+			tfms->tfms_MFMCodeMemory,
+			tfms->tfms_StackMemory,
+			tfms->tfms_CheckpointMemory);
+
+		Printf("Total: %lu bytes\n", unit_memory);
+
+		if(tfms->tfms_NumCacheNodes > 0)
+		{
+			Printf("Cache: %lu nodes, %lu bytes (%lu of which are overhead), shared by %lu unit(s)\n",
+				tfms->tfms_NumCacheNodes,
+				tfms->tfms_NumCacheNodes * (tfms->tfms_CacheNodeOverhead + tfms->tfms_CacheNodePayload),
+				tfms->tfms_NumCacheNodes * tfms->tfms_CacheNodeOverhead,
+				tfms->tfms_NumCacheImageUsers);
+		}
+
+		total_unit_memory += unit_memory;
+
+		/* These are the same for all units. */
+		total_cache_nodes	= tfms->tfms_TotalCacheNodes;
+		node_overhead		= tfms->tfms_CacheNodeOverhead;
+		node_payload		= tfms->tfms_CacheNodePayload;
+
+		num_units++;
+	}
+
+	TFFreeUnitData(first_tfud);
+
+	if(error == OK)
+	{
+		if(num_units > 0)
+		{
+			Printf("\nAll %ld unit(s): %lu bytes\n", num_units, total_unit_memory);
+
+			if(total_cache_nodes > 0)
+			{
+				Printf("Cache: %lu nodes, %lu bytes (%lu bytes of track data, %lu bytes of overhead)\n",
+					total_cache_nodes,
+					total_cache_nodes * (node_overhead + node_payload),
+					total_cache_nodes * node_payload,
+					total_cache_nodes * node_overhead);
+			}
+		}
+		else
+		{
+			Printf("No memory statistics are available.\n");
+		}
+	}
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
@@ -60,6 +60,13 @@
 
 /****************************************************************************/
 
+/* This is how many buffers the ROM file system allocates for a
+ * floppy disk drive.
+ */
+#define MIN_NUM_BUFFERS 5
+
+/****************************************************************************/
+
 /* Mount a file system in the manner of the "strap" module, which is
  * responsible for setting up the Amiga floppy disk drives. The
  * mount process is intended to be compatible with this particular
@@ -68,6 +75,12 @@
  * the expansion.library/AddBootNode function which serves a different
  * purpose (auto-booting).
  *
+ * The number of buffers, the maximum transfer size and the address
+ * mask are chosen to suit trackfile.device rather than trackdisk.device.
+ * If the unit has its own track cache, the file system needs no more
+ * than the few buffers it would use anyway; otherwise it is given
+ * a full cylinder's worth to work with.
+ *
  * Note that this function is called with the global AmigaDOS list
  * of devices locked for writing. Hence you cannot safely use any
  * AmigaDOS functions in it which would result in a file access.
@@ -79,6 +92,7 @@ mount_floppy_file(
 	LONG					unit_number,
 	int						num_cylinders,
 	int						num_sectors_per_track,
+	BOOL					cache_enabled,
 	struct DeviceNode **	dn_ptr)
 {
 	const struct FileSysResource * fsr;
@@ -213,10 +227,26 @@ mount_floppy_file(
 	de->de_Interleave		= 0;
 	de->de_LowCyl			= 0;
 	de->de_HighCyl			= num_cylinders - 1; /* 80 cylinders for a standard 3.5" disk. */
-	de->de_NumBuffers		= 5;
 	de->de_BufMemType		= MEMF_ANY|MEMF_PUBLIC;
-	de->de_MaxTransfer		= 0x200000; /* True for trackdisk.device but not necessarily for trackfile.device */
-	de->de_Mask				= 0x7FFFFFFE; /* True for trackdisk.device but not necessarily for trackfile.device */
+
+	/* trackfile.device does not cache high density disks, which
+	 * is why the number of buffers depends upon the disk type, too.
+	 */
+	if(cache_enabled && num_sectors_per_track == NUMSECS)
+		de->de_NumBuffers = MIN_NUM_BUFFERS;
+	else
+		de->de_NumBuffers = NUMHEADS * num_sectors_per_track;
+
+	/* trackfile.device processes any transfer size which is a
+	 * multiple of the sector size, one track at a time, and it
+	 * copies the data using the CPU rather than through DMA.
+	 * The transfer size is therefore limited only by the size
+	 * of the medium. A transfer split by the file system will
+	 * always end on a track boundary, and any word aligned
+	 * buffer address will do.
+	 */
+	de->de_MaxTransfer		= num_cylinders * NUMHEADS * num_sectors_per_track * TD_SECTOR;
+	de->de_Mask				= 0xFFFFFFFE;
 	de->de_BootPri			= -128;
 	de->de_DosType			= ID_DOS_DISK;
 	de->de_BootBlocks		= de->de_Reserved;
@@ -46,7 +46,7 @@
 
 /****************************************************************************/
 
-extern LONG mount_floppy_file(struct GlobalData * gd, STRPTR dos_device_name, LONG unit_number, int num_cylinders, int num_sectors_per_track, struct DeviceNode ** dn_ptr);
+extern LONG mount_floppy_file(struct GlobalData * gd, STRPTR dos_device_name, LONG unit_number, int num_cylinders, int num_sectors_per_track, BOOL cache_enabled, struct DeviceNode ** dn_ptr);
 
 /****************************************************************************/
 
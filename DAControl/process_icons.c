@@ -59,6 +59,7 @@
 #include "global_data.h"
 #include "start_unit.h"
 #include "insert_media_by_name.h"
+#include "file_system_registry.h"
 #include "process_icons.h"
 #include "cache.h"
 #include "tools.h"
@@ -180,16 +181,12 @@ process_icons(REG(a0, struct GlobalData * gd))
 
 		if(gd->gd_LoadedFileSystem != ZERO)
 		{
-			/* Release the file system loaded for the
-			 * previous icon, if there is one, if
-			 * it hasn't been used.
+			/* Release the file system obtained for the
+			 * previous icon, if there is one.
 			 */
-			if(NOT gd->gd_LoadedFileSystemUsed)
-			{
-				SHOWMSG("unloading unused file system");
+			SHOWMSG("releasing file system");
 
-				UnLoadSeg(gd->gd_LoadedFileSystem);
-			}
+			release_file_system(gd, gd->gd_LoadedFileSystem, gd->gd_LoadedFileSystemUsed);
 
 			/* Get read to load another file system. */
 			gd->gd_LoadedFileSystem = ZERO;
@@ -403,11 +400,9 @@ process_icons(REG(a0, struct GlobalData * gd))
 
 				if(file_system_option[0] != '\0')
 				{
-					gd->gd_LoadedFileSystem = LoadSeg(file_system_option);
-					if(gd->gd_LoadedFileSystem == ZERO)
+					error = obtain_file_system(gd, file_system_option, ID_DOS_DISK, &gd->gd_LoadedFileSystem);
+					if(error != OK)
 					{
-						error = IoErr();
-
 						D(("that didn't work (error=%ld)", error));
 
 						if(ShowError(gd, choices, "Could not load \"%s\" file system (%s).",
@@ -528,6 +523,7 @@ process_icons(REG(a0, struct GlobalData * gd))
 			-1,		/* <- Invalid unit number */
 			TRUE,	/* <- Use the next available unit */
 			cache_size,
+			enable_cache,
 			num_cylinders,
 			num_sectors,
 			&unit,
@@ -590,11 +586,11 @@ process_icons(REG(a0, struct GlobalData * gd))
 
  out:
 
-	if(gd->gd_LoadedFileSystem != ZERO && NOT gd->gd_LoadedFileSystemUsed)
+	if(gd->gd_LoadedFileSystem != ZERO)
 	{
-		SHOWMSG("unloading unused file system");
+		SHOWMSG("releasing file system");
 
-		UnLoadSeg(gd->gd_LoadedFileSystem);
+		release_file_system(gd, gd->gd_LoadedFileSystem, gd->gd_LoadedFileSystemUsed);
 	}
 
 	if(file != ZERO)
@@ -72,6 +72,7 @@ start_unit(
 	LONG				unit,
 	BOOL				use_next_available_unit,
 	LONG				cache_size,
+	BOOL				enable_cache,
 	int					num_cylinders,
 	int					num_sectors_per_track,
 	LONG *				which_unit_ptr,
@@ -232,7 +233,7 @@ start_unit(
 		 * we do not need to keep the DOS list locked for the
 		 * mount operation to succeeed.
 		 */
-		error = mount_floppy_file(gd, new_dos_device_name, new_unit, num_cylinders, num_sectors_per_track, &dn);
+		error = mount_floppy_file(gd, new_dos_device_name, new_unit, num_cylinders, num_sectors_per_track, enable_cache, &dn);
 		if(error != OK)
 		{
 			SHOWMSG("mount attempt failed");
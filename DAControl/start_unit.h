@@ -40,7 +40,7 @@
 
 /****************************************************************************/
 
-extern LONG start_unit(struct GlobalData * gd, BOOL verbose, LONG unit, BOOL use_next_available_unit, LONG cache_size, int num_cylinders, int num_sectors_per_track, LONG * which_unit_ptr, STRPTR dos_device_name);
+extern LONG start_unit(struct GlobalData * gd, BOOL verbose, LONG unit, BOOL use_next_available_unit, LONG cache_size, BOOL enable_cache, int num_cylinders, int num_sectors_per_track, LONG * which_unit_ptr, STRPTR dos_device_name);
 
 /****************************************************************************/
 
@@ -55,6 +55,7 @@
 #include "compiler.h"
 #include "macros.h"
 #include "global_data.h"
+#include "trackfile_extensions.h"
 #include "tools.h"
 
 /****************************************************************************/
@@ -1201,6 +1202,38 @@ tf_checksum_to_text(const struct TrackFileChecksum * tfc, TEXT * text_form)
 
 /****************************************************************************/
 
+/* Find a group of statistics of the given type in a unit data record
+ * returned by TFGetUnitData(). This will return NULL if the
+ * trackfile.device in use does not provide this group, or if it
+ * provides an older version of the group which is smaller than
+ * what the caller expects.
+ */
+APTR
+find_statistics_group(const struct TrackFileUnitData * tfud, ULONG type, ULONG size)
+{
+	const struct TrackFileUnitDataExtension * tfude = (struct TrackFileUnitDataExtension *)tfud;
+	struct TrackFileStatisticsGroup * result = NULL;
+	struct TrackFileStatisticsGroup * tfsg;
+
+	if(tfud->tfud_Size >= sizeof(*tfude))
+	{
+		for(tfsg = tfude->tfude_Groups ; tfsg != NULL ; tfsg = tfsg->tfsg_Next)
+		{
+			if(tfsg->tfsg_Type == type)
+			{
+				if(tfsg->tfsg_Size >= size)
+					result = tfsg;
+
+				break;
+			}
+		}
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
 /* Just like strtok(), but reentrant... */
 char *
 local_strtok_r(char *str, const char *separator_set, char ** state_ptr)
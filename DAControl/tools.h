@@ -80,6 +80,7 @@ extern int ShowError(struct GlobalData *gd, const char *choices, const char * fm
 extern void Error(struct GlobalData *gd, const char * fmt, ...);
 extern void SortList(struct List *list, int (*compare)(const struct Node *a, const struct Node *b));
 extern void tf_checksum_to_text(const struct TrackFileChecksum * tfc, TEXT * text_form);
+extern APTR find_statistics_group(const struct TrackFileUnitData * tfud, ULONG type, ULONG size);
 extern size_t find_version_string(BPTR segment_list, STRPTR string_buffer, size_t string_buffer_size);
 extern struct Resident * find_rom_tag(BPTR segment_list);
 
@@ -0,0 +1,362 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#include <dos/dosextens.h>
+
+/****************************************************************************/
+
+#define __USE_SYSBASE
+#include <proto/exec.h>
+
+#include <proto/dos.h>
+
+#include <proto/trackfile.h>
+
+/****************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "global_data.h"
+#include "trackfile_extensions.h"
+#include "track_statistics.h"
+#include "tools.h"
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+/* Each track belongs to one of two heads, and there are up
+ * to 80 cylinders.
+ */
+#define NUM_HEADS 2
+#define MAX_NUM_CYLINDERS 80
+
+/****************************************************************************/
+
+/* These characters stand for how often a track was accessed, relative
+ * to the track accessed most frequently. Tracks which were not accessed
+ * at all are shown as blanks.
+ */
+static const TEXT heat_levels[] = " .:-=+*#%@";
+
+#define NUM_HEAT_LEVELS (sizeof(heat_levels) - 1)
+
+/****************************************************************************/
+
+/* The names of the background jobs, in the order of the
+ * TFJOB_Flush, etc. numbers.
+ */
+static const TEXT * job_names[NUM_TFJOBS] =
+{
+	"Flush",
+	"Checksum",
+	"Cache",
+	"Warm-up",
+	"Prediction"
+};
+
+/****************************************************************************/
+
+/* Print one line of the heat map, covering all the cylinders which the
+ * given head accesses. Counters are picked from the table by offset, so
+ * that the same code works for reads, writes and misses.
+ */
+static VOID
+print_heat_map_line(
+	struct GlobalData *						gd,
+	const TEXT *							label,
+	int										head,
+	const struct TrackFileTrackStatistics *	tfts,
+	int										num_tracks,
+	size_t									counter_offset,
+	ULONG									max_count)
+{
+	TEXT line[MAX_NUM_CYLINDERS+1];
+	int track, len = 0;
+	ULONG count;
+
+	USE_DOS(gd);
+
+	for(track = head ; track < num_tracks && len < (int)sizeof(line) - 1 ; track += NUM_HEADS)
+	{
+		count = *(ULONG *)(((UBYTE *)&tfts[track]) + counter_offset);
+
+		if(count == 0 || max_count == 0)
+			line[len++] = heat_levels[0];
+		else
+			line[len++] = heat_levels[1 + ((count - 1) * (NUM_HEAT_LEVELS - 1)) / max_count];
+	}
+
+	line[len] = '\0';
+
+	Printf("%-6s %ld  %s\n", label, head, line);
+}
+
+/****************************************************************************/
+
+/* Show the per-track read, write and miss counters for one unit, or for all
+ * units which currently have a medium present if unit < 0. The counters are
+ * either shown as a heat map, with one column per cylinder and one line per
+ * head, or in CSV format with one line per track.
+ */
+LONG
+show_track_statistics(struct GlobalData * gd, LONG unit, BOOL csv_format)
+{
+	struct TrackFileUnitData * first_tfud;
+	struct TrackFileUnitData * tfud;
+	BOOL header_printed = FALSE;
+	TEXT error_message[256];
+	LONG error = OK;
+
+	USE_DOS(gd);
+	USE_TRACKFILE(gd);
+
+	ENTER();
+
+	first_tfud = TFGetUnitData(unit < 0 ? TFGUD_AllUnits : unit);
+	if(first_tfud == NULL)
+	{
+		error = IoErr();
+		if(error != OK)
+		{
+			Error(gd, "Could not obtain unit information (%s).",
+				get_error_message(gd, error, error_message, sizeof(error_message)));
+		}
+
+		goto out;
+	}
+
+	for(tfud = first_tfud ; tfud != NULL ; tfud = tfud->tfud_Next)
+	{
+		const struct TrackFileUnitDataExtension * tfude = (struct TrackFileUnitDataExtension *)tfud;
+		const struct TrackFileTrackStatistics * tfts;
+		const struct TrackFileQueueStatistics * tfqs;
+		const struct TrackFileChunkStatistics * tfcs;
+		const struct TrackFileJobGroup * tfjg;
+		const struct TrackFileAccessOrder * tfao;
+		const struct TrackFilePredictionStatistics * tfps;
+		int num_tracks, track;
+
+		if(CheckSignal(SIGBREAKF_CTRL_C))
+		{
+			error = ERROR_BREAK;
+			break;
+		}
+
+		/* Older versions of trackfile.device do not keep
+		 * track statistics.
+		 */
+		if(tfud->tfud_Size < offsetof(struct TrackFileUnitDataExtension, tfude_Groups) || tfude->tfude_TrackStatistics == NULL)
+			continue;
+
+		if(NOT tfud->tfud_MediumIsPresent)
+			continue;
+
+		tfts		= tfude->tfude_TrackStatistics;
+		num_tracks	= tfude->tfude_NumTracks;
+
+		if(csv_format)
+		{
+			if(NOT header_printed)
+			{
+				Printf("Unit,Device,Track,Cylinder,Head,Reads,Writes,Misses\n");
+
+				header_printed = TRUE;
+			}
+
+			for(track = 0 ; track < num_tracks ; track++)
+			{
+				Printf("%ld,%s,%ld,%ld,%ld,%lu,%lu,%lu\n",
+					tfud->tfud_UnitNumber,
+					tfud->tfud_DeviceName != NULL ? tfud->tfud_DeviceName : (STRPTR)"",
+					track,
+					track / NUM_HEADS,
+					track % NUM_HEADS,
+					tfts[track].tfts_Reads,
+					tfts[track].tfts_Writes,
+					tfts[track].tfts_Misses);
+			}
+		}
+		else
+		{
+			ULONG total_reads = 0, total_writes = 0, total_misses = 0;
+			ULONG max_reads = 0, max_writes = 0, max_misses = 0;
+			int cylinder, head;
+
+			for(track = 0 ; track < num_tracks ; track++)
+			{
+				total_reads		+= tfts[track].tfts_Reads;
+				total_writes	+= tfts[track].tfts_Writes;
+				total_misses	+= tfts[track].tfts_Misses;
+
+				if(max_reads < tfts[track].tfts_Reads)
+					max_reads = tfts[track].tfts_Reads;
+
+				if(max_writes < tfts[track].tfts_Writes)
+					max_writes = tfts[track].tfts_Writes;
+
+				if(max_misses < tfts[track].tfts_Misses)
+					max_misses = tfts[track].tfts_Misses;
+			}
+
+			if(header_printed)
+				Printf("\n");
+
+			Printf("%s%s(unit %ld) %s\n",
+				tfud->tfud_DeviceName != NULL ? tfud->tfud_DeviceName : (STRPTR)"",
+				tfud->tfud_DeviceName != NULL ? ": " : "",
+				tfud->tfud_UnitNumber,
+				tfud->tfud_FileName != NULL ? tfud->tfud_FileName : (STRPTR)"-");
+
+			Printf("Reads: %lu (at most %lu per track), writes: %lu (%lu), misses: %lu (%lu)\n\n",
+				total_reads, max_reads,
+				total_writes, max_writes,
+				total_misses, max_misses);
+
+			/* Older versions of trackfile.device do not keep
+			 * request queue statistics.
+			 */
+			tfqs = find_statistics_group(tfud, TFSG_Queue, sizeof(*tfqs));
+			if(tfqs != NULL)
+			{
+				Printf("Requests queued: %lu (at most %lu at a time), aborted while queued: %lu\n\n",
+					tfqs->tfqs_QueueDepth,
+					tfqs->tfqs_MaxQueueDepth,
+					tfqs->tfqs_NumRequestsAborted);
+			}
+
+			/* Older versions of trackfile.device do not split
+			 * large requests into chunks.
+			 */
+			tfcs = find_statistics_group(tfud, TFSG_Chunks, sizeof(*tfcs));
+			if(tfcs != NULL)
+			{
+				Printf("Large requests split into chunks: %lu, requests performed in between: %lu (latency at most %lu ms)\n\n",
+					tfcs->tfcs_NumChunkedRequests,
+					tfcs->tfcs_NumRequestsBetweenChunks,
+					tfcs->tfcs_MaxLatencyBetweenChunks);
+			}
+
+			/* Older versions of trackfile.device do not perform
+			 * background jobs.
+			 */
+			tfjg = find_statistics_group(tfud, TFSG_Jobs, offsetof(struct TrackFileJobGroup, tfjg_NumPauses));
+			if(tfjg != NULL)
+			{
+				const struct TrackFileJobStatistics * tfjs = tfjg->tfjg_Jobs;
+				int job;
+
+				for(job = 0 ; job < NUM_TFJOBS ; job++)
+				{
+					Printf("%s job: %lu time slices (%lu ms), deferred %lu times\n",
+						job_names[job],
+						tfjs[job].tfjs_Runs,
+						tfjs[job].tfjs_Time,
+						tfjs[job].tfjs_Deferrals);
+				}
+
+				/* Older versions of trackfile.device do not
+				 * pause between time slices.
+				 */
+				if(tfjg->tfjg_Group.tfsg_Size >= sizeof(*tfjg))
+				{
+					Printf("Time given up to other tasks between slices: %lu ms (%lu pauses)\n",
+						tfjg->tfjg_PauseTime,
+						tfjg->tfjg_NumPauses);
+				}
+
+				Printf("\n");
+			}
+
+			/* Older versions of trackfile.device do not record
+			 * the track access order.
+			 */
+			tfao = find_statistics_group(tfud, TFSG_AccessOrder, sizeof(*tfao));
+			if(tfao != NULL)
+				Printf("Different tracks read: %ld\n\n", tfao->tfao_NumTracksAccessed);
+
+			/* Older versions of trackfile.device do not
+			 * predict which tracks will be read next.
+			 */
+			tfps = find_statistics_group(tfud, TFSG_Prediction, sizeof(*tfps));
+			if(tfps != NULL && tfps->tfps_NumPredictions > 0)
+			{
+				Printf("Predictions: %lu, correct: %lu (%lu%%), tracks loaded ahead of time: %lu, read later: %lu (%lu bytes wasted)\n\n",
+					tfps->tfps_NumPredictions,
+					tfps->tfps_NumCorrectPredictions,
+					(100 * tfps->tfps_NumCorrectPredictions) / tfps->tfps_NumPredictions,
+					tfps->tfps_NumTracksPrefetched,
+					tfps->tfps_NumPrefetchedTracksUsed,
+					tfps->tfps_PrefetchBytesWasted);
+			}
+
+			/* Cylinder numbers, in tens and in ones. */
+			Printf("%-6s    ", "");
+
+			for(cylinder = 0 ; cylinder < num_tracks / NUM_HEADS ; cylinder++)
+				Printf("%lc", (cylinder % 10) == 0 ? '0' + ((cylinder / 10) % 10) : ' ');
+
+			Printf("\n%-6s    ", "");
+
+			for(cylinder = 0 ; cylinder < num_tracks / NUM_HEADS ; cylinder++)
+				Printf("%lc", '0' + (cylinder % 10));
+
+			Printf("\n");
+
+			for(head = 0 ; head < NUM_HEADS ; head++)
+				print_heat_map_line(gd, head == 0 ? "Reads" : "", head, tfts, num_tracks, offsetof(struct TrackFileTrackStatistics, tfts_Reads), max_reads);
+
+			for(head = 0 ; head < NUM_HEADS ; head++)
+				print_heat_map_line(gd, head == 0 ? "Writes" : "", head, tfts, num_tracks, offsetof(struct TrackFileTrackStatistics, tfts_Writes), max_writes);
+
+			for(head = 0 ; head < NUM_HEADS ; head++)
+				print_heat_map_line(gd, head == 0 ? "Misses" : "", head, tfts, num_tracks, offsetof(struct TrackFileTrackStatistics, tfts_Misses), max_misses);
+
+			header_printed = TRUE;
+		}
+	}
+
+	TFFreeUnitData(first_tfud);
+
+	if(error == OK && NOT header_printed)
+		Printf("No track statistics are available.\n");
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
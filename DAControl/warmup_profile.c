@@ -0,0 +1,261 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#include <dos/dosextens.h>
+
+/****************************************************************************/
+
+#define __USE_SYSBASE
+#include <proto/exec.h>
+
+#include <proto/dos.h>
+
+#include <proto/trackfile.h>
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+#include "macros.h"
+#include "global_data.h"
+#include "trackfile_extensions.h"
+#include "warmup_profile.h"
+#include "tools.h"
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+/* A warm-up profile lists the tracks of a disk image file in the order in
+ * which they were first read the last time the file was used. It is kept
+ * next to the disk image file, under the same name with ".warmup" added,
+ * and consists of this header, followed by one byte per track number.
+ */
+struct WarmupProfileHeader
+{
+	ULONG	wph_ID;			/* Always WARMUP_PROFILE_ID */
+	LONG	wph_NumTracks;	/* Number of track numbers which follow */
+};
+
+#define WARMUP_PROFILE_ID 0x54465755	/* 'TFWU' */
+
+/****************************************************************************/
+
+/* Build the name of the warm-up profile which belongs to the given disk
+ * image file. Returns NULL if there is not enough memory, otherwise the
+ * name must be released with FreeVec().
+ */
+static STRPTR
+get_warmup_profile_name(struct GlobalData * gd, const TEXT * file_name)
+{
+	STRPTR profile_name;
+
+	USE_EXEC(gd);
+
+	profile_name = AllocVec(strlen(file_name) + strlen(".warmup") + 1, MEMF_ANY);
+	if(profile_name != NULL)
+	{
+		strcpy(profile_name, file_name);
+		strcat(profile_name, ".warmup");
+	}
+
+	return(profile_name);
+}
+
+/****************************************************************************/
+
+/* Read the warm-up profile of the given disk image file, if there is one,
+ * and copy up to max_tracks track numbers into the table provided. Returns
+ * the number of track numbers copied, which is 0 if the profile does not
+ * exist or cannot be used.
+ */
+LONG
+load_warmup_profile(struct GlobalData * gd, const TEXT * file_name, UBYTE * tracks, LONG max_tracks)
+{
+	struct WarmupProfileHeader wph;
+	STRPTR profile_name;
+	LONG num_tracks = 0;
+	BPTR file = ZERO;
+
+	USE_EXEC(gd);
+	USE_DOS(gd);
+
+	ENTER();
+
+	ASSERT( file_name != NULL && tracks != NULL );
+
+	profile_name = get_warmup_profile_name(gd, file_name);
+	if(profile_name == NULL)
+		goto out;
+
+	file = Open(profile_name, MODE_OLDFILE);
+	if(file == ZERO)
+	{
+		D(("no warm-up profile \"%s\" (error=%ld)", profile_name, IoErr()));
+		goto out;
+	}
+
+	if(Read(file, &wph, sizeof(wph)) != sizeof(wph) ||
+	   wph.wph_ID != WARMUP_PROFILE_ID ||
+	   wph.wph_NumTracks < 0 || wph.wph_NumTracks > TF_MAX_WARMUP_TRACKS)
+	{
+		D(("warm-up profile \"%s\" is not usable", profile_name));
+		goto out;
+	}
+
+	if(wph.wph_NumTracks > max_tracks)
+		wph.wph_NumTracks = max_tracks;
+
+	if(Read(file, tracks, wph.wph_NumTracks) != wph.wph_NumTracks)
+	{
+		D(("could not read warm-up profile \"%s\" (error=%ld)", profile_name, IoErr()));
+		goto out;
+	}
+
+	num_tracks = wph.wph_NumTracks;
+
+	D(("warm-up profile \"%s\" lists %ld tracks", profile_name, num_tracks));
+
+ out:
+
+	if(file != ZERO)
+		Close(file);
+
+	if(profile_name != NULL)
+		FreeVec(profile_name);
+
+	RETURN(num_tracks);
+	return(num_tracks);
+}
+
+/****************************************************************************/
+
+/* Store the order in which the tracks of the disk image file currently
+ * loaded into the given unit were first read, so that these tracks can
+ * be loaded into the cache right away when the file is used again. This
+ * needs to be done before the medium is ejected. If no tracks were read,
+ * an existing profile is left unchanged. Returns an error code if the
+ * profile could not be written, which is not a fatal problem; it will
+ * only be reported in verbose mode.
+ */
+LONG
+save_warmup_profile(struct GlobalData * gd, LONG unit, BOOL verbose)
+{
+	const struct TrackFileAccessOrder * tfao;
+	struct TrackFileUnitData * tfud;
+	struct WarmupProfileHeader wph;
+	STRPTR profile_name = NULL;
+	TEXT error_message[256];
+	BPTR file = ZERO;
+	LONG error = OK;
+
+	USE_EXEC(gd);
+	USE_DOS(gd);
+	USE_TRACKFILE(gd);
+
+	ENTER();
+
+	tfud = TFGetUnitData(unit);
+	if(tfud == NULL)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	if(NOT tfud->tfud_MediumIsPresent || tfud->tfud_FileName == NULL)
+		goto out;
+
+	/* Older versions of trackfile.device do not record
+	 * the track access order.
+	 */
+	tfao = find_statistics_group(tfud, TFSG_AccessOrder, sizeof(*tfao));
+	if(tfao == NULL)
+		goto out;
+
+	if(tfao->tfao_NumTracksAccessed <= 0)
+		goto out;
+
+	profile_name = get_warmup_profile_name(gd, tfud->tfud_FileName);
+	if(profile_name == NULL)
+	{
+		error = ERROR_NO_FREE_STORE;
+		goto out;
+	}
+
+	if(verbose)
+		Printf("Saving the order in which %ld tracks were read to \"%s\".\n", tfao->tfao_NumTracksAccessed, profile_name);
+
+	file = Open(profile_name, MODE_NEWFILE);
+	if(file == ZERO)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	wph.wph_ID			= WARMUP_PROFILE_ID;
+	wph.wph_NumTracks	= tfao->tfao_NumTracksAccessed;
+
+	if(Write(file, &wph, sizeof(wph)) != sizeof(wph) ||
+	   Write(file, (APTR)tfao->tfao_TrackAccessOrder, wph.wph_NumTracks) != wph.wph_NumTracks)
+	{
+		error = IoErr();
+
+		Close(file);
+		file = ZERO;
+
+		DeleteFile(profile_name);
+		goto out;
+	}
+
+ out:
+
+	if(file != ZERO)
+		Close(file);
+
+	if(error != OK && verbose)
+	{
+		Error(gd, "Could not save the warm-up profile for unit %ld (%s).", unit,
+			get_error_message(gd, error, error_message, sizeof(error_message)));
+	}
+
+	if(profile_name != NULL)
+		FreeVec(profile_name);
+
+	if(tfud != NULL)
+		TFFreeUnitData(tfud);
+
+	RETURN(error);
+	return(error);
+}
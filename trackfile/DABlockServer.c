@@ -0,0 +1,301 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * This is a shell command which serves the block requests of
+ * trackfile.device units. A disk image file inserted with the
+ * TF_BlockServer tag is read and written by this process rather than
+ * by the unit itself. Each request covers up to one track, and a unit
+ * may send several requests before the first one is returned. This
+ * command does nothing more than perform the requests in the order in
+ * which they arrive, which makes it a stand-in for a server which
+ * keeps all the disk image files in one place.
+ *
+ * Usage: DABlockServer NAME/K,DELAY/K/N,QUIET/S
+ *
+ * The NAME option picks the name of the public message port to which
+ * the units send their requests. It defaults to "DABlockServer". The
+ * DELAY option makes each request take the given number of ticks
+ * (1/50 of a second) longer, which simulates slow storage. Press
+ * Ctrl+C to stop the server; the number of requests performed is
+ * shown unless the QUIET option is used.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "trackfile_extensions.h"
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+extern struct Library * SysBase;
+extern struct Library * DOSBase;
+
+/****************************************************************************/
+
+#define DEFAULT_SERVER_NAME "DABlockServer"
+
+/****************************************************************************/
+
+/* Everything we need while serving requests. */
+struct server_context
+{
+	struct MsgPort *	sc_Port;		/* Public message port */
+	LONG				sc_Delay;		/* Extra ticks per request */
+
+	BPTR				sc_File;		/* File last accessed */
+	LONG				sc_Position;	/* Its file position, or -1 */
+
+	ULONG				sc_NumReads;	/* Number of read requests */
+	ULONG				sc_NumWrites;	/* Number of write requests */
+	ULONG				sc_NumFailed;	/* Requests which failed */
+	ULONG				sc_BytesRead;	/* Number of bytes read */
+	ULONG				sc_BytesWritten;/* Number of bytes written */
+};
+
+/****************************************************************************/
+
+/* Perform a single request and fill in the result. Seeking is avoided
+ * if the request picks up where the previous one for the same file
+ * left off, which is the common case when a unit reads several tracks
+ * in a row.
+ */
+static VOID
+serve_request(struct server_context * sc, struct TrackFileBlockRequest * tfbr)
+{
+	LONG actual = -1;
+	LONG error = OK;
+
+	if(tfbr->tfbr_Message.mn_Length < sizeof(*tfbr) ||
+	   tfbr->tfbr_File == ZERO || tfbr->tfbr_Offset < 0 || tfbr->tfbr_Length < 0 ||
+	   (tfbr->tfbr_Command != TFBR_Read && tfbr->tfbr_Command != TFBR_Write))
+	{
+		error = ERROR_ACTION_NOT_KNOWN;
+		goto out;
+	}
+
+	if(sc->sc_Delay > 0)
+		Delay(sc->sc_Delay);
+
+	if(tfbr->tfbr_File != sc->sc_File || tfbr->tfbr_Offset != sc->sc_Position)
+	{
+		sc->sc_File		= tfbr->tfbr_File;
+		sc->sc_Position	= -1;
+
+		if(Seek(tfbr->tfbr_File, tfbr->tfbr_Offset, OFFSET_BEGINNING) == -1)
+		{
+			error = IoErr();
+			goto out;
+		}
+
+		sc->sc_Position = tfbr->tfbr_Offset;
+	}
+
+	if(tfbr->tfbr_Command == TFBR_Read)
+	{
+		actual = Read(tfbr->tfbr_File, tfbr->tfbr_Data, tfbr->tfbr_Length);
+		if(actual > 0)
+			sc->sc_BytesRead += actual;
+
+		sc->sc_NumReads++;
+	}
+	else
+	{
+		actual = Write(tfbr->tfbr_File, tfbr->tfbr_Data, tfbr->tfbr_Length);
+		if(actual > 0)
+			sc->sc_BytesWritten += actual;
+
+		sc->sc_NumWrites++;
+	}
+
+	if(actual == tfbr->tfbr_Length)
+		sc->sc_Position += actual;
+	else
+		sc->sc_Position = -1;
+
+	if(actual == -1)
+		error = IoErr();
+
+ out:
+
+	if(actual == -1)
+		sc->sc_NumFailed++;
+
+	tfbr->tfbr_Actual	= actual;
+	tfbr->tfbr_Error	= error;
+
+	ReplyMsg(&tfbr->tfbr_Message);
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	struct
+	{
+		STRPTR	Name;
+		LONG *	Delay;
+		LONG	Quiet;
+	} args;
+
+	struct server_context sc;
+	struct TrackFileBlockRequest * tfbr;
+	struct RDArgs * rda = NULL;
+	STRPTR name;
+	int result = RETURN_ERROR;
+	ULONG signals;
+
+	memset(&sc, 0, sizeof(sc));
+
+	/* Kickstart 2.04 or higher required. */
+	if(SysBase->lib_Version < 37)
+	{
+		result = RETURN_FAIL;
+		goto out;
+	}
+
+	memset(&args, 0, sizeof(args));
+
+	rda = ReadArgs("NAME/K,DELAY/K/N,QUIET/S", (LONG *)&args, NULL);
+	if(rda == NULL)
+	{
+		PrintFault(IoErr(), "DABlockServer");
+		goto out;
+	}
+
+	name = (args.Name != NULL) ? args.Name : (STRPTR)DEFAULT_SERVER_NAME;
+
+	if(strlen(name) >= TF_MAX_BLOCK_SERVER_NAME_LEN)
+	{
+		Printf("%s: server name is too long\n", name);
+		goto out;
+	}
+
+	if(args.Delay != NULL && (*args.Delay) > 0)
+		sc.sc_Delay = (*args.Delay);
+
+	sc.sc_Position = -1;
+
+	sc.sc_Port = CreateMsgPort();
+	if(sc.sc_Port == NULL)
+	{
+		PrintFault(ERROR_NO_FREE_STORE, "DABlockServer");
+		goto out;
+	}
+
+	sc.sc_Port->mp_Node.ln_Name	= (char *)name;
+	sc.sc_Port->mp_Node.ln_Pri	= 1;
+
+	/* There can be only one server of the same name. */
+	Forbid();
+
+	if(FindPort(name) == NULL)
+	{
+		AddPort(sc.sc_Port);
+	}
+	else
+	{
+		sc.sc_Port->mp_Node.ln_Name = NULL;
+	}
+
+	Permit();
+
+	if(sc.sc_Port->mp_Node.ln_Name == NULL)
+	{
+		Printf("%s: a block server of this name is already running\n", name);
+		goto out;
+	}
+
+	if(NOT args.Quiet)
+		Printf("%s: serving block requests; press Ctrl+C to stop.\n", name);
+
+	do
+	{
+		signals = Wait(SIGBREAKF_CTRL_C | (1UL << sc.sc_Port->mp_SigBit));
+
+		while((tfbr = (struct TrackFileBlockRequest *)GetMsg(sc.sc_Port)) != NULL)
+			serve_request(&sc, tfbr);
+	}
+	while(FLAG_IS_CLEAR(signals, SIGBREAKF_CTRL_C));
+
+	/* No new requests can arrive once the port is gone, but
+	 * the units still expect the ones already sent to return.
+	 */
+	Forbid();
+	RemPort(sc.sc_Port);
+	Permit();
+
+	sc.sc_Port->mp_Node.ln_Name = NULL;
+
+	while((tfbr = (struct TrackFileBlockRequest *)GetMsg(sc.sc_Port)) != NULL)
+		serve_request(&sc, tfbr);
+
+	if(NOT args.Quiet)
+	{
+		Printf("%s: %lu reads (%lu bytes), %lu writes (%lu bytes), %lu failed\n",
+			name, sc.sc_NumReads, sc.sc_BytesRead, sc.sc_NumWrites, sc.sc_BytesWritten, sc.sc_NumFailed);
+	}
+
+	result = RETURN_OK;
+
+ out:
+
+	if(sc.sc_Port != NULL)
+	{
+		if(sc.sc_Port->mp_Node.ln_Name != NULL)
+		{
+			Forbid();
+			RemPort(sc.sc_Port);
+			Permit();
+		}
+
+		DeleteMsgPort(sc.sc_Port);
+	}
+
+	if(rda != NULL)
+		FreeArgs(rda);
+
+	return(result);
+}
@@ -0,0 +1,1135 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * This is a shell command which rewrites an OFS or FFS disk image file so
+ * that the blocks are laid out in the order in which they are accessed.
+ * The root directory stays where it is, and the bitmap and directory
+ * blocks are placed right next to it. The files and links follow in the
+ * order given by an access profile, each file header being immediately
+ * followed by its extension and data blocks. Files which the access
+ * profile does not mention are placed last, in directory order.
+ *
+ * Usage: DAOptimize FROM/A,TO/A,PROFILE/K,BLOCKS/S,UNIT/K/N,QUIET/S
+ *
+ * The access profile can be one of two things:
+ *
+ *    1. The output of "DAControl TRACKSTATS=CSV", in which case the
+ *       files are placed in order of how often their tracks were read.
+ *       The UNIT option picks the unit to use if the output covers more
+ *       than one unit, otherwise the first unit is used.
+ *
+ *    2. A list of track numbers, one per line, in the order in which
+ *       the tracks were accessed. With the BLOCKS option these are block
+ *       numbers instead. The files are placed in order of when they were
+ *       first accessed. Empty lines and lines starting with "#" are
+ *       ignored.
+ *
+ * The new layout is checked by scanning the directory tree again before
+ * the disk image file is written. The number of track switches needed
+ * to read the profiled files, one after the other, is shown for both
+ * the original and the new layout.
+ *
+ * Directory cache (DCFS) and long name (LNFS) disk image files are not
+ * supported.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "tools.h"
+
+/****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************/
+
+extern struct Library * SysBase;
+extern struct Library * DOSBase;
+
+/****************************************************************************/
+
+/* Number of 32 bit words in a 512 byte block. */
+#define BLOCK_LONGS (TD_SECTOR / sizeof(ULONG))
+
+/* Size of the directory hash table in a 512 byte block. */
+#define HASH_TABLE_SIZE (BLOCK_LONGS - 56)
+
+/* Number of data bitmap bits stored in a bitmap block. */
+#define BITMAP_BITS_PER_BLOCK ((BLOCK_LONGS - 1) * 32)
+
+/* Positions of the header block fields which are counted from the end
+ * of the block rather than from the beginning.
+ */
+#define BLOCK_REAL_ENTRY(b)		((b)[BLOCK_LONGS - 11])
+#define BLOCK_NEXT_LINK(b)		((b)[BLOCK_LONGS - 10])
+#define BLOCK_HASH_CHAIN(b)		((b)[BLOCK_LONGS - 4])
+#define BLOCK_PARENT(b)			((b)[BLOCK_LONGS - 3])
+#define BLOCK_EXTENSION(b)		((b)[BLOCK_LONGS - 2])
+#define BLOCK_SECONDARY_TYPE(b)	((LONG)(b)[BLOCK_LONGS - 1])
+
+/* Primary block types, in addition to T_SHORT. */
+#define T_DATA		8	/* OFS data block */
+#define T_LIST		16	/* File extension block */
+
+/****************************************************************************/
+
+/* A directory, file or link, and the blocks which belong to it. */
+struct layout_object
+{
+	ULONG	lo_HeaderBlock;		/* Header block number */
+	LONG	lo_SecondaryType;	/* ST_ROOT, ST_USERDIR, ST_FILE, etc. */
+	LONG	lo_FirstBlock;		/* Index into the table of owned blocks */
+	LONG	lo_NumBlocks;		/* Number of blocks owned, header first */
+	LONG	lo_FirstAccess;		/* Position in the access profile, or -1 */
+	ULONG	lo_NumAccesses;		/* How often the blocks were accessed */
+	LONG	lo_Order;			/* Position in the directory tree scan */
+};
+
+/* Everything we need to know while rearranging a single disk image file. */
+struct layout_context
+{
+	ULONG *					lc_Image;			/* Disk image file contents */
+	LONG					lc_NumBlocks;		/* Number of 512 byte blocks */
+	LONG					lc_SectorsPerTrack;	/* 11 or 22 */
+	ULONG					lc_RootBlock;		/* Root directory block number */
+	LONG					lc_NumBitmapBlocks;
+	BOOL					lc_FastFileSystem;	/* Data blocks carry no header */
+	LONG *					lc_Owner;			/* Object which each block belongs to, or -1 */
+	ULONG *					lc_NewBlock;		/* New block number for each block */
+	ULONG					lc_NextFreeBlock;	/* Next block number to hand out */
+	ULONG *					lc_OwnedBlocks;		/* Blocks owned by the objects, in reading order */
+	LONG					lc_NumOwnedBlocks;
+	struct layout_object *	lc_Objects;			/* Directories, files and links */
+	LONG					lc_NumObjects;
+	struct layout_object **	lc_Placement;		/* Objects in the order they will be placed */
+	STRPTR					lc_Path;			/* Name of the disk image file */
+};
+
+/****************************************************************************/
+
+/* Report that the directory tree could not be scanned because a block
+ * does not look like it should. Always returns FALSE.
+ */
+static BOOL
+image_is_damaged(const struct layout_context * lc, ULONG block, const char * reason)
+{
+	Printf("%s: block %ld: %s; please check the disk image with DAValidate.\n",
+		lc->lc_Path, block, reason);
+
+	return(FALSE);
+}
+
+/****************************************************************************/
+
+static ULONG *
+get_block(const struct layout_context * lc, ULONG block)
+{
+	return(&lc->lc_Image[block * BLOCK_LONGS]);
+}
+
+/****************************************************************************/
+
+/* Add a block to the list of blocks which belong to an object. Each
+ * block can belong to only one object, and the boot blocks belong to
+ * no object at all.
+ */
+static BOOL
+claim_block(struct layout_context * lc, LONG object, ULONG block)
+{
+	if(block < BOOTSECTS || block >= (ULONG)lc->lc_NumBlocks)
+		return(image_is_damaged(lc, block, "block number is out of range"));
+
+	if(lc->lc_Owner[block] != -1)
+		return(image_is_damaged(lc, block, "block is used more than once"));
+
+	lc->lc_Owner[block] = object;
+	lc->lc_OwnedBlocks[lc->lc_NumOwnedBlocks++] = block;
+
+	lc->lc_Objects[object].lo_NumBlocks++;
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Check if a block is a header or list block of the expected primary
+ * type, with the correct checksum and block number.
+ */
+static BOOL
+header_block_is_valid(const struct layout_context * lc, ULONG block, ULONG primary_type)
+{
+	const ULONG * data;
+
+	if(block < BOOTSECTS || block >= (ULONG)lc->lc_NumBlocks)
+		return(image_is_damaged(lc, block, "block number is out of range"));
+
+	data = get_block(lc, block);
+
+	if(calculate_amiga_block_checksum(data, TD_SECTOR) != 0)
+		return(image_is_damaged(lc, block, "block checksum is invalid"));
+
+	if(data[0] != primary_type || data[1] != block)
+		return(image_is_damaged(lc, block, "block type or number is invalid"));
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Start a new object, which begins with its header block. */
+static LONG
+add_object(struct layout_context * lc, ULONG header_block, LONG secondary_type)
+{
+	struct layout_object * lo = &lc->lc_Objects[lc->lc_NumObjects];
+
+	memset(lo, 0, sizeof(*lo));
+
+	lo->lo_HeaderBlock		= header_block;
+	lo->lo_SecondaryType	= secondary_type;
+	lo->lo_FirstBlock		= lc->lc_NumOwnedBlocks;
+	lo->lo_FirstAccess		= -1;
+	lo->lo_Order			= lc->lc_NumObjects;
+
+	return(lc->lc_NumObjects++);
+}
+
+/****************************************************************************/
+
+/* Collect the extension and data blocks which belong to a file, in the
+ * order in which the file system reads them: each extension block is
+ * followed by the data blocks it lists.
+ */
+static BOOL
+claim_file_blocks(struct layout_context * lc, LONG object, ULONG header_block)
+{
+	const ULONG * list = get_block(lc, header_block);
+	ULONG list_block = header_block;
+	ULONG high_seq;
+	ULONG i;
+
+	while(TRUE)
+	{
+		high_seq = list[2];
+		if(high_seq > HASH_TABLE_SIZE)
+			return(image_is_damaged(lc, list_block, "data block table is invalid"));
+
+		/* The data block table is filled from the end
+		 * towards the beginning.
+		 */
+		for(i = 0 ; i < high_seq ; i++)
+		{
+			if(NOT claim_block(lc, object, list[6 + HASH_TABLE_SIZE - 1 - i]))
+				return(FALSE);
+		}
+
+		list_block = BLOCK_EXTENSION(list);
+		if(list_block == 0)
+			break;
+
+		if(NOT header_block_is_valid(lc, list_block, T_LIST) || NOT claim_block(lc, object, list_block))
+			return(FALSE);
+
+		list = get_block(lc, list_block);
+
+		if(BLOCK_PARENT(list) != header_block)
+			return(image_is_damaged(lc, list_block, "extension block belongs to a different file"));
+	}
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Collect all the objects and the blocks which belong to them, one
+ * directory at a time, starting with the root directory. The root
+ * directory object also owns the bitmap blocks. Directories are
+ * scanned in the order they are found, so that the table of objects
+ * doubles as the list of directories still to be scanned.
+ */
+static BOOL
+scan_directory_tree(struct layout_context * lc)
+{
+	const struct RootDirBlock * rdb = (struct RootDirBlock *)get_block(lc, lc->lc_RootBlock);
+	const ULONG * directory;
+	const ULONG * entry;
+	ULONG block;
+	LONG secondary_type;
+	LONG object, entry_object, i;
+
+	memset(lc->lc_Owner, 0xFF, sizeof(*lc->lc_Owner) * lc->lc_NumBlocks);
+
+	lc->lc_NumOwnedBlocks	= 0;
+	lc->lc_NumObjects		= 0;
+
+	if(NOT root_directory_is_valid(rdb))
+		return(image_is_damaged(lc, lc->lc_RootBlock, "root directory is invalid"));
+
+	if(rdb->rdb_BitMapExtension != 0)
+		return(image_is_damaged(lc, lc->lc_RootBlock, "bitmap extension blocks are not supported"));
+
+	object = add_object(lc, lc->lc_RootBlock, ST_ROOT);
+
+	if(NOT claim_block(lc, object, lc->lc_RootBlock))
+		return(FALSE);
+
+	for(i = 0 ; i < lc->lc_NumBitmapBlocks ; i++)
+	{
+		if(NOT claim_block(lc, object, rdb->rdb_BitMapBlocks[i]))
+			return(FALSE);
+	}
+
+	for(object = 0 ; object < lc->lc_NumObjects ; object++)
+	{
+		if(lc->lc_Objects[object].lo_SecondaryType != ST_ROOT &&
+		   lc->lc_Objects[object].lo_SecondaryType != ST_USERDIR)
+		{
+			continue;
+		}
+
+		directory = get_block(lc, lc->lc_Objects[object].lo_HeaderBlock);
+
+		for(i = 0 ; i < HASH_TABLE_SIZE ; i++)
+		{
+			/* Hash chains which loop back on themselves are
+			 * caught because a block can be claimed only once.
+			 */
+			for(block = directory[6 + i] ; block != 0 ; block = BLOCK_HASH_CHAIN(entry))
+			{
+				if(NOT header_block_is_valid(lc, block, T_SHORT))
+					return(FALSE);
+
+				entry = get_block(lc, block);
+
+				if(BLOCK_PARENT(entry) != lc->lc_Objects[object].lo_HeaderBlock)
+					return(image_is_damaged(lc, block, "entry belongs to a different directory"));
+
+				secondary_type = BLOCK_SECONDARY_TYPE(entry);
+
+				switch(secondary_type)
+				{
+					case ST_USERDIR:
+					case ST_FILE:
+					case ST_SOFTLINK:
+					case ST_LINKDIR:
+					case ST_LINKFILE:
+
+						break;
+
+					default:
+
+						return(image_is_damaged(lc, block, "entry type is unknown"));
+				}
+
+				entry_object = add_object(lc, block, secondary_type);
+
+				if(NOT claim_block(lc, entry_object, block))
+					return(FALSE);
+
+				if(secondary_type == ST_FILE && NOT claim_file_blocks(lc, entry_object, block))
+					return(FALSE);
+			}
+		}
+	}
+
+	/* Hard links and the objects they refer to are chained
+	 * together. Each link must refer to an object which we
+	 * know about, since the references will have to be
+	 * changed along with the block numbers.
+	 */
+	for(object = 1 ; object < lc->lc_NumObjects ; object++)
+	{
+		const ULONG * header = get_block(lc, lc->lc_Objects[object].lo_HeaderBlock);
+		ULONG links[2];
+
+		if(lc->lc_Objects[object].lo_SecondaryType == ST_SOFTLINK)
+			continue;
+
+		links[0] = BLOCK_NEXT_LINK(header);
+		links[1] = (lc->lc_Objects[object].lo_SecondaryType == ST_LINKFILE ||
+		            lc->lc_Objects[object].lo_SecondaryType == ST_LINKDIR) ? BLOCK_REAL_ENTRY(header) : 0;
+
+		for(i = 0 ; i < 2 ; i++)
+		{
+			block = links[i];
+			if(block == 0)
+				continue;
+
+			if(block >= (ULONG)lc->lc_NumBlocks ||
+			   lc->lc_Owner[block] == -1 ||
+			   lc->lc_Objects[lc->lc_Owner[block]].lo_HeaderBlock != block)
+			{
+				return(image_is_damaged(lc, lc->lc_Objects[object].lo_HeaderBlock, "hard link is invalid"));
+			}
+		}
+	}
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Account for an access to a range of blocks recorded in the access
+ * profile. The position is -1 if the order of the accesses is unknown.
+ */
+static void
+record_access(struct layout_context * lc, ULONG first_block, LONG num_blocks, LONG position, ULONG count)
+{
+	struct layout_object * lo;
+	ULONG block;
+	LONG object;
+
+	for(block = first_block ; num_blocks-- > 0 ; block++)
+	{
+		object = lc->lc_Owner[block];
+		if(object == -1)
+			continue;
+
+		lo = &lc->lc_Objects[object];
+
+		lo->lo_NumAccesses += count;
+
+		if(position >= 0 && lo->lo_FirstAccess == -1)
+			lo->lo_FirstAccess = position;
+	}
+}
+
+/****************************************************************************/
+
+/* Pick a number from a line of comma separated values, counting the
+ * fields from zero.
+ */
+static BOOL
+get_csv_number(const TEXT * line, int field, LONG * value)
+{
+	while(field > 0 && (*line) != '\0')
+	{
+		if((*line++) == ',')
+			field--;
+	}
+
+	if(field > 0)
+		return(FALSE);
+
+	return((BOOL)(StrToLong((STRPTR)line, value) > 0));
+}
+
+/****************************************************************************/
+
+/* Read the access profile, which is either the "DAControl TRACKSTATS=CSV"
+ * output or a list of track or block numbers in the order in which
+ * they were accessed.
+ */
+static BOOL
+read_access_profile(struct layout_context * lc, STRPTR name, BOOL use_blocks, const LONG * unit)
+{
+	LONG num_tracks = lc->lc_NumBlocks / lc->lc_SectorsPerTrack;
+	BOOL csv_format = FALSE;
+	BOOL unit_is_known = FALSE;
+	BOOL success = FALSE;
+	LONG line_number = 0;
+	LONG position = 0;
+	LONG csv_unit = 0;
+	LONG number, track, reads;
+	BPTR file = ZERO;
+	TEXT line[256];
+	LONG error;
+	int i;
+
+	if(unit != NULL)
+	{
+		csv_unit = (*unit);
+		unit_is_known = TRUE;
+	}
+
+	file = Open(name, MODE_OLDFILE);
+	if(file == ZERO)
+	{
+		PrintFault(IoErr(), name);
+		goto out;
+	}
+
+	while(FGets(file, line, sizeof(line)) != NULL)
+	{
+		line_number++;
+
+		for(i = 0 ; line[i] == ' ' || line[i] == '\t' ; i++)
+			;
+
+		if(line[i] == '\0' || line[i] == '\n' || line[i] == '#')
+			continue;
+
+		/* This is the header line of the CSV output. */
+		if(line_number == 1 && strncmp(&line[i], "Unit,", 5) == SAME)
+		{
+			csv_format = TRUE;
+			continue;
+		}
+
+		if(csv_format)
+		{
+			if(NOT get_csv_number(&line[i], 0, &number) ||
+			   NOT get_csv_number(&line[i], 2, &track) ||
+			   NOT get_csv_number(&line[i], 5, &reads))
+			{
+				Printf("%s: line %ld is not understood.\n", name, line_number);
+				goto out;
+			}
+
+			/* Use the first unit listed, unless told otherwise. */
+			if(NOT unit_is_known)
+			{
+				csv_unit = number;
+				unit_is_known = TRUE;
+			}
+
+			if(number != csv_unit)
+				continue;
+
+			if(track < 0 || track >= num_tracks)
+			{
+				Printf("%s: line %ld: track %ld is out of range.\n", name, line_number, track);
+				goto out;
+			}
+
+			if(reads > 0)
+				record_access(lc, track * lc->lc_SectorsPerTrack, lc->lc_SectorsPerTrack, -1, reads);
+		}
+		else
+		{
+			if(StrToLong(&line[i], &number) <= 0)
+			{
+				Printf("%s: line %ld is not understood.\n", name, line_number);
+				goto out;
+			}
+
+			if(number < 0 || number >= (use_blocks ? lc->lc_NumBlocks : num_tracks))
+			{
+				Printf("%s: line %ld: %s %ld is out of range.\n", name, line_number,
+					use_blocks ? "block" : "track", number);
+
+				goto out;
+			}
+
+			if(use_blocks)
+				record_access(lc, number, 1, position++, 1);
+			else
+				record_access(lc, number * lc->lc_SectorsPerTrack, lc->lc_SectorsPerTrack, position++, 1);
+		}
+	}
+
+	error = IoErr();
+	if(error != OK)
+	{
+		PrintFault(error, name);
+		goto out;
+	}
+
+	success = TRUE;
+
+ out:
+
+	if(file != ZERO)
+		Close(file);
+
+	return(success);
+}
+
+/****************************************************************************/
+
+/* Sort the files and links so that those which were accessed come
+ * first, in the order in which they were first accessed, or if that
+ * is unknown, by how often they were accessed. Everything else keeps
+ * the order in which it was found in the directory tree.
+ */
+static int
+compare_objects(const void * a, const void * b)
+{
+	const struct layout_object * lo1 = *(const struct layout_object **)a;
+	const struct layout_object * lo2 = *(const struct layout_object **)b;
+
+	if((lo1->lo_NumAccesses > 0) != (lo2->lo_NumAccesses > 0))
+		return((lo1->lo_NumAccesses > 0) ? -1 : 1);
+
+	if(lo1->lo_FirstAccess >= 0 && lo2->lo_FirstAccess >= 0 && lo1->lo_FirstAccess != lo2->lo_FirstAccess)
+		return((lo1->lo_FirstAccess < lo2->lo_FirstAccess) ? -1 : 1);
+
+	if(lo1->lo_NumAccesses != lo2->lo_NumAccesses)
+		return((lo1->lo_NumAccesses > lo2->lo_NumAccesses) ? -1 : 1);
+
+	return(lo1->lo_Order - lo2->lo_Order);
+}
+
+/****************************************************************************/
+
+/* Hand out the next block number for the new layout. Blocks are handed
+ * out from the root directory towards the end of the disk, and then
+ * from the beginning of the disk towards the root directory, much like
+ * the file system does it. There are always enough blocks to go around
+ * because the new layout uses exactly as many blocks as the old one.
+ */
+static ULONG
+allocate_block(struct layout_context * lc)
+{
+	ULONG block = lc->lc_NextFreeBlock;
+
+	if(block == (ULONG)lc->lc_NumBlocks)
+		block = BOOTSECTS;
+
+	lc->lc_NextFreeBlock = block + 1;
+
+	return(block);
+}
+
+/****************************************************************************/
+
+/* Decide where each block should go. The root directory stays in place,
+ * followed by the bitmap and the directories, followed by the files and
+ * links in the order of the access profile.
+ */
+static void
+plan_layout(struct layout_context * lc)
+{
+	const struct layout_object * lo;
+	LONG num_directories = 0;
+	LONG num_placed = 0;
+	ULONG block;
+	LONG i, j;
+
+	for(i = 0 ; i < lc->lc_NumObjects ; i++)
+	{
+		if(lc->lc_Objects[i].lo_SecondaryType == ST_ROOT || lc->lc_Objects[i].lo_SecondaryType == ST_USERDIR)
+			lc->lc_Placement[num_placed++] = &lc->lc_Objects[i];
+	}
+
+	num_directories = num_placed;
+
+	for(i = 0 ; i < lc->lc_NumObjects ; i++)
+	{
+		if(lc->lc_Objects[i].lo_SecondaryType != ST_ROOT && lc->lc_Objects[i].lo_SecondaryType != ST_USERDIR)
+			lc->lc_Placement[num_placed++] = &lc->lc_Objects[i];
+	}
+
+	qsort(&lc->lc_Placement[num_directories], num_placed - num_directories, sizeof(*lc->lc_Placement), compare_objects);
+
+	memset(lc->lc_NewBlock, 0, sizeof(*lc->lc_NewBlock) * lc->lc_NumBlocks);
+
+	lc->lc_NewBlock[lc->lc_RootBlock] = lc->lc_RootBlock;
+	lc->lc_NextFreeBlock = lc->lc_RootBlock + 1;
+
+	for(i = 0 ; i < num_placed ; i++)
+	{
+		lo = lc->lc_Placement[i];
+
+		for(j = 0 ; j < lo->lo_NumBlocks ; j++)
+		{
+			block = lc->lc_OwnedBlocks[lo->lo_FirstBlock + j];
+
+			if(block != lc->lc_RootBlock)
+				lc->lc_NewBlock[block] = allocate_block(lc);
+		}
+	}
+}
+
+/****************************************************************************/
+
+/* Count how often the disk would have to switch from one track to the
+ * next if the files which were accessed according to the profile were
+ * read one after the other, in the order of the new layout.
+ */
+static LONG
+count_track_switches(const struct layout_context * lc, BOOL use_new_layout)
+{
+	const struct layout_object * lo;
+	LONG previous_track = -1;
+	LONG num_switches = 0;
+	ULONG block;
+	LONG track;
+	LONG i, j;
+
+	for(i = 0 ; i < lc->lc_NumObjects ; i++)
+	{
+		lo = lc->lc_Placement[i];
+		if(lo->lo_NumAccesses == 0)
+			continue;
+
+		for(j = 0 ; j < lo->lo_NumBlocks ; j++)
+		{
+			block = lc->lc_OwnedBlocks[lo->lo_FirstBlock + j];
+			if(use_new_layout)
+				block = lc->lc_NewBlock[block];
+
+			track = block / lc->lc_SectorsPerTrack;
+
+			if(previous_track != -1 && track != previous_track)
+				num_switches++;
+
+			previous_track = track;
+		}
+	}
+
+	return(num_switches);
+}
+
+/****************************************************************************/
+
+static ULONG
+new_block_number(const struct layout_context * lc, ULONG block)
+{
+	if(block == 0 || block >= (ULONG)lc->lc_NumBlocks)
+		return(0);
+
+	return(lc->lc_NewBlock[block]);
+}
+
+/****************************************************************************/
+
+static void
+set_block_checksum(ULONG * data, int position)
+{
+	data[position] = 0;
+	data[position] = -calculate_amiga_block_checksum(data, TD_SECTOR);
+}
+
+/****************************************************************************/
+
+/* Change the block numbers stored in a directory, file or link header
+ * block, which has already been copied to its new position.
+ */
+static void
+update_header_block(struct layout_context * lc, ULONG * data, LONG secondary_type)
+{
+	int i;
+
+	data[1] = new_block_number(lc, data[1]);
+
+	/* Directories have a hash table, files have a data block
+	 * table in the same place. Soft links store the name of
+	 * the object they refer to there.
+	 */
+	if(secondary_type == ST_ROOT || secondary_type == ST_USERDIR || secondary_type == ST_FILE)
+	{
+		for(i = 0 ; i < HASH_TABLE_SIZE ; i++)
+			data[6 + i] = new_block_number(lc, data[6 + i]);
+	}
+
+	if(secondary_type == ST_FILE)
+		data[4] = new_block_number(lc, data[4]);
+
+	if(secondary_type == ST_ROOT)
+	{
+		struct RootDirBlock * rdb = (struct RootDirBlock *)data;
+
+		for(i = 0 ; i < lc->lc_NumBitmapBlocks ; i++)
+			rdb->rdb_BitMapBlocks[i] = new_block_number(lc, rdb->rdb_BitMapBlocks[i]);
+
+		/* The bitmap will be rebuilt from scratch. */
+		rdb->rdb_BitMapFlag = DOSTRUE;
+	}
+	else
+	{
+		BLOCK_HASH_CHAIN(data)	= new_block_number(lc, BLOCK_HASH_CHAIN(data));
+		BLOCK_PARENT(data)		= new_block_number(lc, BLOCK_PARENT(data));
+		BLOCK_EXTENSION(data)	= new_block_number(lc, BLOCK_EXTENSION(data));
+		BLOCK_NEXT_LINK(data)	= new_block_number(lc, BLOCK_NEXT_LINK(data));
+
+		if(secondary_type == ST_LINKFILE || secondary_type == ST_LINKDIR)
+			BLOCK_REAL_ENTRY(data) = new_block_number(lc, BLOCK_REAL_ENTRY(data));
+	}
+
+	set_block_checksum(data, 5);
+}
+
+/****************************************************************************/
+
+/* Change the block numbers stored in the extension blocks and, for OFS,
+ * in the data blocks which belong to a file.
+ */
+static void
+update_file_blocks(struct layout_context * lc, ULONG * new_image, ULONG header_block)
+{
+	const ULONG * list = get_block(lc, header_block);
+	ULONG list_block = header_block;
+	ULONG * data;
+	ULONG i;
+
+	while(TRUE)
+	{
+		if(list_block != header_block)
+		{
+			data = &new_image[lc->lc_NewBlock[list_block] * BLOCK_LONGS];
+
+			data[1] = new_block_number(lc, data[1]);
+
+			for(i = 0 ; i < HASH_TABLE_SIZE ; i++)
+				data[6 + i] = new_block_number(lc, data[6 + i]);
+
+			BLOCK_PARENT(data)		= new_block_number(lc, BLOCK_PARENT(data));
+			BLOCK_EXTENSION(data)	= new_block_number(lc, BLOCK_EXTENSION(data));
+
+			set_block_checksum(data, 5);
+		}
+
+		/* OFS data blocks carry a header, which refers to the
+		 * file header block and the next data block.
+		 */
+		if(NOT lc->lc_FastFileSystem)
+		{
+			for(i = 0 ; i < list[2] ; i++)
+			{
+				data = &new_image[lc->lc_NewBlock[list[6 + HASH_TABLE_SIZE - 1 - i]] * BLOCK_LONGS];
+
+				data[1] = new_block_number(lc, data[1]);
+				data[4] = new_block_number(lc, data[4]);
+
+				set_block_checksum(data, 5);
+			}
+		}
+
+		list_block = BLOCK_EXTENSION(list);
+		if(list_block == 0)
+			break;
+
+		list = get_block(lc, list_block);
+	}
+}
+
+/****************************************************************************/
+
+/* Mark a block in the new layout as being available or in use. A bit
+ * which is set stands for a block which is available for use. The first
+ * bitmap bit stands for the first block following the boot blocks.
+ */
+static void
+change_bitmap(const struct layout_context * lc, ULONG * new_image, ULONG block, BOOL is_free)
+{
+	const struct RootDirBlock * rdb = (struct RootDirBlock *)&new_image[lc->lc_RootBlock * BLOCK_LONGS];
+	ULONG bit = block - BOOTSECTS;
+	ULONG * bitmap;
+
+	bitmap = &new_image[rdb->rdb_BitMapBlocks[bit / BITMAP_BITS_PER_BLOCK] * BLOCK_LONGS];
+
+	bit %= BITMAP_BITS_PER_BLOCK;
+
+	if(is_free)
+		bitmap[1 + bit / 32] |= (1UL << (bit % 32));
+	else
+		bitmap[1 + bit / 32] &= ~(1UL << (bit % 32));
+}
+
+/****************************************************************************/
+
+/* Build the new disk image, with all blocks moved to their new positions,
+ * all block references changed accordingly and a new bitmap.
+ */
+static void
+rewrite_disk_image(struct layout_context * lc, ULONG * new_image)
+{
+	const struct RootDirBlock * rdb;
+	const struct layout_object * lo;
+	ULONG block;
+	LONG i;
+
+	memset(new_image, 0, lc->lc_NumBlocks * TD_SECTOR);
+
+	/* The boot blocks stay as they are. */
+	memcpy(new_image, lc->lc_Image, BOOTSECTS * TD_SECTOR);
+
+	for(i = 0 ; i < lc->lc_NumOwnedBlocks ; i++)
+	{
+		block = lc->lc_OwnedBlocks[i];
+
+		memcpy(&new_image[lc->lc_NewBlock[block] * BLOCK_LONGS], get_block(lc, block), TD_SECTOR);
+	}
+
+	for(i = 0 ; i < lc->lc_NumObjects ; i++)
+	{
+		lo = &lc->lc_Objects[i];
+
+		update_header_block(lc, &new_image[lc->lc_NewBlock[lo->lo_HeaderBlock] * BLOCK_LONGS], lo->lo_SecondaryType);
+
+		if(lo->lo_SecondaryType == ST_FILE)
+			update_file_blocks(lc, new_image, lo->lo_HeaderBlock);
+	}
+
+	/* Mark everything as available first, then mark the blocks
+	 * which are in use.
+	 */
+	for(block = BOOTSECTS ; block < (ULONG)lc->lc_NumBlocks ; block++)
+		change_bitmap(lc, new_image, block, TRUE);
+
+	for(i = 0 ; i < lc->lc_NumOwnedBlocks ; i++)
+		change_bitmap(lc, new_image, lc->lc_NewBlock[lc->lc_OwnedBlocks[i]], FALSE);
+
+	rdb = (struct RootDirBlock *)&new_image[lc->lc_RootBlock * BLOCK_LONGS];
+
+	for(i = 0 ; i < lc->lc_NumBitmapBlocks ; i++)
+		set_block_checksum(&new_image[rdb->rdb_BitMapBlocks[i] * BLOCK_LONGS], 0);
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	struct
+	{
+		STRPTR	From;
+		STRPTR	To;
+		STRPTR	Profile;
+		LONG	Blocks;
+		LONG *	Unit;
+		LONG	Quiet;
+	} args;
+
+	/* Both 3.5" double density and high density disks
+	 * are supported.
+	 */
+	const LONG size_dd_disk = TD_SECTOR *     NUMSECS * NUMHEADS * NUMCYLS;
+	const LONG size_hd_disk = TD_SECTOR * 2 * NUMSECS * NUMHEADS * NUMCYLS;
+
+	struct layout_context lc;
+	struct FileInfoBlock * fib = NULL;
+	struct RDArgs * rda = NULL;
+	int result = RETURN_ERROR;
+	BPTR file_handle = ZERO;
+	ULONG * new_image = NULL;
+	ULONG * old_image;
+	LONG num_switches_before = 0;
+	LONG num_switches_after = 0;
+	LONG num_owned_blocks;
+	LONG num_objects;
+	LONG num_bytes;
+	LONG dos_type;
+	LONG error;
+
+	memset(&lc, 0, sizeof(lc));
+
+	/* Kickstart 2.04 or higher required. */
+	if(SysBase->lib_Version < 37)
+	{
+		result = RETURN_FAIL;
+		goto out;
+	}
+
+	memset(&args, 0, sizeof(args));
+
+	rda = ReadArgs("FROM/A,TO/A,PROFILE/K,BLOCKS/S,UNIT/K/N,QUIET/S", (LONG *)&args, NULL);
+	if(rda == NULL)
+	{
+		PrintFault(IoErr(), "DAOptimize");
+		goto out;
+	}
+
+	lc.lc_Path = args.From;
+
+	fib = AllocDosObject(DOS_FIB, NULL);
+	if(fib == NULL)
+	{
+		PrintFault(ERROR_NO_FREE_STORE, "DAOptimize");
+		goto out;
+	}
+
+	file_handle = Open(args.From, MODE_OLDFILE);
+	if(file_handle == ZERO || CANNOT ExamineFH(file_handle, fib))
+	{
+		PrintFault(IoErr(), args.From);
+		goto out;
+	}
+
+	/* Only 3.5" double density and high density disk image
+	 * files are considered.
+	 */
+	if(fib->fib_Size != size_dd_disk && fib->fib_Size != size_hd_disk)
+	{
+		Printf("%s: not a double density or high density disk image file.\n", args.From);
+		goto out;
+	}
+
+	lc.lc_NumBlocks			= fib->fib_Size / TD_SECTOR;
+	lc.lc_SectorsPerTrack	= (fib->fib_Size == size_hd_disk) ? 2 * NUMSECS : NUMSECS;
+	lc.lc_RootBlock			= lc.lc_NumBlocks / 2;
+	lc.lc_NumBitmapBlocks	= (lc.lc_NumBlocks - BOOTSECTS + BITMAP_BITS_PER_BLOCK - 1) / BITMAP_BITS_PER_BLOCK;
+
+	lc.lc_Image			= AllocVec(fib->fib_Size, MEMF_ANY|MEMF_PUBLIC);
+	new_image			= AllocVec(fib->fib_Size, MEMF_ANY|MEMF_PUBLIC);
+	lc.lc_Owner			= AllocVec(sizeof(*lc.lc_Owner) * lc.lc_NumBlocks, MEMF_ANY);
+	lc.lc_NewBlock		= AllocVec(sizeof(*lc.lc_NewBlock) * lc.lc_NumBlocks, MEMF_ANY);
+	lc.lc_OwnedBlocks	= AllocVec(sizeof(*lc.lc_OwnedBlocks) * lc.lc_NumBlocks, MEMF_ANY);
+	lc.lc_Objects		= AllocVec(sizeof(*lc.lc_Objects) * lc.lc_NumBlocks, MEMF_ANY);
+	lc.lc_Placement		= AllocVec(sizeof(*lc.lc_Placement) * lc.lc_NumBlocks, MEMF_ANY);
+
+	if(lc.lc_Image == NULL || new_image == NULL || lc.lc_Owner == NULL || lc.lc_NewBlock == NULL ||
+	   lc.lc_OwnedBlocks == NULL || lc.lc_Objects == NULL || lc.lc_Placement == NULL)
+	{
+		PrintFault(ERROR_NO_FREE_STORE, "DAOptimize");
+		goto out;
+	}
+
+	/* Read the entire disk image file in one go. */
+	num_bytes = Read(file_handle, lc.lc_Image, fib->fib_Size);
+	error = IoErr();
+
+	Close(file_handle);
+	file_handle = ZERO;
+
+	if(num_bytes != fib->fib_Size)
+	{
+		PrintFault(num_bytes == -1 ? error : ERROR_SEEK_ERROR, args.From);
+		goto out;
+	}
+
+	/* Directory cache blocks and the long name format are
+	 * not supported.
+	 */
+	dos_type = lc.lc_Image[0];
+
+	if((dos_type & 0xFFFFFF00) != ID_DOS_DISK || (dos_type & 0xFF) > 3)
+	{
+		Printf("%s: only OFS and FFS disk image files without directory caching are supported.\n", args.From);
+		goto out;
+	}
+
+	lc.lc_FastFileSystem = (BOOL)((dos_type & 1) != 0);
+
+	if(NOT scan_directory_tree(&lc))
+		goto out;
+
+	if(args.Profile != NULL && NOT read_access_profile(&lc, args.Profile, (BOOL)(args.Blocks != 0), args.Unit))
+		goto out;
+
+	plan_layout(&lc);
+
+	if(args.Profile != NULL)
+	{
+		num_switches_before	= count_track_switches(&lc, FALSE);
+		num_switches_after	= count_track_switches(&lc, TRUE);
+	}
+
+	rewrite_disk_image(&lc, new_image);
+
+	/* Check if the new layout holds up by scanning the directory
+	 * tree once more. This must find exactly the same number of
+	 * objects and blocks as before.
+	 */
+	num_owned_blocks	= lc.lc_NumOwnedBlocks;
+	num_objects			= lc.lc_NumObjects;
+
+	old_image	= lc.lc_Image;
+	lc.lc_Image	= new_image;
+	new_image	= old_image;
+
+	if(NOT scan_directory_tree(&lc) || lc.lc_NumOwnedBlocks != num_owned_blocks || lc.lc_NumObjects != num_objects)
+	{
+		Printf("%s: the new layout did not check out; the disk image file was not written.\n", args.From);
+		goto out;
+	}
+
+	file_handle = Open(args.To, MODE_NEWFILE);
+	if(file_handle == ZERO)
+	{
+		PrintFault(IoErr(), args.To);
+		goto out;
+	}
+
+	num_bytes = Write(file_handle, lc.lc_Image, fib->fib_Size);
+	error = IoErr();
+
+	if(CANNOT Close(file_handle) && num_bytes == fib->fib_Size)
+	{
+		error = IoErr();
+		num_bytes = -1;
+	}
+
+	file_handle = ZERO;
+
+	if(num_bytes != fib->fib_Size)
+	{
+		PrintFault(error, args.To);
+		goto out;
+	}
+
+	if(NOT args.Quiet)
+	{
+		Printf("%s: %ld directories, files and links in %ld blocks rearranged.\n",
+			args.From, num_objects, num_owned_blocks);
+
+		if(args.Profile != NULL)
+			Printf("Track switches for the profiled files: %ld before, %ld after.\n", num_switches_before, num_switches_after);
+	}
+
+	result = RETURN_OK;
+
+ out:
+
+	if(file_handle != ZERO)
+		Close(file_handle);
+
+	if(lc.lc_Placement != NULL)
+		FreeVec(lc.lc_Placement);
+
+	if(lc.lc_Objects != NULL)
+		FreeVec(lc.lc_Objects);
+
+	if(lc.lc_OwnedBlocks != NULL)
+		FreeVec(lc.lc_OwnedBlocks);
+
+	if(lc.lc_NewBlock != NULL)
+		FreeVec(lc.lc_NewBlock);
+
+	if(lc.lc_Owner != NULL)
+		FreeVec(lc.lc_Owner);
+
+	if(new_image != NULL)
+		FreeVec(new_image);
+
+	if(lc.lc_Image != NULL)
+		FreeVec(lc.lc_Image);
+
+	if(fib != NULL)
+		FreeDosObject(DOS_FIB, fib);
+
+	if(rda != NULL)
+		FreeArgs(rda);
+
+	return(result);
+}
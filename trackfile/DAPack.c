@@ -0,0 +1,449 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * This is a shell command which converts disk image files into packed disk
+ * image files and back. In a packed disk image file each track is
+ * compressed on its own, and tracks which contain only zero bytes take up
+ * no room at all. trackfile.device can use packed disk image files
+ * directly, reading and unpacking one track at a time.
+ *
+ * Usage: DAPack FROM/A,TO/A,UNPACK/S,QUIET/S
+ *
+ * Without the UNPACK option, the FROM file must be a double density or
+ * high density disk image file, which is packed and stored as the TO
+ * file. With the UNPACK option, the FROM file must be a packed disk
+ * image file, which is unpacked and stored as the TO file.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "track_packer.h"
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+extern struct Library * SysBase;
+extern struct Library * DOSBase;
+
+/****************************************************************************/
+
+/* Both 3.5" double density and high density disks are supported. */
+#define NUM_TRACKS (NUMCYLS * NUMHEADS)
+
+/****************************************************************************/
+
+/* Everything we need while converting a disk image file. */
+struct pack_context
+{
+	BPTR						pc_From;		/* File to read from */
+	BPTR						pc_To;			/* File to write to */
+	LONG						pc_TrackSize;	/* Size of an unpacked track */
+	UBYTE *						pc_Track;		/* Unpacked track data */
+	UBYTE *						pc_Packed;		/* Packed track data */
+	UWORD *						pc_HashTable;	/* Needed by pack_track() */
+	struct PackedImageTrack		pc_Index[NUM_TRACKS];
+
+	LONG						pc_NumEmpty;	/* Number of empty tracks */
+	LONG						pc_NumStored;	/* Tracks which did not compress */
+	LONG						pc_NumPacked;	/* Tracks which did */
+	LONG						pc_SizeIn;		/* Number of bytes read */
+	LONG						pc_SizeOut;		/* Number of bytes written */
+};
+
+/****************************************************************************/
+
+/* Pack the disk image file, one track at a time. The track index is
+ * written last, once the sizes of all the tracks are known.
+ */
+static LONG
+pack_disk_image(struct pack_context * pc)
+{
+	struct PackedImageHeader pih;
+	LONG index_size = sizeof(pc->pc_Index);
+	LONG offset, size;
+	const UBYTE * data;
+	LONG error;
+	int track;
+
+	memset(&pih, 0, sizeof(pih));
+
+	pih.pih_Signature	= PACKED_IMAGE_SIGNATURE;
+	pih.pih_Version		= PACKED_IMAGE_VERSION;
+	pih.pih_NumTracks	= NUM_TRACKS;
+	pih.pih_TrackSize	= pc->pc_TrackSize;
+
+	memset(pc->pc_Index, 0, sizeof(pc->pc_Index));
+
+	if(Write(pc->pc_To, &pih, sizeof(pih)) != sizeof(pih) ||
+	   Write(pc->pc_To, pc->pc_Index, index_size) != index_size)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	offset = sizeof(pih) + index_size;
+
+	for(track = 0 ; track < NUM_TRACKS ; track++)
+	{
+		if(CheckSignal(SIGBREAKF_CTRL_C))
+		{
+			error = ERROR_BREAK;
+			goto out;
+		}
+
+		if(Read(pc->pc_From, pc->pc_Track, pc->pc_TrackSize) != pc->pc_TrackSize)
+		{
+			error = IoErr();
+			if(error == OK)
+				error = ERROR_SEEK_ERROR;
+
+			goto out;
+		}
+
+		pc->pc_SizeIn += pc->pc_TrackSize;
+
+		/* Nothing needs to be stored for an empty track. Tracks
+		 * which do not become smaller are stored as they are.
+		 */
+		if(track_is_empty(pc->pc_Track, pc->pc_TrackSize))
+		{
+			pc->pc_NumEmpty++;
+
+			data = NULL;
+			size = 0;
+		}
+		else
+		{
+			size = pack_track(pc->pc_Track, pc->pc_TrackSize, pc->pc_Packed, pc->pc_TrackSize - 1, pc->pc_HashTable);
+			if(size < 0)
+			{
+				pc->pc_NumStored++;
+
+				data = pc->pc_Track;
+				size = pc->pc_TrackSize;
+			}
+			else
+			{
+				pc->pc_NumPacked++;
+
+				data = pc->pc_Packed;
+			}
+		}
+
+		pc->pc_Index[track].pit_Offset	= (size > 0) ? offset : 0;
+		pc->pc_Index[track].pit_Size	= size;
+
+		if(size > 0)
+		{
+			if(Write(pc->pc_To, (APTR)data, size) != size)
+			{
+				error = IoErr();
+				goto out;
+			}
+
+			offset += size;
+		}
+	}
+
+	/* Now for the complete track index. */
+	if(Seek(pc->pc_To, sizeof(pih), OFFSET_BEGINNING) == -1 ||
+	   Write(pc->pc_To, pc->pc_Index, index_size) != index_size)
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	pc->pc_SizeOut = offset;
+
+	error = OK;
+
+ out:
+
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Unpack a packed disk image file, one track at a time. */
+static LONG
+unpack_disk_image(struct pack_context * pc)
+{
+	struct PackedImageHeader pih;
+	LONG index_size = sizeof(pc->pc_Index);
+	const struct PackedImageTrack * pit;
+	LONG size;
+	LONG error;
+	int track;
+
+	if(Read(pc->pc_From, &pih, sizeof(pih)) != sizeof(pih) ||
+	   pih.pih_Signature != PACKED_IMAGE_SIGNATURE ||
+	   pih.pih_Version != PACKED_IMAGE_VERSION ||
+	   pih.pih_NumTracks != NUM_TRACKS ||
+	   (pih.pih_TrackSize != NUMSECS * TD_SECTOR && pih.pih_TrackSize != 2 * NUMSECS * TD_SECTOR))
+	{
+		error = ERROR_OBJECT_WRONG_TYPE;
+		goto out;
+	}
+
+	pc->pc_TrackSize = pih.pih_TrackSize;
+
+	if(Read(pc->pc_From, pc->pc_Index, index_size) != index_size)
+	{
+		error = ERROR_OBJECT_WRONG_TYPE;
+		goto out;
+	}
+
+	pc->pc_SizeIn = sizeof(pih) + index_size;
+
+	for(track = 0 ; track < NUM_TRACKS ; track++)
+	{
+		if(CheckSignal(SIGBREAKF_CTRL_C))
+		{
+			error = ERROR_BREAK;
+			goto out;
+		}
+
+		pit = &pc->pc_Index[track];
+
+		size = pit->pit_Size;
+
+		if(size > pc->pc_TrackSize)
+		{
+			error = ERROR_OBJECT_WRONG_TYPE;
+			goto out;
+		}
+
+		if(size == 0)
+		{
+			pc->pc_NumEmpty++;
+
+			memset(pc->pc_Track, 0, pc->pc_TrackSize);
+		}
+		else
+		{
+			if(Seek(pc->pc_From, pit->pit_Offset, OFFSET_BEGINNING) == -1 ||
+			   Read(pc->pc_From, (size == pc->pc_TrackSize) ? pc->pc_Track : pc->pc_Packed, size) != size)
+			{
+				error = IoErr();
+				if(error == OK)
+					error = ERROR_SEEK_ERROR;
+
+				goto out;
+			}
+
+			pc->pc_SizeIn += size;
+
+			if(size == pc->pc_TrackSize)
+			{
+				pc->pc_NumStored++;
+			}
+			else
+			{
+				pc->pc_NumPacked++;
+
+				if(NOT unpack_track(pc->pc_Packed, size, pc->pc_Track, pc->pc_TrackSize))
+				{
+					error = ERROR_OBJECT_WRONG_TYPE;
+					goto out;
+				}
+			}
+		}
+
+		if(Write(pc->pc_To, pc->pc_Track, pc->pc_TrackSize) != pc->pc_TrackSize)
+		{
+			error = IoErr();
+			goto out;
+		}
+
+		pc->pc_SizeOut += pc->pc_TrackSize;
+	}
+
+	error = OK;
+
+ out:
+
+	return(error);
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	struct
+	{
+		STRPTR	From;
+		STRPTR	To;
+		LONG	Unpack;
+		LONG	Quiet;
+	} args;
+
+	const LONG size_dd_disk = TD_SECTOR *     NUMSECS * NUM_TRACKS;
+	const LONG size_hd_disk = TD_SECTOR * 2 * NUMSECS * NUM_TRACKS;
+
+	D_S(struct FileInfoBlock, fib);
+	struct pack_context * pc = NULL;
+	struct RDArgs * rda = NULL;
+	int result = RETURN_ERROR;
+	BOOL delete_to = FALSE;
+	LONG error;
+
+	/* Kickstart 2.04 or higher required. */
+	if(SysBase->lib_Version < 37)
+	{
+		result = RETURN_FAIL;
+		goto out;
+	}
+
+	memset(&args, 0, sizeof(args));
+
+	rda = ReadArgs("FROM/A,TO/A,UNPACK/S,QUIET/S", (LONG *)&args, NULL);
+	if(rda == NULL)
+	{
+		PrintFault(IoErr(), "DAPack");
+		goto out;
+	}
+
+	pc = AllocVec(sizeof(*pc), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	if(pc != NULL)
+	{
+		pc->pc_Track		= AllocVec(2 * NUMSECS * TD_SECTOR, MEMF_ANY|MEMF_PUBLIC);
+		pc->pc_Packed		= AllocVec(2 * NUMSECS * TD_SECTOR, MEMF_ANY|MEMF_PUBLIC);
+		pc->pc_HashTable	= AllocVec(sizeof(*pc->pc_HashTable) * PACK_HASH_TABLE_SIZE, MEMF_ANY);
+	}
+
+	if(pc == NULL || pc->pc_Track == NULL || pc->pc_Packed == NULL || pc->pc_HashTable == NULL)
+	{
+		PrintFault(ERROR_NO_FREE_STORE, "DAPack");
+		goto out;
+	}
+
+	pc->pc_From = Open(args.From, MODE_OLDFILE);
+	if(pc->pc_From == ZERO)
+	{
+		PrintFault(IoErr(), args.From);
+		goto out;
+	}
+
+	if(NOT args.Unpack)
+	{
+		if(CANNOT ExamineFH(pc->pc_From, fib))
+		{
+			PrintFault(IoErr(), args.From);
+			goto out;
+		}
+
+		if(fib->fib_Size != size_dd_disk && fib->fib_Size != size_hd_disk)
+		{
+			Printf("%s: not a double density or high density disk image file\n", args.From);
+			goto out;
+		}
+
+		pc->pc_TrackSize = fib->fib_Size / NUM_TRACKS;
+	}
+
+	pc->pc_To = Open(args.To, MODE_NEWFILE);
+	if(pc->pc_To == ZERO)
+	{
+		PrintFault(IoErr(), args.To);
+		goto out;
+	}
+
+	delete_to = TRUE;
+
+	if(args.Unpack)
+		error = unpack_disk_image(pc);
+	else
+		error = pack_disk_image(pc);
+
+	if(error != OK)
+	{
+		PrintFault(error, args.From);
+		goto out;
+	}
+
+	delete_to = FALSE;
+
+	if(NOT args.Quiet)
+	{
+		LONG percent = 0;
+
+		if(pc->pc_SizeIn > 0)
+			percent = (pc->pc_SizeOut / 16) * 100 / (pc->pc_SizeIn / 16);
+
+		Printf("%s: %ld tracks packed, %ld stored, %ld empty; %ld -> %ld bytes (%ld%%)\n",
+			args.To, pc->pc_NumPacked, pc->pc_NumStored, pc->pc_NumEmpty,
+			pc->pc_SizeIn, pc->pc_SizeOut, percent);
+	}
+
+	result = RETURN_OK;
+
+ out:
+
+	if(pc != NULL)
+	{
+		if(pc->pc_From != ZERO)
+			Close(pc->pc_From);
+
+		if(pc->pc_To != ZERO)
+		{
+			Close(pc->pc_To);
+
+			/* Don't leave an incomplete file behind. */
+			if(delete_to)
+				DeleteFile(args.To);
+		}
+
+		FreeVec(pc->pc_HashTable);
+		FreeVec(pc->pc_Packed);
+		FreeVec(pc->pc_Track);
+		FreeVec(pc);
+	}
+
+	if(rda != NULL)
+		FreeArgs(rda);
+
+	return(result);
+}
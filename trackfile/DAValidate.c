@@ -0,0 +1,835 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * This is a shell command which checks the structural integrity of Amiga
+ * disk image files without having to mount them first. It performs the
+ * same boot block and root directory checks which trackfile.device uses
+ * when a disk image file is inserted, followed by a check of the
+ * directory hash chains, the file header, extension and data blocks,
+ * and finally the block allocation bitmap.
+ *
+ * Each disk image file is read in one single piece and then validated
+ * from memory, in one single pass over the directory tree.
+ *
+ * Usage: DAValidate FILES/A/M,ALL/S,REPORT/K,QUIET/S
+ *
+ * The REPORT option writes a machine-readable report to the named file,
+ * one line for each problem found and one summary line for each disk
+ * image file. All fields are separated by tab characters:
+ *
+ *    <path> PROBLEM <block number> <description>
+ *    <path> RESULT <OK|FAIL|NDOS> <number of problems> <DOS type>
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "tools.h"
+
+/****************************************************************************/
+
+#include <stdarg.h>
+#include <string.h>
+
+/****************************************************************************/
+
+extern struct Library * SysBase;
+extern struct Library * DOSBase;
+
+/****************************************************************************/
+
+/* Number of 32 bit words in a 512 byte block. */
+#define BLOCK_LONGS (TD_SECTOR / sizeof(ULONG))
+
+/* Size of the directory hash table in a 512 byte block. */
+#define HASH_TABLE_SIZE (BLOCK_LONGS - 56)
+
+/* Number of data bytes stored in an OFS data block. */
+#define OFS_DATA_SIZE (TD_SECTOR - 6 * sizeof(ULONG))
+
+/* Number of data bitmap bits stored in a bitmap block. */
+#define BITMAP_BITS_PER_BLOCK ((BLOCK_LONGS - 1) * 32)
+
+/* Positions of the header block fields which are counted from the end
+ * of the block rather than from the beginning.
+ */
+#define BLOCK_BYTE_SIZE(b)		((b)[BLOCK_LONGS - 47])
+#define BLOCK_NAME(b)			((const TEXT *)&(b)[BLOCK_LONGS - 20])
+#define BLOCK_HASH_CHAIN(b)		((b)[BLOCK_LONGS - 4])
+#define BLOCK_PARENT(b)			((b)[BLOCK_LONGS - 3])
+#define BLOCK_EXTENSION(b)		((b)[BLOCK_LONGS - 2])
+#define BLOCK_SECONDARY_TYPE(b)	((LONG)(b)[BLOCK_LONGS - 1])
+
+/* Primary block types, in addition to T_SHORT. */
+#define T_DATA		8	/* OFS data block */
+#define T_LIST		16	/* File extension block */
+#define T_DIRLIST	33	/* Directory cache block (DCFS) */
+
+/****************************************************************************/
+
+/* Everything we need to know while checking a single disk image file. */
+struct validation_context
+{
+	const ULONG *	vc_Image;			/* Disk image file contents */
+	LONG			vc_NumBlocks;		/* Number of 512 byte blocks */
+	ULONG			vc_RootBlock;		/* Root directory block number */
+	UBYTE *			vc_Used;			/* One bit per block, set if in use */
+	ULONG *			vc_Directories;		/* Directories still to be checked */
+	LONG			vc_NumDirectories;
+	ULONG			vc_DosType;			/* 'DOS\0' and friends */
+	BOOL			vc_FastFileSystem;	/* Data blocks carry no header */
+	BOOL			vc_International;	/* Name hashing is case-insensitive for ISO 8859-1 */
+	BOOL			vc_DirectoryCache;	/* Directories have a directory cache */
+	STRPTR			vc_Path;			/* Name of the disk image file */
+	BPTR			vc_Report;			/* Machine-readable report, if any */
+	BOOL			vc_Quiet;
+	LONG			vc_NumProblems;
+};
+
+/****************************************************************************/
+
+/* Print a problem report for the disk image file currently being checked
+ * and also add it to the machine-readable report, if requested.
+ */
+static void
+report_problem(struct validation_context * vc, LONG block, const char * fmt, ...)
+{
+	va_list args;
+
+	vc->vc_NumProblems++;
+
+	if(NOT vc->vc_Quiet)
+	{
+		Printf("%s: ", vc->vc_Path);
+
+		if(block >= 0)
+			Printf("block %ld: ", block);
+
+		va_start(args, fmt);
+		VPrintf((STRPTR)fmt, (LONG *)args);
+		va_end(args);
+
+		Printf("\n");
+	}
+
+	if(vc->vc_Report != ZERO)
+	{
+		FPrintf(vc->vc_Report, "%s\tPROBLEM\t%ld\t", vc->vc_Path, block);
+
+		va_start(args, fmt);
+		VFPrintf(vc->vc_Report, (STRPTR)fmt, (LONG *)args);
+		va_end(args);
+
+		FPrintf(vc->vc_Report, "\n");
+	}
+}
+
+/****************************************************************************/
+
+static const ULONG *
+get_block(const struct validation_context * vc, ULONG block)
+{
+	return(&vc->vc_Image[block * BLOCK_LONGS]);
+}
+
+/****************************************************************************/
+
+/* Check if a block number refers to a block which the file system may
+ * use. The two boot blocks at the beginning of the disk are off limits.
+ */
+static BOOL
+block_is_valid(const struct validation_context * vc, ULONG block)
+{
+	return((BOOL)(BOOTSECTS <= block && block < (ULONG)vc->vc_NumBlocks));
+}
+
+/****************************************************************************/
+
+/* Mark a block as being in use. Returns FALSE if the block was already
+ * in use, which means that it is cross-linked.
+ */
+static BOOL
+mark_block_used(struct validation_context * vc, ULONG block)
+{
+	UBYTE mask = 1 << (block % 8);
+
+	if(vc->vc_Used[block / 8] & mask)
+	{
+		report_problem(vc, block, "block is used more than once");
+		return(FALSE);
+	}
+
+	vc->vc_Used[block / 8] |= mask;
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Check if a block is a valid header or list block of the expected
+ * primary type, with the correct checksum and block number.
+ */
+static BOOL
+header_block_is_valid(struct validation_context * vc, ULONG block, ULONG primary_type)
+{
+	const ULONG * data;
+
+	if(NOT block_is_valid(vc, block))
+	{
+		report_problem(vc, block, "block number is out of range");
+		return(FALSE);
+	}
+
+	data = get_block(vc, block);
+
+	if(calculate_amiga_block_checksum(data, TD_SECTOR) != 0)
+	{
+		report_problem(vc, block, "block checksum is invalid");
+		return(FALSE);
+	}
+
+	if(data[0] != primary_type)
+	{
+		report_problem(vc, block, "block type is %ld, should be %ld", data[0], primary_type);
+		return(FALSE);
+	}
+
+	if(data[1] != block)
+	{
+		report_problem(vc, block, "block claims to be block %ld", data[1]);
+		return(FALSE);
+	}
+
+	return(mark_block_used(vc, block));
+}
+
+/****************************************************************************/
+
+/* This is how the file system hashes the names of directory entries. The
+ * "international" mode also treats the ISO 8859-1 accented characters as
+ * case-insensitive.
+ */
+static ULONG
+hash_name(const struct validation_context * vc, const TEXT * name, int len)
+{
+	ULONG hash = len;
+	TEXT c;
+	int i;
+
+	for(i = 0 ; i < len ; i++)
+	{
+		c = name[i];
+
+		if(('a' <= c && c <= 'z') || (vc->vc_International && 0xE0 <= c && c <= 0xFE && c != 0xF7))
+			c -= 'a' - 'A';
+
+		hash = (hash * 13 + c) & 0x7FF;
+	}
+
+	return(hash % HASH_TABLE_SIZE);
+}
+
+/****************************************************************************/
+
+/* Follow the chain of directory cache blocks which belongs to a
+ * directory (DCFS only).
+ */
+static void
+check_directory_cache(struct validation_context * vc, ULONG directory_block)
+{
+	const ULONG * data;
+	ULONG block;
+	LONG count = 0;
+
+	for(block = BLOCK_EXTENSION(get_block(vc, directory_block)) ;
+	    block != 0 ;
+	    block = data[4])
+	{
+		if(NOT header_block_is_valid(vc, block, T_DIRLIST))
+			break;
+
+		data = get_block(vc, block);
+
+		if(data[2] != directory_block)
+		{
+			report_problem(vc, block, "directory cache block belongs to directory %ld, should be %ld",
+				data[2], directory_block);
+
+			break;
+		}
+
+		/* This catches chains which loop back on themselves. */
+		if(++count > vc->vc_NumBlocks)
+			break;
+	}
+}
+
+/****************************************************************************/
+
+/* Check the data blocks which belong to a file, by following the file
+ * header and its chain of extension blocks.
+ */
+static void
+check_file_data(struct validation_context * vc, ULONG header_block)
+{
+	const ULONG * header = get_block(vc, header_block);
+	const ULONG * list = header;
+	ULONG byte_size = BLOCK_BYTE_SIZE(header);
+	ULONG bytes_per_block = vc->vc_FastFileSystem ? TD_SECTOR : OFS_DATA_SIZE;
+	ULONG num_blocks_expected = (byte_size + bytes_per_block - 1) / bytes_per_block;
+	ULONG num_blocks_found = 0;
+	ULONG list_block = header_block;
+	const ULONG * data;
+	ULONG high_seq;
+	ULONG block;
+	ULONG i;
+
+	while(TRUE)
+	{
+		high_seq = list[2];
+		if(high_seq > HASH_TABLE_SIZE)
+		{
+			report_problem(vc, list_block, "data block table claims to hold %ld entries", high_seq);
+			return;
+		}
+
+		/* The data block table is filled from the end
+		 * towards the beginning.
+		 */
+		for(i = 0 ; i < high_seq ; i++)
+		{
+			block = list[6 + HASH_TABLE_SIZE - 1 - i];
+
+			num_blocks_found++;
+
+			if(NOT block_is_valid(vc, block))
+			{
+				report_problem(vc, list_block, "data block number %ld is out of range", block);
+				return;
+			}
+
+			if(NOT mark_block_used(vc, block))
+				return;
+
+			/* OFS data blocks carry a header and a checksum. */
+			if(NOT vc->vc_FastFileSystem)
+			{
+				data = get_block(vc, block);
+
+				if(calculate_amiga_block_checksum(data, TD_SECTOR) != 0)
+					report_problem(vc, block, "data block checksum is invalid");
+				else if (data[0] != T_DATA)
+					report_problem(vc, block, "data block type is %ld, should be %ld", data[0], T_DATA);
+				else if (data[1] != header_block)
+					report_problem(vc, block, "data block belongs to file %ld, should be %ld", data[1], header_block);
+				else if (data[2] != num_blocks_found)
+					report_problem(vc, block, "data block sequence number is %ld, should be %ld", data[2], num_blocks_found);
+			}
+		}
+
+		list_block = BLOCK_EXTENSION(list);
+		if(list_block == 0)
+			break;
+
+		if(NOT header_block_is_valid(vc, list_block, T_LIST))
+			return;
+
+		list = get_block(vc, list_block);
+
+		if(BLOCK_PARENT(list) != header_block)
+		{
+			report_problem(vc, list_block, "extension block belongs to file %ld, should be %ld",
+				BLOCK_PARENT(list), header_block);
+
+			return;
+		}
+	}
+
+	if(num_blocks_found != num_blocks_expected)
+	{
+		report_problem(vc, header_block, "file size %ld requires %ld data blocks, but %ld were found",
+			byte_size, num_blocks_expected, num_blocks_found);
+	}
+}
+
+/****************************************************************************/
+
+/* Check all the entries of a directory, following the hash chains. Any
+ * directories found are added to the list of directories to check next.
+ */
+static void
+check_directory(struct validation_context * vc, ULONG directory_block)
+{
+	const ULONG * directory = get_block(vc, directory_block);
+	const ULONG * entry;
+	const TEXT * name;
+	ULONG block;
+	LONG secondary_type;
+	LONG count;
+	int len;
+	int i;
+
+	if(vc->vc_DirectoryCache)
+		check_directory_cache(vc, directory_block);
+
+	for(i = 0 ; i < HASH_TABLE_SIZE ; i++)
+	{
+		count = 0;
+
+		for(block = directory[6 + i] ; block != 0 ; block = BLOCK_HASH_CHAIN(entry))
+		{
+			if(NOT header_block_is_valid(vc, block, T_SHORT))
+				break;
+
+			entry = get_block(vc, block);
+
+			if(BLOCK_PARENT(entry) != directory_block)
+			{
+				report_problem(vc, block, "entry belongs to directory %ld, should be %ld",
+					BLOCK_PARENT(entry), directory_block);
+			}
+
+			name = BLOCK_NAME(entry);
+			len = name[0];
+
+			if(len == 0 || len > 30)
+				report_problem(vc, block, "name length %ld is invalid", len);
+			else if (hash_name(vc, &name[1], len) != (ULONG)i)
+				report_problem(vc, block, "entry is on hash chain %ld, should be on %ld", i, hash_name(vc, &name[1], len));
+
+			secondary_type = BLOCK_SECONDARY_TYPE(entry);
+
+			switch(secondary_type)
+			{
+				case ST_USERDIR:
+
+					vc->vc_Directories[vc->vc_NumDirectories++] = block;
+					break;
+
+				case ST_FILE:
+
+					check_file_data(vc, block);
+					break;
+
+				case ST_SOFTLINK:
+				case ST_LINKDIR:
+				case ST_LINKFILE:
+
+					break;
+
+				default:
+
+					report_problem(vc, block, "entry type %ld is unknown", secondary_type);
+					break;
+			}
+
+			/* This catches hash chains which loop back on themselves;
+			 * the cross-link check should have caught it already.
+			 */
+			if(++count > vc->vc_NumBlocks)
+				break;
+		}
+	}
+}
+
+/****************************************************************************/
+
+/* Compare the block allocation bitmap against the blocks which were
+ * found to be in use. Blocks which are in use but marked as free are
+ * reported individually because the file system may hand them out
+ * again. Blocks which are marked as used but are not in use are just
+ * counted.
+ */
+static void
+check_bitmap(struct validation_context * vc, const struct RootDirBlock * rdb)
+{
+	LONG num_bitmap_blocks = (vc->vc_NumBlocks - BOOTSECTS + BITMAP_BITS_PER_BLOCK - 1) / BITMAP_BITS_PER_BLOCK;
+	LONG num_lost = 0;
+	const ULONG * bitmap;
+	ULONG block;
+	ULONG bit;
+	BOOL is_free;
+	BOOL is_used;
+	LONG i;
+
+	if(rdb->rdb_BitMapFlag != DOSTRUE)
+		report_problem(vc, vc->vc_RootBlock, "block allocation bitmap is marked as invalid");
+
+	/* The bitmap blocks count as being in use. */
+	for(i = 0 ; i < num_bitmap_blocks ; i++)
+	{
+		block = rdb->rdb_BitMapBlocks[i];
+
+		if(NOT block_is_valid(vc, block))
+		{
+			report_problem(vc, vc->vc_RootBlock, "bitmap block number %ld is out of range", block);
+			return;
+		}
+
+		if(calculate_amiga_block_checksum(get_block(vc, block), TD_SECTOR) != 0)
+		{
+			report_problem(vc, block, "bitmap block checksum is invalid");
+			return;
+		}
+
+		if(NOT mark_block_used(vc, block))
+			return;
+	}
+
+	/* The first bitmap bit stands for the first block following
+	 * the boot blocks. A bit which is set stands for a block
+	 * which is available for use.
+	 */
+	for(block = BOOTSECTS ; block < (ULONG)vc->vc_NumBlocks ; block++)
+	{
+		bit = block - BOOTSECTS;
+
+		bitmap = get_block(vc, rdb->rdb_BitMapBlocks[bit / BITMAP_BITS_PER_BLOCK]);
+
+		bit %= BITMAP_BITS_PER_BLOCK;
+
+		is_free = (BOOL)((bitmap[1 + bit / 32] & (1UL << (bit % 32))) != 0);
+		is_used = (BOOL)((vc->vc_Used[block / 8] & (1 << (block % 8))) != 0);
+
+		if(is_used && is_free)
+			report_problem(vc, block, "block is in use but marked as free in the bitmap");
+		else if (NOT is_used && NOT is_free)
+			num_lost++;
+	}
+
+	if(num_lost > 0)
+		report_problem(vc, -1, "%ld blocks are marked as used in the bitmap but are not in use", num_lost);
+}
+
+/****************************************************************************/
+
+/* Check a single disk image file, which must have been read into
+ * memory in its entirety. Returns FALSE if the disk image file
+ * does not contain an AmigaDOS file system.
+ */
+static BOOL
+validate_disk_image(struct validation_context * vc)
+{
+	const struct RootDirBlock * rdb;
+
+	/* The boot block comes first. */
+	vc->vc_DosType = vc->vc_Image[0];
+
+	if((vc->vc_DosType & 0xFFFFFF00) != ID_DOS_DISK || (vc->vc_DosType & 0xFF) > 7)
+		return(FALSE);
+
+	vc->vc_FastFileSystem	= (BOOL)((vc->vc_DosType & 1) != 0);
+	vc->vc_International	= (BOOL)((vc->vc_DosType & 0xFF) >= 2);
+	vc->vc_DirectoryCache	= (BOOL)((vc->vc_DosType & 0xFF) == 4 || (vc->vc_DosType & 0xFF) == 5);
+
+	if(calculate_boot_block_checksum(vc->vc_Image, BOOTSECTS * TD_SECTOR) != 0xFFFFFFFF)
+		report_problem(vc, 0, "boot block checksum is invalid");
+
+	/* Then the root directory, which sits in the middle of the disk. */
+	rdb = (const struct RootDirBlock *)get_block(vc, vc->vc_RootBlock);
+
+	if(NOT root_directory_is_valid(rdb))
+	{
+		report_problem(vc, vc->vc_RootBlock, "root directory is invalid");
+		return(TRUE);
+	}
+
+	mark_block_used(vc, vc->vc_RootBlock);
+
+	/* Check the directory tree, one directory at a time. Each
+	 * directory can be encountered only once because a block
+	 * cannot be marked as being in use more than once. This
+	 * means that the list cannot hold more entries than there
+	 * are blocks on the disk.
+	 */
+	vc->vc_Directories[0] = vc->vc_RootBlock;
+	vc->vc_NumDirectories = 1;
+
+	while(vc->vc_NumDirectories > 0)
+		check_directory(vc, vc->vc_Directories[--vc->vc_NumDirectories]);
+
+	check_bitmap(vc, rdb);
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	struct
+	{
+		STRPTR *	Files;
+		LONG		All;
+		STRPTR		Report;
+		LONG		Quiet;
+	} args;
+
+	/* Both 3.5" double density and high density disks
+	 * are supported.
+	 */
+	const LONG size_dd_disk = TD_SECTOR *     NUMSECS * NUMHEADS * NUMCYLS;
+	const LONG size_hd_disk = TD_SECTOR * 2 * NUMSECS * NUMHEADS * NUMCYLS;
+	const LONG max_blocks = size_hd_disk / TD_SECTOR;
+
+	struct validation_context vc;
+	struct AnchorPath * ap = NULL;
+	struct RDArgs * rda = NULL;
+	BOOL matched = FALSE;
+	int result = RETURN_ERROR;
+	BPTR file_handle = ZERO;
+	ULONG * disk_data = NULL;
+	LONG num_files = 0;
+	LONG num_failed = 0;
+	LONG num_bytes_read;
+	STRPTR * files;
+	STRPTR file_name;
+	STRPTR status;
+	TEXT dos_type[8];
+	BOOL is_dos_disk;
+	BPTR old_dir;
+	LONG error;
+	int i;
+
+	memset(&vc, 0, sizeof(vc));
+
+	/* Kickstart 2.04 or higher required. */
+	if(SysBase->lib_Version < 37)
+	{
+		result = RETURN_FAIL;
+		goto out;
+	}
+
+	disk_data			= AllocVec(size_hd_disk, MEMF_ANY|MEMF_PUBLIC);
+	vc.vc_Used			= AllocVec((max_blocks + 7) / 8, MEMF_ANY);
+	vc.vc_Directories	= AllocVec(sizeof(*vc.vc_Directories) * max_blocks, MEMF_ANY);
+
+	ap = AllocVec(sizeof(*ap) + MAX_PATH_SIZE, MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+
+	if(disk_data == NULL || vc.vc_Used == NULL || vc.vc_Directories == NULL || ap == NULL)
+	{
+		PrintFault(ERROR_NO_FREE_STORE, "DAValidate");
+		goto out;
+	}
+
+	memset(&args, 0, sizeof(args));
+
+	rda = ReadArgs("FILES/A/M,ALL/S,REPORT/K,QUIET/S", (LONG *)&args, NULL);
+	if(rda == NULL)
+	{
+		PrintFault(IoErr(), "DAValidate");
+		goto out;
+	}
+
+	vc.vc_Quiet = (BOOL)(args.Quiet != 0);
+
+	if(args.Report != NULL)
+	{
+		vc.vc_Report = Open(args.Report, MODE_NEWFILE);
+		if(vc.vc_Report == ZERO)
+		{
+			PrintFault(IoErr(), args.Report);
+			goto out;
+		}
+	}
+
+	files = args.Files;
+
+	while((file_name = (*files++)) != NULL)
+	{
+		memset(ap, 0, sizeof(*ap));
+
+		ap->ap_Strlen		= MAX_PATH_SIZE;
+		ap->ap_BreakBits	= SIGBREAKF_CTRL_C;
+
+		for(error = MatchFirst(file_name, ap), matched = TRUE ;
+		    error == OK ;
+		    error = MatchNext(ap))
+		{
+			/* Enter directories only if asked to. */
+			if(ap->ap_Info.fib_DirEntryType >= 0)
+			{
+				if(args.All)
+				{
+					if(FLAG_IS_SET(ap->ap_Flags, APF_DIDDIR))
+						CLEAR_FLAG(ap->ap_Flags, APF_DIDDIR);
+					else
+						SET_FLAG(ap->ap_Flags, APF_DODIR);
+				}
+
+				continue;
+			}
+
+			if(ap->ap_Info.fib_DirEntryType == ST_SOFTLINK)
+				continue;
+
+			/* Only 3.5" double density and high density disk image
+			 * files are considered.
+			 */
+			if(ap->ap_Info.fib_Size != size_dd_disk &&
+			   ap->ap_Info.fib_Size != size_hd_disk)
+			{
+				continue;
+			}
+
+			old_dir = CurrentDir(ap->ap_Current->an_Lock);
+
+			file_handle = Open(ap->ap_Info.fib_FileName, MODE_OLDFILE);
+			error = IoErr();
+
+			CurrentDir(old_dir);
+
+			if(file_handle == ZERO)
+			{
+				PrintFault(error, ap->ap_Buf);
+				goto out;
+			}
+
+			/* Read the entire disk image file in one go. */
+			num_bytes_read = Read(file_handle, disk_data, ap->ap_Info.fib_Size);
+			error = IoErr();
+
+			Close(file_handle);
+			file_handle = ZERO;
+
+			if(num_bytes_read == -1)
+			{
+				PrintFault(error, ap->ap_Buf);
+				goto out;
+			}
+
+			num_files++;
+
+			vc.vc_Image			= disk_data;
+			vc.vc_NumBlocks		= ap->ap_Info.fib_Size / TD_SECTOR;
+			vc.vc_RootBlock		= vc.vc_NumBlocks / 2;
+			vc.vc_Path			= ap->ap_Buf;
+			vc.vc_NumProblems	= 0;
+
+			memset(vc.vc_Used, 0, (vc.vc_NumBlocks + 7) / 8);
+
+			if(num_bytes_read != ap->ap_Info.fib_Size)
+			{
+				report_problem(&vc, -1, "file was truncated (expected %ld bytes, read only %ld)",
+					ap->ap_Info.fib_Size, num_bytes_read);
+
+				is_dos_disk = TRUE;
+			}
+			else
+			{
+				is_dos_disk = validate_disk_image(&vc);
+			}
+
+			if(NOT is_dos_disk)
+				status = "NDOS";
+			else if (vc.vc_NumProblems > 0)
+				status = "FAIL";
+			else
+				status = "OK";
+
+			if(vc.vc_NumProblems > 0)
+				num_failed++;
+
+			/* Show the DOS type as text, e.g. "DOS\1". */
+			for(i = 0 ; i < 3 ; i++)
+			{
+				dos_type[i] = (vc.vc_DosType >> (24 - 8 * i)) & 0xFF;
+				if(dos_type[i] < ' ' || (128 <= dos_type[i] && dos_type[i] < 160))
+					dos_type[i] = '?';
+			}
+
+			dos_type[3] = '\\';
+			dos_type[4] = '0' + (vc.vc_DosType & 7);
+			dos_type[5] = '\0';
+
+			if(NOT vc.vc_Quiet || vc.vc_NumProblems > 0)
+				Printf("%s: %s (%s, %ld problems)\n", ap->ap_Buf, status, dos_type, vc.vc_NumProblems);
+
+			if(vc.vc_Report != ZERO)
+				FPrintf(vc.vc_Report, "%s\tRESULT\t%s\t%ld\t%s\n", ap->ap_Buf, status, vc.vc_NumProblems, dos_type);
+		}
+
+		if(error != OK && error != ERROR_NO_MORE_ENTRIES)
+		{
+			PrintFault(error, "DAValidate");
+			goto out;
+		}
+
+		MatchEnd(ap);
+		matched = FALSE;
+	}
+
+	if(NOT vc.vc_Quiet)
+		Printf("%ld files checked, %ld with problems\n", num_files, num_failed);
+
+	result = (num_failed > 0) ? RETURN_WARN : RETURN_OK;
+
+ out:
+
+	if(file_handle != ZERO)
+		Close(file_handle);
+
+	if(vc.vc_Report != ZERO)
+		Close(vc.vc_Report);
+
+	if(ap != NULL)
+	{
+		if(matched)
+			MatchEnd(ap);
+
+		FreeVec(ap);
+	}
+
+	if(vc.vc_Directories != NULL)
+		FreeVec(vc.vc_Directories);
+
+	if(vc.vc_Used != NULL)
+		FreeVec(vc.vc_Used);
+
+	if(disk_data != NULL)
+		FreeVec(disk_data);
+
+	if(rda != NULL)
+		FreeArgs(rda);
+
+	return(result);
+}
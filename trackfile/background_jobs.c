@@ -0,0 +1,440 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+#include "unit.h"
+#include "commands.h"
+#include "functions.h"
+#include "cache.h"
+#include "background_jobs.h"
+
+/****************************************************************************/
+
+/* Each unit Process performs a small number of background jobs while it
+ * has no I/O requests or control messages to attend to. A job is given
+ * a time slice and has to yield as soon as that slice is used up, or as
+ * soon as there is more important work for the unit Process to do.
+ * Jobs which could not finish their work in one slice remain scheduled
+ * and will receive another slice later. In between, the unit Process
+ * waits for at least as long as the slices took, so that tasks of lower
+ * priority get to run, too.
+ */
+
+/* The shortest pause between time slices, in milliseconds. This is
+ * about as short as a UNIT_VBLANK timer request can be.
+ */
+#define MIN_JOB_PAUSE 20
+
+/****************************************************************************/
+
+/* What a job needs to know about the time slice it was given. */
+struct JobSlice
+{
+	ULONG	js_Start;		/* When the slice began, in milliseconds */
+	ULONG	js_Budget;		/* How long the slice may take, in milliseconds */
+	ULONG	js_WakeMask;	/* Yield if any of these signals are set */
+};
+
+/* Each job returns TRUE if it has finished its work, and FALSE if
+ * it had to yield before that.
+ */
+typedef BOOL (*JOB_FUNCTION)(struct TrackFileUnit * tfu, const struct JobSlice * js);
+
+/****************************************************************************/
+
+/* Check if a job must stop and yield to the unit Process, either because
+ * its time slice is used up, or because there is more important work to
+ * be done. Returns TRUE if so, FALSE otherwise.
+ */
+static BOOL
+job_must_yield(struct TrackFileUnit * tfu, const struct JobSlice * js)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	BOOL must_yield;
+
+	USE_EXEC(tfd);
+
+	must_yield = (BOOL)((SetSignal(0, 0) & js->js_WakeMask) != 0 ||
+	                    get_current_milliseconds(tfu) - js->js_Start >= js->js_Budget);
+
+	return(must_yield);
+}
+
+/****************************************************************************/
+
+/* Write back any changes made to the track buffer and turn off the
+ * motor. This cannot be split into smaller steps.
+ */
+static BOOL
+flush_job(struct TrackFileUnit * tfu, const struct JobSlice * js)
+{
+	LONG error;
+
+	if(tfu->tfu_TrackDataChanged)
+	{
+		SHOWMSG("changes were made to the track buffer; writing it back");
+
+		error = write_back_track_data(tfu);
+		if(error != OK)
+			D(("writing back the track buffer failed (error=%ld)", error));
+	}
+
+	SHOWMSG("turning off the motor");
+
+	turn_off_motor(tfu);
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Update the disk checksum after track checksums have changed, so that
+ * it need not be done when somebody asks for it.
+ */
+static BOOL
+checksum_job(struct TrackFileUnit * tfu, const struct JobSlice * js)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+
+	USE_EXEC(tfd);
+
+	ObtainSemaphore(&tfu->tfu_Lock);
+
+	update_disk_checksum(tfu);
+
+	ReleaseSemaphore(&tfu->tfu_Lock);
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Reclaim the cache entries which were invalidated, a few at a time. */
+static BOOL
+cache_job(struct TrackFileUnit * tfu, const struct JobSlice * js)
+{
+	BOOL finished = TRUE;
+
+	#if defined(ENABLE_CACHE)
+	{
+		struct TrackFileDevice * tfd = tfu->tfu_Device;
+
+		if(tfd->tfd_CacheContext != NULL)
+		{
+			while(sweep_stale_cache_entries(tfd->tfd_CacheContext, NUM_STALE_ENTRIES_PER_SWEEP))
+			{
+				if(job_must_yield(tfu, js))
+				{
+					finished = FALSE;
+					break;
+				}
+			}
+		}
+	}
+	#endif /* ENABLE_CACHE */
+
+	return(finished);
+}
+
+/****************************************************************************/
+
+/* Load the tracks which the client listed when the medium was inserted
+ * into the cache, one track at a time and in the order given. Tracks
+ * which are already in the cache are skipped. The warm-up stops early
+ * if the medium is removed or a track cannot be read.
+ */
+static BOOL
+warmup_job(struct TrackFileUnit * tfu, const struct JobSlice * js)
+{
+	BOOL finished = TRUE;
+
+	#if defined(ENABLE_CACHE)
+	{
+		struct TrackFileDevice * tfd = tfu->tfu_Device;
+		APTR data;
+		LONG error;
+
+		USE_EXEC(tfd);
+
+		if(unit_medium_is_present(tfu) && tfu->tfu_NextWarmupTrack < tfu->tfu_NumWarmupTracks)
+		{
+			data = AllocVec(tfu->tfu_TrackDataSize, MEMF_ANY|MEMF_PUBLIC);
+			if(data != NULL)
+			{
+				while(tfu->tfu_NextWarmupTrack < tfu->tfu_NumWarmupTracks)
+				{
+					error = prefetch_track(tfu, tfu->tfu_WarmupTracks[tfu->tfu_NextWarmupTrack++], data, NULL);
+					if(error != OK)
+					{
+						D(("could not load track into the cache (error=%ld); stopping", error));
+
+						tfu->tfu_NextWarmupTrack = tfu->tfu_NumWarmupTracks;
+						break;
+					}
+
+					if(tfu->tfu_NextWarmupTrack < tfu->tfu_NumWarmupTracks && job_must_yield(tfu, js))
+					{
+						finished = FALSE;
+						break;
+					}
+				}
+
+				FreeVec(data);
+			}
+			else
+			{
+				SHOWMSG("not enough memory to load tracks into the cache");
+			}
+		}
+	}
+	#endif /* ENABLE_CACHE */
+
+	return(finished);
+}
+
+/****************************************************************************/
+
+/* Load the tracks which the track predictor expects to be read next into
+ * the cache, most likely track first. The tracks which had to be read
+ * from the file are remembered, so that it can be told later whether
+ * loading them was worth the effort.
+ */
+static BOOL
+predict_job(struct TrackFileUnit * tfu, const struct JobSlice * js)
+{
+	BOOL finished = TRUE;
+
+	#if defined(ENABLE_CACHE)
+	{
+		struct TrackFileDevice * tfd = tfu->tfu_Device;
+		BOOL loaded;
+		APTR data;
+		LONG which_track;
+		LONG error;
+
+		USE_EXEC(tfd);
+
+		if(unit_medium_is_present(tfu) && tfu->tfu_NextPredictedTrack < tfu->tfu_NumPredictedTracks)
+		{
+			data = AllocVec(tfu->tfu_TrackDataSize, MEMF_ANY|MEMF_PUBLIC);
+			if(data != NULL)
+			{
+				while(tfu->tfu_NextPredictedTrack < tfu->tfu_NumPredictedTracks)
+				{
+					which_track = tfu->tfu_PredictedTracks[tfu->tfu_NextPredictedTrack++];
+
+					error = prefetch_track(tfu, which_track, data, &loaded);
+					if(error != OK)
+					{
+						D(("could not load predicted track %ld (error=%ld)", which_track, error));
+
+						tfu->tfu_NextPredictedTrack = tfu->tfu_NumPredictedTracks;
+						break;
+					}
+
+					if(loaded)
+					{
+						SET_FLAG(tfu->tfu_PrefetchedTracks[which_track / 32], (1UL << (which_track % 32)));
+
+						tfu->tfu_NumTracksPrefetched++;
+					}
+
+					if(tfu->tfu_NextPredictedTrack < tfu->tfu_NumPredictedTracks && job_must_yield(tfu, js))
+					{
+						finished = FALSE;
+						break;
+					}
+				}
+
+				FreeVec(data);
+			}
+			else
+			{
+				SHOWMSG("not enough memory to load predicted tracks into the cache");
+			}
+		}
+	}
+	#endif /* ENABLE_CACHE */
+
+	return(finished);
+}
+
+/****************************************************************************/
+
+/* The jobs, in the order of the TFJOB_Flush, etc. numbers, and the
+ * length of the time slice each job receives, in milliseconds.
+ */
+static const struct
+{
+	JOB_FUNCTION	function;
+	ULONG			budget;
+} unit_jobs[NUM_TFJOBS] =
+{
+	{ flush_job,	100 },	/* TFJOB_Flush */
+	{ checksum_job,	10 },	/* TFJOB_Checksum */
+	{ cache_job,	20 },	/* TFJOB_Cache */
+	{ warmup_job,	50 },	/* TFJOB_Warmup */
+	{ predict_job,	20 },	/* TFJOB_Predict */
+};
+
+/****************************************************************************/
+
+/* Make sure that a job will run when the unit Process is idle the next
+ * time. This must be called by the unit Process only.
+ */
+VOID
+schedule_unit_job(struct TrackFileUnit * tfu, LONG job)
+{
+	ASSERT( 0 <= job && job < NUM_TFJOBS );
+
+	SET_FLAG(tfu->tfu_PendingJobs, 1UL << job);
+}
+
+/****************************************************************************/
+
+/* Give up the CPU for the given number of milliseconds, or until one of
+ * the signals in the wake mask is received. Returns the signals in the
+ * wake mask which were received.
+ */
+static ULONG
+pause_unit_jobs(struct TrackFileUnit * tfu, ULONG wake_mask, ULONG milliseconds)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct timerequest * tr = &tfu->tfu_PauseRequest;
+	ULONG pause_mask = (1UL << tfu->tfu_PausePort.mp_SigBit);
+	ULONG signals_received;
+	ULONG start;
+
+	USE_EXEC(tfd);
+
+	ASSERT( tr->tr_node.io_Message.mn_Node.ln_Type != NT_MESSAGE );
+
+	start = get_current_milliseconds(tfu);
+
+	tr->tr_node.io_Command	= TR_ADDREQUEST;
+	tr->tr_time.tv_secs		= milliseconds / 1000;
+	tr->tr_time.tv_micro	= (milliseconds % 1000) * 1000;
+
+	SetSignal(0, pause_mask);
+
+	SendIO((struct IORequest *)tr);
+
+	signals_received = Wait(wake_mask | pause_mask) & wake_mask;
+
+	if(CheckIO((struct IORequest *)tr) == BUSY)
+		AbortIO((struct IORequest *)tr);
+
+	WaitIO((struct IORequest *)tr);
+
+	tfu->tfu_NumJobPauses++;
+	tfu->tfu_JobPauseTime += get_current_milliseconds(tfu) - start;
+
+	return(signals_received);
+}
+
+/****************************************************************************/
+
+/* Give each scheduled job one time slice, unless one of the signals in
+ * the wake mask is set. This is called by the unit Process when it is
+ * idle, and it returns as soon as the unit Process has other work to do.
+ * If some jobs still have work left, the unit Process then pauses before
+ * it returns. Returns the signals in the wake mask which were received
+ * during that pause.
+ */
+ULONG
+run_unit_jobs(struct TrackFileUnit * tfu, ULONG wake_mask)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct TrackFileJobStatistics * tfjs;
+	struct JobSlice js;
+	ULONG time_used = 0;
+	ULONG slice_time;
+	BOOL finished;
+	LONG job;
+
+	USE_EXEC(tfd);
+
+	for(job = 0 ; job < NUM_TFJOBS ; job++)
+	{
+		if(FLAG_IS_CLEAR(tfu->tfu_PendingJobs, 1UL << job))
+			continue;
+
+		if((SetSignal(0, 0) & wake_mask) != 0)
+			break;
+
+		js.js_Start		= get_current_milliseconds(tfu);
+		js.js_Budget	= unit_jobs[job].budget;
+		js.js_WakeMask	= wake_mask;
+
+		finished = (*unit_jobs[job].function)(tfu, &js);
+
+		tfjs = &tfu->tfu_JobStatistics[job];
+
+		slice_time = get_current_milliseconds(tfu) - js.js_Start;
+
+		tfjs->tfjs_Runs++;
+		tfjs->tfjs_Time += slice_time;
+
+		time_used += slice_time;
+
+		if(finished)
+			CLEAR_FLAG(tfu->tfu_PendingJobs, 1UL << job);
+		else
+			tfjs->tfjs_Deferrals++;
+	}
+
+	/* Jobs which are not finished yet would otherwise run again
+	 * right away. Since the unit Process has a higher priority than
+	 * most tasks, it has to wait before that happens.
+	 */
+	if(tfu->tfu_PendingJobs == 0 || (SetSignal(0, 0) & wake_mask) != 0)
+		return(0);
+
+	if(time_used < MIN_JOB_PAUSE)
+		time_used = MIN_JOB_PAUSE;
+
+	return(pause_unit_jobs(tfu, wake_mask, time_used));
+}
@@ -385,7 +385,7 @@ adjust_protected_cache_size(struct CacheContext * cc)
 		{
 			SHOWMSG("THIS SHOULD NEVER HAPPEN: Found duplicate in protected cache tree");
 
-			RemoveMinNode(&cn->cn_UnitNode);
+			RemoveMinNode(&cn->cn_ImageNode);
 
 			AddHeadMinList(&cc->cc_SpareList, &cn->cn_SplayNode.sn_Node);
 		}
@@ -457,9 +457,13 @@ read_cache_contents(
 	D(("cache read unit %ld/track %ld: data = 0x%08lx, data_size = %ld",
 		tfu->tfu_UnitNumber, track_number, data, data_size));
 
-	if(data_size == cc->cc_DataSize)
+	if(tfu->tfu_CacheImage == NULL)
 	{
-		ULONG key = CACHE_KEY(tfu->tfu_UnitNumber, track_number);
+		D(("unit %ld has no cache image", tfu->tfu_UnitNumber));
+	}
+	else if(data_size == cc->cc_DataSize)
+	{
+		ULONG key = CACHE_KEY(tfu->tfu_CacheImage->ci_ImageNumber, track_number);
 		struct CacheNode * cn;
 
 		/* We try to find an existing cache node with the same
@@ -506,7 +510,7 @@ read_cache_contents(
 				{
 					SHOWMSG("THIS SHOULD NEVER HAPPEN: Found duplicate in probation cache tree");
 
-					RemoveMinNode(&cn->cn_UnitNode);
+					RemoveMinNode(&cn->cn_ImageNode);
 
 					AddHeadMinList(&cc->cc_SpareList, &cn->cn_SplayNode.sn_Node);
 					cn = NULL;
@@ -550,66 +554,63 @@ read_cache_contents(
 
 /****************************************************************************/
 
-/* Translate the address of the CacheNode->cn_UnitNode field into the
+/* Translate the address of the CacheNode->cn_ImageNode field into the
  * address of the CacheNode itself.
  */
 static struct CacheNode *
-cache_node_from_unit_node(const struct MinNode * mn)
+cache_node_from_image_node(const struct MinNode * mn)
 {
 	struct SplayNode * sn;
 
 	sn = (struct SplayNode *)mn;
 
-	ASSERT( offsetof(struct CacheNode, cn_UnitNode) == sizeof(struct SplayNode) );
+	ASSERT( offsetof(struct CacheNode, cn_ImageNode) == sizeof(struct SplayNode) );
 
 	return((struct CacheNode *)&sn[-1]);
 }
 
 /****************************************************************************/
 
-/* Invalidate all cache entries associated with a specific unit number, which
- * is needed when a disk image is ejected. We wouldn't want the old cache
- * entries for that disk to persist until it's reinserted, would we?
+/* Move all the nodes of one list to the end of another list, leaving
+ * the first list empty. This takes the same time regardless of how
+ * many nodes are involved.
  */
-void
-invalidate_cache_entries_for_unit(struct CacheContext * cc, struct TrackFileUnit * tfu)
+static void
+move_min_list_nodes(struct MinList * to, struct MinList * from)
 {
-	USE_EXEC(cc->cc_TrackFileBase);
-
-	ULONG num_entries_removed = 0;
-
-	struct CacheNode * cn;
-	struct CacheNode * cn_removed;
-	struct MinNode * mn;
+	if(NOT IsMinListEmpty(from))
+	{
+		struct MinNode * first	= from->mlh_Head;
+		struct MinNode * last	= from->mlh_TailPred;
 
-	ENTER();
+		first->mln_Pred				= to->mlh_TailPred;
+		last->mln_Succ				= (struct MinNode *)&to->mlh_Tail;
+		to->mlh_TailPred->mln_Succ	= first;
+		to->mlh_TailPred			= last;
 
-	ASSERT( cc != NULL );
-	ASSERT( tfu != NULL );
+		NewMinList(from);
+	}
+}
 
-	#if DEBUG
-	check_stack_size_available(SysBase);
-	#endif /* DEBUG */
+/****************************************************************************/
 
-	D(("invalidating cache entries for unit #%ld", tfu->tfu_UnitNumber));
+/* Remove the oldest stale cache node from the list of stale nodes and from
+ * the splay tree it is still stored in. Returns NULL if there are no stale
+ * nodes left. The cache lock must be held when calling this function.
+ */
+static struct CacheNode *
+reclaim_stale_cache_node(struct CacheContext * cc)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
 
-	ObtainSemaphore(&cc->cc_Lock);
+	struct CacheNode * result = NULL;
+	struct CacheNode * cn;
+	struct CacheNode * cn_removed;
+	struct MinNode * mn;
 
-	/* All the cache nodes associated with this particular unit
-	 * are stored in a list so that the invalidation could be
-	 * made as fast as possible. The alternatives would have been
-	 * to search for each key that belongs to a unit which
-	 * may scale poorly...
-	 */
-	while((mn = RemHeadMinList(&tfu->tfu_CacheNodeList)) != NULL)
+	while(result == NULL && (mn = RemHeadMinList(&cc->cc_StaleList)) != NULL)
 	{
-		num_entries_removed++;
-
-		/* This node is embedded in the CacheNode, following the
-		 * SplayNode, which is why we need to translate the address
-		 * back to the beginning of the CacheNode.
-		 */
-		cn = cache_node_from_unit_node(mn);
+		cn = cache_node_from_image_node(mn);
 
 		/* That node may be in the probationary segment. */
 		cn_removed = (struct CacheNode *)remove_node_from_splay_tree(&cc->cc_ProbationCacheTree, cn->cn_SplayNode.sn_Key);
@@ -630,25 +631,189 @@ invalidate_cache_entries_for_unit(struct CacheContext * cc, struct TrackFileUnit
 
 		ASSERT( cn == cn_removed && "THIS SHOULD NEVER HAPPEN" );
 
-		ASSERT( node_is_in_list((struct List *)&cc->cc_ProbationCacheTree.st_List, (struct Node *)&cn->cn_SplayNode.sn_Node) ||
-		        node_is_in_list((struct List *)&cc->cc_ProtectedCacheTree.st_List, (struct Node *)&cn->cn_SplayNode.sn_Node));
-
 		RemoveMinNode(&cn->cn_SplayNode.sn_Node);
 
-		ASSERT( NOT node_is_in_list((struct List *)&cc->cc_SpareList, (struct Node *)&cn->cn_SplayNode.sn_Node) );
+		result = cn;
+	}
 
-		AddTailMinList(&cc->cc_SpareList, &cn->cn_SplayNode.sn_Node);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Hand out the next number for a CacheImage. Stale cache nodes still carry
+ * the numbers of the images they belonged to. Once the numbers wrap around,
+ * these nodes must be gone, or they would turn up again under a new image.
+ * The cache lock must be held when calling this function.
+ */
+static ULONG
+get_next_cache_image_number(struct CacheContext * cc)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	ULONG image_number = cc->cc_NextImageNumber;
+	struct CacheNode * cn;
+
+	cc->cc_NextImageNumber = (cc->cc_NextImageNumber + 1) & CACHE_IMAGE_NUMBER_MASK;
+
+	if(cc->cc_NextImageNumber == 0)
+	{
+		SHOWMSG("image numbers wrap around; reclaiming all stale cache entries");
+
+		while((cn = reclaim_stale_cache_node(cc)) != NULL)
+			AddTailMinList(&cc->cc_SpareList, &cn->cn_SplayNode.sn_Node);
 	}
 
-	ReleaseSemaphore(&cc->cc_Lock);
+	return(image_number);
+}
+
+/****************************************************************************/
+
+/* Invalidate all cache entries associated with a specific disk image, which
+ * is needed when its contents can no longer be trusted, or when the cache
+ * is disabled for the unit which uses it.
+ *
+ * This has to be quick, since the cache is locked meanwhile. The entries
+ * are not removed one by one. The image receives a new number instead,
+ * which means that the keys of its existing entries no longer match any
+ * lookup. These entries become stale, and are reclaimed later.
+ */
+void
+invalidate_cache_image_entries(struct CacheContext * cc, struct CacheImage * ci)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	ENTER();
+
+	ASSERT( cc != NULL );
+	ASSERT( ci != NULL );
 
-	D(("%lu cache entries removed", num_entries_removed));
+	#if DEBUG
+	check_stack_size_available(SysBase);
+	#endif /* DEBUG */
+
+	ObtainSemaphore(&cc->cc_Lock);
+
+	D(("invalidating cache entries for image #%ld", ci->ci_ImageNumber));
+
+	move_min_list_nodes(&cc->cc_StaleList, &ci->ci_CacheNodeList);
+
+	ci->ci_ImageNumber = get_next_cache_image_number(cc);
+
+	D(("image is now known as #%ld", ci->ci_ImageNumber));
+
+	ReleaseSemaphore(&cc->cc_Lock);
 
 	LEAVE();
 }
 
 /****************************************************************************/
 
+/* Reclaim up to a given number of stale cache entries, moving them to
+ * the list of unused entries. This is called by the unit Processes
+ * while they are idle. It never waits for the cache to become
+ * available, since there will be another opportunity soon. Returns
+ * TRUE if stale cache entries are still left to be reclaimed, and
+ * FALSE if there are none left or if the cache was busy.
+ */
+BOOL
+sweep_stale_cache_entries(struct CacheContext * cc, ULONG max_count)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	struct CacheNode * cn;
+	BOOL more_left = FALSE;
+
+	ASSERT( cc != NULL );
+
+	if(AttemptSemaphore(&cc->cc_Lock))
+	{
+		while(max_count > 0 && (cn = reclaim_stale_cache_node(cc)) != NULL)
+		{
+			AddTailMinList(&cc->cc_SpareList, &cn->cn_SplayNode.sn_Node);
+
+			max_count--;
+		}
+
+		more_left = (BOOL)(NOT IsMinListEmpty(&cc->cc_StaleList));
+
+		ReleaseSemaphore(&cc->cc_Lock);
+	}
+
+	return(more_left);
+}
+
+/****************************************************************************/
+
+/* Check if the cache holds the given track of the disk image file which
+ * the unit uses, without changing the state of the cache. This is used
+ * when prefetching tracks which may already be in the cache.
+ */
+BOOL
+cache_contains_track(struct CacheContext * cc, struct TrackFileUnit * tfu, LONG track_number)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	BOOL found = FALSE;
+
+	ASSERT( cc != NULL );
+	ASSERT( tfu != NULL );
+	ASSERT( 0 <= track_number && track_number < tfu->tfu_NumTracks );
+
+	ObtainSemaphore(&cc->cc_Lock);
+
+	if(tfu->tfu_CacheImage != NULL)
+	{
+		ULONG key = CACHE_KEY(tfu->tfu_CacheImage->ci_ImageNumber, track_number);
+
+		found = (BOOL)(
+			find_splay_node(&cc->cc_ProtectedCacheTree, key) != NULL ||
+			find_splay_node(&cc->cc_ProbationCacheTree, key) != NULL
+		);
+	}
+
+	ReleaseSemaphore(&cc->cc_Lock);
+
+	return(found);
+}
+
+/****************************************************************************/
+
+/* Count the cache nodes which hold tracks of the given disk image file,
+ * and all the cache nodes allocated, including the unused and the stale
+ * ones. The disk image file may be NULL.
+ */
+VOID
+get_cache_memory_usage(struct CacheContext * cc, const struct CacheImage * ci, ULONG * num_image_nodes_ptr, ULONG * num_nodes_ptr)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	const struct MinNode * mn;
+	ULONG num_image_nodes = 0;
+
+	ASSERT( cc != NULL );
+	ASSERT( num_image_nodes_ptr != NULL && num_nodes_ptr != NULL );
+
+	ObtainSemaphore(&cc->cc_Lock);
+
+	if(ci != NULL)
+	{
+		for(mn = ci->ci_CacheNodeList.mlh_Head ;
+		    mn->mln_Succ != NULL ;
+		    mn = mn->mln_Succ)
+		{
+			num_image_nodes++;
+		}
+	}
+
+	(*num_image_nodes_ptr)	= num_image_nodes;
+	(*num_nodes_ptr)		= cc->cc_NumNodesAllocated;
+
+	ReleaseSemaphore(&cc->cc_Lock);
+}
+
+/****************************************************************************/
+
 /* Invalidate a cache entry, such as may be necessary after a read error was
  * detected. The cache entry will be moved into the list of unused entries
  * to be reused later, perhaps.
@@ -688,7 +853,7 @@ invalidate_cache_entry(struct CacheContext * cc, ULONG key)
 	 */
 	if(cn != NULL)
 	{
-		RemoveMinNode(&cn->cn_UnitNode);
+		RemoveMinNode(&cn->cn_ImageNode);
 
 		RemoveMinNode(&cn->cn_SplayNode.sn_Node);
 		AddTailMinList(&cc->cc_SpareList, &cn->cn_SplayNode.sn_Node);
@@ -701,6 +866,178 @@ invalidate_cache_entry(struct CacheContext * cc, ULONG key)
 
 /****************************************************************************/
 
+/* Free the CacheImages which are no longer used by any unit and which no
+ * longer have any cache entries associated with them. The cache lock must
+ * be held when calling this function.
+ */
+static void
+purge_unused_cache_images(struct CacheContext * cc)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	struct CacheImage * ci;
+	struct CacheImage * ci_next;
+
+	for(ci = (struct CacheImage *)cc->cc_ImageList.mlh_Head ;
+	    (ci_next = (struct CacheImage *)ci->ci_Node.mln_Succ) != NULL ;
+	    ci = ci_next)
+	{
+		if(ci->ci_UseCount == 0 && IsMinListEmpty(&ci->ci_CacheNodeList))
+		{
+			D(("freeing cache image #%ld", ci->ci_ImageNumber));
+
+			RemoveMinNode(&ci->ci_Node);
+
+			FreeMem(ci, sizeof(*ci));
+		}
+	}
+}
+
+/****************************************************************************/
+
+/* Find the CacheImage which matches the disk image file, as described by
+ * a lock on it and the FileInfoBlock filled in by examining it, and add a
+ * reference to it. If no such image is known yet, a new one will be created.
+ * If the file cannot be identified because no lock is available, the image
+ * will not be shared with other units and its cache entries will be dropped
+ * when it is released. Returns NULL if no memory could be allocated.
+ */
+struct CacheImage *
+obtain_cache_image(struct CacheContext * cc, BPTR file_lock, const struct FileInfoBlock * fib)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	struct CacheImage * result = NULL;
+	struct CacheImage * ci;
+	BPTR volume = ZERO;
+
+	ENTER();
+
+	ASSERT( cc != NULL );
+	ASSERT( fib != NULL );
+
+	#if DEBUG
+	check_stack_size_available(SysBase);
+	#endif /* DEBUG */
+
+	/* Both the volume and the file header block key are
+	 * needed to tell image files apart.
+	 */
+	if(file_lock != ZERO && fib->fib_DiskKey != 0)
+	{
+		const struct FileLock * fl = BADDR(file_lock);
+
+		volume = fl->fl_Volume;
+	}
+
+	ObtainSemaphore(&cc->cc_Lock);
+
+	purge_unused_cache_images(cc);
+
+	if(volume != ZERO)
+	{
+		for(ci = (struct CacheImage *)cc->cc_ImageList.mlh_Head ;
+		    ci->ci_Node.mln_Succ != NULL ;
+		    ci = (struct CacheImage *)ci->ci_Node.mln_Succ)
+		{
+			if(ci->ci_Volume == volume &&
+			   ci->ci_DiskKey == fib->fib_DiskKey &&
+			   ci->ci_Size == fib->fib_Size &&
+			   ci->ci_Date.ds_Days == fib->fib_Date.ds_Days &&
+			   ci->ci_Date.ds_Minute == fib->fib_Date.ds_Minute &&
+			   ci->ci_Date.ds_Tick == fib->fib_Date.ds_Tick &&
+			   NOT ci->ci_Modified)
+			{
+				D(("found cache image #%ld (use count = %ld)", ci->ci_ImageNumber, ci->ci_UseCount));
+
+				ci->ci_UseCount++;
+
+				result = ci;
+				break;
+			}
+		}
+	}
+
+	if(result == NULL)
+	{
+		ci = AllocMem(sizeof(*ci), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+		if(ci != NULL)
+		{
+			NewMinList(&ci->ci_CacheNodeList);
+
+			ci->ci_ImageNumber	= get_next_cache_image_number(cc);
+			ci->ci_UseCount		= 1;
+			ci->ci_Volume		= volume;
+			ci->ci_DiskKey		= fib->fib_DiskKey;
+			ci->ci_Size			= fib->fib_Size;
+			ci->ci_Date			= fib->fib_Date;
+
+			D(("created cache image #%ld", ci->ci_ImageNumber));
+
+			AddTailMinList(&cc->cc_ImageList, &ci->ci_Node);
+
+			result = ci;
+		}
+		else
+		{
+			SHOWMSG("not enough memory for cache image");
+		}
+	}
+
+	ReleaseSemaphore(&cc->cc_Lock);
+
+	RETURN(result);
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Drop a reference to a CacheImage obtained through obtain_cache_image().
+ * The cache entries remain in the cache after the last unit has released
+ * the image, so that they can be reused if the image is inserted again.
+ * This is not possible if the image cannot be identified or if it was
+ * written to, in which case the entries are dropped.
+ */
+void
+release_cache_image(struct CacheContext * cc, struct CacheImage * ci)
+{
+	USE_EXEC(cc->cc_TrackFileBase);
+
+	ENTER();
+
+	ASSERT( cc != NULL );
+
+	if(ci != NULL)
+	{
+		BOOL drop_entries;
+
+		ObtainSemaphore(&cc->cc_Lock);
+
+		ASSERT( ci->ci_UseCount > 0 );
+
+		ci->ci_UseCount--;
+
+		D(("cache image #%ld use count = %ld", ci->ci_ImageNumber, ci->ci_UseCount));
+
+		drop_entries = (BOOL)(ci->ci_UseCount == 0 && (ci->ci_Volume == ZERO || ci->ci_Modified));
+
+		ReleaseSemaphore(&cc->cc_Lock);
+
+		if(drop_entries)
+		{
+			invalidate_cache_image_entries(cc, ci);
+
+			ObtainSemaphore(&cc->cc_Lock);
+			purge_unused_cache_images(cc);
+			ReleaseSemaphore(&cc->cc_Lock);
+		}
+	}
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
 /* Try to update the cache, either by replacing data in an already  existing
  * cache node or by creating a new cache mode. Whether this function will
  * limit itself to updating existing cache nodes, or recycling existing ones,
@@ -735,15 +1072,19 @@ update_cache_contents(
 	check_stack_size_available(SysBase);
 	#endif /* DEBUG */
 
-	key = CACHE_KEY(tfu->tfu_UnitNumber, track_number);
-
 	D(("update unit %ld/track %ld: data = 0x%08lx, data_size = %ld, mode = %s",
 		tfu->tfu_UnitNumber, track_number, data, data_size, mode == UDN_Allocate ? "allocate" : "update only"));
 
 	ObtainSemaphore(&cc->cc_Lock);
 
-	if(data_size == cc->cc_DataSize)
+	if(tfu->tfu_CacheImage == NULL)
+	{
+		D(("unit %ld has no cache image", tfu->tfu_UnitNumber));
+	}
+	else if(data_size == cc->cc_DataSize)
 	{
+		key = CACHE_KEY(tfu->tfu_CacheImage->ci_ImageNumber, track_number);
+
 		/* We try to find an existing cache node with the same
 		 * key in use in the probationary and protected cache
 		 * segments first.
@@ -763,10 +1104,14 @@ update_cache_contents(
 
 			SHOWVALUE(allocation_size);
 
-			/* Try to reuse an unused cache node first, and if
-			 * that fails, allocate memory for a new node.
+			/* Try to reuse an unused cache node first, then a
+			 * stale one, and if that fails, allocate memory for
+			 * a new node.
 			 */
 			cn = (struct CacheNode *)RemHeadMinList(&cc->cc_SpareList);
+			if(cn == NULL)
+				cn = reclaim_stale_cache_node(cc);
+
 			if(cn == NULL)
 			{
 				D(("number of bytes allocated (%lu) + allocation size (%lu) > maximum (%lu)? %s",
@@ -784,6 +1129,8 @@ update_cache_contents(
 						D(("0x%08lx = AllocMem(%lu, MEMF_ANY)", cn, allocation_size));
 
 						cc->cc_NumBytesAllocated += allocation_size;
+						cc->cc_NumNodesAllocated++;
+
 						if(cc->cc_NumBytesAllocated == cc->cc_MaxCacheSize)
 						{
 							D(("cache now contains %lu bytes and has reached its maximum size",
@@ -819,7 +1166,7 @@ update_cache_contents(
 				cn = (struct CacheNode *)RemTailMinList(&cc->cc_ProbationCacheTree.st_List);
 				if(cn != NULL)
 				{
-					RemoveMinNode(&cn->cn_UnitNode);
+					RemoveMinNode(&cn->cn_ImageNode);
 
 					cn_removed = (struct CacheNode *)remove_node_from_splay_tree(&cc->cc_ProbationCacheTree, cn->cn_SplayNode.sn_Key);
 
@@ -833,7 +1180,7 @@ update_cache_contents(
 					cn = (struct CacheNode *)RemTailMinList(&cc->cc_ProtectedCacheTree.st_List);
 					if(cn != NULL)
 					{
-						RemoveMinNode(&cn->cn_UnitNode);
+						RemoveMinNode(&cn->cn_ImageNode);
 
 						cn_removed = (struct CacheNode *)remove_node_from_splay_tree(&cc->cc_ProtectedCacheTree, cn->cn_SplayNode.sn_Key);
 
@@ -855,10 +1202,10 @@ update_cache_contents(
 				{
 					AddHeadMinList(&cc->cc_ProbationCacheTree.st_List, &cn->cn_SplayNode.sn_Node);
 
-					/* This cache node now belongs to this unit. */
-					ASSERT( NOT node_is_in_list((struct List *)&tfu->tfu_CacheNodeList, (struct Node *)&cn->cn_UnitNode) );
+					/* This cache node now belongs to the image used by this unit. */
+					ASSERT( NOT node_is_in_list((struct List *)&tfu->tfu_CacheImage->ci_CacheNodeList, (struct Node *)&cn->cn_ImageNode) );
 
-					AddTailMinList(&tfu->tfu_CacheNodeList, &cn->cn_UnitNode);
+					AddTailMinList(&tfu->tfu_CacheImage->ci_CacheNodeList, &cn->cn_ImageNode);
 				}
 				else
 				{
@@ -931,13 +1278,27 @@ reduce_cache_size_memory_usage(struct CacheContext * cc, ULONG max_memory_usage)
 		total_memory_freed += allocation_size;
 
 		cc->cc_NumBytesAllocated -= allocation_size;
+		cc->cc_NumNodesAllocated--;
+	}
+
+	/* Then the stale entries, which can no longer be found anyway. */
+	while(cc->cc_NumBytesAllocated > max_memory_usage &&
+	      (cn = reclaim_stale_cache_node(cc)) != NULL)
+	{
+		D(("FreeMem(0x%08lx, %lu)", cn, allocation_size));
+
+		FreeMem(cn, allocation_size);
+		total_memory_freed += allocation_size;
+
+		cc->cc_NumBytesAllocated -= allocation_size;
+		cc->cc_NumNodesAllocated--;
 	}
 
 	/* Drop the least recently-used entries from the probationary segment. */
 	while(cc->cc_NumBytesAllocated > max_memory_usage &&
 	      (cn = (struct CacheNode *)RemTailMinList(&cc->cc_ProbationCacheTree.st_List)) != NULL)
 	{
-		RemoveMinNode(&cn->cn_UnitNode);
+		RemoveMinNode(&cn->cn_ImageNode);
 
 		cn_removed = (struct CacheNode *)remove_node_from_splay_tree(&cc->cc_ProbationCacheTree, cn->cn_SplayNode.sn_Key);
 
@@ -949,6 +1310,7 @@ reduce_cache_size_memory_usage(struct CacheContext * cc, ULONG max_memory_usage)
 		total_memory_freed += allocation_size;
 
 		cc->cc_NumBytesAllocated -= allocation_size;
+		cc->cc_NumNodesAllocated--;
 	}
 
 	/* If we still haven't suceeded in meeting the requirements
@@ -958,7 +1320,7 @@ reduce_cache_size_memory_usage(struct CacheContext * cc, ULONG max_memory_usage)
 	while(cc->cc_NumBytesAllocated > max_memory_usage &&
 	      (cn = (struct CacheNode *)RemTailMinList(&cc->cc_ProtectedCacheTree.st_List)) != NULL)
 	{
-		RemoveMinNode(&cn->cn_UnitNode);
+		RemoveMinNode(&cn->cn_ImageNode);
 
 		cn_removed = (struct CacheNode *)remove_node_from_splay_tree(&cc->cc_ProtectedCacheTree, cn->cn_SplayNode.sn_Key);
 
@@ -972,6 +1334,7 @@ reduce_cache_size_memory_usage(struct CacheContext * cc, ULONG max_memory_usage)
 		total_memory_freed += allocation_size;
 
 		cc->cc_NumBytesAllocated -= allocation_size;
+		cc->cc_NumNodesAllocated--;
 	}
 
 	RETURN(total_memory_freed);
@@ -1203,6 +1566,10 @@ delete_cache_context(struct CacheContext * cc)
 
 		reduce_cache_size_memory_usage(cc, 0);
 
+		purge_unused_cache_images(cc);
+
+		ASSERT( IsMinListEmpty(&cc->cc_ImageList) );
+
 		FreeVec(cc->cc_StackSwap);
 
 		FreeMem(cc, sizeof(*cc));
@@ -1249,6 +1616,8 @@ create_cache_context(struct TrackFileDevice * tfd, ULONG data_size)
 	initialize_splay_tree(&cc->cc_ProtectedCacheTree);
 
 	NewMinList(&cc->cc_SpareList);
+	NewMinList(&cc->cc_ImageList);
+	NewMinList(&cc->cc_StaleList);
 
 	/* Kickstart 3.0 and higher feature a mechanism by which
 	 * failed memory allocation attempts may result in asking
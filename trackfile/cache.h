@@ -49,17 +49,19 @@
 
 /****************************************************************************/
 
-/* Combine unit number, track number (0..159: 8 bits) and a possible way to
+/* Combine image number, track number (0..159: 8 bits) and a possible way to
  * support high density disks by allocating two cache entries per track for
  * which a single bit is reserved.
  *
  * This leaves 32 - (8 + 1) = 23 bits, allowing for only up to a meagre
- * 8,388,608 units to be used at a time.
+ * 8,388,608 disk images to be known to the cache at a time.
  */
-#define CACHE_KEY(unit_number, track_number) \
-	(((unit_number) << 9) | ((track_number) << 1))
+#define CACHE_KEY(image_number, track_number) \
+	(((image_number) << 9) | ((track_number) << 1))
 
-#define CACHE_KEY_UNIT_MASK ((~0UL << 9) & 0xFFFFFFFFUL)
+#define CACHE_KEY_IMAGE_MASK ((~0UL << 9) & 0xFFFFFFFFUL)
+
+#define CACHE_IMAGE_NUMBER_MASK (CACHE_KEY_IMAGE_MASK >> 9)
 
 /****************************************************************************/
 
@@ -89,12 +91,46 @@ struct SplayTree
 struct CacheNode
 {
 	struct SplayNode	cn_SplayNode;	/* This is part of the splay tree */
-	struct MinNode		cn_UnitNode;	/* This is associated with the unit which uses the cache node */
+	struct MinNode		cn_ImageNode;	/* This is associated with the disk image the data belongs to */
 	ULONG				cn_Checksum;	/* Checksum for the data which follows the CacheNode */
 };
 
 /****************************************************************************/
 
+/* Cache entries belong to a disk image file rather than to the unit which
+ * uses it. The image is identified by the volume the file resides on, its
+ * file header key, its size and its modification date. Units which use the
+ * same image file share the same cache entries, and if the image is ejected
+ * and then inserted again, possibly into a different unit, the entries
+ * which are still in the cache can be reused.
+ *
+ * Once an image has been written to, its modification date no longer
+ * identifies its contents. Its cache entries will be dropped as soon as
+ * the last unit stops using it.
+ *
+ * Dropping the cache entries of an image does not remove them from the
+ * cache right away. Instead, the image receives a new image number, which
+ * makes the entries unreachable, and they are moved to the list of stale
+ * entries as a whole. Stale entries are reclaimed later, whenever a new
+ * entry is needed, or by sweep_stale_cache_entries() while the units
+ * are idle.
+ */
+struct CacheImage
+{
+	struct MinNode		ci_Node;			/* Stored in CacheContext->cc_ImageList */
+	struct MinList		ci_CacheNodeList;	/* All the CacheNodes used by this image */
+	ULONG				ci_ImageNumber;		/* Used in place of the unit number by CACHE_KEY() */
+	ULONG				ci_UseCount;		/* Number of units which currently use this image */
+
+	BPTR				ci_Volume;			/* Volume on which the file resides; ZERO if not known */
+	LONG				ci_DiskKey;			/* File header block number */
+	LONG				ci_Size;			/* File size in bytes */
+	struct DateStamp	ci_Date;			/* File modification date */
+	BOOL				ci_Modified;		/* Was the image written to while in use? */
+};
+
+/****************************************************************************/
+
 struct CacheContext
 {
 	struct TrackFileDevice *		cc_TrackFileBase;		/* Very handy... */
@@ -106,12 +142,18 @@ struct CacheContext
 
 	ULONG							cc_MaxCacheSize;		/* Maximum amount of memory to spend on caching */
 	ULONG							cc_NumBytesAllocated;	/* Total number of bytes allocated for cache nodes */
+	ULONG							cc_NumNodesAllocated;	/* Total number of cache nodes allocated */
 
 	struct SplayTree				cc_ProtectedCacheTree;	/* Protected segment of the LRU scheme */
 	struct SplayTree				cc_ProbationCacheTree;	/* Probationary segment of the LRU scheme */
 
 	struct MinList					cc_SpareList;			/* Unused cache nodes go here. */
 
+	struct MinList					cc_ImageList;			/* All the CacheImages known */
+	ULONG							cc_NextImageNumber;		/* Used for numbering the CacheImages */
+
+	struct MinList					cc_StaleList;			/* Invalidated CacheNodes, not yet reclaimed */
+
 	ULONG							cc_ProtectedCacheMax;	/* How many nodes may be in the protected section? */
 	ULONG							cc_ProtectedCacheSize;	/* How many nodes are currently in the protected section? */
 
@@ -135,9 +177,19 @@ enum UDN_Mode
 
 /****************************************************************************/
 
+/* How many stale cache entries a unit reclaims at a time while it is idle. */
+#define NUM_STALE_ENTRIES_PER_SWEEP 16
+
+/****************************************************************************/
+
 extern BOOL read_cache_contents(struct CacheContext *cc, struct TrackFileUnit *	tfu, LONG track_number, void *data, ULONG data_size);
-extern void invalidate_cache_entries_for_unit(struct CacheContext * cc, struct TrackFileUnit * tfu);
+extern void invalidate_cache_image_entries(struct CacheContext * cc, struct CacheImage * ci);
+extern struct CacheImage * obtain_cache_image(struct CacheContext * cc, BPTR file_lock, const struct FileInfoBlock * fib);
+extern void release_cache_image(struct CacheContext * cc, struct CacheImage * ci);
 extern void invalidate_cache_entry(struct CacheContext * cc, ULONG key);
+extern VOID get_cache_memory_usage(struct CacheContext * cc, const struct CacheImage * ci, ULONG * num_image_nodes_ptr, ULONG * num_nodes_ptr);
+extern BOOL cache_contains_track(struct CacheContext * cc, struct TrackFileUnit * tfu, LONG track_number);
+extern BOOL sweep_stale_cache_entries(struct CacheContext * cc, ULONG max_count);
 extern void update_cache_contents(struct CacheContext *cc, struct TrackFileUnit * tfu, LONG track_number, const void * data, ULONG data_size, enum UDN_Mode mode);
 extern void change_cache_size(struct CacheContext *cc, ULONG max_cache_size);
 extern void delete_cache_context(struct CacheContext * cc);
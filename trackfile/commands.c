@@ -50,6 +50,8 @@
 #include "unit.h"
 #include "mfm_encoding.h"
 #include "cache.h"
+#include "background_jobs.h"
+#include "image_backend.h"
 
 /****************************************************************************/
 
@@ -304,8 +306,16 @@ close_unit_file(struct TrackFileUnit * tfu)
 	if(file != ZERO)
 		Close(file);
 
+	free_extended_adf(tfd, tfu->tfu_ExtendedADF);
+	tfu->tfu_ExtendedADF = NULL;
+
+	free_packed_image(tfd, tfu->tfu_PackedImage);
+	tfu->tfu_PackedImage = NULL;
+
 	mark_track_buffer_as_invalid(tfu);
 
+	discard_checkpoint(tfu);
+
 	tfu->tfu_ChangesMade = FALSE;
 
 	D(("releasing unit %ld lock", tfu->tfu_UnitNumber));
@@ -316,6 +326,237 @@ close_unit_file(struct TrackFileUnit * tfu)
 
 /****************************************************************************/
 
+/* Read a track of an extended ADF file or of a packed disk image file,
+ * which may have to be decoded or unpacked first. Returns a
+ * trackdisk.device error code if this fails.
+ */
+static LONG
+read_indexed_track(struct TrackFileUnit * tfu, LONG which_track, APTR data)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG error;
+
+	ASSERT( TRACKS_ARE_INDEXED(tfu) );
+
+	/* We don't know where we will end up in the file. */
+	tfu->tfu_FilePosition = -1;
+
+	if(tfu->tfu_ExtendedADF != NULL)
+		error = read_extended_adf_track(tfd, tfu->tfu_ExtendedADF, tfu->tfu_File, which_track, data, tfu->tfu_TrackDataSize);
+	else
+		error = read_packed_image_track(tfd, tfu->tfu_PackedImage, tfu->tfu_File, which_track, data, tfu->tfu_TrackDataSize);
+
+	if(error != OK)
+		D(("could not read track %ld (error=%ld)", which_track, error));
+
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Remember the order in which the tracks of the medium are first read
+ * from, so that the same tracks can be loaded into the cache ahead of
+ * time when the medium is inserted again.
+ */
+static VOID
+record_track_access(struct TrackFileUnit * tfu, LONG which_track)
+{
+	ULONG mask = (1UL << (which_track % 32));
+
+	ASSERT( 0 <= which_track && which_track < NUM_STATISTICS_TRACKS );
+
+	if(FLAG_IS_CLEAR(tfu->tfu_TracksAccessed[which_track / 32], mask))
+	{
+		SET_FLAG(tfu->tfu_TracksAccessed[which_track / 32], mask);
+
+		ASSERT( tfu->tfu_NumTracksAccessed < NUM_STATISTICS_TRACKS );
+
+		tfu->tfu_TrackAccessOrder[tfu->tfu_NumTracksAccessed++] = which_track;
+	}
+}
+
+/****************************************************************************/
+
+#if defined(ENABLE_CACHE)
+
+/* Check if the tracks of the disk image file in use should be kept in
+ * the cache. Tracks decoded from raw MFM data always go into the
+ * cache, so that they need to be decoded only once.
+ */
+static BOOL
+unit_uses_cache(const struct TrackFileUnit * tfu)
+{
+	const struct TrackFileDevice * tfd = tfu->tfu_Device;
+	BOOL result;
+
+	result = (BOOL)(
+		tfd->tfd_CacheContext != NULL &&
+		tfu->tfu_CacheImage != NULL &&
+		(tfu->tfu_CacheEnabled || tfu->tfu_ExtendedADF != NULL) &&
+		tfu->tfu_DriveType != DRIVE3_5_150RPM
+	);
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Remember that one track was loaded into the track buffer right after
+ * another. Each track keeps a short list of its most frequent successors,
+ * sorted by how often they followed it. A successor which is not yet in
+ * the list takes the place of the least frequent one, but only after the
+ * latter has been weakened enough, so that rare transitions do not push
+ * out frequent ones.
+ */
+static VOID
+learn_track_transition(struct TrackFileUnit * tfu, LONG from_track, LONG to_track)
+{
+	struct TrackSuccessor * ts = tfu->tfu_TrackSuccessors[from_track];
+	struct TrackSuccessor * least = &ts[NUM_TRACK_SUCCESSORS-1];
+	struct TrackSuccessor swap;
+	int i;
+
+	ASSERT( 0 <= from_track && from_track < NUM_STATISTICS_TRACKS );
+	ASSERT( 0 <= to_track && to_track < NUM_STATISTICS_TRACKS );
+
+	for(i = 0 ; i < NUM_TRACK_SUCCESSORS ; i++)
+	{
+		if(ts[i].ts_Count > 0 && ts[i].ts_Track == to_track)
+			break;
+	}
+
+	if(i < NUM_TRACK_SUCCESSORS)
+	{
+		/* The counters are relative to each other, so
+		 * they can be halved before they overflow.
+		 */
+		if(ts[i].ts_Count == 255)
+		{
+			int j;
+
+			for(j = 0 ; j < NUM_TRACK_SUCCESSORS ; j++)
+				ts[j].ts_Count = (ts[j].ts_Count + 1) / 2;
+		}
+
+		ts[i].ts_Count++;
+	}
+	else if (least->ts_Count > 1)
+	{
+		least->ts_Count--;
+		i = NUM_TRACK_SUCCESSORS-1;
+	}
+	else
+	{
+		least->ts_Track = to_track;
+		least->ts_Count = 1;
+		i = NUM_TRACK_SUCCESSORS-1;
+	}
+
+	/* Keep the list sorted, most frequent successor first. */
+	for( ; i > 0 && ts[i].ts_Count > ts[i-1].ts_Count ; i--)
+	{
+		swap = ts[i];
+		ts[i] = ts[i-1];
+		ts[i-1] = swap;
+	}
+
+	for( ; i < NUM_TRACK_SUCCESSORS-1 && ts[i].ts_Count < ts[i+1].ts_Count ; i++)
+	{
+		swap = ts[i];
+		ts[i] = ts[i+1];
+		ts[i+1] = swap;
+	}
+}
+
+/****************************************************************************/
+
+/* Called whenever a track is loaded into the track buffer. Checks if the
+ * track was predicted, learns from the transition and then predicts which
+ * tracks will be loaded next. These will be loaded into the cache by the
+ * TFJOB_Predict background job while the unit is idle.
+ */
+static VOID
+predict_next_tracks(struct TrackFileUnit * tfu, LONG which_track)
+{
+	const struct TrackSuccessor * ts;
+	ULONG mask = (1UL << (which_track % 32));
+	int i;
+
+	ASSERT( 0 <= which_track && which_track < NUM_STATISTICS_TRACKS );
+
+	if(NOT unit_uses_cache(tfu))
+		return;
+
+	/* Was this track loaded ahead of time? */
+	if(FLAG_IS_SET(tfu->tfu_PrefetchedTracks[which_track / 32], mask))
+	{
+		CLEAR_FLAG(tfu->tfu_PrefetchedTracks[which_track / 32], mask);
+
+		tfu->tfu_NumPrefetchedTracksUsed++;
+	}
+
+	/* Was this track among those predicted last time? */
+	for(i = 0 ; i < tfu->tfu_NumPredictedTracks ; i++)
+	{
+		if(tfu->tfu_PredictedTracks[i] == which_track)
+		{
+			tfu->tfu_NumCorrectPredictions++;
+			break;
+		}
+	}
+
+	if(tfu->tfu_PreviousTrack != -1 && tfu->tfu_PreviousTrack != which_track)
+		learn_track_transition(tfu, tfu->tfu_PreviousTrack, which_track);
+
+	tfu->tfu_PreviousTrack = which_track;
+
+	/* Predictions which were not acted upon yet are
+	 * no longer useful.
+	 */
+	tfu->tfu_NumPredictedTracks = 0;
+	tfu->tfu_NextPredictedTrack = 0;
+
+	ts = tfu->tfu_TrackSuccessors[which_track];
+
+	for(i = 0 ; i < NUM_TRACK_SUCCESSORS && ts[i].ts_Count >= MIN_SUCCESSOR_COUNT ; i++)
+	{
+		if(ts[i].ts_Track < tfu->tfu_NumTracks)
+			tfu->tfu_PredictedTracks[tfu->tfu_NumPredictedTracks++] = ts[i].ts_Track;
+	}
+
+	if(tfu->tfu_NumPredictedTracks > 0)
+	{
+		tfu->tfu_NumPredictions++;
+
+		schedule_unit_job(tfu, TFJOB_Predict);
+	}
+}
+
+#endif /* ENABLE_CACHE */
+
+/****************************************************************************/
+
+/* Check if the cache holds the given track, in which case reading
+ * it costs next to nothing.
+ */
+static BOOL
+track_is_in_cache(struct TrackFileUnit * tfu, LONG which_track)
+{
+	BOOL result = FALSE;
+
+	#if defined(ENABLE_CACHE)
+	{
+		struct TrackFileDevice * tfd = tfu->tfu_Device;
+
+		result = (BOOL)(unit_uses_cache(tfu) && cache_contains_track(tfd->tfd_CacheContext, tfu, which_track));
+	}
+	#endif /* ENABLE_CACHE */
+
+	return(result);
+}
+
+/****************************************************************************/
+
 /* Read a complete track into the unit's track buffer, replacing
  * its contents. If necessary, the current track buffer contents
  * may have to be written back to the file first.
@@ -354,7 +595,18 @@ read_track_data(struct TrackFileUnit * tfu, LONG which_track)
 
 	ASSERT( tfu->tfu_TrackDataSize > 0 );
 
-	new_position = which_track * tfu->tfu_TrackDataSize;
+	new_position = OFFSET_FROM_TRACK(tfu, which_track);
+
+	tfu->tfu_TrackStatistics[which_track].tfts_Reads++;
+
+	record_track_access(tfu, which_track);
+
+	#if defined(ENABLE_CACHE)
+	{
+		if(tfu->tfu_PredictTracks)
+			predict_next_tracks(tfu, which_track);
+	}
+	#endif /* ENABLE_CACHE */
 
 	/* If the cache feature is enabled, try to find the
 	 * data in the cache rather than reading it from
@@ -369,11 +621,7 @@ read_track_data(struct TrackFileUnit * tfu, LONG which_track)
 		SHOWVALUE(tfu->tfu_CacheEnabled);
 		SHOWVALUE(tfu->tfu_DriveType);
 
-		use_cache = (BOOL)(
-			tfd->tfd_CacheContext != NULL &&
-			tfu->tfu_CacheEnabled &&
-			tfu->tfu_DriveType != DRIVE3_5_150RPM
-		);
+		use_cache = unit_uses_cache(tfu);
 
 		/* Let's see if we can find this track in the cache, however the
 		 * cache must be enabled for this to work out.
@@ -416,47 +664,38 @@ read_track_data(struct TrackFileUnit * tfu, LONG which_track)
 		}
 
 		/* Do we have to read the data from the file after all? */
-		if(read_data_from_file)
+		if(read_data_from_file && TRACKS_ARE_INDEXED(tfu))
 		{
-			#if DEBUG
-			{
-				LONG current_file_position;
-
-				current_file_position = Seek(tfu->tfu_File, 0, OFFSET_CURRENT);
+			tfu->tfu_TrackStatistics[which_track].tfts_Misses++;
 
-				SHOWVALUE(tfu->tfu_FilePosition);
-				SHOWVALUE(current_file_position);
-				SHOWVALUE(new_position);
-
-				ASSERT( tfu->tfu_FilePosition < 0 || tfu->tfu_FilePosition == current_file_position );
-			}
-			#endif /* DEBUG */
-
-			/* Move to the file position which matches the track number. */
-			if(new_position != tfu->tfu_FilePosition)
+			error = read_indexed_track(tfu, which_track, tfu->tfu_TrackData);
+			if(error != OK)
 			{
-				if(Seek(tfu->tfu_File, new_position, OFFSET_BEGINNING) == -1)
-				{
-					D(("that seek didn't work (error=%ld)", IoErr()));
+				if(use_cache)
+					invalidate_cache_entry(tfd->tfd_CacheContext, CACHE_KEY(tfu->tfu_CacheImage->ci_ImageNumber, which_track));
 
-					/* We probably don't know where we are now... */
-					tfu->tfu_FilePosition = -1;
+				mark_track_buffer_as_invalid(tfu);
+				goto out;
+			}
 
-					error = TDERR_NoSecHdr;
-					goto out;
-				}
+			num_track_bytes_read = tfu->tfu_TrackDataSize;
 
-				tfu->tfu_FilePosition = new_position;
+			if(use_cache)
+			{
+				update_cache_contents(tfd->tfd_CacheContext,
+					tfu, which_track,
+					tfu->tfu_TrackData, tfu->tfu_TrackDataSize,
+					UDN_Allocate);
 			}
+		}
+		else if (read_data_from_file)
+		{
+			tfu->tfu_TrackStatistics[which_track].tfts_Misses++;
 
 			/* Read the track data we came for. */
-			num_track_bytes_read = Read(tfu->tfu_File, tfu->tfu_TrackData, tfu->tfu_TrackDataSize);
+			num_track_bytes_read = read_image_data(tfu, tfu->tfu_File, new_position, tfu->tfu_TrackData, tfu->tfu_TrackDataSize);
 			if(num_track_bytes_read == tfu->tfu_TrackDataSize)
 			{
-				ASSERT( tfu->tfu_FilePosition >= 0 );
-
-				tfu->tfu_FilePosition += num_track_bytes_read;
-
 				/* Update the cache or maybe create a new cache entry. */
 				if(use_cache)
 				{
@@ -473,54 +712,33 @@ read_track_data(struct TrackFileUnit * tfu, LONG which_track)
 				 * we don't actually know what could be read.
 				 */
 				if(use_cache)
-					invalidate_cache_entry(tfd->tfd_CacheContext, CACHE_KEY(tfu->tfu_UnitNumber, which_track));
+					invalidate_cache_entry(tfd->tfd_CacheContext, CACHE_KEY(tfu->tfu_CacheImage->ci_ImageNumber, which_track));
 			}
 		}
 	}
 	#else
+	if(TRACKS_ARE_INDEXED(tfu))
 	{
-		#if DEBUG
-		{
-			LONG current_file_position;
-
-			current_file_position = Seek(tfu->tfu_File, 0, OFFSET_CURRENT);
-
-			SHOWVALUE(tfu->tfu_FilePosition);
-			SHOWVALUE(current_file_position);
-			SHOWVALUE(new_position);
-
-			ASSERT( tfu->tfu_FilePosition < 0 || tfu->tfu_FilePosition == current_file_position );
-		}
-		#endif /* DEBUG */
+		tfu->tfu_TrackStatistics[which_track].tfts_Misses++;
 
-		/* Move to the file position which matches the track number. */
-		if(new_position != tfu->tfu_FilePosition)
+		error = read_indexed_track(tfu, which_track, tfu->tfu_TrackData);
+		if(error != OK)
 		{
-			if(Seek(tfu->tfu_File, new_position, OFFSET_BEGINNING) == -1)
-			{
-				D(("that seek didn't work (error=%ld)", IoErr()));
-
-				/* We probably don't know where we are now... */
-				tfu->tfu_FilePosition = -1;
-
-				error = TDERR_NoSecHdr;
-				goto out;
-			}
-
-			tfu->tfu_FilePosition = new_position;
+			mark_track_buffer_as_invalid(tfu);
+			goto out;
 		}
 
+		num_track_bytes_read = tfu->tfu_TrackDataSize;
+	}
+	else
+	{
 		D(("reading %ld bytes from file at position %ld, to go into track file buffer 0x%08lx",
-			tfu->tfu_TrackDataSize, tfu->tfu_FilePosition, tfu->tfu_TrackData));
+			tfu->tfu_TrackDataSize, new_position, tfu->tfu_TrackData));
 
-		/* Read the track data we came for. */
-		num_track_bytes_read = Read(tfu->tfu_File, tfu->tfu_TrackData, tfu->tfu_TrackDataSize);
-		if(num_track_bytes_read == tfu->tfu_TrackDataSize)
-		{
-			ASSERT( tfu->tfu_FilePosition >= 0 );
+		tfu->tfu_TrackStatistics[which_track].tfts_Misses++;
 
-			tfu->tfu_FilePosition += num_track_bytes_read;
-		}
+		/* Read the track data we came for. */
+		num_track_bytes_read = read_image_data(tfu, tfu->tfu_File, new_position, tfu->tfu_TrackData, tfu->tfu_TrackDataSize);
 	}
 	#endif /* ENABLE_CACHE */
 
@@ -590,6 +808,7 @@ read_track_data(struct TrackFileUnit * tfu, LONG which_track)
 
 	/* There's new data in the buffer for a new track. */
 	tfu->tfu_CurrentTrackNumber = tfu->tfu_Unit.tdu_CurrTrk = which_track;
+	tfu->tfu_ValidSectors = ALL_SECTORS_VALID(tfu);
 
 	/* So we can verify the checksum later. */
 	fletcher64_checksum(tfu->tfu_TrackData, tfu->tfu_TrackDataSize, &tfu->tfu_TrackDataChecksum);
@@ -608,236 +827,948 @@ read_track_data(struct TrackFileUnit * tfu, LONG which_track)
 
 /****************************************************************************/
 
-/* If the track buffer has been modified, write its contents
- * back to the disk image file. This is used most prominently
- * by the CMD_UPDATE command.
+/* Load a track of the disk image file into the cache, unless the cache
+ * already holds it, or the track is currently in the track buffer. The
+ * data is read into the buffer provided rather than into the track buffer,
+ * whose contents remain unchanged, and the track is not counted as being
+ * accessed. Returns a trackdisk.device error code if the track could not
+ * be read. Nothing happens if the unit does not use the cache. If
+ * loaded_ptr is not NULL, it will be set to TRUE if the track had to be
+ * read from the file, and to FALSE otherwise.
  */
 LONG
-write_back_track_data(struct TrackFileUnit * tfu)
+prefetch_track(struct TrackFileUnit * tfu, LONG which_track, APTR data, BOOL * loaded_ptr)
+{
+	LONG error = OK;
+
+	ENTER();
+
+	if(loaded_ptr != NULL)
+		(*loaded_ptr) = FALSE;
+
+	#if defined(ENABLE_CACHE)
+	{
+		struct TrackFileDevice * tfd = tfu->tfu_Device;
+		LONG num_track_bytes_read;
+		LONG new_position;
+
+		USE_DOS(tfd);
+
+		ASSERT( tfu->tfu_File != ZERO );
+		ASSERT( 0 <= which_track && which_track < tfu->tfu_NumTracks );
+		ASSERT( data != NULL );
+
+		if(NOT unit_uses_cache(tfu))
+			goto out;
+
+		if(which_track == tfu->tfu_CurrentTrackNumber)
+			goto out;
+
+		if(cache_contains_track(tfd->tfd_CacheContext, tfu, which_track))
+			goto out;
+
+		D(("prefetching track %ld", which_track));
+
+		if(TRACKS_ARE_INDEXED(tfu))
+		{
+			error = read_indexed_track(tfu, which_track, data);
+			if(error != OK)
+				goto out;
+		}
+		else
+		{
+			new_position = OFFSET_FROM_TRACK(tfu, which_track);
+
+			num_track_bytes_read = read_image_data(tfu, tfu->tfu_File, new_position, data, tfu->tfu_TrackDataSize);
+			if(num_track_bytes_read != tfu->tfu_TrackDataSize)
+			{
+				D(("that read didn't work: %ld bytes requested, read only %ld (error=%ld)",
+					tfu->tfu_TrackDataSize, num_track_bytes_read, IoErr()));
+
+				error = TDERR_BadSecHdr;
+				goto out;
+			}
+		}
+
+		update_cache_contents(tfd->tfd_CacheContext,
+			tfu, which_track,
+			data, tfu->tfu_TrackDataSize,
+			UDN_Allocate);
+
+		if(loaded_ptr != NULL)
+			(*loaded_ptr) = TRUE;
+	}
+	#endif /* ENABLE_CACHE */
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Try to make some sense of the AmigaDOS error code returned by a
+ * failed write access to the disk image file, and return the
+ * matching trackdisk.device error code. This may not be a reliable
+ * approach, though, since every file system or handler can pick its
+ * own error codes to match the situation.
+ */
+static LONG
+translate_write_error(struct TrackFileUnit * tfu, LONG error)
 {
 	struct TrackFileDevice * tfd = tfu->tfu_Device;
-	struct fletcher64_checksum new_track_checksum;
-	LONG error;
 
 	USE_EXEC(tfd);
-	USE_DOS(tfd);
 
 	ENTER();
 
-	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
+	/* We probably don't know where we are now... */
+	tfu->tfu_FilePosition = -1;
 
-	ASSERT( tfu->tfu_TrackDataChanged );
-	ASSERT( NOT tfu->tfu_WriteProtected );
-	ASSERT( 0 <= tfu->tfu_CurrentTrackNumber && tfu->tfu_CurrentTrackNumber < tfu->tfu_NumTracks );
-	ASSERT( tfu->tfu_File != ZERO );
-	ASSERT( NOT multiplication_overflows(tfu->tfu_CurrentTrackNumber, tfu->tfu_TrackDataSize) );
-	ASSERT( tfu->tfu_CurrentTrackNumber * tfu->tfu_TrackDataSize >= 0 );
+	D(("that write didn't work (error=%ld)", error));
 
-	D(("OLD checksum for track %3ld = 0x%08lx%08lx",
-		tfu->tfu_CurrentTrackNumber,
-		tfu->tfu_TrackDataChecksum.f64c_high, tfu->tfu_TrackDataChecksum.f64c_low));
+	switch(error)
+	{
+		/* Disk or file is no longer writable. */
+		case ERROR_DISK_NOT_VALIDATED:
+		case ERROR_DISK_WRITE_PROTECTED:
+		case ERROR_WRITE_PROTECTED:
 
-	/* Let's see if the data really needs to be written back to the file. */
-	fletcher64_checksum(tfu->tfu_TrackData, tfu->tfu_TrackDataSize, &new_track_checksum);
+			D(("obtaining unit %ld lock", tfu->tfu_UnitNumber));
+			ObtainSemaphore(&tfu->tfu_Lock);
 
-	D(("NEW checksum for track %3ld = 0x%08lx%08lx",
-		tfu->tfu_CurrentTrackNumber,
-		new_track_checksum.f64c_high, new_track_checksum.f64c_low));
+			tfu->tfu_WriteProtected = TRUE;
 
-	if(tfu->tfu_IgnoreTrackChecksum || compare_fletcher64_checksums(&tfu->tfu_TrackDataChecksum, &new_track_checksum) != SAME)
-	{
-		LONG new_position;
+			D(("releasing unit %ld lock", tfu->tfu_UnitNumber));
+			ReleaseSemaphore(&tfu->tfu_Lock);
 
-		/* Next time, do not ignore the old track checksum. */
-		tfu->tfu_IgnoreTrackChecksum = FALSE;
+			error = TDERR_WriteProt;
+			break;
 
-		SHOWMSG("track contents have been changed, so we really need to write them back");
+		/* The disk has been removed. */
+		case ERROR_DEVICE_NOT_MOUNTED:
+		case ERROR_NO_DISK:
+
+			SHOWMSG("disk has been removed -- closing the file");
+
+			close_unit_file(tfu);
+			turn_off_motor(tfu);
+
+			error = TDERR_DiskChanged;
+			break;
+
+		default:
+
+			error = TDERR_SeekError;
+			break;
+	}
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Track data has just been written back to the disk image file.
+ * If this is the track which contains the reserved blocks or the
+ * root directory, pick up the information which TFGetUnitData()
+ * reports about the medium.
+ */
+static VOID
+update_volume_information(struct TrackFileUnit * tfu, LONG which_track, const APTR track_data)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+
+	USE_EXEC(tfd);
+
+	ENTER();
+
+	/* Is this the track which contains the reserved blocks,
+	 * i.e. the boot block and the file system signature?
+	 */
+	if (which_track == 0)
+	{
+		tfu->tfu_FileSystemSignature = *(ULONG *)track_data;
+
+		D(("file system signature = 0x%08lx", tfu->tfu_FileSystemSignature));
+
+		tfu->tfu_BootBlockChecksum = calculate_boot_block_checksum(track_data, TD_SECTOR * BOOTSECTS);
+
+		D(("boot block checksum = 0x%08lx", tfu->tfu_BootBlockChecksum));
+	}
+	/* Is this the track which contains the root directory? */
+	else if (which_track == tfu->tfu_RootDirTrackNumber)
+	{
+		const struct RootDirBlock * rdb = (struct RootDirBlock *)&((UBYTE *)track_data)[tfu->tfu_RootDirBlockOffset];
+
+		SHOWMSG("updating the root directory information");
+
+		tfu->tfu_RootDirValid = root_directory_is_valid(rdb);
+		if(tfu->tfu_RootDirValid)
+		{
+			TEXT root_directory_name[32];
+			size_t len;
+
+			len = rdb->rdb_Name[0];
+
+			/* Avoid unexpected buffer overflows. */
+			if(len >= sizeof(root_directory_name))
+				len = sizeof(root_directory_name)-1;
+
+			CopyMem(&rdb->rdb_Name[1], root_directory_name, len);
+			root_directory_name[len] = '\0';
+
+			D(("volume name = \"%s\"", root_directory_name));
+			D(("creation date and time = %ld/%ld/%ld",
+				rdb->rdb_DiskInitialization.ds_Days,
+				rdb->rdb_DiskInitialization.ds_Minute,
+				rdb->rdb_DiskInitialization.ds_Tick));
+
+			CopyMem(root_directory_name, tfu->tfu_RootDirName, len+1);
+			tfu->tfu_RootDirDate = rdb->rdb_DiskInitialization;
+		}
+	}
+
+	LEAVE();
+}
+
+/****************************************************************************/
+
+/* Read the sectors of the track in the track buffer which were not
+ * loaded because a write operation was about to replace them, but which
+ * are needed after all, either because they are about to be read or
+ * because the whole track is about to be written back to the file. The
+ * sectors which already hold valid data remain unchanged. Returns a
+ * trackdisk.device error code if this fails.
+ */
+static LONG
+complete_track_data(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	UBYTE * track_data = tfu->tfu_TrackData;
+	LONG first_sector, num_sectors;
+	LONG new_position;
+	LONG num_bytes;
+	LONG error = OK;
+
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( 0 <= tfu->tfu_CurrentTrackNumber && tfu->tfu_CurrentTrackNumber < tfu->tfu_NumTracks );
+	ASSERT( tfu->tfu_File != ZERO );
+
+	if(tfu->tfu_ValidSectors == ALL_SECTORS_VALID(tfu))
+		goto out;
+
+	/* Only plain ADF files can be written to. */
+	ASSERT( NOT TRACKS_ARE_INDEXED(tfu) );
+
+	D(("track %ld is incomplete (valid sectors = 0x%08lx); reading the missing sectors",
+		tfu->tfu_CurrentTrackNumber, tfu->tfu_ValidSectors));
+
+	first_sector = 0;
+
+	while(first_sector < tfu->tfu_SectorsPerTrack)
+	{
+		if(FLAG_IS_SET(tfu->tfu_ValidSectors, (1UL << first_sector)))
+		{
+			first_sector++;
+			continue;
+		}
+
+		/* Read as many consecutive missing sectors in one go as possible. */
+		for(num_sectors = 1 ;
+		    first_sector + num_sectors < tfu->tfu_SectorsPerTrack && FLAG_IS_CLEAR(tfu->tfu_ValidSectors, (1UL << (first_sector + num_sectors))) ;
+		    num_sectors++)
+		{
+			;
+		}
+
+		new_position	= OFFSET_FROM_TRACK(tfu, tfu->tfu_CurrentTrackNumber) + first_sector * TD_SECTOR;
+		num_bytes		= num_sectors * TD_SECTOR;
+
+		if(read_image_data(tfu, tfu->tfu_File, new_position, &track_data[first_sector * TD_SECTOR], num_bytes) != num_bytes)
+		{
+			D(("could not read %ld sectors from sector %ld on (error=%ld)", num_sectors, first_sector, IoErr()));
+
+			error = TDERR_BadSecHdr;
+			goto out;
+		}
+
+		SET_FLAG(tfu->tfu_ValidSectors, SECTOR_RANGE(first_sector, num_sectors));
+
+		first_sector += num_sectors;
+	}
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* If a checkpoint was taken, save the contents of a track which is about
+ * to be changed for the first time since then. The disk image file, and
+ * the cache which mirrors it, still hold the contents as of the checkpoint.
+ * Returns a trackdisk.device error code if this fails.
+ */
+static LONG
+preserve_checkpoint_track(struct TrackFileUnit * tfu, LONG which_track)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	BOOL found = FALSE;
+	LONG position;
+	APTR data;
+	LONG error = OK;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( 0 <= which_track && which_track < tfu->tfu_NumTracks );
+	ASSERT( tfu->tfu_NumTracks <= NUM_STATISTICS_TRACKS );
+
+	if(NOT tfu->tfu_CheckpointActive || tfu->tfu_CheckpointTracks[which_track] != NULL)
+		goto out;
+
+	D(("preserving the contents of track %ld", which_track));
+
+	data = AllocVec(tfu->tfu_TrackDataSize, MEMF_ANY|MEMF_PUBLIC);
+	if(data == NULL)
+	{
+		SHOWMSG("not enough memory for the track copy");
+
+		error = TDERR_NoMem;
+		goto out;
+	}
+
+	#if defined(ENABLE_CACHE)
+	{
+		if(unit_uses_cache(tfu) &&
+		   read_cache_contents(tfd->tfd_CacheContext,
+		   tfu, which_track,
+		   data, tfu->tfu_TrackDataSize))
+		{
+			D(("track %ld is in the cache", which_track));
+
+			found = TRUE;
+		}
+	}
+	#endif /* ENABLE_CACHE */
+
+	if(NOT found)
+	{
+		position = OFFSET_FROM_TRACK(tfu, which_track);
+
+		if(read_image_data(tfu, tfu->tfu_File, position, data, tfu->tfu_TrackDataSize) != tfu->tfu_TrackDataSize)
+		{
+			D(("could not read track %ld (error=%ld)", which_track, IoErr()));
+
+			FreeVec(data);
+
+			error = TDERR_BadSecHdr;
+			goto out;
+		}
+	}
+
+	fletcher64_checksum(data, tfu->tfu_TrackDataSize, &tfu->tfu_CheckpointChecksums[which_track]);
+
+	tfu->tfu_CheckpointTracks[which_track] = data;
+	tfu->tfu_NumCheckpointTracks++;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* If the track buffer has been modified, write its contents
+ * back to the disk image file. This is used most prominently
+ * by the CMD_UPDATE command.
+ */
+LONG
+write_back_track_data(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct fletcher64_checksum new_track_checksum;
+	LONG error;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
+
+	ASSERT( tfu->tfu_TrackDataChanged );
+	ASSERT( NOT tfu->tfu_WriteProtected );
+	ASSERT( 0 <= tfu->tfu_CurrentTrackNumber && tfu->tfu_CurrentTrackNumber < tfu->tfu_NumTracks );
+	ASSERT( tfu->tfu_File != ZERO );
+	ASSERT( NOT multiplication_overflows(tfu->tfu_CurrentTrackNumber, tfu->tfu_TrackDataSize) );
+	ASSERT( tfu->tfu_CurrentTrackNumber * tfu->tfu_TrackDataSize >= 0 );
+
+	/* The whole track will be written, so the sectors which were
+	 * never read have to be read now.
+	 */
+	error = complete_track_data(tfu);
+	if(error != OK)
+		goto out;
+
+	D(("OLD checksum for track %3ld = 0x%08lx%08lx",
+		tfu->tfu_CurrentTrackNumber,
+		tfu->tfu_TrackDataChecksum.f64c_high, tfu->tfu_TrackDataChecksum.f64c_low));
+
+	/* Let's see if the data really needs to be written back to the file. */
+	fletcher64_checksum(tfu->tfu_TrackData, tfu->tfu_TrackDataSize, &new_track_checksum);
+
+	D(("NEW checksum for track %3ld = 0x%08lx%08lx",
+		tfu->tfu_CurrentTrackNumber,
+		new_track_checksum.f64c_high, new_track_checksum.f64c_low));
+
+	if(tfu->tfu_IgnoreTrackChecksum || compare_fletcher64_checksums(&tfu->tfu_TrackDataChecksum, &new_track_checksum) != SAME)
+	{
+		LONG new_position;
+
+		/* Next time, do not ignore the old track checksum. */
+		tfu->tfu_IgnoreTrackChecksum = FALSE;
+
+		SHOWMSG("track contents have been changed, so we really need to write them back");
+
+		new_position = OFFSET_FROM_TRACK(tfu, tfu->tfu_CurrentTrackNumber);
+
+		D(("writing to track %ld at file position %ld (%ld bytes are written from the track buffer at 0x%08lx)",
+			tfu->tfu_CurrentTrackNumber, new_position, tfu->tfu_TrackDataSize, tfu->tfu_TrackData));
+
+		ASSERT( tfu->tfu_TrackDataSize > 0 );
+
+		error = preserve_checkpoint_track(tfu, tfu->tfu_CurrentTrackNumber);
+		if(error != OK)
+			goto out;
+
+		if(write_image_data(tfu, tfu->tfu_File, new_position, tfu->tfu_TrackData, tfu->tfu_TrackDataSize) == -1)
+		{
+			error = translate_write_error(tfu, IoErr());
+			goto out;
+		}
+
+		tfu->tfu_TrackStatistics[tfu->tfu_CurrentTrackNumber].tfts_Writes++;
+
+		/* Update the cache's idea of what should be stored in it.
+		 * This needs to be done even if the cache is disabled for
+		 * this unit because a different unit may share the cache
+		 * entries for the same disk image file.
+		 */
+		#if defined(ENABLE_CACHE)
+		{
+			SHOWPOINTER(tfd->tfd_CacheContext);
+			SHOWPOINTER(tfu->tfu_CacheImage);
+			SHOWVALUE(tfu->tfu_DriveType);
+
+			if(tfd->tfd_CacheContext != NULL &&
+			   tfu->tfu_CacheImage != NULL &&
+			   tfu->tfu_DriveType != DRIVE3_5_150RPM)
+			{
+				/* The file modification date no longer
+				 * identifies the image contents.
+				 */
+				tfu->tfu_CacheImage->ci_Modified = TRUE;
+
+				update_cache_contents(tfd->tfd_CacheContext,
+					tfu, tfu->tfu_CurrentTrackNumber,
+					tfu->tfu_TrackData, tfu->tfu_TrackDataSize,
+					UDN_UpdateOnly);
+			}
+		}
+		#endif /* ENABLE_CACHE */
+
+		update_volume_information(tfu, tfu->tfu_CurrentTrackNumber, tfu->tfu_TrackData);
+
+		/* Update the track checksum, while we're at it. */
+		tfu->tfu_TrackDataChecksum = new_track_checksum;
+
+		if(tfu->tfu_DiskChecksumTable != NULL)
+		{
+			ASSERT( 0 <= tfu->tfu_CurrentTrackNumber && tfu->tfu_CurrentTrackNumber < tfu->tfu_DiskChecksumTableLength );
+
+			tfu->tfu_DiskChecksumTable[tfu->tfu_CurrentTrackNumber] = new_track_checksum;
+			tfu->tfu_ChecksumUpdated = TRUE;
+		}
+
+		/* The file data may have to be flushed to disk
+		 * before the medium is ejected.
+		 */
+		tfu->tfu_ChangesMade = TRUE;
+	}
+	else
+	{
+		SHOWMSG("track contents are unchanged; no need to write them back");
+	}
+
+	tfu->tfu_TrackDataChanged = FALSE;
+
+	error = OK;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Fill in the data of a run of consecutive tracks, on behalf of
+ * TFCopyUnitTagList(). The track buffer takes precedence since it
+ * may hold changes which have not been written back yet, followed
+ * by the cache. Whatever is left is read from the disk image file,
+ * as many consecutive tracks in one go as possible. None of this
+ * counts as a track access, and the track buffer is left alone.
+ */
+LONG
+read_track_run(struct TrackFileUnit * tfu, struct TrackFileTrackRun * tftr)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	UBYTE * run_data = tftr->tftr_Data;
+	ULONG tracks_to_read = 0;
+	LONG num_tracks_to_read;
+	LONG num_bytes_to_read;
+	LONG new_position;
+	LONG which_track;
+	LONG error;
+	LONG i;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
+
+	ASSERT( tfu->tfu_File != ZERO );
+	ASSERT( 0 < tftr->tftr_NumTracks && tftr->tftr_NumTracks <= MAX_TRACK_RUN_LENGTH );
+	ASSERT( 0 <= tftr->tftr_FirstTrack && tftr->tftr_FirstTrack + tftr->tftr_NumTracks <= tfu->tfu_NumTracks );
+
+	for(i = 0 ; i < tftr->tftr_NumTracks ; i++)
+	{
+		which_track = tftr->tftr_FirstTrack + i;
+
+		if(which_track == tfu->tfu_CurrentTrackNumber)
+		{
+			D(("track %ld is in the track buffer", which_track));
+
+			error = complete_track_data(tfu);
+			if(error != OK)
+				goto out;
+
+			CopyMem(tfu->tfu_TrackData, &run_data[OFFSET_FROM_TRACK(tfu, i)], tfu->tfu_TrackDataSize);
+			continue;
+		}
+
+		#if defined(ENABLE_CACHE)
+		{
+			if(unit_uses_cache(tfu) &&
+			   read_cache_contents(tfd->tfd_CacheContext,
+			   tfu, which_track,
+			   &run_data[OFFSET_FROM_TRACK(tfu, i)], tfu->tfu_TrackDataSize))
+			{
+				D(("track %ld is in the cache", which_track));
+				continue;
+			}
+		}
+		#endif /* ENABLE_CACHE */
+
+		SET_FLAG(tracks_to_read, (1UL << i));
+	}
+
+	/* The tracks of extended ADF files and packed disk image files
+	 * are not stored back to back, and may have to be decoded or
+	 * unpacked, so we read them one at a time.
+	 */
+	if(TRACKS_ARE_INDEXED(tfu))
+	{
+		for(i = 0 ; i < tftr->tftr_NumTracks ; i++)
+		{
+			if(FLAG_IS_CLEAR(tracks_to_read, (1UL << i)))
+				continue;
+
+			error = read_indexed_track(tfu, tftr->tftr_FirstTrack + i, &run_data[OFFSET_FROM_TRACK(tfu, i)]);
+			if(error != OK)
+				goto out;
+		}
+
+		tracks_to_read = 0;
+	}
+
+	i = 0;
+
+	while(i < tftr->tftr_NumTracks)
+	{
+		if(FLAG_IS_CLEAR(tracks_to_read, (1UL << i)))
+		{
+			i++;
+			continue;
+		}
+
+		/* Read as many consecutive tracks in one go as possible. */
+		for(num_tracks_to_read = 1 ;
+		    i + num_tracks_to_read < tftr->tftr_NumTracks && FLAG_IS_SET(tracks_to_read, (1UL << (i + num_tracks_to_read))) ;
+		    num_tracks_to_read++)
+		{
+			;
+		}
+
+		new_position = OFFSET_FROM_TRACK(tfu, tftr->tftr_FirstTrack + i);
+
+		num_bytes_to_read = num_tracks_to_read * tfu->tfu_TrackDataSize;
+
+		D(("reading %ld tracks (%ld bytes) from file at position %ld",
+			num_tracks_to_read, num_bytes_to_read, new_position));
+
+		if(read_image_data(tfu, tfu->tfu_File, new_position, &run_data[OFFSET_FROM_TRACK(tfu, i)], num_bytes_to_read) != num_bytes_to_read)
+		{
+			D(("that read didn't work (error=%ld)", IoErr()));
+
+			error = TDERR_BadSecHdr;
+			goto out;
+		}
+
+		i += num_tracks_to_read;
+	}
+
+	/* Carry over the track checksums, if possible. The checksum of
+	 * the track in the track buffer is out of date if the buffer
+	 * contents have been modified.
+	 */
+	if(tftr->tftr_Checksums != NULL)
+	{
+		for(i = 0 ; i < tftr->tftr_NumTracks ; i++)
+		{
+			which_track = tftr->tftr_FirstTrack + i;
+
+			if(tfu->tfu_DiskChecksumTable != NULL && NOT (which_track == tfu->tfu_CurrentTrackNumber && tfu->tfu_TrackDataChanged))
+				tftr->tftr_Checksums[i] = tfu->tfu_DiskChecksumTable[which_track];
+			else
+				fletcher64_checksum(&run_data[OFFSET_FROM_TRACK(tfu, i)], tfu->tfu_TrackDataSize, &tftr->tftr_Checksums[i]);
+		}
+	}
+
+	error = OK;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Replace the contents of a run of consecutive tracks in the disk image
+ * file, on behalf of TFCopyUnitTagList(). The whole run is written in
+ * one go, after which the cache, the track checksums and the volume
+ * information are brought up to date. If the track buffer holds one
+ * of the tracks in the run, its contents are discarded.
+ */
+LONG
+write_track_run(struct TrackFileUnit * tfu, const struct TrackFileTrackRun * tftr)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	UBYTE * run_data = tftr->tftr_Data;
+	LONG num_bytes_to_write;
+	LONG new_position;
+	LONG which_track;
+	LONG error;
+	LONG i;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
+
+	ASSERT( tfu->tfu_File != ZERO );
+	ASSERT( NOT tfu->tfu_WriteProtected );
+	ASSERT( 0 < tftr->tftr_NumTracks && tftr->tftr_NumTracks <= MAX_TRACK_RUN_LENGTH );
+	ASSERT( 0 <= tftr->tftr_FirstTrack && tftr->tftr_FirstTrack + tftr->tftr_NumTracks <= tfu->tfu_NumTracks );
+
+	if(tftr->tftr_FirstTrack <= tfu->tfu_CurrentTrackNumber && tfu->tfu_CurrentTrackNumber < tftr->tftr_FirstTrack + tftr->tftr_NumTracks)
+	{
+		D(("track %ld in the track buffer is about to be replaced", tfu->tfu_CurrentTrackNumber));
+
+		mark_track_buffer_as_invalid(tfu);
+	}
+
+	for(i = 0 ; i < tftr->tftr_NumTracks ; i++)
+	{
+		error = preserve_checkpoint_track(tfu, tftr->tftr_FirstTrack + i);
+		if(error != OK)
+			goto out;
+	}
+
+	new_position = OFFSET_FROM_TRACK(tfu, tftr->tftr_FirstTrack);
+
+	num_bytes_to_write = tftr->tftr_NumTracks * tfu->tfu_TrackDataSize;
+
+	D(("writing %ld tracks (%ld bytes) to file at position %ld",
+		tftr->tftr_NumTracks, num_bytes_to_write, new_position));
+
+	if(write_image_data(tfu, tfu->tfu_File, new_position, run_data, num_bytes_to_write) != num_bytes_to_write)
+	{
+		error = translate_write_error(tfu, IoErr());
+		goto out;
+	}
+
+	#if defined(ENABLE_CACHE)
+	{
+		/* The file modification date no longer
+		 * identifies the image contents.
+		 */
+		if(tfd->tfd_CacheContext != NULL && tfu->tfu_CacheImage != NULL)
+			tfu->tfu_CacheImage->ci_Modified = TRUE;
+	}
+	#endif /* ENABLE_CACHE */
+
+	for(i = 0 ; i < tftr->tftr_NumTracks ; i++)
+	{
+		which_track = tftr->tftr_FirstTrack + i;
+
+		tfu->tfu_TrackStatistics[which_track].tfts_Writes++;
+
+		/* Other units may share the cache entries for the same
+		 * disk image file, which is why this needs to be done
+		 * even if the cache is disabled for this unit.
+		 */
+		#if defined(ENABLE_CACHE)
+		{
+			if(tfd->tfd_CacheContext != NULL &&
+			   tfu->tfu_CacheImage != NULL &&
+			   tfu->tfu_DriveType != DRIVE3_5_150RPM)
+			{
+				update_cache_contents(tfd->tfd_CacheContext,
+					tfu, which_track,
+					&run_data[OFFSET_FROM_TRACK(tfu, i)], tfu->tfu_TrackDataSize,
+					UDN_UpdateOnly);
+			}
+		}
+		#endif /* ENABLE_CACHE */
+
+		if(tfu->tfu_DiskChecksumTable != NULL)
+		{
+			ASSERT( which_track < tfu->tfu_DiskChecksumTableLength );
+
+			if(tftr->tftr_Checksums != NULL)
+				tfu->tfu_DiskChecksumTable[which_track] = tftr->tftr_Checksums[i];
+			else
+				fletcher64_checksum(&run_data[OFFSET_FROM_TRACK(tfu, i)], tfu->tfu_TrackDataSize, &tfu->tfu_DiskChecksumTable[which_track]);
+
+			tfu->tfu_ChecksumUpdated = TRUE;
+		}
+
+		update_volume_information(tfu, which_track, &run_data[OFFSET_FROM_TRACK(tfu, i)]);
+	}
+
+	/* The file data may have to be flushed to disk
+	 * before the medium is ejected.
+	 */
+	tfu->tfu_ChangesMade = TRUE;
 
-		new_position = tfu->tfu_CurrentTrackNumber * tfu->tfu_TrackDataSize;
+	error = OK;
 
-		#if DEBUG
-		{
-			LONG current_file_position;
+ out:
 
-			current_file_position = Seek(tfu->tfu_File, 0, OFFSET_CURRENT);
+	RETURN(error);
+	return(error);
+}
 
-			SHOWVALUE(tfu->tfu_FilePosition);
-			SHOWVALUE(current_file_position);
-			SHOWVALUE(new_position);
+/****************************************************************************/
 
-			ASSERT( tfu->tfu_FilePosition < 0 || tfu->tfu_FilePosition == current_file_position );
-		}
-		#endif /* DEBUG */
+/* Release the track contents preserved since the last checkpoint
+ * was taken, and stop preserving them.
+ */
+VOID
+discard_checkpoint(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG which_track;
 
-		if(new_position != tfu->tfu_FilePosition)
-		{
-			if(Seek(tfu->tfu_File, new_position, OFFSET_BEGINNING) == -1)
-			{
-				D(("that seek didn't work (error=%ld)", IoErr()));
+	USE_EXEC(tfd);
 
-				/* We probably don't know where we are now... */
-				tfu->tfu_FilePosition = -1;
+	ENTER();
 
-				error = TDERR_SeekError;
-				goto out;
-			}
+	D(("discarding %ld preserved tracks of unit %ld", tfu->tfu_NumCheckpointTracks, tfu->tfu_UnitNumber));
 
-			tfu->tfu_FilePosition = new_position;
+	for(which_track = 0 ; which_track < NUM_STATISTICS_TRACKS ; which_track++)
+	{
+		if(tfu->tfu_CheckpointTracks[which_track] != NULL)
+		{
+			FreeVec(tfu->tfu_CheckpointTracks[which_track]);
+			tfu->tfu_CheckpointTracks[which_track] = NULL;
 		}
+	}
 
-		ASSERT( tfu->tfu_FilePosition >= 0 );
+	tfu->tfu_NumCheckpointTracks	= 0;
+	tfu->tfu_CheckpointActive		= FALSE;
 
-		D(("writing to track %ld at file position %ld (%ld bytes are written from the track buffer at 0x%08lx)",
-			tfu->tfu_CurrentTrackNumber, tfu->tfu_FilePosition, tfu->tfu_TrackDataSize, tfu->tfu_TrackData));
+	LEAVE();
+}
 
-		ASSERT( tfu->tfu_TrackDataSize > 0 );
+/****************************************************************************/
 
-		if(Write(tfu->tfu_File, tfu->tfu_TrackData, tfu->tfu_TrackDataSize) == -1)
-		{
-			error = IoErr();
+/* Take a checkpoint of the disk contents. Nothing is copied at this
+ * time: the contents of each track are preserved only when the track
+ * is about to be changed for the first time since the checkpoint.
+ * Any previous checkpoint is discarded, and any changes still held
+ * in the track buffer are written back first, so that they become
+ * part of the checkpoint. Returns a trackdisk.device error code if
+ * this fails.
+ */
+LONG
+take_checkpoint(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG error = OK;
 
-			/* We probably don't know where we are now... */
-			tfu->tfu_FilePosition = -1;
+	USE_EXEC(tfd);
 
-			D(("that write didn't work (error=%ld)", error));
+	ENTER();
 
-			/* Let's try and make some sense of the AmigaDOS error code.
-			 * This may not be a reliable approach, though, since every
-			 * file system or handler can pick its own error codes to
-			 * match the situation.
-			 */
-			switch(error)
-			{
-				/* Disk or file is no longer writable. */
-				case ERROR_DISK_NOT_VALIDATED:
-				case ERROR_DISK_WRITE_PROTECTED:
-				case ERROR_WRITE_PROTECTED:
+	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
 
-					D(("obtaining unit %ld lock", tfu->tfu_UnitNumber));
-					ObtainSemaphore(&tfu->tfu_Lock);
+	discard_checkpoint(tfu);
 
-					tfu->tfu_WriteProtected = TRUE;
+	if(tfu->tfu_TrackDataChanged && NOT tfu->tfu_WriteProtected)
+	{
+		error = write_back_track_data(tfu);
+		if(error != OK)
+			goto out;
+	}
 
-					D(("releasing unit %ld lock", tfu->tfu_UnitNumber));
-					ReleaseSemaphore(&tfu->tfu_Lock);
+	tfu->tfu_CheckpointActive = TRUE;
 
-					error = TDERR_WriteProt;
-					break;
+ out:
 
-				/* The disk has been removed. */
-				case ERROR_DEVICE_NOT_MOUNTED:
-				case ERROR_NO_DISK:
+	RETURN(error);
+	return(error);
+}
 
-					SHOWMSG("disk has been removed -- closing the file");
+/****************************************************************************/
 
-					close_unit_file(tfu);
-					turn_off_motor(tfu);
+/* Restore the disk contents as of the last checkpoint. Only the tracks
+ * which were preserved since then are written back, and of these only
+ * the ones whose checksums show that their contents really differ from
+ * the preserved copies. The cache entries of exactly these tracks are
+ * invalidated. Changes still held in the track buffer are discarded.
+ * The checkpoint remains active, so that the disk contents can be
+ * restored again later. Returns ERROR_OBJECT_NOT_FOUND if no checkpoint
+ * was taken, or a trackdisk.device error code if this fails.
+ */
+LONG
+roll_back_to_checkpoint(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG new_position;
+	LONG which_track;
+	APTR data;
+	LONG error;
 
-					error = TDERR_DiskChanged;
-					break;
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
 
-				default:
+	ENTER();
 
-					error = TDERR_SeekError;
-					break;
-			}
+	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
 
-			goto out;
-		}
+	ASSERT( tfu->tfu_File != ZERO );
+	ASSERT( NOT tfu->tfu_WriteProtected );
+	ASSERT( tfu->tfu_NumTracks <= NUM_STATISTICS_TRACKS );
 
-		ASSERT( tfu->tfu_FilePosition >= 0 );
+	if(NOT tfu->tfu_CheckpointActive)
+	{
+		SHOWMSG("no checkpoint was taken");
 
-		tfu->tfu_FilePosition += tfu->tfu_TrackDataSize;
+		error = ERROR_OBJECT_NOT_FOUND;
+		goto out;
+	}
 
-		/* If the cache is enabled, update the cache's idea
-		 * of what should be stored in it.
-		 */
-		#if defined(ENABLE_CACHE)
-		{
-			SHOWPOINTER(tfd->tfd_CacheContext);
-			SHOWVALUE(tfu->tfu_CacheEnabled);
-			SHOWVALUE(tfu->tfu_DriveType);
+	D(("restoring up to %ld tracks of unit %ld", tfu->tfu_NumCheckpointTracks, tfu->tfu_UnitNumber));
 
-			if(tfd->tfd_CacheContext != NULL &&
-			   tfu->tfu_CacheEnabled &&
-			   tfu->tfu_DriveType != DRIVE3_5_150RPM)
-			{
-				update_cache_contents(tfd->tfd_CacheContext,
-					tfu, tfu->tfu_CurrentTrackNumber,
-					tfu->tfu_TrackData, tfu->tfu_TrackDataSize,
-					UDN_UpdateOnly);
-			}
-		}
-		#endif /* ENABLE_CACHE */
+	mark_track_buffer_as_invalid(tfu);
+
+	for(which_track = 0 ; which_track < tfu->tfu_NumTracks ; which_track++)
+	{
+		data = tfu->tfu_CheckpointTracks[which_track];
+		if(data == NULL)
+			continue;
 
-		/* Is this the track which contains the reserved blocks,
-		 * i.e. the boot block and the file system signature?
+		/* Skip the tracks which were changed, but which now
+		 * hold the same contents as before.
 		 */
-		if (tfu->tfu_CurrentTrackNumber == 0)
+		if(tfu->tfu_DiskChecksumTable != NULL &&
+		   compare_fletcher64_checksums(&tfu->tfu_DiskChecksumTable[which_track], &tfu->tfu_CheckpointChecksums[which_track]) == SAME)
 		{
-			tfu->tfu_FileSystemSignature = *(ULONG *)tfu->tfu_TrackData;
-
-			D(("file system signature = 0x%08lx", tfu->tfu_FileSystemSignature));
-
-			tfu->tfu_BootBlockChecksum = calculate_boot_block_checksum(tfu->tfu_TrackData, TD_SECTOR * BOOTSECTS);
-
-			D(("boot block checksum = 0x%08lx", tfu->tfu_BootBlockChecksum));
+			D(("track %ld is unchanged", which_track));
 		}
-		/* Is this the track which contains the root directory? */
-		else if (tfu->tfu_CurrentTrackNumber == tfu->tfu_RootDirTrackNumber)
+		else
 		{
-			const struct RootDirBlock * rdb = (struct RootDirBlock *)&((UBYTE *)tfu->tfu_TrackData)[tfu->tfu_RootDirBlockOffset];
+			new_position = OFFSET_FROM_TRACK(tfu, which_track);
 
-			SHOWMSG("updating the root directory information");
+			D(("restoring track %ld at file position %ld", which_track, new_position));
 
-			tfu->tfu_RootDirValid = root_directory_is_valid(rdb);
-			if(tfu->tfu_RootDirValid)
+			if(write_image_data(tfu, tfu->tfu_File, new_position, data, tfu->tfu_TrackDataSize) != tfu->tfu_TrackDataSize)
 			{
-				TEXT root_directory_name[32];
-				size_t len;
+				error = translate_write_error(tfu, IoErr());
+				goto out;
+			}
 
-				len = rdb->rdb_Name[0];
+			tfu->tfu_TrackStatistics[which_track].tfts_Writes++;
 
-				/* Avoid unexpected buffer overflows. */
-				if(len >= sizeof(root_directory_name))
-					len = sizeof(root_directory_name)-1;
+			/* Other units may share the cache entries for the same
+			 * disk image file, which is why this needs to be done
+			 * even if the cache is disabled for this unit.
+			 */
+			#if defined(ENABLE_CACHE)
+			{
+				if(tfd->tfd_CacheContext != NULL && tfu->tfu_CacheImage != NULL)
+				{
+					/* The file modification date no longer
+					 * identifies the image contents.
+					 */
+					tfu->tfu_CacheImage->ci_Modified = TRUE;
 
-				CopyMem(&rdb->rdb_Name[1], root_directory_name, len);
-				root_directory_name[len] = '\0';
+					invalidate_cache_entry(tfd->tfd_CacheContext, CACHE_KEY(tfu->tfu_CacheImage->ci_ImageNumber, which_track));
+				}
+			}
+			#endif /* ENABLE_CACHE */
 
-				D(("volume name = \"%s\"", root_directory_name));
-				D(("creation date and time = %ld/%ld/%ld",
-					rdb->rdb_DiskInitialization.ds_Days,
-					rdb->rdb_DiskInitialization.ds_Minute,
-					rdb->rdb_DiskInitialization.ds_Tick));
+			if(tfu->tfu_DiskChecksumTable != NULL)
+			{
+				ASSERT( which_track < tfu->tfu_DiskChecksumTableLength );
 
-				CopyMem(root_directory_name, tfu->tfu_RootDirName, len+1);
-				tfu->tfu_RootDirDate = rdb->rdb_DiskInitialization;
+				tfu->tfu_DiskChecksumTable[which_track] = tfu->tfu_CheckpointChecksums[which_track];
+				tfu->tfu_ChecksumUpdated = TRUE;
 			}
-		}
-
-		/* Update the track checksum, while we're at it. */
-		tfu->tfu_TrackDataChecksum = new_track_checksum;
 
-		if(tfu->tfu_DiskChecksumTable != NULL)
-		{
-			ASSERT( 0 <= tfu->tfu_CurrentTrackNumber && tfu->tfu_CurrentTrackNumber < tfu->tfu_DiskChecksumTableLength );
+			update_volume_information(tfu, which_track, data);
 
-			tfu->tfu_DiskChecksumTable[tfu->tfu_CurrentTrackNumber] = new_track_checksum;
-			tfu->tfu_ChecksumUpdated = TRUE;
+			/* The file data may have to be flushed to disk
+			 * before the medium is ejected.
+			 */
+			tfu->tfu_ChangesMade = TRUE;
 		}
 
-		/* The file data may have to be flushed to disk
-		 * before the medium is ejected.
+		/* The track now holds the same contents as at the
+		 * time the checkpoint was taken.
 		 */
-		tfu->tfu_ChangesMade = TRUE;
-	}
-	else
-	{
-		SHOWMSG("track contents are unchanged; no need to write them back");
-	}
+		FreeVec(data);
+		tfu->tfu_CheckpointTracks[which_track] = NULL;
 
-	tfu->tfu_TrackDataChanged = FALSE;
+		tfu->tfu_NumCheckpointTracks--;
+	}
 
 	error = OK;
 
@@ -1053,13 +1984,13 @@ cmd_read(struct IOStdReq * io)
 		ASSERT( tfu->tfu_TrackDataSize > 0 );
 
 		/* Which track is the requested data stored on? */
-		which_track = io->io_Offset / tfu->tfu_TrackDataSize;
+		which_track = TRACK_FROM_OFFSET(tfu, io->io_Offset);
 
 		ASSERT( 0 <= which_track && which_track < tfu->tfu_NumTracks );
 		ASSERT( which_track * tfu->tfu_TrackDataSize < tfu->tfu_FileSize );
 
 		/* Where on that track does the read operation begin? */
-		source_position = io->io_Offset % tfu->tfu_TrackDataSize;
+		source_position = io->io_Offset - OFFSET_FROM_TRACK(tfu, which_track);
 
 		/* How much data can we read from the track? */
 		num_bytes_available = tfu->tfu_TrackDataSize - source_position;
@@ -1121,6 +2052,23 @@ cmd_read(struct IOStdReq * io)
 					goto out;
 				}
 			}
+			/* Were the sectors to be read never loaded, because the
+			 * track was written to without reading it first?
+			 */
+			else
+			{
+				ULONG sectors = SECTOR_RANGE(source_position / TD_SECTOR, num_bytes / TD_SECTOR);
+
+				if((tfu->tfu_ValidSectors & sectors) != sectors)
+				{
+					error = complete_track_data(tfu);
+					if(error != OK)
+					{
+						D(("couldn't complete the track data, error=%ld", error));
+						goto out;
+					}
+				}
+			}
 
 			ASSERT( destination == io->io_Data );
 
@@ -1537,13 +2485,13 @@ cmd_write(struct IOStdReq * io)
 		ASSERT( tfu->tfu_TrackDataSize > 0 );
 
 		/* Which track is the data stored on? */
-		which_track = io->io_Offset / tfu->tfu_TrackDataSize;
+		which_track = TRACK_FROM_OFFSET(tfu, io->io_Offset);
 
 		ASSERT( 0 <= which_track && which_track < tfu->tfu_NumTracks );
 		ASSERT( which_track * tfu->tfu_TrackDataSize < tfu->tfu_FileSize );
 
 		/* Where on that track does the write operation begin? */
-		destination_position = io->io_Offset % tfu->tfu_TrackDataSize;
+		destination_position = io->io_Offset - OFFSET_FROM_TRACK(tfu, which_track);
 
 		/* How much data can we write to the track? */
 		num_bytes_remaining = tfu->tfu_TrackDataSize - destination_position;
@@ -1599,12 +2547,14 @@ cmd_write(struct IOStdReq * io)
 				}
 
 				/* Will this write operation leave parts of the track
-				 * unchanged? Then we will need to read the track
-				 * data first.
+				 * unchanged? If the cache holds the track, reading
+				 * it first costs next to nothing. Otherwise the
+				 * sectors which are not written to are read only
+				 * if they are needed later.
 				 */
-				if(num_bytes < tfu->tfu_TrackDataSize)
+				if(num_bytes < tfu->tfu_TrackDataSize && track_is_in_cache(tfu, which_track))
 				{
-					D(("track %ld will be partly overwritten; we will have to read it...", which_track));
+					D(("track %ld will be partly overwritten; reading it from the cache...", which_track));
 
 					error = read_track_data(tfu, which_track);
 					if(error != OK)
@@ -1613,15 +2563,16 @@ cmd_write(struct IOStdReq * io)
 						goto out;
 					}
 				}
-				/* Otherwise it doesn't matter. The contents of the track will
-				 * be completely replaced.
+				/* Otherwise the track need not be read now. Only the
+				 * sectors written to will hold valid data.
 				 */
 				else
 				{
-					D(("entire track %ld will be overwritten; no need to read it.", which_track));
+					D(("track %ld will be overwritten; no need to read it.", which_track));
 
 					/* Data will be written to this new track. */
 					tfu->tfu_CurrentTrackNumber = tfu->tfu_Unit.tdu_CurrTrk = which_track;
+					tfu->tfu_ValidSectors = 0;
 
 					/* When writing back this track, do not compare the
 					 * the old track checksum against the new one to
@@ -1638,6 +2589,8 @@ cmd_write(struct IOStdReq * io)
 
 			CopyMem(&source[source_position], &destination[destination_position], num_bytes);
 
+			SET_FLAG(tfu->tfu_ValidSectors, SECTOR_RANGE(destination_position / TD_SECTOR, num_bytes / TD_SECTOR));
+
 			tfu->tfu_TrackDataChanged = TRUE;
 
 			ASSERT( num_bytes_to_write >= num_bytes );
@@ -2143,7 +3096,10 @@ td_format(struct IOStdReq * io)
 		/* This must be a complete track. */
 		destination_position = 0;
 
-		/* Which track is the data stored on? */
+		/* Which track is the data stored on? Formatting is not
+		 * performance critical, which is why we can afford the
+		 * division here.
+		 */
 		which_track = io->io_Offset / tfu->tfu_TrackDataSize;
 
 		ASSERT( NOT multiplication_overflows(which_track, tfu->tfu_TrackDataSize) );
@@ -2198,6 +3154,9 @@ td_format(struct IOStdReq * io)
 
 			tfu->tfu_CurrentTrackNumber = tfu->tfu_Unit.tdu_CurrTrk = which_track;
 
+			/* The rest of the track buffer was cleared. */
+			tfu->tfu_ValidSectors = ALL_SECTORS_VALID(tfu);
+
 			ASSERT( num_bytes_to_write > 0 );
 			ASSERT( num_bytes_remaining > 0 );
 
@@ -2697,12 +3656,19 @@ td_protstatus(struct IOStdReq * io)
 *   FUNCTION
 *	These commands will produce a track of raw MFM-encoded data from the
 *	disk image file data as if it had been read from an Amiga floppy disk
-*	drive. This has no real practical use beyond experimentation, testing
-*	and quality assurance work.
+*	drive.
+*
+*	If the disk image file is an extended ADF file which stores the
+*	track as raw MFM data, that data is returned as is, without the
+*	io_Flags having any effect. The data is repeated if more is
+*	requested than the track holds.
 *
-*	The MFM-encoded data follows the specifications of the Amiga 1.0
-*	disk format, as described in the 3rd edition "Amiga ROM Kernel
-*	Reference Manual: Devices", Appendix C.
+*	Otherwise, the track data is MFM-encoded, following the specifications
+*	of the Amiga 1.0 disk format, as described in the 3rd edition "Amiga
+*	ROM Kernel Reference Manual: Devices", Appendix C. This has no real
+*	practical use beyond experimentation, testing and quality assurance
+*	work, and it is only supported if trackfile.device was built with
+*	the MFM encoding enabled.
 *
 *   IO REQUEST INPUT
 *	io_Device	preset by the call to OpenDevice()
@@ -2728,6 +3694,10 @@ td_protstatus(struct IOStdReq * io)
 *	Even if successful, these commands will not update the io_Actual field
 *	to reflect the amount of data read.
 *
+*	IOERR_NOCMD is returned for a track which would have to be
+*	MFM-encoded, but trackfile.device was built without support
+*	for MFM encoding.
+*
 *   SEE ALSO
 *	trackdisk.device/TD_RAWREAD
 *	trackdisk.device/TD_RAWWRITE
@@ -2762,6 +3732,8 @@ xor_shift_32(ULONG x)
 	return(x);
 }
 
+#endif /* ENABLE_MFM_ENCODING */
+
 static LONG
 td_rawread(struct IOStdReq * io)
 {
@@ -2848,9 +3820,30 @@ td_rawread(struct IOStdReq * io)
 
 	tfu->tfu_MotorEnabled = TRUE;
 
+	/* Raw MFM tracks of an extended ADF file are copied as is. */
+	if(io->io_Length > 0 && tfu->tfu_ExtendedADF != NULL && tfu->tfu_ExtendedADF->eai_Tracks[io->io_Offset].eat_Type == EAT_RawMFM)
+	{
+		LONG to_length = io->io_Length;
+
+		/* The Amiga hardware transfers 16 bit words. */
+		if((to_length % 2) > 0 && to_length < 32768)
+			to_length++;
+
+		/* We don't know where we will end up in the file. */
+		tfu->tfu_FilePosition = -1;
+
+		error = read_extended_adf_raw_track(tfd, tfu->tfu_ExtendedADF, tfu->tfu_File, io->io_Offset, io->io_Data, to_length);
+		if(error != OK)
+		{
+			D(("couldn't read the raw track data, error=%ld", error));
+			goto out;
+		}
+	}
 	/* Do we need to read anything at all? */
-	if(io->io_Length > 0)
+	else if (io->io_Length > 0)
 	{
+	#if defined(ENABLE_MFM_ENCODING)
+
 		LONG which_track = io->io_Offset;
 		const BYTE * source = tfu->tfu_TrackData;
 		BYTE * destination = io->io_Data;
@@ -2879,6 +3872,15 @@ td_rawread(struct IOStdReq * io)
 				goto out;
 			}
 		}
+		else
+		{
+			error = complete_track_data(tfu);
+			if(error != OK)
+			{
+				D(("couldn't complete the track data, error=%ld", error));
+				goto out;
+			}
+		}
 
 		/* Encode all the track sectors in sequence. */
 		reset_mfm_code_context(mcc);
@@ -3006,6 +4008,15 @@ td_rawread(struct IOStdReq * io)
 			if(++from == from_length)
 				from = 0;
 		}
+
+	#else
+
+		SHOWMSG("MFM encoding is not supported");
+
+		error = IOERR_NOCMD;
+		goto out;
+
+	#endif /* ENABLE_MFM_ENCODING */
 	}
 
 	SHOWMSG("that went well");
@@ -3021,8 +4032,6 @@ td_rawread(struct IOStdReq * io)
 	return(error);
 }
 
-#endif /* ENABLE_MFM_ENCODING */
-
 /****************************************************************************/
 
 /****** trackfile.device/TD_REMCHANGEINT *************************************
@@ -3346,12 +4355,8 @@ nscmd_devicequery(struct IOStdReq * io)
 		TD_GETNUMTRACKS,
 		TD_MOTOR,
 		TD_PROTSTATUS,
-	#if defined(ENABLE_MFM_ENCODING)
-
 		TD_RAWREAD,
 		ETD_RAWREAD,
-
-	#endif /* ENABLE_MFM_ENCODING */
 		TD_REMCHANGEINT,
 		TD_REMOVE,
 		TD_SEEK,
@@ -3508,16 +4513,12 @@ perform_io(struct IOStdReq * io)
 			error = td_protstatus(io);
 			break;
 
-	#if defined(ENABLE_MFM_ENCODING)
-
 		case TD_RAWREAD:
 		case ETD_RAWREAD:
 
 			error = td_rawread(io);
 			break;
 
-	#endif /* ENABLE_MFM_ENCODING */
-
 		case TD_REMCHANGEINT:
 
 			error = td_remchangeint(io);
@@ -3640,13 +4641,9 @@ is_known_command(const struct IORequest * io)
 		case TD_SEEK:
 		case NSCMD_DEVICEQUERY:
 
-	#if defined(ENABLE_MFM_ENCODING)
-
 		case TD_RAWREAD:
 		case ETD_RAWREAD:
 
-	#endif /* ENABLE_MFM_ENCODING */
-
 			is_known = TRUE;
 			break;
 
@@ -3663,6 +4660,96 @@ is_known_command(const struct IORequest * io)
 
 /****************************************************************************/
 
+/* Check if the I/O request is a CMD_READ, CMD_WRITE, ETD_READ or
+ * ETD_WRITE command which uses the 'struct IOStdReq' fields. Returns
+ * TRUE if so, FALSE otherwise.
+ */
+BOOL
+is_read_write_command(const struct IORequest * io)
+{
+	BOOL is_read_write;
+
+	ASSERT( io != NULL );
+
+	switch(io->io_Command)
+	{
+		case CMD_READ:
+		case CMD_WRITE:
+		case ETD_READ:
+		case ETD_WRITE:
+
+			is_read_write = (BOOL)(check_io_request_size((struct IOStdReq *)io) == OK);
+			break;
+
+		default:
+
+			is_read_write = FALSE;
+			break;
+	}
+
+	return(is_read_write);
+}
+
+/****************************************************************************/
+
+/* Check if the I/O request is a read or write command which cmd_read()
+ * or cmd_write() would accept, and which part of the disk it covers.
+ * Returns TRUE if so, FALSE otherwise. If this function returns FALSE,
+ * the command may still be performed, but it will fail before any data
+ * is transferred.
+ *
+ * The unit Process uses this information to split large requests into
+ * smaller chunks, and to decide which requests may be performed in
+ * between these chunks.
+ */
+BOOL
+get_io_request_range(const struct IOStdReq * io, ULONG * offset_ptr, ULONG * length_ptr, BOOL * is_write_ptr)
+{
+	struct TrackFileUnit * tfu = (struct TrackFileUnit *)io->io_Unit;
+	BOOL is_write;
+	BOOL result = FALSE;
+
+	ASSERT( io != NULL && offset_ptr != NULL && length_ptr != NULL && is_write_ptr != NULL );
+
+	if(NOT is_read_write_command((struct IORequest *)io))
+		goto out;
+
+	is_write = (BOOL)(io->io_Command == CMD_WRITE || io->io_Command == ETD_WRITE);
+
+	if(NOT unit_medium_is_present(tfu))
+		goto out;
+
+	if(is_write && tfu->tfu_WriteProtected)
+		goto out;
+
+	if(check_extended_command(io) != OK)
+		goto out;
+
+	if(check_offset(io) != OK)
+		goto out;
+
+	if(check_io_request_data_and_length(io, 0, TD_SECTOR, sizeof(WORD)) != OK)
+		goto out;
+
+	if(addition_overflows(io->io_Offset, io->io_Length) ||
+	   io->io_Offset + io->io_Length > (ULONG)tfu->tfu_FileSize)
+	{
+		goto out;
+	}
+
+	(*offset_ptr)	= io->io_Offset;
+	(*length_ptr)	= io->io_Length;
+	(*is_write_ptr)	= is_write;
+
+	result = TRUE;
+
+ out:
+
+	return(result);
+}
+
+/****************************************************************************/
+
 /* Mark both the buffer contents as invalid, as well as
  * the number of the track which the buffer's contents
  * used to be associated with.
@@ -3674,6 +4761,7 @@ mark_track_buffer_as_invalid(struct TrackFileUnit * tfu)
 
 	tfu->tfu_TrackDataChanged	= FALSE;
 	tfu->tfu_CurrentTrackNumber	= -1;
+	tfu->tfu_ValidSectors		= 0;
 }
 
 /****************************************************************************/
@@ -36,6 +36,7 @@
 
 #ifndef _UNIT_H
 struct TrackFileUnit;
+struct TrackFileTrackRun;
 #endif /* _UNIT_H */
 
 /****************************************************************************/
@@ -43,9 +44,17 @@ struct TrackFileUnit;
 VOID mark_track_buffer_as_invalid(struct TrackFileUnit * tfu);
 VOID turn_off_motor(struct TrackFileUnit * tfu);
 LONG write_back_track_data(struct TrackFileUnit * tfu);
+LONG read_track_run(struct TrackFileUnit * tfu, struct TrackFileTrackRun * tftr);
+LONG write_track_run(struct TrackFileUnit * tfu, const struct TrackFileTrackRun * tftr);
+VOID discard_checkpoint(struct TrackFileUnit * tfu);
+LONG take_checkpoint(struct TrackFileUnit * tfu);
+LONG roll_back_to_checkpoint(struct TrackFileUnit * tfu);
+LONG prefetch_track(struct TrackFileUnit * tfu, LONG which_track, APTR data, BOOL * loaded_ptr);
 VOID perform_io(struct IOStdReq *io);
 BOOL is_immediate_command(const struct IORequest *io);
 BOOL is_known_command(const struct IORequest *io);
+BOOL is_read_write_command(const struct IORequest *io);
+BOOL get_io_request_range(const struct IOStdReq *io, ULONG *offset_ptr, ULONG *length_ptr, BOOL *is_write_ptr);
 
 /****************************************************************************/
 
@@ -0,0 +1,609 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+#include "extended_adf.h"
+
+/****************************************************************************/
+
+/* The sector header sync pattern, as it appears in the MFM data. */
+#define MFM_SYNC_WORDS 0x44894489
+
+/* Only the odd bits of an MFM-encoded longword carry data. */
+#define MFM_DATA_BITS 0x55555555
+
+/* Part of the sector header, identifying the Amiga 1.0 format */
+#define AMIGA_10_FORMAT 0xFF
+
+/****************************************************************************/
+
+/* Release the memory allocated by examine_extended_adf(). */
+VOID
+free_extended_adf(struct TrackFileDevice * tfd, struct ExtendedADFImage * eai)
+{
+	USE_EXEC(tfd);
+
+	if(eai != NULL)
+	{
+		FreeVec(eai->eai_RawTrack);
+		FreeVec(eai);
+	}
+}
+
+/****************************************************************************/
+
+/* Check if the file is an extended ADF file and, if it is, find out where
+ * the tracks are stored. For a plain ADF file no error is returned, and
+ * the image pointer is set to NULL. The file must contain at least as
+ * many tracks as requested, and any tracks which store sector data must
+ * be of the expected size. Note that this leaves the file position
+ * undefined.
+ */
+LONG
+examine_extended_adf(
+	struct TrackFileDevice *	tfd,
+	BPTR						file,
+	LONG						num_tracks,
+	LONG						track_size,
+	struct ExtendedADFImage **	eai_ptr)
+{
+	struct ExtendedADFImage * eai = NULL;
+	struct ExtendedADFFileHeader eafh;
+	struct ExtendedADFTrackHeader eath;
+	struct ExtendedADFTrack * eat;
+	LONG max_raw_track_size = 0;
+	LONG num_bytes_read;
+	LONG offset;
+	LONG error;
+	LONG i;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( num_tracks > 0 && track_size > 0 );
+
+	(*eai_ptr) = NULL;
+
+	if(Seek(file, 0, OFFSET_BEGINNING) == -1)
+	{
+		error = IoErr();
+
+		D(("could not seek to the start of the file (error=%ld)", error));
+		goto out;
+	}
+
+	num_bytes_read = Read(file, &eafh, sizeof(eafh));
+	if(num_bytes_read == -1)
+	{
+		error = IoErr();
+
+		D(("could not read the file header (error=%ld)", error));
+		goto out;
+	}
+
+	/* A plain ADF file it is, then. */
+	if(num_bytes_read != sizeof(eafh) || memcmp(eafh.eafh_Signature, EXTENDED_ADF_SIGNATURE, sizeof(eafh.eafh_Signature)) != SAME)
+	{
+		SHOWMSG("this is not an extended ADF file");
+
+		error = OK;
+		goto out;
+	}
+
+	D(("extended ADF file with %ld tracks", eafh.eafh_NumTracks));
+
+	if(eafh.eafh_NumTracks < num_tracks)
+	{
+		D(("file contains only %ld tracks, but %ld are needed", eafh.eafh_NumTracks, num_tracks));
+
+		error = TFERROR_InvalidFileSize;
+		goto out;
+	}
+
+	eai = AllocVec(sizeof(*eai) + sizeof(eai->eai_Tracks[0]) * (num_tracks - 1), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	if(eai == NULL)
+	{
+		SHOWMSG("not enough memory");
+
+		error = TFERROR_OutOfMemory;
+		goto out;
+	}
+
+	eai->eai_NumTracks = num_tracks;
+
+	/* The track data follows all the track headers, including those
+	 * of the tracks we are not going to use.
+	 */
+	offset = sizeof(eafh) + sizeof(eath) * eafh.eafh_NumTracks;
+
+	for(i = 0 ; i < num_tracks ; i++)
+	{
+		num_bytes_read = Read(file, &eath, sizeof(eath));
+		if(num_bytes_read != sizeof(eath))
+		{
+			error = (num_bytes_read == -1) ? IoErr() : TFERROR_InvalidFileSize;
+
+			D(("could not read the header of track %ld (error=%ld)", i, error));
+			goto out;
+		}
+
+		eat = &eai->eai_Tracks[i];
+
+		eat->eat_Offset		= offset;
+		eat->eat_Size		= eath.eath_Size;
+		eat->eat_NumBits	= eath.eath_NumBits;
+		eat->eat_Type		= eath.eath_Type;
+
+		D(("track %ld: type=%ld, offset=%ld, size=%ld, bits=%ld",
+			i, eat->eat_Type, eat->eat_Offset, eat->eat_Size, eat->eat_NumBits));
+
+		if(eat->eat_Type == EAT_Standard)
+		{
+			/* This must be the same as a track of a plain ADF file. */
+			if(eat->eat_Size != track_size)
+			{
+				D(("track %ld holds %ld bytes instead of %ld", i, eat->eat_Size, track_size));
+
+				error = TFERROR_InvalidFileSize;
+				goto out;
+			}
+		}
+		else if (eat->eat_Type == EAT_RawMFM)
+		{
+			LONG raw_track_size = (eat->eat_NumBits + 7) / 8;
+
+			/* The track must hold at least one complete sector, and
+			 * the stored data must cover all of its bits. The start
+			 * of the track is later appended to its end, which
+			 * requires the track to be longer than the slack.
+			 */
+			if(eat->eat_NumBits <= (LONG)(8 * RAW_TRACK_SLACK_SIZE) ||
+			   raw_track_size > eat->eat_Size ||
+			   raw_track_size > MAX_RAW_TRACK_SIZE)
+			{
+				D(("raw track %ld is either too short or too long", i));
+
+				error = TFERROR_InvalidFileSize;
+				goto out;
+			}
+
+			if(max_raw_track_size < raw_track_size)
+				max_raw_track_size = raw_track_size;
+
+			eai->eai_NumRawTracks++;
+		}
+		else
+		{
+			D(("track %ld is of unknown type %ld", i, eat->eat_Type));
+
+			error = TFERROR_InvalidFileSize;
+			goto out;
+		}
+
+		offset += eat->eat_Size;
+	}
+
+	D(("%ld of %ld tracks are raw MFM tracks", eai->eai_NumRawTracks, num_tracks));
+
+	/* The raw track buffer needs to include room for the start of
+	 * the track to be appended to its end, plus one more byte
+	 * for the bit shifts.
+	 */
+	if(max_raw_track_size > 0)
+	{
+		eai->eai_RawTrackSize = max_raw_track_size + RAW_TRACK_SLACK_SIZE + 1;
+
+		eai->eai_RawTrack = AllocVec(eai->eai_RawTrackSize, MEMF_ANY|MEMF_PUBLIC);
+		if(eai->eai_RawTrack == NULL)
+		{
+			SHOWMSG("not enough memory");
+
+			error = TFERROR_OutOfMemory;
+			goto out;
+		}
+	}
+
+	(*eai_ptr) = eai;
+	eai = NULL;
+
+	error = OK;
+
+ out:
+
+	free_extended_adf(tfd, eai);
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Append the first bits of the raw track to its end, so that a sector
+ * which begins shortly before the end of the track can be decoded as
+ * if the track did not wrap around. The track does not necessarily end
+ * on a byte boundary, which is why this may need to shift the data.
+ */
+static VOID
+append_track_start(UBYTE * raw_track, LONG num_bits)
+{
+	UBYTE * to = &raw_track[num_bits / 8];
+	int shift = num_bits % 8;
+	UBYTE carry;
+	LONG i;
+
+	ASSERT( num_bits / 8 >= (LONG)RAW_TRACK_SLACK_SIZE );
+
+	if(shift == 0)
+	{
+		memcpy(to, raw_track, RAW_TRACK_SLACK_SIZE);
+		to[RAW_TRACK_SLACK_SIZE] = 0;
+	}
+	else
+	{
+		/* Keep the bits which still belong to the end of the track. */
+		carry = to[0] & (UBYTE)(0xFF << (8 - shift));
+
+		for(i = 0 ; i < (LONG)RAW_TRACK_SLACK_SIZE ; i++)
+		{
+			to[i] = carry | (raw_track[i] >> shift);
+
+			carry = (UBYTE)(raw_track[i] << (8 - shift));
+		}
+
+		to[i] = carry;
+	}
+}
+
+/****************************************************************************/
+
+/* Look for the next sector sync pattern, starting at the given bit
+ * position. Returns the position of the first bit following the
+ * pattern, or -1 if no pattern turned up before the given end.
+ */
+static LONG
+find_sector_sync(const UBYTE * raw_track, LONG bit_position, LONG last_bit_position)
+{
+	ULONG window = 0;
+	LONG result = -1;
+
+	while(bit_position < last_bit_position)
+	{
+		window = (window << 1) | ((raw_track[bit_position >> 3] >> (7 - (bit_position & 7))) & 1);
+
+		bit_position++;
+
+		if(window == MFM_SYNC_WORDS)
+		{
+			result = bit_position;
+			break;
+		}
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Copy the sector which follows the sync pattern, so that its longwords
+ * line up with the sector contents, regardless of the bit position at
+ * which the sector begins.
+ */
+static VOID
+align_sector(const UBYTE * raw_track, LONG bit_position, ULONG * sector)
+{
+	const UBYTE * from = &raw_track[bit_position >> 3];
+	int shift = bit_position & 7;
+	ULONG value;
+	int i;
+
+	for(i = 0 ; i < MFM_SECTOR_LONGS ; i++, from += sizeof(ULONG))
+	{
+		value = (((ULONG)from[0]) << 24) | (((ULONG)from[1]) << 16) | (((ULONG)from[2]) << 8) | from[3];
+
+		if(shift > 0)
+			value = (value << shift) | (from[4] >> (8 - shift));
+
+		sector[i] = value;
+	}
+}
+
+/****************************************************************************/
+
+/* Combine the odd and even bits of an MFM-encoded longword. */
+#define MFM_DECODE(odd, even) \
+	((((odd) & MFM_DATA_BITS) << 1) | ((even) & MFM_DATA_BITS))
+
+/* Decode all the sectors of a raw MFM track in the Amiga 1.0 format.
+ * Unlike mfm_decode_track() this does not expect the sectors to follow
+ * one another without gaps, or the first sector to begin at the start
+ * of the buffer. Each sector is found by its sync pattern, at any
+ * bit position. Once a sector has been decoded, the search for the
+ * next sync pattern resumes after its end.
+ */
+static LONG
+decode_raw_track(struct ExtendedADFImage * eai, LONG which_track, LONG num_bits, int num_sectors, UBYTE * data)
+{
+	const ULONG all_sectors = (1UL << num_sectors) - 1;
+	const ULONG * sector = eai->eai_Sector;
+	ULONG sectors_found = 0;
+	ULONG header, checksum;
+	LONG bit_position = 0;
+	LONG error = TDERR_TooFewSecs;
+	ULONG * to;
+	int sector_number;
+	int i;
+
+	ENTER();
+
+	ASSERT( num_sectors <= 32 );
+
+	while(sectors_found != all_sectors)
+	{
+		/* The sync pattern must begin within the track, but
+		 * can continue in the slack area.
+		 */
+		bit_position = find_sector_sync(eai->eai_RawTrack, bit_position, num_bits + 32);
+		if(bit_position < 0)
+			break;
+
+		align_sector(eai->eai_RawTrack, bit_position, eai->eai_Sector);
+
+		/* The header checksum covers the format, track and sector
+		 * numbers, as well as the sector label.
+		 */
+		checksum = 0;
+
+		for(i = 0 ; i < 10 ; i++)
+			checksum ^= sector[i];
+
+		if((checksum & MFM_DATA_BITS) != MFM_DECODE(sector[10], sector[11]))
+		{
+			D(("bad header checksum at bit position %ld", bit_position));
+
+			error = TDERR_BadHdrSum;
+			continue;
+		}
+
+		header = MFM_DECODE(sector[0], sector[1]);
+
+		sector_number = (header >> 8) & 0xFF;
+
+		if((header >> 24) != AMIGA_10_FORMAT ||
+		   ((header >> 16) & 0xFF) != (ULONG)which_track ||
+		   sector_number >= num_sectors)
+		{
+			D(("sector header 0x%08lx does not fit track %ld", header, which_track));
+
+			error = TDERR_BadSecID;
+			continue;
+		}
+
+		/* Skip the sector if we already have a good copy of it. */
+		if(FLAG_IS_CLEAR(sectors_found, (1UL << sector_number)))
+		{
+			checksum = 0;
+
+			for(i = 14 ; i < MFM_SECTOR_LONGS ; i++)
+				checksum ^= sector[i];
+
+			if((checksum & MFM_DATA_BITS) != MFM_DECODE(sector[12], sector[13]))
+			{
+				D(("bad data checksum for sector %ld", sector_number));
+
+				error = TDERR_BadSecSum;
+				continue;
+			}
+
+			/* The odd bits of the sector data come first,
+			 * followed by the even bits.
+			 */
+			to = (ULONG *)&data[sector_number * TD_SECTOR];
+
+			for(i = 0 ; i < (int)(TD_SECTOR / sizeof(ULONG)) ; i++)
+				to[i] = MFM_DECODE(sector[14 + i], sector[14 + (TD_SECTOR / sizeof(ULONG)) + i]);
+
+			SET_FLAG(sectors_found, (1UL << sector_number));
+		}
+
+		/* Resume the search after the end of this sector. */
+		bit_position += 32 * MFM_SECTOR_LONGS;
+	}
+
+	if(sectors_found == all_sectors)
+		error = OK;
+	else
+		D(("found only sectors 0x%08lx of track %ld (error=%ld)", sectors_found, which_track, error));
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Read a track from an extended ADF file, decoding it if it is stored
+ * in raw MFM form. The data buffer must be large enough to hold all
+ * the sectors of the track. Returns a trackdisk.device error code if
+ * the track could not be read or decoded. The file position will
+ * be undefined afterwards.
+ */
+LONG
+read_extended_adf_track(
+	struct TrackFileDevice *	tfd,
+	struct ExtendedADFImage *	eai,
+	BPTR						file,
+	LONG						which_track,
+	APTR						data,
+	LONG						data_size)
+{
+	const struct ExtendedADFTrack * eat;
+	LONG num_bytes;
+	LONG error;
+
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( 0 <= which_track && which_track < eai->eai_NumTracks );
+	ASSERT( (data_size % TD_SECTOR) == 0 );
+
+	eat = &eai->eai_Tracks[which_track];
+
+	if(Seek(file, eat->eat_Offset, OFFSET_BEGINNING) == -1)
+	{
+		D(("that seek didn't work (error=%ld)", IoErr()));
+
+		error = TDERR_NoSecHdr;
+		goto out;
+	}
+
+	if(eat->eat_Type == EAT_Standard)
+	{
+		ASSERT( eat->eat_Size == data_size );
+
+		if(Read(file, data, data_size) != data_size)
+		{
+			D(("that read didn't work (error=%ld)", IoErr()));
+
+			error = TDERR_BadSecHdr;
+			goto out;
+		}
+	}
+	else
+	{
+		ASSERT( eat->eat_Type == EAT_RawMFM );
+		ASSERT( eai->eai_RawTrack != NULL );
+
+		num_bytes = (eat->eat_NumBits + 7) / 8;
+
+		ASSERT( num_bytes + (LONG)RAW_TRACK_SLACK_SIZE < eai->eai_RawTrackSize );
+
+		if(Read(file, eai->eai_RawTrack, num_bytes) != num_bytes)
+		{
+			D(("that read didn't work (error=%ld)", IoErr()));
+
+			error = TDERR_BadSecHdr;
+			goto out;
+		}
+
+		append_track_start(eai->eai_RawTrack, eat->eat_NumBits);
+
+		error = decode_raw_track(eai, which_track, eat->eat_NumBits, data_size / TD_SECTOR, data);
+		if(error != OK)
+			goto out;
+	}
+
+	error = OK;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Copy a raw MFM track from an extended ADF file, as TD_RAWREAD would
+ * read it. If more data is requested than the track holds, the track
+ * data is repeated, as if the disk had completed another revolution.
+ * Returns a trackdisk.device error code if the track could not be
+ * read. The file position will be undefined afterwards.
+ */
+LONG
+read_extended_adf_raw_track(
+	struct TrackFileDevice *		tfd,
+	const struct ExtendedADFImage *	eai,
+	BPTR							file,
+	LONG							which_track,
+	APTR							data,
+	LONG							data_size)
+{
+	const struct ExtendedADFTrack * eat;
+	UBYTE * to = data;
+	LONG num_bytes;
+	LONG error;
+	LONG i;
+
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( 0 <= which_track && which_track < eai->eai_NumTracks );
+	ASSERT( eai->eai_Tracks[which_track].eat_Type == EAT_RawMFM );
+
+	eat = &eai->eai_Tracks[which_track];
+
+	num_bytes = (eat->eat_NumBits + 7) / 8;
+	if(num_bytes > data_size)
+		num_bytes = data_size;
+
+	if(Seek(file, eat->eat_Offset, OFFSET_BEGINNING) == -1)
+	{
+		D(("that seek didn't work (error=%ld)", IoErr()));
+
+		error = TDERR_NoSecHdr;
+		goto out;
+	}
+
+	if(Read(file, data, num_bytes) != num_bytes)
+	{
+		D(("that read didn't work (error=%ld)", IoErr()));
+
+		error = TDERR_BadSecHdr;
+		goto out;
+	}
+
+	for(i = num_bytes ; i < data_size ; i++)
+		to[i] = to[i - num_bytes];
+
+	error = OK;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
@@ -0,0 +1,128 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _EXTENDED_ADF_H
+#define _EXTENDED_ADF_H
+
+/****************************************************************************/
+
+#ifndef EXEC_TYPES_H
+#include <exec/types.h>
+#endif /* EXEC_TYPES_H */
+
+#ifndef DOS_DOS_H
+#include <dos/dos.h>
+#endif /* DOS_DOS_H */
+
+/****************************************************************************/
+
+/* The extended ADF format, as introduced by UAE, stores each track either
+ * as plain sector data or as the raw MFM bit stream which was read from
+ * the disk. The file begins with the "UAE-1ADF" signature, followed by
+ * two reserved bytes and the number of tracks (16 bits each). Then comes
+ * a 12 byte header for each track, and finally the track data itself,
+ * one track after the other, in the same order as the track headers.
+ */
+#define EXTENDED_ADF_SIGNATURE "UAE-1ADF"
+
+struct ExtendedADFFileHeader
+{
+	UBYTE	eafh_Signature[8];	/* Must be EXTENDED_ADF_SIGNATURE */
+	UWORD	eafh_Reserved;
+	UWORD	eafh_NumTracks;		/* Number of track headers to follow */
+};
+
+struct ExtendedADFTrackHeader
+{
+	UWORD	eath_Reserved;
+	UWORD	eath_Type;			/* EAT_Standard or EAT_RawMFM */
+	ULONG	eath_Size;			/* Number of bytes stored in the file */
+	ULONG	eath_NumBits;		/* Length of the track in bits */
+};
+
+/* Which kind of data is stored for a track. */
+#define EAT_Standard	0		/* Sector data, as in a plain ADF file */
+#define EAT_RawMFM		1		/* Raw MFM-encoded track */
+
+/****************************************************************************/
+
+/* Where to find the data of each track in the file, and what kind
+ * of data it is.
+ */
+struct ExtendedADFTrack
+{
+	LONG	eat_Offset;			/* Start of the track data in the file */
+	LONG	eat_Size;			/* Number of bytes stored in the file */
+	LONG	eat_NumBits;		/* Length of a raw MFM track in bits */
+	UWORD	eat_Type;			/* EAT_Standard or EAT_RawMFM */
+	UWORD	eat_Pad;
+};
+
+/* An MFM-encoded sector takes up 1088 bytes, of which we need the 1080
+ * bytes which follow the two sync words (270 longwords). The sync words
+ * may start near the end of the raw track, and the sector will then
+ * continue at the beginning of the track. This is why the start of the
+ * track is appended to the end of the raw track buffer.
+ */
+#define MFM_SECTOR_LONGS		270
+#define RAW_TRACK_SLACK_SIZE	(sizeof(ULONG) * (MFM_SECTOR_LONGS + 4))
+
+/* Raw tracks longer than this are not accepted. */
+#define MAX_RAW_TRACK_SIZE		32768
+
+/* Everything needed to decode the tracks of an extended ADF file. */
+struct ExtendedADFImage
+{
+	LONG					eai_NumTracks;		/* Number of tracks in use */
+	LONG					eai_NumRawTracks;	/* How many of these are raw MFM tracks */
+
+	UBYTE *					eai_RawTrack;		/* Raw MFM track data, with room for the slack */
+	LONG					eai_RawTrackSize;	/* Size of the raw track buffer, including the slack */
+
+	ULONG					eai_Sector[MFM_SECTOR_LONGS];	/* One sector, aligned to the sync word */
+
+	struct ExtendedADFTrack	eai_Tracks[1];		/* One entry per track */
+};
+
+/****************************************************************************/
+
+struct TrackFileDevice;
+
+/****************************************************************************/
+
+LONG examine_extended_adf(struct TrackFileDevice * tfd, BPTR file, LONG num_tracks, LONG track_size, struct ExtendedADFImage ** eai_ptr);
+LONG read_extended_adf_track(struct TrackFileDevice * tfd, struct ExtendedADFImage * eai, BPTR file, LONG which_track, APTR data, LONG data_size);
+LONG read_extended_adf_raw_track(struct TrackFileDevice * tfd, const struct ExtendedADFImage * eai, BPTR file, LONG which_track, APTR data, LONG data_size);
+VOID free_extended_adf(struct TrackFileDevice * tfd, struct ExtendedADFImage * eai);
+
+/****************************************************************************/
+
+#endif /* _EXTENDED_ADF_H */
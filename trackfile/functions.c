@@ -52,6 +52,7 @@
 #include "functions.h"
 #include "tools.h"
 #include "unit.h"
+#include "image_backend.h"
 
 /****************************************************************************/
 
@@ -185,7 +186,7 @@ get_volume_root_lock(
  * if individual track checksums have been updated, since the
  * disk checksum is an aggregate of all the track checksums.
  */
-static void
+void
 update_disk_checksum(struct TrackFileUnit * tfu)
 {
 	ENTER();
@@ -506,6 +507,9 @@ tf_start_unit_taglist(
 		tfu->tfu_Device					= tfd;
 		tfu->tfu_UnitNumber				= which_unit;
 		tfu->tfu_CurrentTrackNumber		= -1;
+		tfu->tfu_ImageBackend			= &file_backend;
+
+		ASSERT( tfu->tfu_NumTracks <= NUM_STATISTICS_TRACKS );
 
 		/* If checksums are enabled for this unit, allocate memory
 		 * for storing these.
@@ -555,11 +559,13 @@ tf_start_unit_taglist(
 
 		InitSemaphore(&tfu->tfu_Lock);
 
+		NewList(&tfu->tfu_Queue);
+
 		NewMinList(&tfu->tfu_ChangeIntList);
 
 		#if defined(ENABLE_CACHE)
 		{
-			NewMinList(&tfu->tfu_CacheNodeList);
+			tfu->tfu_CacheImage = NULL;
 		}
 		#endif /* ENABLE_CACHE */
 
@@ -817,6 +823,18 @@ tf_stop_unit_taglist(
 *	need to specify either the name of the floppy disk image file in
 *	question or you may provide an already opened file.
 *
+*	Besides plain ADF files, extended ADF files ("UAE-1ADF") are
+*	supported, too. These may store some or all tracks as raw MFM data,
+*	which is decoded when the track is read. Only double density disks
+*	are supported in this format.
+*
+*	Packed disk image files, as created by the DAPack shell command,
+*	are supported as well. Each track is compressed on its own and
+*	unpacked when it is read.
+*
+*	Extended ADF files and packed disk image files will always be
+*	write-protected.
+*
 *   INPUTS
 *	which_unit -- Which unit to insert the disk image file into.
 *	    Unit numbers must be >= 0.
@@ -852,6 +870,43 @@ tf_stop_unit_taglist(
 *	    reading the file and storing its contents in the cache first,
 *	    though. Defaults to FALSE.
 *
+*	TF_WarmupTracks (const UBYTE *) - If the unit uses the shared
+*	    cache, you may provide a list of track numbers to be loaded into
+*	    the cache after the disk image file has been inserted. The unit
+*	    loads these tracks in the order given, one at a time, whenever it
+*	    has no I/O requests to attend to. Tracks which are already in the
+*	    cache are skipped. This is intended to be used with the track
+*	    access order which TFGetUnitData() reported for the same disk
+*	    image file the last time it was used, so that the tracks needed
+*	    first are already in the cache when they are read. The list is
+*	    copied, and it is ignored if TF_PrefillUnitCache is in effect.
+*	    Defaults to NULL.
+*
+*	TF_NumWarmupTracks (LONG) - Number of entries in the
+*	    TF_WarmupTracks list; no more than TF_MAX_WARMUP_TRACKS will
+*	    be used. Defaults to 0.
+*
+*	TF_PredictTracks (BOOL) - If the unit uses the shared cache, it
+*	    may learn which tracks tend to be read after which other tracks,
+*	    such as when the file system moves from the root directory to a
+*	    directory, then to a file header and then to the file data. For
+*	    each track, the two most frequent successors are remembered, so
+*	    the memory needed for this does not grow. Whenever a track is
+*	    read, the successors which followed it at least twice are loaded
+*	    into the cache while the unit has no I/O requests to attend to.
+*	    What the unit learns is forgotten when the medium is ejected.
+*	    Defaults to FALSE.
+*
+*	TF_BlockServer (STRPTR) - Name of the public message port of a
+*	    block server process which will read and write the disk image
+*	    file on behalf of the unit, rather than the unit accessing the
+*	    file itself. The unit sends TrackFileBlockRequest messages to
+*	    this port, one per track, and may have several of these
+*	    outstanding at a time. This is ignored for extended ADF files
+*	    and packed disk image files. The insertion fails with the
+*	    error code ERROR_OBJECT_NOT_FOUND if there is no such message
+*	    port. Defaults to NULL.
+*
 *   RESULT
 *	error - Zero if successful, otherwise an error code is returned.
 *
@@ -874,7 +929,8 @@ tf_stop_unit_taglist(
 *
 *	TFERROR_InvalidFileSize -- The disk image file you provided does
 *	    not match the supported 880 KByte or 1760 KByte disk image file
-*	    types.
+*	    types, or it is an extended ADF file or a packed disk image
+*	    file with too few tracks or with tracks which cannot be used.
 *
 *	TFERROR_DuplicateVolume -- There is already is a disk mounted
 *	    which shares the same volume name and volume creation signature with
@@ -936,10 +992,23 @@ tf_insert_media_taglist(
 	LONG num_bytes_read;
 	UBYTE * track_buffer;
 	LONG track_size;
-	BOOL volume_already_in_use = FALSE;
+	LONG track_number;
+	BOOL read_all_tracks;
+	BOOL track_is_readable;
 	BOOL prefill_unit_cache = FALSE;
 	BOOL change_unit_cache = FALSE;
 	BOOL enable_unit_cache = FALSE;
+	BOOL fill_cache = FALSE;
+	const UBYTE * warmup_tracks = NULL;
+	LONG num_warmup_tracks = 0;
+	BOOL predict_tracks = FALSE;
+	const TEXT * block_server_name = NULL;
+	struct ExtendedADFImage * eai = NULL;
+	struct PackedImage * pi = NULL;
+	LONG image_size;
+	#if defined(ENABLE_CACHE)
+	struct CacheImage * cache_image = NULL;
+	#endif /* ENABLE_CACHE */
 
 	ENTER();
 
@@ -1031,6 +1100,18 @@ tf_insert_media_taglist(
 
 				break;
 
+			/* The client may want a block server to access the file. */
+			case TF_BlockServer:
+
+				block_server_name = (const TEXT *)ti->ti_Data;
+
+				if(block_server_name != NULL)
+					D(("TF_BlockServer='%s'", block_server_name));
+				else
+					D(("TF_BlockServer=NULL"));
+
+				break;
+
 		#if defined(ENABLE_CACHE)
 
 			case TF_EnableUnitCache:
@@ -1050,6 +1131,30 @@ tf_insert_media_taglist(
 
 				break;
 
+			case TF_WarmupTracks:
+
+				D(("TF_WarmupTracks=0x%08lx", ti->ti_Data));
+
+				warmup_tracks = (const UBYTE *)ti->ti_Data;
+
+				break;
+
+			case TF_NumWarmupTracks:
+
+				D(("TF_NumWarmupTracks=%ld", ti->ti_Data));
+
+				num_warmup_tracks = (LONG)ti->ti_Data;
+
+				break;
+
+			case TF_PredictTracks:
+
+				D(("TF_PredictTracks=%s", ti->ti_Data ? "TRUE" : "FALSE"));
+
+				predict_tracks = (BOOL)(ti->ti_Data != FALSE);
+
+				break;
+
 		#endif /* ENABLE_CACHE */
 
 			default:
@@ -1190,6 +1295,59 @@ tf_insert_media_taglist(
 	}
 	#endif /* __SASC */
 
+	image_size = fib->fib_Size;
+
+	/* This might be an extended ADF file, which holds the
+	 * tracks of a double density disk, some of which
+	 * may have to be decoded from raw MFM data, or a
+	 * packed disk image file. Such a disk can only be
+	 * read from.
+	 */
+	if(drive_type == TFEFS_Unsupported)
+	{
+		result = examine_packed_image(tfd, image_file_handle, which_tfu->tfu_NumTracks, &pi);
+		if(result != OK)
+		{
+			D(("could not examine the file (error=%ld)", result));
+			goto out;
+		}
+
+		if(pi != NULL)
+		{
+			SHOWMSG("this is a packed disk image file; switching to read-only access");
+
+			image_size = which_tfu->tfu_NumTracks * pi->pi_TrackSize;
+
+			if(pi->pi_TrackSize == 2 * NUMSECS * TD_SECTOR)
+				drive_type = DRIVE3_5_150RPM;
+			else
+				drive_type = DRIVE3_5;
+
+			write_protected = TRUE;
+		}
+	}
+
+	if(drive_type == TFEFS_Unsupported)
+	{
+		result = examine_extended_adf(tfd, image_file_handle, which_tfu->tfu_NumTracks, NUMSECS * TD_SECTOR, &eai);
+		if(result != OK)
+		{
+			D(("could not examine the file (error=%ld)", result));
+			goto out;
+		}
+
+		if(eai != NULL)
+		{
+			SHOWMSG("this is an extended ADF file; switching to read-only access");
+
+			image_size = which_tfu->tfu_NumTracks * NUMSECS * TD_SECTOR;
+
+			drive_type = DRIVE3_5;
+
+			write_protected = TRUE;
+		}
+	}
+
 	/* This should either be a standard double density
 	 * disk or a high density disk. That's 80 cylinders
 	 * and either 11 or 22 sectors per track.
@@ -1254,9 +1412,9 @@ tf_insert_media_taglist(
 		D(("could not get lock on this file, error=%ld", IoErr()));
 	}
 
-	ASSERT( fib->fib_Size > 0 );
+	ASSERT( image_size > 0 );
 
-	which_tfu->tfu_FileSize = fib->fib_Size;
+	which_tfu->tfu_FileSize = image_size;
 
 	ASSERT( which_tfu->tfu_NumTracks > 0 );
 
@@ -1272,9 +1430,25 @@ tf_insert_media_taglist(
 	which_tfu->tfu_FileSystemSignature = ID_UNREADABLE_DISK;
 	which_tfu->tfu_BootBlockChecksum = ~0UL;
 	which_tfu->tfu_RootDirValid = FALSE;
+
+	/* We may have just received this file handle as is, and
+	 * it's not a given that the read position refers to the
+	 * start of the file.
+	 */
 	which_tfu->tfu_FilePosition = -1;
 
-	track_size = fib->fib_Size / which_tfu->tfu_NumTracks;
+	/* Plain disk image files may be accessed through a block server.
+	 * The tracks of extended ADF files and packed disk image files
+	 * are always read directly.
+	 */
+	result = select_image_backend(which_tfu, (eai == NULL && pi == NULL) ? block_server_name : NULL);
+	if(result != OK)
+	{
+		D(("could not use block server (error=%ld)", result));
+		goto out;
+	}
+
+	track_size = image_size / which_tfu->tfu_NumTracks;
 
 	ASSERT( track_size > 0 );
 
@@ -1335,85 +1509,171 @@ tf_insert_media_taglist(
 
 	SHOWVALUE(root_directory_block_offset);
 
-	/* Begin by looking into the reserved blocks. We are interested
-	 * in the file system signature information.
+	/* Should the cache be filled while we read the disk image
+	 * file? This needs to be decided now because we read the
+	 * file only once. The cache currently works only for
+	 * double density disks and all the tracks must fit into it.
 	 */
-	if(Seek(image_file_handle, 0, OFFSET_BEGINNING) == -1)
+	#if defined(ENABLE_CACHE)
 	{
-		result = IoErr();
+		BOOL cache_enabled;
 
-		D(("could not seek to beginning of the disk image file (error=%ld)", result));
+		/* On second thought, let's see if we can enable the cache
+		 * in the first place. As of this writing there is no good
+		 * solution for high density 3.5" disks.
+		 */
+		if(change_unit_cache && enable_unit_cache && drive_type == DRIVE3_5_150RPM)
+		{
+			SHOWMSG("disabling cache since it doesn't make good sense yet");
 
-		goto out;
-	}
+			enable_unit_cache = FALSE;
+		}
 
-	ASSERT( num_reserved_blocks * sectors_per_block * bytes_per_sector <= track_size );
+		if(change_unit_cache)
+			cache_enabled = enable_unit_cache;
+		else
+			cache_enabled = which_tfu->tfu_CacheEnabled;
 
-	num_bytes_read = Read(image_file_handle, track_buffer, num_reserved_blocks * sectors_per_block * bytes_per_sector);
-	if(num_bytes_read == -1)
-	{
-		result = IoErr();
+		/* The cache entries belong to the disk image file rather
+		 * than to the unit. If the same file was used before and
+		 * has not changed since, the entries which are still in
+		 * the cache will be reused.
+		 */
+		ASSERT( which_tfu->tfu_CacheImage == NULL );
 
-		D(("could not read reserved blocks of the disk image file (error=%ld)", result));
+		if(tfd->tfd_CacheContext != NULL && drive_type != DRIVE3_5_150RPM)
+		{
+			cache_image = obtain_cache_image(tfd->tfd_CacheContext, image_file_handle_lock, fib);
+			if(cache_image == NULL)
+				SHOWMSG("unit will not use the cache");
 
-		goto out;
-	}
+			which_tfu->tfu_CacheImage = cache_image;
+		}
 
-	SHOWVALUE(num_bytes_read);
+		D(("prefill unit #%ld cache = %s", which_tfu->tfu_UnitNumber, prefill_unit_cache ? "TRUE" : "FALSE"));
 
-	/* Which type of file system is this? We only care about
-	 * the Amiga default file system and its variants, e.g.
-	 * OFS, FFS, DCFS, etc.
-	 */
-	if(num_bytes_read >= BOOTSECTS * bytes_per_sector * sectors_per_block)
-	{
-		which_tfu->tfu_FileSystemSignature = *(ULONG *)track_buffer;
+		if(prefill_unit_cache && which_tfu->tfu_CacheImage != NULL && cache_enabled)
+		{
+			if(tfd->tfd_CacheContext->cc_MaxCacheSize < image_size)
+			{
+				D(("cache cannot hold enough data (%ld bytes) for a complete prefill of unit #%ld (%ld bytes)",
+					tfd->tfd_CacheContext->cc_MaxCacheSize, which_tfu->tfu_UnitNumber, image_size));
+			}
+			else
+			{
+				D(("filling the cache for unit #%ld", which_tfu->tfu_UnitNumber));
+
+				fill_cache = TRUE;
+			}
+		}
+		else
+		{
+			D(("won't fill the cache for unit #%ld", which_tfu->tfu_UnitNumber));
+		}
+	}
+	#endif /* ENABLE_CACHE */
 
-		D(("file system signature = 0x%08lx", which_tfu->tfu_FileSystemSignature));
+	/* We read the whole disk image file only if the track checksums
+	 * need to be calculated or if the cache should be filled. Both
+	 * are taken care of in the same pass over the file, which also
+	 * picks up the file system signature and the root directory
+	 * information. Without these two options we only need to look
+	 * at track 0 and the track on which the root directory resides.
+	 */
+	read_all_tracks = (BOOL)(which_tfu->tfu_DiskChecksumTable != NULL || fill_cache);
 
-		which_tfu->tfu_BootBlockChecksum =
-			calculate_boot_block_checksum((ULONG *)track_buffer, BOOTSECTS * bytes_per_sector * sectors_per_block);
+	ASSERT( which_tfu->tfu_DiskChecksumTable == NULL || which_tfu->tfu_NumTracks <= which_tfu->tfu_DiskChecksumTableLength );
 
-		D(("boot block checksum = 0x%08lx", which_tfu->tfu_BootBlockChecksum));
-	}
+	ASSERT( num_reserved_blocks * sectors_per_block * bytes_per_sector <= track_size );
+	ASSERT( root_directory_block_offset + bytes_per_sector * sectors_per_block <= track_size );
 
-	/* Is this an AmigaDOS disk, e.g. OFS, FFS, DCFS, etc.? */
-	if((which_tfu->tfu_FileSystemSignature & 0xFFFFFF00) == ID_DOS_DISK)
+	for(track_number = 0 ; track_number < which_tfu->tfu_NumTracks ; track_number++)
 	{
-		LONG root_directory_position;
-
-		SHOWMSG("file system signature seems to be for the Amiga default file system");
+		if(NOT read_all_tracks && track_number != 0 && track_number != root_directory_track_number)
+			continue;
 
-		root_directory_position = root_directory_block_offset + root_directory_track_number * sectors_per_track * bytes_per_sector;
+		track_is_readable = TRUE;
 
-		D(("seek to position %ld", root_directory_position));
+		/* The tracks of an extended ADF file may need to be decoded,
+		 * and they are not necessarily stored back to back. Disks
+		 * with copy protection schemes may contain raw tracks which
+		 * do not decode as Amiga 1.0 format tracks at all, which is
+		 * no reason to reject the disk. Such tracks read as all
+		 * zeroes here, and will not end up in the cache.
+		 */
+		if(pi != NULL)
+		{
+			result = read_packed_image_track(tfd, pi, image_file_handle, track_number, track_buffer, track_size);
+			if(result != OK)
+			{
+				D(("could not read track %ld of the packed disk image file (error=%ld)", track_number, result));
 
-		/* Now read the root directory block proper. */
-		if(Seek(image_file_handle, root_directory_position, OFFSET_BEGINNING) == -1)
+				goto out;
+			}
+		}
+		else if (eai != NULL)
 		{
-			result = IoErr();
+			if(read_extended_adf_track(tfd, eai, image_file_handle, track_number, track_buffer, track_size) != OK)
+			{
+				D(("could not read track %ld of the extended ADF file", track_number));
 
-			D(("could not seek to root directory of the disk image file (error=%ld)", result));
+				memset(track_buffer, 0, track_size);
 
-			goto out;
+				track_is_readable = FALSE;
+			}
 		}
+		else
+		{
+			/* This moves to the start of the track unless the file
+			 * position is already there.
+			 */
+			num_bytes_read = read_image_data(which_tfu, image_file_handle, track_number * track_size, track_buffer, track_size);
+			if(num_bytes_read == -1)
+			{
+				result = IoErr();
+
+				D(("could not read track %ld (error=%ld)", track_number, result));
+
+				goto out;
+			}
+			else if (num_bytes_read != track_size)
+			{
+				D(("failed to read %ld bytes of track data; got only %ld", track_size, num_bytes_read));
 
-		ASSERT( bytes_per_sector * sectors_per_block <= track_size );
+				result = TFERROR_InvalidFileSize;
+				goto out;
+			}
+		}
 
-		num_bytes_read = Read(image_file_handle, track_buffer, bytes_per_sector * sectors_per_block);
-		if(num_bytes_read == -1)
+		/* Which type of file system is this? We only care about
+		 * the Amiga default file system and its variants, e.g.
+		 * OFS, FFS, DCFS, etc. The reserved blocks are found
+		 * at the start of track 0.
+		 */
+		if(track_number == 0)
 		{
-			result = IoErr();
+			which_tfu->tfu_FileSystemSignature = *(ULONG *)track_buffer;
 
-			D(("could not read root directory of the disk image file (error=%ld)", result));
+			D(("file system signature = 0x%08lx", which_tfu->tfu_FileSystemSignature));
 
-			goto out;
+			which_tfu->tfu_BootBlockChecksum =
+				calculate_boot_block_checksum((ULONG *)track_buffer, BOOTSECTS * bytes_per_sector * sectors_per_block);
+
+			D(("boot block checksum = 0x%08lx", which_tfu->tfu_BootBlockChecksum));
+
+			if((which_tfu->tfu_FileSystemSignature & 0xFFFFFF00) == ID_DOS_DISK)
+				SHOWMSG("file system signature seems to be for the Amiga default file system");
+			else
+				SHOWMSG("this does not appear to be an Amiga file system disk");
 		}
 
-		/* Did we get what we came for? */
-		if(num_bytes_read == bytes_per_sector * sectors_per_block)
+		/* Is this an AmigaDOS disk, e.g. OFS, FFS, DCFS, etc., and
+		 * did we just read the track on which the root directory
+		 * is found? Note that track 0 always comes first.
+		 */
+		if(track_number == root_directory_track_number && (which_tfu->tfu_FileSystemSignature & 0xFFFFFF00) == ID_DOS_DISK)
 		{
-			const struct RootDirBlock * rdb = (struct RootDirBlock *)track_buffer;
+			const struct RootDirBlock * rdb = (struct RootDirBlock *)&track_buffer[root_directory_block_offset];
 
 			/* Is the root block really what we need? */
 			if(root_directory_is_valid(rdb))
@@ -1456,8 +1716,13 @@ tf_insert_media_taglist(
 
 					UnLock(root_dir_lock);
 
-					/* We can't use this... */
-					volume_already_in_use = TRUE;
+					/* We can't use this, and there is no point
+					 * in reading the remainder of the file.
+					 */
+					SHOWMSG("there is a volume node in active use which matches the volume data of this disk");
+
+					result = TFERROR_DuplicateVolume;
+					goto out;
 				}
 				else
 				{
@@ -1469,76 +1734,35 @@ tf_insert_media_taglist(
 				SHOWMSG("root directory information is invalid");
 			}
 		}
-		else
-		{
-			D(("failed to read %ld bytes, got %ld instead", bytes_per_sector * sectors_per_block, num_bytes_read));
-		}
-	}
-	else
-	{
-		SHOWMSG("this does not appear to be an Amiga file system disk");
-	}
-
-	if(volume_already_in_use)
-	{
-		SHOWMSG("there is a volume node in active use which matches the volume data of this disk");
-
-		result = TFERROR_DuplicateVolume;
-		goto out;
-	}
-
-	/* Calculate the disk/track checksums for this unit file? */
-	if(which_tfu->tfu_DiskChecksumTable != NULL)
-	{
-		int i;
-
-		SHOWMSG("setting up the disk and track checksums for the file now");
-
-		ASSERT( which_tfu->tfu_NumTracks > 0 );
-		ASSERT( track_size > 0 );
-		ASSERT( track_buffer != NULL );
-
-		/* We may have just received this file handle as is, and
-		 * it's not a given that the read position refers to the
-		 * start of the file.
-		 */
-		if(Seek(image_file_handle, 0, OFFSET_BEGINNING) == -1)
-		{
-			result = IoErr();
-
-			D(("could not seek to beginning of the disk image file (error=%ld)", result));
-
-			goto out;
-		}
 
-		ASSERT( which_tfu->tfu_NumTracks <= which_tfu->tfu_DiskChecksumTableLength );
+		/* Calculate the track checksum for this unit file? */
+		if(which_tfu->tfu_DiskChecksumTable != NULL)
+			fletcher64_checksum(track_buffer, track_size, &which_tfu->tfu_DiskChecksumTable[track_number]);
 
-		/* We read the image file one track at a time and
-		 * calculate the track checksum for each.
-		 */
-		for(i = 0 ; i < which_tfu->tfu_NumTracks ; i++)
+		/* Store the track in the cache? */
+		#if defined(ENABLE_CACHE)
 		{
-			num_bytes_read = Read(image_file_handle, track_buffer, track_size);
-			if (num_bytes_read == -1)
+			if(fill_cache && track_is_readable)
 			{
-				result = IoErr();
-
-				D(("could not read track %ld (error=%ld)", i, result));
-
-				goto out;
+				update_cache_contents(tfd->tfd_CacheContext,
+					which_tfu, track_number,
+					track_buffer,
+					track_size,
+					UDN_Allocate);
 			}
-			else if (num_bytes_read != track_size)
-			{
-				D(("failed to read %ld bytes of track data; got only %ld", track_size, num_bytes_read));
+		}
+		#endif /* ENABLE_CACHE */
 
-				result = TFERROR_InvalidFileSize;
-				goto out;
-			}
+		/* We're done if the rest of the file is of no interest. */
+		if(NOT read_all_tracks && track_number >= root_directory_track_number)
+			break;
+	}
 
-			fletcher64_checksum(track_buffer, track_size, &which_tfu->tfu_DiskChecksumTable[i]);
-		}
+	/* Aggregate the track checksums to produce the disk checksum. */
+	if(which_tfu->tfu_DiskChecksumTable != NULL)
+	{
+		SHOWMSG("set up the disk and track checksums for the file");
 
-		/* Aggregate the track checksums to produce the disk checksum. */
 		which_tfu->tfu_ChecksumUpdated = TRUE;
 
 		update_disk_checksum(which_tfu);
@@ -1637,41 +1861,42 @@ tf_insert_media_taglist(
 			else
 				D(("disabling cache for unit #%ld", which_tfu->tfu_UnitNumber));
 
-			/* On second thought, let's see if we can enable the cache
-			 * in the first place. As of this writing there is no good
-			 * solution for high density 3.5" disks.
-			 */
-			if(drive_type == DRIVE3_5_150RPM)
-			{
-				SHOWMSG("disabling cache since it doesn't make good sense yet");
-
-				enable_unit_cache = FALSE;
-			}
-
 			which_tfu->tfu_CacheEnabled = enable_unit_cache;
 
 			which_tfu->tfu_CacheAccesses	= 0;
 			which_tfu->tfu_CacheMisses		= 0;
 		}
+	}
+	#endif /* ENABLE_CACHE */
 
-		D(("prefill unit #%ld cache = %s", which_tfu->tfu_UnitNumber, prefill_unit_cache ? "TRUE" : "FALSE"));
+	/* There is no need to load individual tracks into the cache
+	 * if it already holds all of them.
+	 */
+	if(warmup_tracks == NULL || num_warmup_tracks < 0 || fill_cache)
+		num_warmup_tracks = 0;
+	else if(num_warmup_tracks > TF_MAX_WARMUP_TRACKS)
+		num_warmup_tracks = TF_MAX_WARMUP_TRACKS;
 
-		which_tfu->tfu_PrefillCache = prefill_unit_cache;
+	#if defined(ENABLE_CACHE)
+	{
+		which_tfu->tfu_PredictTracks = predict_tracks;
 	}
 	#endif /* ENABLE_CACHE */
 
 	/* Ask the unit to use the new medium. */
-	result = send_unit_control_command(which_tfu, TFC_Insert, image_file_handle, fib->fib_Size, write_protected, -1);
+	result = send_unit_insert_command(which_tfu, image_file_handle, image_size, write_protected, eai, pi, warmup_tracks, num_warmup_tracks);
 	if(result != OK)
 	{
 		D(("that didnt't work (error=%ld)", result));
 		goto out;
 	}
 
-	/* If this succeeded, then the file is now in the
-	 * hands of the unit Process.
+	/* If this succeeded, then the file and the track index
+	 * information are now in the hands of the unit Process.
 	 */
 	file = ZERO;
+	eai = NULL;
+	pi = NULL;
 
 	SHOWMSG("that went well");
 
@@ -1679,8 +1904,25 @@ tf_insert_media_taglist(
 
  out:
 
+	/* If the medium was not accepted, the unit no longer
+	 * uses the disk image file's cache entries.
+	 */
+	#if defined(ENABLE_CACHE)
+	{
+		if(result != OK && cache_image != NULL)
+		{
+			which_tfu->tfu_CacheImage = NULL;
+
+			release_cache_image(tfd->tfd_CacheContext, cache_image);
+		}
+	}
+	#endif /* ENABLE_CACHE */
+
 	free_aligned_memory(tfd, &track_memory);
 
+	free_extended_adf(tfd, eai);
+	free_packed_image(tfd, pi);
+
 	if(file != ZERO)
 		Close(file);
 
@@ -1913,6 +2155,44 @@ tf_eject_media_taglist(
 
 /***********************************************************************/
 
+/* TFGetUnitData() allocates each record together with the statistics
+ * groups which it reports, so that TFFreeUnitData() can release them
+ * in one go.
+ */
+struct UnitDataRecord
+{
+	struct TrackFileUnitDataExtension		udr_Extension;
+
+	struct TrackFileQueueStatistics			udr_Queue;
+	struct TrackFileChunkStatistics			udr_Chunks;
+	struct TrackFileJobGroup				udr_Jobs;
+	struct TrackFileAccessOrder				udr_AccessOrder;
+	struct TrackFilePredictionStatistics	udr_Prediction;
+	struct TrackFileMemoryStatistics		udr_Memory;
+};
+
+/***********************************************************************/
+
+/* Add a statistics group to the end of the list of groups which
+ * a TFGetUnitData() record reports.
+ */
+static VOID
+add_statistics_group(struct UnitDataRecord * udr, struct TrackFileStatisticsGroup * tfsg, ULONG type, ULONG size)
+{
+	struct TrackFileStatisticsGroup ** tail;
+
+	for(tail = &udr->udr_Extension.tfude_Groups ; (*tail) != NULL ; tail = &(*tail)->tfsg_Next)
+		;
+
+	tfsg->tfsg_Next	= NULL;
+	tfsg->tfsg_Type	= type;
+	tfsg->tfsg_Size	= size;
+
+	(*tail) = tfsg;
+}
+
+/***********************************************************************/
+
 /****** trackfile.device/TFGetUnitData ***************************************
 *
 *   NAME
@@ -1959,6 +2239,18 @@ tf_eject_media_taglist(
 *	need to be released when no longer needed. More active units will
 *	require more memory to store the snapshot.
 *
+*	Each record is really a "struct TrackFileUnitDataExtension" which
+*	includes a copy of the unit's per-track access counters and a list
+*	of statistics groups: the statistics of its I/O request queue,
+*	how often large read and write requests were split into chunks,
+*	how much time the unit spent on background work while it was idle,
+*	the order in which the tracks were first read since the medium was
+*	inserted, how well the track predictor did, and how much memory
+*	the unit uses, including its share of the cache. Check that
+*	tfud_Size is at least as large as that structure before you access
+*	them, and that the tfsg_Size of each group is large enough for the
+*	fields you need (see "trackfile_extensions.h").
+*
 *   SEE ALSO
 *	<devices/trackdisk.h>, <devices/trackfile.h>, TFFreeUnitData()
 *
@@ -1980,6 +2272,7 @@ tf_get_unit_data(REG(d0, LONG which_unit), REG(a6, struct TrackFileDevice *tfd))
 	struct TrackFileUnitData * first_tfud = NULL;
 	struct TrackFileUnitData * previous_tfud = NULL;
 	struct TrackFileUnit * which_tfu;
+	struct UnitDataRecord * udr;
 	TEXT path_name[MAX_PATH_SIZE];
 	struct DosList * dol;
 	LONG error = OK;
@@ -2031,7 +2324,7 @@ tf_get_unit_data(REG(d0, LONG which_unit), REG(a6, struct TrackFileDevice *tfd))
 		    tfu->tfu_Unit.tdu_Unit.unit_MsgPort.mp_Node.ln_Succ != NULL && error == OK;
 		    tfu = (struct TrackFileUnit *)tfu->tfu_Unit.tdu_Unit.unit_MsgPort.mp_Node.ln_Succ)
 		{
-			tfud = AllocVec(sizeof(*tfud), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+			tfud = AllocVec(sizeof(struct UnitDataRecord), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
 			if(tfud == NULL)
 			{
 				SHOWMSG("not enough memory");
@@ -2075,7 +2368,7 @@ tf_get_unit_data(REG(d0, LONG which_unit), REG(a6, struct TrackFileDevice *tfd))
 			goto out;
 		}
 
-		tfud = AllocVec(sizeof(*tfud), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+		tfud = AllocVec(sizeof(struct UnitDataRecord), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
 		if(tfud == NULL)
 		{
 			SHOWMSG("not enough memory");
@@ -2123,11 +2416,13 @@ tf_get_unit_data(REG(d0, LONG which_unit), REG(a6, struct TrackFileDevice *tfd))
 		/* Update the disk checksum if necessary. */
 		update_disk_checksum(which_tfu);
 
-		tfud->tfud_Size				= sizeof(*tfud);
+		udr = (struct UnitDataRecord *)tfud;
+
+		tfud->tfud_Size				= sizeof(struct TrackFileUnitDataExtension);
 		tfud->tfud_DriveType		= which_tfu->tfu_DriveType;
 		tfud->tfud_IsActive			= unit_is_active(which_tfu);
 		tfud->tfud_MediumIsPresent	= unit_medium_is_present(which_tfu);
-		tfud->tfud_IsBusy			= unit_medium_is_busy(which_tfu);
+		tfud->tfud_IsBusy			= unit_medium_is_busy(which_tfu) || which_tfu->tfu_Copying;
 		tfud->tfud_IsWritable		= NOT which_tfu->tfu_WriteProtected;
 		tfud->tfud_ChecksumsEnabled	= (BOOL)(which_tfu->tfu_DiskChecksumTable != NULL);
 
@@ -2190,41 +2485,186 @@ tf_get_unit_data(REG(d0, LONG which_unit), REG(a6, struct TrackFileDevice *tfd))
 		tfud->tfud_FileSysSignature		= which_tfu->tfu_FileSystemSignature;
 		tfud->tfud_BootBlockChecksum	= which_tfu->tfu_BootBlockChecksum;
 
-		D(("releasing unit %ld lock", which_tfu->tfu_UnitNumber));
-		ReleaseSemaphore(&which_tfu->tfu_Lock);
+		/* How busy the unit's request queue is. */
+		{
+			struct TrackFileQueueStatistics * tfqs = &udr->udr_Queue;
 
-		D(("trying to get the device name used by unit %ld", tfud->tfud_UnitNumber));
+			tfqs->tfqs_QueueDepth			= which_tfu->tfu_QueueDepth;
+			tfqs->tfqs_MaxQueueDepth		= which_tfu->tfu_MaxQueueDepth;
+			tfqs->tfqs_NumRequestsAborted	= which_tfu->tfu_NumRequestsAborted;
 
-		/* Let's see if the AmigaDOS device name for this unit is known. */
-		for(dol = NextDosEntry(LockDosList(LDF_DEVICES|LDF_READ), LDF_DEVICES) ;
-		    dol != NULL ;
-		    dol = NextDosEntry(dol, LDF_DEVICES))
+			add_statistics_group(udr, &tfqs->tfqs_Group, TFSG_Queue, sizeof(*tfqs));
+		}
+
+		/* How large requests were split into chunks. */
 		{
-			struct fs_startup_msg fsm;
+			struct TrackFileChunkStatistics * tfcs = &udr->udr_Chunks;
 
-			if(decode_file_sys_startup_msg(SysBase, dol->dol_misc.dol_handler.dol_Startup, &fsm))
-			{
-				if(fsm.fsm_device_unit == tfud->tfud_UnitNumber &&
-					strcmp(fsm.fsm_device_name, tfd->tfd_Device.dd_Library.lib_Node.ln_Name) == SAME)
-				{
-					const TEXT * device_name = BADDR(dol->dol_Name);
-					int device_name_len = device_name[0];
+			tfcs->tfcs_NumChunkedRequests			= which_tfu->tfu_NumChunkedRequests;
+			tfcs->tfcs_NumRequestsBetweenChunks		= which_tfu->tfu_NumRequestsBetweenChunks;
+			tfcs->tfcs_MaxLatencyBetweenChunks		= which_tfu->tfu_MaxLatencyBetweenChunks;
 
-					tfud->tfud_DeviceName = AllocVec(device_name_len+1, MEMF_ANY|MEMF_PUBLIC);
-					if(tfud->tfud_DeviceName != NULL)
-					{
-						CopyMem(&device_name[1], tfud->tfud_DeviceName, device_name_len);
-						tfud->tfud_DeviceName[device_name_len] = '\0';
+			add_statistics_group(udr, &tfcs->tfcs_Group, TFSG_Chunks, sizeof(*tfcs));
+		}
 
-						D(("and the name is \"%s\"", tfud->tfud_DeviceName));
-					}
-					else
-					{
-						SHOWMSG("out of memory");
-					}
+		/* How much time was spent on background work. */
+		{
+			struct TrackFileJobGroup * tfjg = &udr->udr_Jobs;
 
-					break;
-				}
+			CopyMem(which_tfu->tfu_JobStatistics, tfjg->tfjg_Jobs, sizeof(tfjg->tfjg_Jobs));
+
+			tfjg->tfjg_NumPauses	= which_tfu->tfu_NumJobPauses;
+			tfjg->tfjg_PauseTime	= which_tfu->tfu_JobPauseTime;
+
+			add_statistics_group(udr, &tfjg->tfjg_Group, TFSG_Jobs, sizeof(*tfjg));
+		}
+
+		/* Which tracks were read, in order of first access. */
+		{
+			struct TrackFileAccessOrder * tfao = &udr->udr_AccessOrder;
+
+			if(unit_medium_is_present(which_tfu))
+			{
+				LONG num_tracks_accessed = which_tfu->tfu_NumTracksAccessed;
+
+				ASSERT( num_tracks_accessed <= TF_MAX_WARMUP_TRACKS );
+
+				CopyMem(which_tfu->tfu_TrackAccessOrder, tfao->tfao_TrackAccessOrder, num_tracks_accessed);
+
+				tfao->tfao_NumTracksAccessed = num_tracks_accessed;
+			}
+
+			add_statistics_group(udr, &tfao->tfao_Group, TFSG_AccessOrder, sizeof(*tfao));
+		}
+
+		/* How well the track predictor did. */
+		#if defined(ENABLE_CACHE)
+		{
+			struct TrackFilePredictionStatistics * tfps = &udr->udr_Prediction;
+
+			tfps->tfps_NumPredictions			= which_tfu->tfu_NumPredictions;
+			tfps->tfps_NumCorrectPredictions	= which_tfu->tfu_NumCorrectPredictions;
+			tfps->tfps_NumTracksPrefetched		= which_tfu->tfu_NumTracksPrefetched;
+			tfps->tfps_NumPrefetchedTracksUsed	= which_tfu->tfu_NumPrefetchedTracksUsed;
+
+			tfps->tfps_PrefetchBytesWasted =
+				(which_tfu->tfu_NumTracksPrefetched - which_tfu->tfu_NumPrefetchedTracksUsed) * which_tfu->tfu_TrackDataSize;
+
+			add_statistics_group(udr, &tfps->tfps_Group, TFSG_Prediction, sizeof(*tfps));
+		}
+		#endif /* ENABLE_CACHE */
+
+		/* How much memory the unit uses. */
+		{
+			struct TrackFileMemoryStatistics * tfms = &udr->udr_Memory;
+
+			tfms->tfms_UnitMemory = sizeof(*which_tfu);
+
+			/* The track buffer is allocated with room for
+			 * aligning it to a 16 byte boundary.
+			 */
+			if(which_tfu->tfu_TrackMemory.ama_Allocated != NULL)
+				tfms->tfms_TrackBufferMemory = which_tfu->tfu_TrackDataSize + 15;
+
+			if(which_tfu->tfu_DiskChecksumTable != NULL)
+				tfms->tfms_ChecksumTableMemory = sizeof(*which_tfu->tfu_DiskChecksumTable) * (1 + which_tfu->tfu_DiskChecksumTableLength);
+
+			#if defined(ENABLE_MFM_ENCODING)
+			{
+				const struct mfm_code_context * mcc = which_tfu->tfu_MFMCodeContext;
+
+				if(mcc != NULL)
+					tfms->tfms_MFMCodeMemory = sizeof(*mcc) - sizeof(mcc->mcc_data) + mcc->mcc_data_size + mcc->mcc_sector_gap_size;
+			}
+			#endif /* ENABLE_MFM_ENCODING */
+
+			/* The unit process cannot go away while we
+			 * are holding the unit lock.
+			 */
+			if(which_tfu->tfu_Process != NULL)
+			{
+				const struct Task * tc = &which_tfu->tfu_Process->pr_Task;
+
+				tfms->tfms_StackMemory = (ULONG)tc->tc_SPUpper - (ULONG)tc->tc_SPLower;
+			}
+
+			tfms->tfms_CheckpointMemory = which_tfu->tfu_NumCheckpointTracks * which_tfu->tfu_TrackDataSize;
+
+			#if defined(ENABLE_CACHE)
+			{
+				if(tfd->tfd_CacheContext != NULL)
+				{
+					get_cache_memory_usage(tfd->tfd_CacheContext, which_tfu->tfu_CacheImage,
+						&tfms->tfms_NumCacheNodes, &tfms->tfms_TotalCacheNodes);
+
+					if(which_tfu->tfu_CacheImage != NULL)
+						tfms->tfms_NumCacheImageUsers = which_tfu->tfu_CacheImage->ci_UseCount;
+
+					tfms->tfms_CacheNodeOverhead	= sizeof(struct CacheNode);
+					tfms->tfms_CacheNodePayload		= tfd->tfd_CacheContext->cc_DataSize;
+				}
+			}
+			#endif /* ENABLE_CACHE */
+
+			add_statistics_group(udr, &tfms->tfms_Group, TFSG_Memory, sizeof(*tfms));
+		}
+
+		/* Make a copy of the per-track access counters. */
+		if(which_tfu->tfu_NumTracks > 0)
+		{
+			struct TrackFileUnitDataExtension * tfude = &udr->udr_Extension;
+			LONG table_size = sizeof(*tfude->tfude_TrackStatistics) * which_tfu->tfu_NumTracks;
+
+			ASSERT( which_tfu->tfu_NumTracks <= NUM_STATISTICS_TRACKS );
+
+			tfude->tfude_TrackStatistics = AllocVec(table_size, MEMF_ANY|MEMF_PUBLIC);
+			if(tfude->tfude_TrackStatistics != NULL)
+			{
+				CopyMem(which_tfu->tfu_TrackStatistics, tfude->tfude_TrackStatistics, table_size);
+
+				tfude->tfude_NumTracks = which_tfu->tfu_NumTracks;
+			}
+			else
+			{
+				SHOWMSG("out of memory");
+			}
+		}
+
+		D(("releasing unit %ld lock", which_tfu->tfu_UnitNumber));
+		ReleaseSemaphore(&which_tfu->tfu_Lock);
+
+		D(("trying to get the device name used by unit %ld", tfud->tfud_UnitNumber));
+
+		/* Let's see if the AmigaDOS device name for this unit is known. */
+		for(dol = NextDosEntry(LockDosList(LDF_DEVICES|LDF_READ), LDF_DEVICES) ;
+		    dol != NULL ;
+		    dol = NextDosEntry(dol, LDF_DEVICES))
+		{
+			struct fs_startup_msg fsm;
+
+			if(decode_file_sys_startup_msg(SysBase, dol->dol_misc.dol_handler.dol_Startup, &fsm))
+			{
+				if(fsm.fsm_device_unit == tfud->tfud_UnitNumber &&
+					strcmp(fsm.fsm_device_name, tfd->tfd_Device.dd_Library.lib_Node.ln_Name) == SAME)
+				{
+					const TEXT * device_name = BADDR(dol->dol_Name);
+					int device_name_len = device_name[0];
+
+					tfud->tfud_DeviceName = AllocVec(device_name_len+1, MEMF_ANY|MEMF_PUBLIC);
+					if(tfud->tfud_DeviceName != NULL)
+					{
+						CopyMem(&device_name[1], tfud->tfud_DeviceName, device_name_len);
+						tfud->tfud_DeviceName[device_name_len] = '\0';
+
+						D(("and the name is \"%s\"", tfud->tfud_DeviceName));
+					}
+					else
+					{
+						SHOWMSG("out of memory");
+					}
+
+					break;
+				}
 			}
 		}
 
@@ -2311,6 +2751,14 @@ tf_free_unit_data(REG(a0, struct TrackFileUnitData * first_tfud), REG(a6, struct
 		if(tfud->tfud_DeviceName != NULL)
 			FreeVec(tfud->tfud_DeviceName);
 
+		if(tfud->tfud_Size >= sizeof(struct TrackFileUnitDataExtension))
+		{
+			struct TrackFileUnitDataExtension * tfude = (struct TrackFileUnitDataExtension *)tfud;
+
+			if(tfude->tfude_TrackStatistics != NULL)
+				FreeVec(tfude->tfude_TrackStatistics);
+		}
+
 		FreeVec(tfud);
 	}
 
@@ -2379,6 +2827,33 @@ tf_free_unit_data(REG(a0, struct TrackFileUnitData * first_tfud), REG(a6, struct
 *	    able to use the shared cache and enabling it will have no
 *	    effect.
 *
+*	TF_ResetTrackStatistics (BOOL) -- Each unit counts how often each
+*	    track was loaded, how often it was written back, and how often
+*	    it had to be read from the disk image file because it was not
+*	    found in the cache. TF_ResetTrackStatistics set to TRUE will
+*	    reset these counters to zero. Use TFUNIT_CONTROL as the unit
+*	    number to reset the counters of all units.
+*
+*	TF_Checkpoint (BOOL) -- TRUE takes a checkpoint of the disk contents,
+*	    replacing any previous one, and FALSE discards it. Taking a
+*	    checkpoint copies nothing: from then on, each track is copied
+*	    to memory only before it is changed for the first time. This
+*	    memory is released when the checkpoint is discarded or the
+*	    medium is ejected. Extended ADF files and packed disk image
+*	    files cannot be changed, and do not support checkpoints.
+*
+*	TF_Rollback (BOOL) -- TRUE restores the disk contents as of the
+*	    last TF_Checkpoint. Only the tracks which have been changed
+*	    since then are written back, and their cache entries are
+*	    invalidated. Changes which have not been written back yet are
+*	    lost. The checkpoint remains in effect, so that the disk
+*	    contents can be restored again later. Since the file system
+*	    must not be using the medium at this time, you should inhibit
+*	    it first, which also makes it read the restored contents
+*	    afterwards. Fails with ERROR_OBJECT_NOT_FOUND if no checkpoint
+*	    was taken, and with TDERR_DriveInUse if the motor is still
+*	    turned on.
+*
 *   RESULT
 *	error - Zero if successful, otherwise an error code is returned.
 *
@@ -2560,6 +3035,72 @@ tf_change_unit_taglist(
 
 		#endif /* ENABLE_CACHE */
 
+			/* Start counting track accesses from scratch? */
+			case TF_ResetTrackStatistics:
+
+				D(("TF_ResetTrackStatistics=%s", ti->ti_Data ? "TRUE" : "FALSE"));
+
+				if(ti->ti_Data != FALSE)
+				{
+					struct TrackFileUnit * reset_tfu;
+
+					/* The control unit stands for all units. */
+					for(reset_tfu = (struct TrackFileUnit *)tfd->tfd_UnitList.mlh_Head ;
+					    reset_tfu->tfu_Unit.tdu_Unit.unit_MsgPort.mp_Node.ln_Succ != NULL ;
+					    reset_tfu = (struct TrackFileUnit *)reset_tfu->tfu_Unit.tdu_Unit.unit_MsgPort.mp_Node.ln_Succ)
+					{
+						if(tfu != NULL && reset_tfu != tfu)
+							continue;
+
+						D(("resetting track statistics of unit %ld", reset_tfu->tfu_UnitNumber));
+
+						ObtainSemaphore(&reset_tfu->tfu_Lock);
+
+						memset(reset_tfu->tfu_TrackStatistics, 0, sizeof(reset_tfu->tfu_TrackStatistics));
+
+						ReleaseSemaphore(&reset_tfu->tfu_Lock);
+					}
+				}
+
+				break;
+
+			/* Take or discard a checkpoint of the disk contents? */
+			case TF_Checkpoint:
+			case TF_Rollback:
+
+				D(("%s=%s", (ti->ti_Tag == TF_Checkpoint) ? "TF_Checkpoint" : "TF_Rollback", ti->ti_Data ? "TRUE" : "FALSE"));
+
+				/* The control unit does not support this operation. */
+				if(which_unit == TFUNIT_CONTROL)
+				{
+					SHOWMSG("the control unit does not support this operation");
+
+					if(tag_item_failed != NULL)
+						(*tag_item_failed) = ti;
+
+					result = TFERROR_NotSupported;
+					goto out;
+				}
+
+				ASSERT( tfu != NULL );
+
+				/* Rolling back is optional. */
+				if(ti->ti_Tag == TF_Rollback && ti->ti_Data == FALSE)
+					break;
+
+				result = send_unit_control_command(tfu, (ti->ti_Tag == TF_Checkpoint) ? TFC_Checkpoint : TFC_Rollback, ZERO, 0, FALSE, (BOOL)(ti->ti_Data != FALSE));
+				if(result != OK)
+				{
+					D(("that didn't work (error=%ld)", result));
+
+					if(tag_item_failed != NULL)
+						(*tag_item_failed) = ti;
+
+					goto out;
+				}
+
+				break;
+
 			default:
 
 				break;
@@ -2660,3 +3201,355 @@ tf_examine_file_size(
 	RETURN(result);
 	return(result);
 }
+
+/***********************************************************************/
+
+/****** trackfile.device/TFCopyUnitTagList ***********************************
+*
+*   NAME
+*	TFCopyUnitTagList - Copy the contents of the disk image file of one
+*	    unit to the disk image file of a different unit.
+*
+*   SYNOPSIS
+*	error = TFCopyUnitTagList(from_unit, to_unit, tags)
+*	  D0                         D0         D1      A0
+*
+*	LONG TFCopyUnitTagList(LONG from_unit, LONG to_unit,
+*	                       const struct TagItem *tags);
+*
+*   FUNCTION
+*	Duplicating a disk, e.g. for making a backup copy, would otherwise
+*	require reading every track of one unit through CMD_READ and
+*	writing it to the other unit through CMD_WRITE. TFCopyUnitTagList()
+*	performs the same operation within trackfile.device: track data
+*	found in the source unit's track buffer or in the shared unit cache
+*	is used as is, the destination disk image file is written in runs
+*	of several tracks at a time and the track checksums of the source
+*	unit are carried over rather than calculated anew.
+*
+*	Once the copy operation has finished, the destination unit will
+*	report a disk change, just as if a new disk had been inserted.
+*
+*	The other trackfile.device functions remain available while the
+*	tracks are copied. However, neither unit's medium can be ejected
+*	or rolled back to a checkpoint until the copy operation has
+*	finished.
+*
+*   INPUTS
+*	from_unit -- Which unit to copy the disk contents from. Unit
+*	    numbers must be >= 0.
+*
+*	to_unit -- Which unit to copy the disk contents to. This must not
+*	    be the same as from_unit.
+*
+*	tags -- Pointer to a list of TagItems; this may be NULL. No tags
+*	    are currently defined.
+*
+*   RESULT
+*	error - Zero if successful, otherwise an error code is returned.
+*
+*   ERRORS
+*	TFERROR_Denied -- Only a Process may call the
+*	    TFCopyUnitTagList() function, never a Task.
+*
+*	TFERROR_UnitNotFound -- One of the units you requested is not
+*	    known.
+*
+*	TFERROR_AlreadyInUse -- The source and the destination unit
+*	    are the same, or one of them is being copied by another
+*	    TFCopyUnitTagList() call.
+*
+*	TFERROR_NoMediumPresent -- One of the units currently has no
+*	    medium inserted.
+*
+*	TFERROR_InvalidFileSize -- The disk image files of the two units
+*	    do not have the same size.
+*
+*	TFERROR_OutOfMemory -- Not enough memory for the copy buffer is
+*	    available.
+*
+*	TDERR_WriteProt -- The destination unit's medium is
+*	    write-protected.
+*
+*	TDERR_DriveInUse -- The destination unit's medium is still in
+*	    use, i.e. its motor is running.
+*
+*	TDERR_NoSecHdr, TDERR_BadSecHdr -- The source disk image file could
+*	    not be read.
+*
+*	TDERR_SeekError, TDERR_DiskChanged -- The destination disk image
+*	    file could not be written to.
+*
+*   NOTES
+*	The file system which uses the destination unit should be
+*	inhibited while the copy is made. Once the copy is complete,
+*	both units will contain the same volume, with the same name and
+*	creation date, as would be the case for a disk copied with the
+*	"DiskCopy" command.
+*
+*	If the copy operation fails after the destination disk image file
+*	has been written to, its contents will be incomplete. The disk
+*	change is reported nonetheless.
+*
+*   SEE ALSO
+*	<devices/trackdisk.h>, <devices/trackfile.h>, TFInsertMediaTagList()
+*
+******************************************************************************
+*
+*/
+
+LONG ASM
+tf_copy_unit_taglist(
+	REG(d0, LONG from_unit),
+	REG(d1, LONG to_unit),
+	REG(a0, struct TagItem * tags),
+	REG(a6, struct TrackFileDevice *tfd))
+{
+	USE_EXEC(tfd);
+
+	struct fletcher64_checksum checksums[MAX_TRACK_RUN_LENGTH];
+	struct AlignedMemoryAllocation run_memory;
+	struct TrackFileUnit * from_tfu = NULL;
+	struct TrackFileUnit * to_tfu = NULL;
+	struct TrackFileTrackRun tftr;
+	struct MsgPort * file_system;
+	BOOL from_medium_is_present;
+	BOOL to_medium_is_present;
+	BOOL copy_checksums;
+	BOOL tracks_written = FALSE;
+	BOOL device_is_locked = FALSE;
+	BOOL units_are_marked = FALSE;
+	LONG from_file_size, to_file_size;
+	LONG from_num_tracks, to_num_tracks;
+	LONG track_size;
+	LONG run_length;
+	LONG result;
+
+	ENTER();
+
+	#if DEBUG
+	check_stack_size_available(SysBase);
+	#endif /* DEBUG */
+
+	memset(&run_memory, 0, sizeof(run_memory));
+
+	ASSERT( FindTask(NULL)->tc_Node.ln_Type == NT_PROCESS );
+
+	/* Paranoia? */
+	if(FindTask(NULL)->tc_Node.ln_Type != NT_PROCESS)
+	{
+		SHOWMSG("this function cannot be called safely by a Task, it needs a Process");
+
+		result = TFERROR_Denied;
+		goto out;
+	}
+
+	SHOWVALUE(from_unit);
+	SHOWVALUE(to_unit);
+	SHOWPOINTER(tags);
+
+	SHOWMSG("obtaining device lock");
+	ObtainSemaphore(&tfd->tfd_Lock);
+	device_is_locked = TRUE;
+
+	/* Let's see which units were requested. */
+	from_tfu = find_unit_by_number(tfd, from_unit);
+	if(from_tfu == NULL)
+	{
+		D(("didn't find unit %ld", from_unit));
+
+		result = TFERROR_UnitNotFound;
+		goto out;
+	}
+
+	to_tfu = find_unit_by_number(tfd, to_unit);
+	if(to_tfu == NULL)
+	{
+		D(("didn't find unit %ld", to_unit));
+
+		result = TFERROR_UnitNotFound;
+		goto out;
+	}
+
+	if(from_tfu == to_tfu)
+	{
+		SHOWMSG("cannot copy a unit onto itself");
+
+		result = TFERROR_AlreadyInUse;
+		goto out;
+	}
+
+	/* Only one copy may involve a unit at a time. */
+	if(from_tfu->tfu_Copying || to_tfu->tfu_Copying)
+	{
+		SHOWMSG("one of the units is being copied already");
+
+		result = TFERROR_AlreadyInUse;
+		goto out;
+	}
+
+	/* The device lock is not held while the tracks are copied.
+	 * Marking both units as being copied keeps their media
+	 * from being ejected or rolled back meanwhile, and hence
+	 * the units from being stopped.
+	 */
+	units_are_marked = TRUE;
+
+	D(("obtaining unit %ld lock", from_tfu->tfu_UnitNumber));
+	ObtainSemaphore(&from_tfu->tfu_Lock);
+
+	from_tfu->tfu_Copying = TRUE;
+
+	from_medium_is_present	= (BOOL)(from_tfu->tfu_File != ZERO);
+	from_file_size			= from_tfu->tfu_FileSize;
+	from_num_tracks			= from_tfu->tfu_NumTracks;
+	track_size				= from_tfu->tfu_TrackDataSize;
+
+	D(("releasing unit %ld lock", from_tfu->tfu_UnitNumber));
+	ReleaseSemaphore(&from_tfu->tfu_Lock);
+
+	D(("obtaining unit %ld lock", to_tfu->tfu_UnitNumber));
+	ObtainSemaphore(&to_tfu->tfu_Lock);
+
+	to_tfu->tfu_Copying = TRUE;
+
+	to_medium_is_present	= (BOOL)(to_tfu->tfu_File != ZERO);
+	to_file_size			= to_tfu->tfu_FileSize;
+	to_num_tracks			= to_tfu->tfu_NumTracks;
+	file_system				= to_tfu->tfu_TrackFileSystem;
+	copy_checksums			= (BOOL)(to_tfu->tfu_DiskChecksumTable != NULL);
+
+	D(("releasing unit %ld lock", to_tfu->tfu_UnitNumber));
+	ReleaseSemaphore(&to_tfu->tfu_Lock);
+
+	if(NOT from_medium_is_present || NOT to_medium_is_present)
+	{
+		SHOWMSG("both units need to have a medium inserted");
+
+		result = TFERROR_NoMediumPresent;
+		goto out;
+	}
+
+	if(from_file_size != to_file_size || from_num_tracks != to_num_tracks)
+	{
+		D(("disk image file sizes differ (%ld != %ld)", from_file_size, to_file_size));
+
+		result = TFERROR_InvalidFileSize;
+		goto out;
+	}
+
+	SHOWMSG("releasing device lock");
+	ReleaseSemaphore(&tfd->tfd_Lock);
+	device_is_locked = FALSE;
+
+	/* The longer the runs of tracks which are copied, the fewer
+	 * messages need to be exchanged with the unit processes, and
+	 * the fewer write operations the file system has to deal with.
+	 * Settle for shorter runs if memory is tight.
+	 */
+	for(run_length = MAX_TRACK_RUN_LENGTH ; run_length > 0 ; run_length /= 2)
+	{
+		if(allocate_aligned_memory(tfd, file_system, run_length * track_size, &run_memory) == OK)
+			break;
+	}
+
+	if(run_length == 0)
+	{
+		SHOWMSG("not enough memory for the copy buffer");
+
+		result = TFERROR_OutOfMemory;
+		goto out;
+	}
+
+	D(("copying %ld tracks, up to %ld at a time", from_num_tracks, run_length));
+
+	memset(&tftr, 0, sizeof(tftr));
+
+	tftr.tftr_Data		= run_memory.ama_Aligned;
+	tftr.tftr_Checksums	= copy_checksums ? checksums : NULL;
+
+	for(tftr.tftr_FirstTrack = 0 ;
+	    tftr.tftr_FirstTrack < from_num_tracks ;
+	    tftr.tftr_FirstTrack += tftr.tftr_NumTracks)
+	{
+		tftr.tftr_NumTracks = from_num_tracks - tftr.tftr_FirstTrack;
+		if(tftr.tftr_NumTracks > run_length)
+			tftr.tftr_NumTracks = run_length;
+
+		result = send_unit_track_run(from_tfu, TFC_ReadTrackRun, &tftr);
+		if(result != OK)
+		{
+			D(("could not read tracks %ld..%ld of unit %ld (error=%ld)",
+				tftr.tftr_FirstTrack, tftr.tftr_FirstTrack + tftr.tftr_NumTracks - 1,
+				from_unit, result));
+
+			goto out;
+		}
+
+		/* Even if the write operation fails, some of the
+		 * destination disk contents may have changed.
+		 */
+		tracks_written = TRUE;
+
+		result = send_unit_track_run(to_tfu, TFC_WriteTrackRun, &tftr);
+		if(result != OK)
+		{
+			D(("could not write tracks %ld..%ld of unit %ld (error=%ld)",
+				tftr.tftr_FirstTrack, tftr.tftr_FirstTrack + tftr.tftr_NumTracks - 1,
+				to_unit, result));
+
+			goto out;
+		}
+	}
+
+	SHOWMSG("that went well");
+
+	result = OK;
+
+ out:
+
+	/* The file system using the destination unit needs to
+	 * know that the disk contents have changed. This is
+	 * reported only once, no matter how many tracks were
+	 * copied.
+	 */
+	if(tracks_written)
+		trigger_change(to_tfu);
+
+	free_aligned_memory(tfd, &run_memory);
+
+	if(units_are_marked)
+	{
+		if(NOT device_is_locked)
+		{
+			SHOWMSG("obtaining device lock");
+			ObtainSemaphore(&tfd->tfd_Lock);
+			device_is_locked = TRUE;
+		}
+
+		D(("obtaining unit %ld lock", from_tfu->tfu_UnitNumber));
+		ObtainSemaphore(&from_tfu->tfu_Lock);
+
+		from_tfu->tfu_Copying = FALSE;
+
+		D(("releasing unit %ld lock", from_tfu->tfu_UnitNumber));
+		ReleaseSemaphore(&from_tfu->tfu_Lock);
+
+		D(("obtaining unit %ld lock", to_tfu->tfu_UnitNumber));
+		ObtainSemaphore(&to_tfu->tfu_Lock);
+
+		to_tfu->tfu_Copying = FALSE;
+
+		D(("releasing unit %ld lock", to_tfu->tfu_UnitNumber));
+		ReleaseSemaphore(&to_tfu->tfu_Lock);
+	}
+
+	if(device_is_locked)
+	{
+		SHOWMSG("releasing device lock");
+		ReleaseSemaphore(&tfd->tfd_Lock);
+	}
+
+	RETURN(result);
+	return(result);
+}
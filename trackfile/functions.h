@@ -34,6 +34,12 @@
 
 /****************************************************************************/
 
+#ifndef _UNIT_H
+struct TrackFileUnit;
+#endif /* _UNIT_H */
+
+/****************************************************************************/
+
 LONG ASM tf_start_unit_taglist(REG (d0, LONG which_unit ), REG (a0, struct TagItem *tags ), REG (a6, struct TrackFileDevice *tfd ));
 LONG ASM tf_stop_unit_taglist(REG (d0, LONG which_unit ), REG (a0, struct TagItem *tags ), REG (a6, struct TrackFileDevice *tfd ));
 LONG ASM tf_insert_media_taglist(REG (d0, LONG which_unit ), REG (a0, struct TagItem *tags ), REG (a6, struct TrackFileDevice *tfd ));
@@ -42,6 +48,9 @@ LONG ASM tf_change_unit_taglist(REG (d0, LONG which_unit ), REG (a0, struct TagI
 struct TrackFileUnitData *ASM tf_get_unit_data(REG (d0, LONG which_unit ), REG (a6, struct TrackFileDevice *tfd ));
 VOID ASM tf_free_unit_data(REG (a0, struct TrackFileUnitData *first_tfud ), REG (a6, struct TrackFileDevice *tfd ));
 LONG ASM tf_examine_file_size(REG (d0, LONG file_size), REG (a6, struct TrackFileDevice *tfd ));
+LONG ASM tf_copy_unit_taglist(REG (d0, LONG from_unit ), REG (d1, LONG to_unit ), REG (a0, struct TagItem *tags ), REG (a6, struct TrackFileDevice *tfd ));
+
+void update_disk_checksum(struct TrackFileUnit * tfu);
 
 /****************************************************************************/
 
@@ -0,0 +1,968 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * cc -O2 -o adf2eadf adf2eadf.c
+ */
+
+/*
+ * This tool converts ADF disk image files into extended ADF files, which
+ * hold every track as a raw MFM bit stream, the way an emulator or a disk
+ * writer needs it. It runs on the host and only uses the standard 'C'
+ * library, so that entire image libraries can be converted in one go.
+ *
+ * Each ADF file is streamed one track at a time: read the track, encode
+ * its sectors, write the encoded track. Because all tracks are encoded to
+ * the same size, the file header and the track headers can be written
+ * before the first track, and no more than one track is ever held in
+ * memory.
+ *
+ * The encoder is a word-parallel version of mfm_encode_sector() in
+ * mfm_encoding.c. The original encodes every 32 bit word through a chain
+ * of helper functions, each of which checks the buffer bounds and tracks
+ * the previous byte stored, and it computes the checksums by reading
+ * back what it has just encoded. The version in here computes both
+ * checksums from the sector data before encoding anything, and encodes
+ * each 32 bit word with a single expression which also takes care of the
+ * clock bit shared with the preceding word. The original encoder is
+ * included for reference, and the -b option compares the two, both for
+ * speed and for identical output.
+ *
+ * The -v option decodes each track again after it has been encoded, as a
+ * disk reader would: it looks for the sector sync words, checks the
+ * sector headers and both checksums, compares the sector data with the
+ * ADF file contents and makes sure that the bit stream obeys the MFM
+ * encoding rules.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/****************************************************************************/
+
+#define SAME (0)
+#define NOT !
+
+/****************************************************************************/
+
+/* Both 3.5" double density and high density disks are supported. */
+#define NUM_TRACKS			(80 * 2)
+#define SECTOR_SIZE			512
+#define NUM_SECTORS_DD		11
+#define NUM_SECTORS_HD		22
+#define MAX_NUM_SECTORS		NUM_SECTORS_HD
+
+/****************************************************************************/
+
+/* Constants used in the sector header (in MFM format). */
+#define MFM_ZERO		0xAAAAAAAAUL	/* The value 0 in MFM-encoded form */
+#define MFM_SPECIAL_A1	0x44894489UL	/* Magic value identifying the sector header */
+
+/* In the MFM-encoded form only the odd bits of a 32 bit word
+ * carry the information.
+ */
+#define MFM_DATA_BIT_MASK	0x55555555UL
+#define MFM_CLOCK_BIT_MASK	0xAAAAAAAAUL
+
+/* Part of the sector header, identifying the Amiga 1.0 format */
+#define AMIGA_10_FORMAT 0xFF
+
+/****************************************************************************/
+
+/* An MFM-encoded sector takes up 1088 bytes (272 longwords): two words
+ * for the sync mark, two each for the sector information, eight for the
+ * sector label, two each for the header and data checksums and 256 for
+ * the sector data.
+ */
+#define MFM_SECTOR_LONGS	272
+#define MFM_SECTOR_SIZE		(MFM_SECTOR_LONGS * 4)
+
+/* Where the parts of an encoded sector begin, in longwords. */
+#define MFM_INFO			2
+#define MFM_LABEL			4
+#define MFM_HEADER_CHECKSUM	12
+#define MFM_DATA_CHECKSUM	14
+#define MFM_DATA			16
+
+/* The sector gap which follows the sectors, as trackdisk.device would
+ * write it on a double density disk. A high density disk needs twice
+ * as much.
+ */
+#define SECTOR_GAP_SIZE_DD	1660
+
+/* The largest encoded track, which is that of a high density disk. */
+#define MAX_RAW_TRACK_SIZE	(MAX_NUM_SECTORS * MFM_SECTOR_SIZE + 2 * SECTOR_GAP_SIZE_DD)
+
+/****************************************************************************/
+
+/* How often each track is encoded by either encoder for the
+ * speed comparison.
+ */
+#define NUM_BENCHMARK_ROUNDS 20
+
+/****************************************************************************/
+
+typedef uint32_t mfm_word_t;
+
+/****************************************************************************/
+
+/* What kind of disk the ADF file contains. */
+struct disk_format
+{
+	int		df_num_sectors;		/* Sectors per track */
+	long	df_track_size;		/* Bytes per track in the ADF file */
+	long	df_gap_size;		/* Size of the sector gap in bytes */
+	long	df_raw_track_size;	/* Size of an encoded track in bytes */
+};
+
+/****************************************************************************/
+
+static mfm_word_t
+get_long(const unsigned char * p)
+{
+	return(((mfm_word_t)p[0] << 24) | ((mfm_word_t)p[1] << 16) | ((mfm_word_t)p[2] << 8) | p[3]);
+}
+
+static void
+put_long(unsigned char * p, mfm_word_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+static void
+put_word(unsigned char * p, unsigned int value)
+{
+	p[0] = (unsigned char)(value >> 8);
+	p[1] = (unsigned char)value;
+}
+
+/****************************************************************************/
+
+/* Encode the data bits of a 32 bit word, adding the clock bits. A clock
+ * bit is set only if neither the data bit before it nor the data bit after
+ * it is set. For the most significant bit the data bit before it is the
+ * least significant bit of the word encoded before, which is passed in
+ * 'previous' and updated for the next call.
+ */
+static mfm_word_t
+encode_long(mfm_word_t d, mfm_word_t * previous)
+{
+	mfm_word_t clock;
+
+	d &= MFM_DATA_BIT_MASK;
+
+	clock = ~((d << 1) | (d >> 1) | ((*previous) << 31)) & MFM_CLOCK_BIT_MASK;
+
+	(*previous) = d & 1;
+
+	return(d | clock);
+}
+
+/****************************************************************************/
+
+/* Encode a single sector, with the given track number, sector number and
+ * sector offset, storing MFM_SECTOR_LONGS encoded words. The sector data
+ * is given in big-endian byte order.
+ */
+static void
+fast_encode_sector(
+	mfm_word_t *			encoded,
+	mfm_word_t *			previous,
+	int						track,
+	int						sector,
+	int						sector_offset,
+	const unsigned char *	sector_data)
+{
+	mfm_word_t data[SECTOR_SIZE / 4];
+	mfm_word_t info, checksum, data_checksum;
+	int i;
+
+	/* Pick up the sector data, and work out the data checksum while
+	 * we're at it: it covers the odd and the even bits of every word.
+	 */
+	data_checksum = 0;
+
+	for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+	{
+		data[i] = get_long(&sector_data[4 * i]);
+
+		data_checksum ^= data[i];
+	}
+
+	data_checksum = ((data_checksum >> 1) ^ data_checksum) & MFM_DATA_BIT_MASK;
+
+	/* The sector header's leading 0x0000 word, followed by the
+	 * sync mark, which no correct MFM encoding can produce.
+	 */
+	encoded[0] = encode_long(0, previous);
+	encoded[1] = MFM_SPECIAL_A1;
+
+	(*previous) = 1;
+
+	/* The sector information, followed by the sector label,
+	 * which is all zeroes.
+	 */
+	info = ((mfm_word_t)AMIGA_10_FORMAT << 24) | ((mfm_word_t)track << 16) | ((mfm_word_t)sector << 8) | (mfm_word_t)sector_offset;
+
+	encoded[MFM_INFO+0] = encode_long(info >> 1, previous);
+	encoded[MFM_INFO+1] = encode_long(info, previous);
+
+	for(i = MFM_LABEL ; i < MFM_HEADER_CHECKSUM ; i++)
+		encoded[i] = encode_long(0, previous);
+
+	/* The header checksum only covers the sector information,
+	 * since the label is all zeroes.
+	 */
+	checksum = ((info >> 1) ^ info) & MFM_DATA_BIT_MASK;
+
+	encoded[MFM_HEADER_CHECKSUM+0] = encode_long(checksum >> 1, previous);
+	encoded[MFM_HEADER_CHECKSUM+1] = encode_long(checksum, previous);
+
+	encoded[MFM_DATA_CHECKSUM+0] = encode_long(data_checksum >> 1, previous);
+	encoded[MFM_DATA_CHECKSUM+1] = encode_long(data_checksum, previous);
+
+	/* The odd bits of the sector data come first, then the even bits. */
+	for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+		encoded[MFM_DATA + i] = encode_long(data[i] >> 1, previous);
+
+	for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+		encoded[MFM_DATA + SECTOR_SIZE / 4 + i] = encode_long(data[i], previous);
+}
+
+/****************************************************************************/
+
+/* The following is the encoder in mfm_encoding.c, as used by
+ * trackfile.device for TD_RAWREAD, with the buffer holding 32 bit
+ * words rather than bytes. It serves as the reference for the
+ * speed and output comparison.
+ */
+struct mfm_code_context
+{
+	int				mcc_data_size;				/* In longwords */
+	int				mcc_sector_position;
+	int				mcc_data_position;
+	int				mcc_saved_data_position;
+	mfm_word_t		mcc_previous_word;
+	mfm_word_t *	mcc_data;
+};
+
+static void
+mfm_encode_store_encoded_word(struct mfm_code_context * mcc, mfm_word_t value)
+{
+	if(mcc->mcc_data_position + 1 <= mcc->mcc_data_size)
+	{
+		mcc->mcc_data[mcc->mcc_data_position++] = value;
+
+		/* Remember this for the next mfm_encode_half_the_bits() call. */
+		mcc->mcc_previous_word = value;
+	}
+}
+
+static void
+mfm_encode_skip_encoded_words(struct mfm_code_context * mcc, int count)
+{
+	if(mcc->mcc_data_position + count * 2 <= mcc->mcc_data_size)
+		mcc->mcc_data_position += count * 2;
+}
+
+static void
+mfm_encode_half_the_bits(struct mfm_code_context * mcc, mfm_word_t d0)
+{
+	mfm_word_t d2;
+
+	d0 &= MFM_DATA_BIT_MASK;
+	d2 = d0 ^ MFM_DATA_BIT_MASK;
+	d0 |= ((d2 >> 1) | (1UL << 31)) & (d2 << 1);
+
+	if(mcc->mcc_data_position > 0 && (mcc->mcc_previous_word & 1) != 0)
+		d0 &= ~(1UL << 31);
+
+	mfm_encode_store_encoded_word(mcc, d0);
+}
+
+static void
+mfm_encode_fix_clock_bit(struct mfm_code_context * mcc)
+{
+	if(mcc->mcc_data_position > 0)
+	{
+		mfm_word_t current_word = mcc->mcc_data[mcc->mcc_data_position];
+
+		if((current_word & (1UL << 30)) == 0)
+		{
+			if((mcc->mcc_previous_word & 1) == 0)
+				current_word |=  (1UL << 31);
+			else
+				current_word &= ~(1UL << 31);
+
+			mcc->mcc_data[mcc->mcc_data_position] = current_word;
+		}
+	}
+}
+
+static void
+mfm_encode_word(struct mfm_code_context * mcc, mfm_word_t data)
+{
+	mfm_encode_half_the_bits(mcc, data >> 1);
+	mfm_encode_half_the_bits(mcc, data);
+}
+
+static mfm_word_t
+mfm_calculate_buffer_checksum(const struct mfm_code_context * mcc, int start_position, int stop_position)
+{
+	const mfm_word_t * encoded_data = &mcc->mcc_data[mcc->mcc_sector_position + start_position];
+	mfm_word_t sum = 0;
+	int pos;
+
+	for(pos = start_position ; pos < stop_position ; pos++)
+		sum ^= (*encoded_data++);
+
+	return(sum & MFM_DATA_BIT_MASK);
+}
+
+static void
+mfm_encode_sector(
+	struct mfm_code_context *	mcc,
+	int							track,
+	int							sector,
+	int							sector_offset,
+	const mfm_word_t *			sector_data)
+{
+	mfm_word_t null_pattern;
+	mfm_word_t checksum;
+	int i;
+
+	null_pattern = MFM_ZERO;
+	if(mcc->mcc_data_position > 0 && (mcc->mcc_previous_word & 1) != 0)
+		null_pattern &= ~(1UL << 31);
+
+	mfm_encode_store_encoded_word(mcc, null_pattern);
+	mfm_encode_store_encoded_word(mcc, MFM_SPECIAL_A1);
+
+	mfm_encode_word(mcc,
+		((mfm_word_t)AMIGA_10_FORMAT << 24) |
+		((mfm_word_t)track << 16) |
+		((mfm_word_t)sector << 8) |
+		(mfm_word_t)sector_offset
+	);
+
+	for(i = 0 ; i < 4 ; i++)
+		mfm_encode_word(mcc, 0);
+
+	checksum = mfm_calculate_buffer_checksum(mcc, MFM_INFO, MFM_HEADER_CHECKSUM);
+
+	mfm_encode_word(mcc, checksum);
+
+	mcc->mcc_saved_data_position = mcc->mcc_data_position;
+	mfm_encode_skip_encoded_words(mcc, 1);
+
+	for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+		mfm_encode_half_the_bits(mcc, sector_data[i] >> 1);
+
+	for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+		mfm_encode_half_the_bits(mcc, sector_data[i]);
+
+	mcc->mcc_data_position = mcc->mcc_saved_data_position;
+	mcc->mcc_previous_word = mcc->mcc_data[mcc->mcc_data_position - 1];
+
+	checksum = mfm_calculate_buffer_checksum(mcc, MFM_DATA, MFM_SECTOR_LONGS);
+
+	mfm_encode_word(mcc, checksum);
+	mfm_encode_fix_clock_bit(mcc);
+
+	mcc->mcc_previous_word = mcc->mcc_data[mcc->mcc_sector_position + MFM_SECTOR_LONGS - 1];
+
+	mcc->mcc_sector_position += MFM_SECTOR_LONGS;
+	mcc->mcc_data_position = mcc->mcc_sector_position;
+}
+
+/****************************************************************************/
+
+/* Fill in the sector gap which follows the last sector, and store
+ * the complete track in big-endian byte order. The first clock bit
+ * of the gap must be clear if the last data bit before it is set.
+ */
+static void
+finish_track(
+	const struct disk_format *	df,
+	const mfm_word_t *			encoded,
+	unsigned char *				raw_track)
+{
+	int num_longs = df->df_num_sectors * MFM_SECTOR_LONGS;
+	int i;
+
+	for(i = 0 ; i < num_longs ; i++)
+		put_long(&raw_track[4 * i], encoded[i]);
+
+	memset(&raw_track[4 * num_longs], 0xAA, df->df_gap_size);
+
+	if(encoded[num_longs - 1] & 1)
+		raw_track[4 * num_longs] &= 0x7F;
+}
+
+/****************************************************************************/
+
+/* Encode a track with the word-parallel encoder. */
+static void
+fast_encode_track(
+	const struct disk_format *	df,
+	int							track,
+	const unsigned char *		track_data,
+	mfm_word_t *				encoded,
+	unsigned char *				raw_track)
+{
+	mfm_word_t previous = 0;
+	int sector;
+
+	for(sector = 0 ; sector < df->df_num_sectors ; sector++)
+	{
+		fast_encode_sector(&encoded[sector * MFM_SECTOR_LONGS], &previous, track, sector,
+			df->df_num_sectors - sector, &track_data[sector * SECTOR_SIZE]);
+	}
+
+	finish_track(df, encoded, raw_track);
+}
+
+/****************************************************************************/
+
+/* Encode a track with the reference encoder. */
+static void
+reference_encode_track(
+	const struct disk_format *	df,
+	int							track,
+	const unsigned char *		track_data,
+	mfm_word_t *				encoded,
+	unsigned char *				raw_track)
+{
+	mfm_word_t sector_data[SECTOR_SIZE / 4];
+	struct mfm_code_context mcc;
+	int sector, i;
+
+	memset(&mcc, 0, sizeof(mcc));
+
+	mcc.mcc_data		= encoded;
+	mcc.mcc_data_size	= df->df_num_sectors * MFM_SECTOR_LONGS;
+
+	for(sector = 0 ; sector < df->df_num_sectors ; sector++)
+	{
+		for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+			sector_data[i] = get_long(&track_data[sector * SECTOR_SIZE + 4 * i]);
+
+		mfm_encode_sector(&mcc, track, sector, df->df_num_sectors - sector, sector_data);
+	}
+
+	finish_track(df, encoded, raw_track);
+}
+
+/****************************************************************************/
+
+/* Decode a complete raw track and compare it against the ADF track data
+ * it was made from. Returns NULL if everything checks out, and a
+ * description of what went wrong otherwise.
+ */
+static const char *
+verify_track(
+	const struct disk_format *	df,
+	int							track,
+	const unsigned char *		track_data,
+	const unsigned char *		raw_track)
+{
+	char sector_found[MAX_NUM_SECTORS];
+	long num_bits = df->df_raw_track_size * 8;
+	int num_sectors_found = 0;
+	int previous_bit, bit, run_of_zeros;
+	long position, i;
+
+	/* No two set bits in a row, and no more than three clear bits in a
+	 * row, in the whole track, including the wrap-around from the end
+	 * to the beginning.
+	 */
+	previous_bit = raw_track[df->df_raw_track_size - 1] & 1;
+	run_of_zeros = 0;
+
+	for(i = 0 ; i < num_bits ; i++)
+	{
+		bit = (raw_track[i / 8] >> (7 - (i % 8))) & 1;
+
+		if(bit != 0 && previous_bit != 0)
+			return("two adjacent one bits");
+
+		if(bit == 0)
+		{
+			if(++run_of_zeros > 3)
+				return("more than three adjacent zero bits");
+		}
+		else
+		{
+			run_of_zeros = 0;
+		}
+
+		previous_bit = bit;
+	}
+
+	memset(sector_found, 0, sizeof(sector_found));
+
+	/* Look for the sync words, which may appear at any 16 bit
+	 * boundary.
+	 */
+	for(position = 0 ; position + MFM_SECTOR_SIZE - 4 <= df->df_raw_track_size ; position += 2)
+	{
+		mfm_word_t info, header_checksum, data_checksum, checksum, odd, even;
+		const unsigned char * sector_data;
+		const unsigned char * s;
+		int sector, sector_offset;
+
+		if(get_long(&raw_track[position]) != MFM_SPECIAL_A1)
+			continue;
+
+		/* Everything else is relative to the sync word. */
+		s = &raw_track[position - 4];
+
+		info = ((get_long(&s[4 * MFM_INFO]) & MFM_DATA_BIT_MASK) << 1) | (get_long(&s[4 * (MFM_INFO+1)]) & MFM_DATA_BIT_MASK);
+
+		if((info >> 24) != AMIGA_10_FORMAT)
+			return("wrong sector format");
+
+		if((int)((info >> 16) & 0xFF) != track)
+			return("wrong track number");
+
+		sector			= (info >> 8) & 0xFF;
+		sector_offset	= info & 0xFF;
+
+		if(sector >= df->df_num_sectors || sector_found[sector])
+			return("wrong sector number");
+
+		if(sector_offset != df->df_num_sectors - sector)
+			return("wrong sector offset");
+
+		checksum = 0;
+
+		for(i = MFM_INFO ; i < MFM_HEADER_CHECKSUM ; i++)
+			checksum ^= get_long(&s[4 * i]);
+
+		header_checksum = ((get_long(&s[4 * MFM_HEADER_CHECKSUM]) & MFM_DATA_BIT_MASK) << 1) | (get_long(&s[4 * (MFM_HEADER_CHECKSUM+1)]) & MFM_DATA_BIT_MASK);
+
+		if((checksum & MFM_DATA_BIT_MASK) != header_checksum)
+			return("sector header checksum mismatch");
+
+		data_checksum = ((get_long(&s[4 * MFM_DATA_CHECKSUM]) & MFM_DATA_BIT_MASK) << 1) | (get_long(&s[4 * (MFM_DATA_CHECKSUM+1)]) & MFM_DATA_BIT_MASK);
+
+		sector_data = &track_data[sector * SECTOR_SIZE];
+		checksum = 0;
+
+		for(i = 0 ; i < SECTOR_SIZE / 4 ; i++)
+		{
+			odd		= get_long(&s[4 * (MFM_DATA + i)]);
+			even	= get_long(&s[4 * (MFM_DATA + SECTOR_SIZE / 4 + i)]);
+
+			checksum ^= odd ^ even;
+
+			if((((odd & MFM_DATA_BIT_MASK) << 1) | (even & MFM_DATA_BIT_MASK)) != get_long(&sector_data[4 * i]))
+				return("sector data mismatch");
+		}
+
+		if((checksum & MFM_DATA_BIT_MASK) != data_checksum)
+			return("sector data checksum mismatch");
+
+		sector_found[sector] = 1;
+		num_sectors_found++;
+
+		position += MFM_SECTOR_SIZE - 8;
+	}
+
+	if(num_sectors_found != df->df_num_sectors)
+		return("sectors are missing");
+
+	return(NULL);
+}
+
+/****************************************************************************/
+
+static double
+elapsed_seconds(clock_t start)
+{
+	return((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+/****************************************************************************/
+
+/* The name of the extended ADF file which is made from an ADF file:
+ * "disk.adf" becomes "disk_mfm.adf", optionally in a different
+ * directory.
+ */
+static char *
+make_output_name(const char * input_name, const char * directory)
+{
+	const char * base = input_name;
+	const char * p;
+	char * name;
+	size_t len;
+
+	if(directory != NULL)
+	{
+		for(p = input_name ; *p != '\0' ; p++)
+		{
+			if(*p == '/' || *p == ':')
+				base = p + 1;
+		}
+	}
+
+	len = strlen(base);
+	if(len > 4 && (strcmp(&base[len - 4], ".adf") == SAME || strcmp(&base[len - 4], ".ADF") == SAME))
+		len -= 4;
+
+	name = malloc((directory != NULL ? strlen(directory) + 1 : 0) + len + sizeof("_mfm.adf"));
+	if(name != NULL)
+	{
+		name[0] = '\0';
+
+		if(directory != NULL)
+		{
+			strcpy(name, directory);
+
+			if(name[0] != '\0' && name[strlen(name) - 1] != '/' && name[strlen(name) - 1] != ':')
+				strcat(name, "/");
+		}
+
+		strncat(name, base, len);
+		strcat(name, "_mfm.adf");
+	}
+
+	return(name);
+}
+
+/****************************************************************************/
+
+/* Totals for all the files converted. */
+struct statistics
+{
+	long	st_num_files;
+	double	st_bytes_read;
+	double	st_bytes_written;
+	double	st_encode_time;
+	double	st_fast_time;
+	double	st_reference_time;
+	double	st_benchmark_bytes;
+};
+
+/****************************************************************************/
+
+/* Convert a single ADF file. Returns 0 on success and -1 on failure. */
+static int
+convert_file(
+	const char *		input_name,
+	const char *		output_name,
+	int					verify,
+	int					benchmark,
+	struct statistics *	st)
+{
+	static unsigned char track_data[MAX_NUM_SECTORS * SECTOR_SIZE];
+	static unsigned char raw_track[MAX_RAW_TRACK_SIZE];
+	static unsigned char reference_raw_track[MAX_RAW_TRACK_SIZE];
+	static mfm_word_t encoded[MAX_NUM_SECTORS * MFM_SECTOR_LONGS];
+
+	unsigned char header[12];
+	struct disk_format df;
+	FILE * in = NULL;
+	FILE * out = NULL;
+	int result = -1;
+	long file_size;
+	const char * problem;
+	clock_t start;
+	int track, round;
+
+	in = fopen(input_name, "rb");
+	if(in == NULL)
+	{
+		perror(input_name);
+		goto out;
+	}
+
+	if(fseek(in, 0, SEEK_END) != 0 || (file_size = ftell(in)) < 0 || fseek(in, 0, SEEK_SET) != 0)
+	{
+		perror(input_name);
+		goto out;
+	}
+
+	memset(&df, 0, sizeof(df));
+
+	if(file_size == (long)NUM_TRACKS * NUM_SECTORS_DD * SECTOR_SIZE)
+	{
+		df.df_num_sectors	= NUM_SECTORS_DD;
+		df.df_gap_size		= SECTOR_GAP_SIZE_DD;
+	}
+	else if(file_size == (long)NUM_TRACKS * NUM_SECTORS_HD * SECTOR_SIZE)
+	{
+		df.df_num_sectors	= NUM_SECTORS_HD;
+		df.df_gap_size		= 2 * SECTOR_GAP_SIZE_DD;
+	}
+	else
+	{
+		fprintf(stderr, "%s: not a double density or high density disk image file\n", input_name);
+		goto out;
+	}
+
+	df.df_track_size		= df.df_num_sectors * SECTOR_SIZE;
+	df.df_raw_track_size	= df.df_num_sectors * MFM_SECTOR_SIZE + df.df_gap_size;
+
+	out = fopen(output_name, "wb");
+	if(out == NULL)
+	{
+		perror(output_name);
+		goto out;
+	}
+
+	/* The file header, followed by one header for each track. All
+	 * tracks are raw MFM tracks of the same size.
+	 */
+	memcpy(header, "UAE-1ADF", 8);
+	put_word(&header[8], 0);
+	put_word(&header[10], NUM_TRACKS);
+
+	if(fwrite(header, 12, 1, out) != 1)
+		goto write_error;
+
+	for(track = 0 ; track < NUM_TRACKS ; track++)
+	{
+		put_word(&header[0], 0);
+		put_word(&header[2], 1);	/* Raw MFM track */
+		put_long(&header[4], df.df_raw_track_size);
+		put_long(&header[8], df.df_raw_track_size * 8);
+
+		if(fwrite(header, 12, 1, out) != 1)
+			goto write_error;
+	}
+
+	for(track = 0 ; track < NUM_TRACKS ; track++)
+	{
+		if(fread(track_data, df.df_track_size, 1, in) != 1)
+		{
+			perror(input_name);
+			goto out;
+		}
+
+		start = clock();
+		fast_encode_track(&df, track, track_data, encoded, raw_track);
+		st->st_encode_time += elapsed_seconds(start);
+
+		if(benchmark)
+		{
+			reference_encode_track(&df, track, track_data, encoded, reference_raw_track);
+
+			if(memcmp(raw_track, reference_raw_track, df.df_raw_track_size) != SAME)
+			{
+				fprintf(stderr, "%s: track %d is not encoded the same way by both encoders\n", input_name, track);
+				goto out;
+			}
+
+			start = clock();
+
+			for(round = 0 ; round < NUM_BENCHMARK_ROUNDS ; round++)
+				fast_encode_track(&df, track, track_data, encoded, raw_track);
+
+			st->st_fast_time += elapsed_seconds(start);
+
+			start = clock();
+
+			for(round = 0 ; round < NUM_BENCHMARK_ROUNDS ; round++)
+				reference_encode_track(&df, track, track_data, encoded, reference_raw_track);
+
+			st->st_reference_time += elapsed_seconds(start);
+
+			st->st_benchmark_bytes += (double)df.df_track_size * NUM_BENCHMARK_ROUNDS;
+		}
+
+		if(verify)
+		{
+			problem = verify_track(&df, track, track_data, raw_track);
+			if(problem != NULL)
+			{
+				fprintf(stderr, "%s: track %d failed verification (%s)\n", input_name, track, problem);
+				goto out;
+			}
+		}
+
+		if(fwrite(raw_track, df.df_raw_track_size, 1, out) != 1)
+			goto write_error;
+	}
+
+	if(fclose(out) != 0)
+	{
+		out = NULL;
+		goto write_error;
+	}
+
+	out = NULL;
+
+	st->st_num_files++;
+	st->st_bytes_read		+= file_size;
+	st->st_bytes_written	+= 12 + 12 * NUM_TRACKS + (double)df.df_raw_track_size * NUM_TRACKS;
+
+	result = 0;
+	goto out;
+
+ write_error:
+
+	perror(output_name);
+
+ out:
+
+	if(out != NULL)
+	{
+		fclose(out);
+
+		/* Don't leave an incomplete file behind. */
+		if(result != 0)
+			remove(output_name);
+	}
+
+	if(in != NULL)
+		fclose(in);
+
+	return(result);
+}
+
+/****************************************************************************/
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: adf2eadf [options] file.adf [file.adf ...]\n"
+		"\n"
+		"  -d <directory>  Store the converted files in this directory, rather\n"
+		"                  than next to the ADF files\n"
+		"  -v              Decode each track again and compare it with the\n"
+		"                  ADF file\n"
+		"  -b              Compare the encoder with the reference encoder, both\n"
+		"                  for speed and for identical output\n"
+		"  -q              Don't list the files converted\n"
+		"\n"
+		"Each file \"name.adf\" is converted to \"name_mfm.adf\".\n");
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	const char * directory = NULL;
+	struct statistics st;
+	int verify = 0, benchmark = 0, quiet = 0;
+	int num_failed = 0;
+	char * output_name;
+	int result = EXIT_FAILURE;
+	int first_file;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+
+	for(i = 1 ; i < argc && argv[i][0] == '-' ; i++)
+	{
+		if(strcmp(argv[i], "-d") == SAME && i + 1 < argc)
+			directory = argv[++i];
+		else if (strcmp(argv[i], "-v") == SAME)
+			verify = 1;
+		else if (strcmp(argv[i], "-b") == SAME)
+			benchmark = 1;
+		else if (strcmp(argv[i], "-q") == SAME)
+			quiet = 1;
+		else
+			break;
+	}
+
+	first_file = i;
+
+	if(first_file == argc)
+	{
+		usage();
+		goto out;
+	}
+
+	for(i = first_file ; i < argc ; i++)
+	{
+		output_name = make_output_name(argv[i], directory);
+		if(output_name == NULL)
+		{
+			fprintf(stderr, "adf2eadf: not enough memory\n");
+			goto out;
+		}
+
+		if(convert_file(argv[i], output_name, verify, benchmark, &st) == 0)
+		{
+			if(NOT quiet)
+				printf("%s -> %s\n", argv[i], output_name);
+		}
+		else
+		{
+			num_failed++;
+		}
+
+		free(output_name);
+	}
+
+	if(NOT quiet && st.st_num_files > 0)
+	{
+		printf("\n%ld file(s) converted, %.0f -> %.0f bytes", st.st_num_files, st.st_bytes_read, st.st_bytes_written);
+
+		if(st.st_encode_time > 0)
+			printf(", encoding at %.1f MBytes/s", (st.st_bytes_read / (1024.0 * 1024.0)) / st.st_encode_time);
+
+		printf("\n");
+	}
+
+	if(benchmark && st.st_fast_time > 0 && st.st_reference_time > 0)
+	{
+		double fast = (st.st_benchmark_bytes / (1024.0 * 1024.0)) / st.st_fast_time;
+		double reference = (st.st_benchmark_bytes / (1024.0 * 1024.0)) / st.st_reference_time;
+
+		printf("Word-parallel encoder: %.1f MBytes/s\n", fast);
+		printf("Reference encoder: %.1f MBytes/s\n", reference);
+		printf("Speedup: %.2f\n", fast / reference);
+	}
+
+	if(num_failed > 0)
+	{
+		fprintf(stderr, "adf2eadf: %d file(s) could not be converted\n", num_failed);
+		goto out;
+	}
+
+	result = EXIT_SUCCESS;
+
+ out:
+
+	return(result);
+}
@@ -0,0 +1,783 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * cc -O2 -o cache_sizing cache_sizing.c
+ */
+
+/*
+ * This is a tool for picking the DAControl CACHESIZE (TF_MaxCacheMemory)
+ * value. It runs on the host rather than on the Amiga, so that production
+ * machines can be sized offline, and it therefore only uses the standard
+ * 'C' library.
+ *
+ * It reads a track access stream and works out which share of the track
+ * reads the trackfile.device cache would have served for every cache size
+ * worth considering. The result is printed as a curve, with one line per
+ * cache size, followed by a recommendation.
+ *
+ * The access stream is either read from a file (or standard input) or
+ * made up by a synthetic generator. The file holds one track access per
+ * line, either as a track number or as a disk image number followed by a
+ * track number, separated by a blank or a comma. Empty lines and lines
+ * which begin with "#" are ignored. Only track reads should be listed,
+ * since writing a track back does not change the order of the entries
+ * in the cache.
+ *
+ * The cache in cache.c is a segmented LRU cache: new entries go into the
+ * probationary segment, entries which are read again move into the
+ * protected segment, which may hold two thirds of all entries. Because
+ * of this split the cache does not have the "inclusion property" of a
+ * plain LRU cache, which means that the hit ratio for a cache size
+ * cannot be derived from the LRU stack distances alone. Instead, the
+ * cache is simulated for every cache size considered, with all the
+ * simulations stepping through the access stream together, in one
+ * single pass. The plain LRU stack distances are collected in the same
+ * pass and shown for comparison.
+ *
+ * The simulation also reproduces how the cache size is turned into a
+ * number of cache entries: the size is rounded to a multiple of the entry
+ * size, one entry less than this number may be allocated, and the cache
+ * stays disabled if the protected segment would hold fewer than 8 entries.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/****************************************************************************/
+
+/* An entry in the cache holds a complete double density track (11 sectors
+ * of 512 bytes each), preceded by a 'struct CacheNode', which is 32 bytes
+ * in size on the Amiga.
+ */
+#define DEFAULT_DATA_SIZE	(11 * 512)
+#define DEFAULT_NODE_SIZE	32
+
+/* No more than this many cache sizes are simulated. */
+#define DEFAULT_NUM_SIZES	128
+
+/* The cache stays disabled unless the protected segment can hold
+ * at least this many entries.
+ */
+#define MIN_PROTECTED_SIZE	8
+
+/* Number of tracks on a double density disk. */
+#define NUM_TRACKS			160
+
+/****************************************************************************/
+
+#define NOT !
+#define SAME 0
+
+/****************************************************************************/
+
+/* Where a track currently is in a simulated cache. */
+enum segment
+{
+	SEGMENT_NONE,
+	SEGMENT_PROBATION,
+	SEGMENT_PROTECTED
+};
+
+/* A doubly-linked list of tracks, by track index. */
+struct track_list
+{
+	long	tl_head;
+	long	tl_tail;
+	long	tl_size;
+};
+
+/* The state of one simulated cache. */
+struct simulated_cache
+{
+	long				sc_max_nodes;		/* CACHESIZE divided by the entry size */
+	long				sc_capacity;		/* How many entries may be allocated */
+	long				sc_protected_max;	/* How many may be in the protected segment */
+	long				sc_num_nodes;		/* How many are allocated */
+	unsigned long		sc_hits;
+
+	struct track_list	sc_probation;
+	struct track_list	sc_protected;
+
+	unsigned char *		sc_segment;			/* For each track */
+	long *				sc_prev;			/* For each track */
+	long *				sc_next;			/* For each track */
+};
+
+/****************************************************************************/
+
+/* The access stream, with each track identified by an index rather than by
+ * its disk image and track numbers.
+ */
+static long *	accesses;
+static long		num_accesses;
+static long		max_accesses;
+static long		num_tracks;
+
+/* For turning disk image and track numbers into track indexes. */
+static unsigned long *	hash_keys;
+static long *			hash_indexes;
+static long				hash_size;
+
+/****************************************************************************/
+
+static void
+list_remove(struct simulated_cache * sc, struct track_list * tl, long track)
+{
+	long prev = sc->sc_prev[track];
+	long next = sc->sc_next[track];
+
+	if(prev != -1)
+		sc->sc_next[prev] = next;
+	else
+		tl->tl_head = next;
+
+	if(next != -1)
+		sc->sc_prev[next] = prev;
+	else
+		tl->tl_tail = prev;
+
+	tl->tl_size--;
+}
+
+/****************************************************************************/
+
+static void
+list_add_head(struct simulated_cache * sc, struct track_list * tl, long track)
+{
+	sc->sc_prev[track] = -1;
+	sc->sc_next[track] = tl->tl_head;
+
+	if(tl->tl_head != -1)
+		sc->sc_prev[tl->tl_head] = track;
+	else
+		tl->tl_tail = track;
+
+	tl->tl_head = track;
+	tl->tl_size++;
+}
+
+/****************************************************************************/
+
+/* This follows what read_cache_contents() and update_cache_contents() do
+ * when a track is read: a track found in the protected segment moves to
+ * the front of it, a track found in the probationary segment moves to the
+ * front of the protected segment, and a track which is not in the cache
+ * is added to the front of the probationary segment, reusing the least
+ * recently-used entry if no further entry may be allocated.
+ */
+static void
+simulate_access(struct simulated_cache * sc, long track)
+{
+	long victim;
+
+	switch(sc->sc_segment[track])
+	{
+		case SEGMENT_PROTECTED:
+
+			sc->sc_hits++;
+
+			list_remove(sc, &sc->sc_protected, track);
+			list_add_head(sc, &sc->sc_protected, track);
+			break;
+
+		case SEGMENT_PROBATION:
+
+			sc->sc_hits++;
+
+			list_remove(sc, &sc->sc_probation, track);
+			list_add_head(sc, &sc->sc_protected, track);
+
+			sc->sc_segment[track] = SEGMENT_PROTECTED;
+
+			/* This is what adjust_protected_cache_size() does. */
+			while(sc->sc_protected.tl_size > sc->sc_protected_max)
+			{
+				victim = sc->sc_protected.tl_tail;
+
+				list_remove(sc, &sc->sc_protected, victim);
+				list_add_head(sc, &sc->sc_probation, victim);
+
+				sc->sc_segment[victim] = SEGMENT_PROBATION;
+			}
+
+			break;
+
+		default:
+
+			if(sc->sc_num_nodes < sc->sc_capacity)
+			{
+				sc->sc_num_nodes++;
+			}
+			else if (sc->sc_probation.tl_size > 0)
+			{
+				victim = sc->sc_probation.tl_tail;
+
+				list_remove(sc, &sc->sc_probation, victim);
+
+				sc->sc_segment[victim] = SEGMENT_NONE;
+			}
+			else if (sc->sc_protected.tl_size > 0)
+			{
+				victim = sc->sc_protected.tl_tail;
+
+				list_remove(sc, &sc->sc_protected, victim);
+
+				sc->sc_segment[victim] = SEGMENT_NONE;
+			}
+			else
+			{
+				/* No room in the cache at all. */
+				break;
+			}
+
+			list_add_head(sc, &sc->sc_probation, track);
+
+			sc->sc_segment[track] = SEGMENT_PROBATION;
+			break;
+	}
+}
+
+/****************************************************************************/
+
+/* Prepare a simulated cache for a CACHESIZE which corresponds to the given
+ * number of cache entries, as set up by change_cache_size(). Returns 0 if
+ * the cache would remain disabled with this size.
+ */
+static int
+init_simulated_cache(struct simulated_cache * sc, long max_nodes)
+{
+	memset(sc, 0, sizeof(*sc));
+
+	sc->sc_max_nodes		= max_nodes;
+	sc->sc_protected_max	= max_nodes - max_nodes / 3;
+
+	if(sc->sc_protected_max < MIN_PROTECTED_SIZE)
+		return(0);
+
+	/* A new entry is allocated only while the total amount of
+	 * memory allocated stays below the maximum.
+	 */
+	sc->sc_capacity = max_nodes - 1;
+
+	sc->sc_probation.tl_head = sc->sc_probation.tl_tail = -1;
+	sc->sc_protected.tl_head = sc->sc_protected.tl_tail = -1;
+
+	sc->sc_segment	= calloc(num_tracks, sizeof(*sc->sc_segment));
+	sc->sc_prev		= malloc(num_tracks * sizeof(*sc->sc_prev));
+	sc->sc_next		= malloc(num_tracks * sizeof(*sc->sc_next));
+
+	if(sc->sc_segment == NULL || sc->sc_prev == NULL || sc->sc_next == NULL)
+	{
+		fprintf(stderr, "cache_sizing: not enough memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return(1);
+}
+
+/****************************************************************************/
+
+/* Turn a disk image and track number into a track index, adding a new
+ * index if this track was not seen before.
+ */
+static long
+get_track_index(unsigned long image, unsigned long track)
+{
+	unsigned long key = image * NUM_TRACKS + track;
+	long i, new_hash_size;
+
+	/* Keep the table at most half full. */
+	if(2 * (num_tracks + 1) > hash_size)
+	{
+		unsigned long * old_keys = hash_keys;
+		long * old_indexes = hash_indexes;
+		long old_hash_size = hash_size;
+
+		new_hash_size = (hash_size > 0) ? 2 * hash_size : 1024;
+
+		hash_keys		= malloc(new_hash_size * sizeof(*hash_keys));
+		hash_indexes	= malloc(new_hash_size * sizeof(*hash_indexes));
+
+		if(hash_keys == NULL || hash_indexes == NULL)
+		{
+			fprintf(stderr, "cache_sizing: not enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+
+		hash_size = new_hash_size;
+
+		for(i = 0 ; i < hash_size ; i++)
+			hash_indexes[i] = -1;
+
+		for(i = 0 ; i < old_hash_size ; i++)
+		{
+			if(old_indexes[i] != -1)
+			{
+				long j = (long)((old_keys[i] * 2654435761UL) % (unsigned long)hash_size);
+
+				while(hash_indexes[j] != -1)
+					j = (j + 1) % hash_size;
+
+				hash_keys[j]	= old_keys[i];
+				hash_indexes[j]	= old_indexes[i];
+			}
+		}
+
+		free(old_keys);
+		free(old_indexes);
+	}
+
+	i = (long)((key * 2654435761UL) % (unsigned long)hash_size);
+
+	while(hash_indexes[i] != -1)
+	{
+		if(hash_keys[i] == key)
+			return(hash_indexes[i]);
+
+		i = (i + 1) % hash_size;
+	}
+
+	hash_keys[i]	= key;
+	hash_indexes[i]	= num_tracks++;
+
+	return(hash_indexes[i]);
+}
+
+/****************************************************************************/
+
+static void
+add_access(unsigned long image, unsigned long track)
+{
+	if(num_accesses == max_accesses)
+	{
+		long * new_accesses;
+
+		max_accesses = (max_accesses > 0) ? 2 * max_accesses : 65536;
+
+		new_accesses = realloc(accesses, max_accesses * sizeof(*accesses));
+		if(new_accesses == NULL)
+		{
+			fprintf(stderr, "cache_sizing: not enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+
+		accesses = new_accesses;
+	}
+
+	accesses[num_accesses++] = get_track_index(image, track);
+}
+
+/****************************************************************************/
+
+/* Read the access stream, one track per line. Returns 0 on failure. */
+static int
+read_access_stream(FILE * in, const char * name)
+{
+	unsigned long image, track;
+	long line_number = 0;
+	char line[256];
+	char * s;
+	int n;
+
+	while(fgets(line, sizeof(line), in) != NULL)
+	{
+		line_number++;
+
+		for(s = line ; (*s) == ' ' || (*s) == '\t' ; s++)
+			;
+
+		if((*s) == '\0' || (*s) == '\n' || (*s) == '\r' || (*s) == '#')
+			continue;
+
+		n = sscanf(s, "%lu%*[ ,\t]%lu", &image, &track);
+		if(n == 1)
+		{
+			track = image;
+			image = 0;
+		}
+		else if (n != 2)
+		{
+			fprintf(stderr, "%s: line %ld is not understood\n", name, line_number);
+			return(0);
+		}
+
+		if(track >= NUM_TRACKS)
+		{
+			fprintf(stderr, "%s: line %ld: track %lu is out of range\n", name, line_number, track);
+			return(0);
+		}
+
+		add_access(image, track);
+	}
+
+	if(ferror(in))
+	{
+		perror(name);
+		return(0);
+	}
+
+	return(1);
+}
+
+/****************************************************************************/
+
+/* A simple linear congruential generator, so that the synthetic access
+ * stream is the same on every host.
+ */
+static unsigned long random_state = 1;
+
+static unsigned long
+next_random(unsigned long range)
+{
+	random_state = (random_state * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+
+	return((random_state >> 8) % range);
+}
+
+/****************************************************************************/
+
+/* Make up an access stream which looks a bit like a file system at work
+ * on a number of disk images: the tracks around the root directory are
+ * read frequently, files are read sequentially, a few tracks at a time,
+ * and now and then a track is read at random.
+ */
+static void
+generate_access_stream(long count, unsigned long num_images)
+{
+	unsigned long image, track;
+	long run;
+
+	while(num_accesses < count)
+	{
+		image = next_random(num_images);
+
+		switch(next_random(10))
+		{
+			/* Directory and bitmap blocks, close to the root. */
+			case 0:
+			case 1:
+			case 2:
+			case 3:
+
+				add_access(image, NUM_TRACKS / 2 - 2 + next_random(5));
+				break;
+
+			/* Reading a file. */
+			case 4:
+			case 5:
+			case 6:
+			case 7:
+			case 8:
+
+				track = next_random(NUM_TRACKS);
+
+				for(run = 1 + next_random(8) ; run > 0 && num_accesses < count ; run--)
+					add_access(image, (track++) % NUM_TRACKS);
+
+				break;
+
+			/* Anything else. */
+			default:
+
+				add_access(image, next_random(NUM_TRACKS));
+				break;
+		}
+	}
+}
+
+/****************************************************************************/
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: cache_sizing [options] [trace file]\n"
+		"\n"
+		"  -g <count>      Generate a synthetic access stream of <count> reads\n"
+		"  -i <images>     Number of disk images used by the generator (default: 4)\n"
+		"  -r <seed>       Random number seed for the generator (default: 1)\n"
+		"  -d <bytes>      Size of the data stored in a cache entry (default: %d)\n"
+		"  -e <bytes>      Size of the cache entry header (default: %d)\n"
+		"  -n <number>     Number of cache sizes to simulate (default: %d)\n"
+		"  -t <percent>    Recommend the smallest size whose hit ratio is within\n"
+		"                  this many percentage points of the best (default: 1)\n"
+		"\n"
+		"Without -g, the trace file (or standard input) holds one track read per\n"
+		"line, as '<track>' or '<image> <track>'.\n",
+		DEFAULT_DATA_SIZE, DEFAULT_NODE_SIZE, DEFAULT_NUM_SIZES);
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	long data_size = DEFAULT_DATA_SIZE;
+	long node_size = DEFAULT_NODE_SIZE;
+	long num_sizes = DEFAULT_NUM_SIZES;
+	double tolerance = 1.0;
+	long generate_count = 0;
+	unsigned long num_images = 4;
+	const char * trace_name = NULL;
+	struct simulated_cache * caches = NULL;
+	long num_caches = 0;
+	unsigned long * stack_distances = NULL;
+	long * last_access = NULL;
+	long * fenwick = NULL;
+	long min_nodes, max_nodes, nodes, step;
+	unsigned long lru_hits, compulsory_misses;
+	double best_ratio, ratio, lru_ratio;
+	long recommended = -1;
+	long entry_size;
+	int result = EXIT_FAILURE;
+	FILE * in = NULL;
+	long i, j, t, d;
+
+	for(i = 1 ; i < argc ; i++)
+	{
+		if(argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0' && i + 1 < argc && strchr("girdent", argv[i][1]) != NULL)
+		{
+			const char * value = argv[++i];
+
+			switch(argv[i-1][1])
+			{
+				case 'g':	generate_count	= atol(value); break;
+				case 'i':	num_images		= strtoul(value, NULL, 10); break;
+				case 'r':	random_state	= strtoul(value, NULL, 10); break;
+				case 'd':	data_size		= atol(value); break;
+				case 'e':	node_size		= atol(value); break;
+				case 'n':	num_sizes		= atol(value); break;
+				case 't':	tolerance		= atof(value); break;
+			}
+		}
+		else if (argv[i][0] != '-' && trace_name == NULL)
+		{
+			trace_name = argv[i];
+		}
+		else
+		{
+			usage();
+			goto out;
+		}
+	}
+
+	if(data_size <= 0 || node_size < 0 || num_sizes <= 0 || num_images == 0 || tolerance < 0)
+	{
+		usage();
+		goto out;
+	}
+
+	entry_size = node_size + data_size;
+
+	if(generate_count > 0)
+	{
+		generate_access_stream(generate_count, num_images);
+	}
+	else
+	{
+		if(trace_name != NULL && strcmp(trace_name, "-") != SAME)
+		{
+			in = fopen(trace_name, "r");
+			if(in == NULL)
+			{
+				perror(trace_name);
+				goto out;
+			}
+		}
+		else
+		{
+			trace_name = "stdin";
+		}
+
+		if(NOT read_access_stream(in != NULL ? in : stdin, trace_name))
+			goto out;
+	}
+
+	if(num_accesses == 0)
+	{
+		fprintf(stderr, "cache_sizing: no track reads to work with\n");
+		goto out;
+	}
+
+	/* The smallest cache size which is not disabled, and the
+	 * smallest size which can hold every track read.
+	 */
+	for(min_nodes = 1 ; min_nodes - min_nodes / 3 < MIN_PROTECTED_SIZE ; min_nodes++)
+		;
+
+	max_nodes = num_tracks + 1;
+	if(max_nodes < min_nodes)
+		max_nodes = min_nodes;
+
+	step = (max_nodes - min_nodes + num_sizes - 1) / num_sizes;
+	if(step < 1)
+		step = 1;
+
+	caches = calloc((max_nodes - min_nodes) / step + 2, sizeof(*caches));
+	if(caches == NULL)
+	{
+		fprintf(stderr, "cache_sizing: not enough memory\n");
+		goto out;
+	}
+
+	for(nodes = min_nodes ; nodes < max_nodes + step ; nodes += step)
+	{
+		if(nodes > max_nodes)
+			nodes = max_nodes;
+
+		if(init_simulated_cache(&caches[num_caches], nodes))
+			num_caches++;
+
+		if(nodes == max_nodes)
+			break;
+	}
+
+	/* The LRU stack distance of an access is the number of different
+	 * tracks read since the same track was last read, plus one. This
+	 * is counted with a Fenwick tree over the access times, in which
+	 * only the most recent access to each track is marked.
+	 */
+	stack_distances	= calloc(num_tracks + 2, sizeof(*stack_distances));
+	last_access		= malloc(num_tracks * sizeof(*last_access));
+	fenwick			= calloc(num_accesses + 1, sizeof(*fenwick));
+
+	if(stack_distances == NULL || last_access == NULL || fenwick == NULL)
+	{
+		fprintf(stderr, "cache_sizing: not enough memory\n");
+		goto out;
+	}
+
+	for(i = 0 ; i < num_tracks ; i++)
+		last_access[i] = -1;
+
+	compulsory_misses = 0;
+
+	/* This is the one single pass through the access stream. */
+	for(t = 0 ; t < num_accesses ; t++)
+	{
+		long track = accesses[t];
+
+		if(last_access[track] == -1)
+		{
+			compulsory_misses++;
+		}
+		else
+		{
+			/* Count the marked accesses after the previous one. */
+			d = 0;
+
+			for(j = t ; j > 0 ; j -= j & (-j))
+				d += fenwick[j];
+
+			for(j = last_access[track] + 1 ; j > 0 ; j -= j & (-j))
+				d -= fenwick[j];
+
+			stack_distances[d + 1]++;
+
+			for(j = last_access[track] + 1 ; j <= num_accesses ; j += j & (-j))
+				fenwick[j]--;
+		}
+
+		for(j = t + 1 ; j <= num_accesses ; j += j & (-j))
+			fenwick[j]++;
+
+		last_access[track] = t;
+
+		for(i = 0 ; i < num_caches ; i++)
+			simulate_access(&caches[i], track);
+	}
+
+	/* Every access which is not the first read of a track
+	 * could have been a cache hit.
+	 */
+	best_ratio = 100.0 * (double)(num_accesses - compulsory_misses) / (double)num_accesses;
+
+	printf("# %ld track reads, %ld different tracks, best possible hit ratio %.2f%%\n",
+		num_accesses, num_tracks, best_ratio);
+
+	printf("# %-9s %7s %12s %9s\n", "CACHESIZE", "entries", "segmented", "plain LRU");
+
+	for(i = 0 ; i < num_caches ; i++)
+	{
+		struct simulated_cache * sc = &caches[i];
+
+		lru_hits = 0;
+
+		for(d = 1 ; d <= sc->sc_capacity && d <= num_tracks ; d++)
+			lru_hits += stack_distances[d];
+
+		ratio		= 100.0 * (double)sc->sc_hits / (double)num_accesses;
+		lru_ratio	= 100.0 * (double)lru_hits / (double)num_accesses;
+
+		printf("%11ld %7ld %11.2f%% %8.2f%%\n", sc->sc_max_nodes * entry_size, sc->sc_capacity, ratio, lru_ratio);
+
+		if(recommended == -1 && ratio >= best_ratio - tolerance)
+			recommended = i;
+	}
+
+	if(recommended != -1)
+	{
+		printf("# Recommended CACHESIZE=%ld (%ld entries, %.2f%% hits)\n",
+			caches[recommended].sc_max_nodes * entry_size,
+			caches[recommended].sc_capacity,
+			100.0 * (double)caches[recommended].sc_hits / (double)num_accesses);
+	}
+
+	result = EXIT_SUCCESS;
+
+ out:
+
+	if(in != NULL)
+		fclose(in);
+
+	if(caches != NULL)
+	{
+		for(i = 0 ; i < num_caches ; i++)
+		{
+			free(caches[i].sc_segment);
+			free(caches[i].sc_prev);
+			free(caches[i].sc_next);
+		}
+
+		free(caches);
+	}
+
+	free(fenwick);
+	free(last_access);
+	free(stack_distances);
+	free(hash_keys);
+	free(hash_indexes);
+	free(accesses);
+
+	return(result);
+}
@@ -0,0 +1,382 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * This is a small benchmark which helps to figure out how well a
+ * file system gets along with the trackfile.device unit it is
+ * mounted on. It first walks through a directory tree, examining
+ * every entry, and then reads the contents of every file found
+ * in it, optionally copying the data to a file.
+ *
+ * The time spent on the directory scan shows how well the file
+ * system buffers and the device cache cooperate, and the time
+ * spent on reading the files shows how well the transfer size
+ * suits the device. Run it once on a disk image file mounted with
+ * the cache enabled, and once with the cache disabled, ideally
+ * right after inserting the medium so that neither the file system
+ * buffers nor the cache have been filled yet.
+ *
+ * sc link mount_benchmark.c
+ */
+
+/****************************************************************************/
+
+#include <dos/dosextens.h>
+#include <dos/rdargs.h>
+#include <exec/memory.h>
+
+#include <proto/exec.h>
+#include <proto/dos.h>
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+#define OK (0)
+#define NOT !
+#define CANNOT !
+#define ZERO ((BPTR)NULL)
+
+/****************************************************************************/
+
+/* The default size of the buffer used for reading files. This is
+ * large enough to let the file system bypass its own buffers and
+ * hand the request over to the device in one piece.
+ */
+#define DEFAULT_BUFFER_SIZE 32768
+
+/****************************************************************************/
+
+/* What the directory scan and the file copy have found so far. */
+struct benchmark_context
+{
+	UBYTE *	bc_Buffer;
+	LONG	bc_BufferSize;
+	BPTR	bc_Output;
+
+	ULONG	bc_NumDirectories;
+	ULONG	bc_NumFiles;
+	ULONG	bc_NumBytes;
+};
+
+/****************************************************************************/
+
+/* Returns the number of ticks which elapsed between two points of time. */
+static ULONG
+get_elapsed_ticks(const struct DateStamp * start, const struct DateStamp * stop)
+{
+	LONG minutes;
+
+	minutes = (stop->ds_Days - start->ds_Days) * 24 * 60 + (stop->ds_Minute - start->ds_Minute);
+
+	return((ULONG)(minutes * 60 * TICKS_PER_SECOND + stop->ds_Tick - start->ds_Tick));
+}
+
+/****************************************************************************/
+
+/* Print how long something took, in seconds. */
+static void
+print_elapsed_time(ULONG ticks)
+{
+	Printf("%lu.%02lu seconds",
+		ticks / TICKS_PER_SECOND,
+		((ticks % TICKS_PER_SECOND) * 100) / TICKS_PER_SECOND);
+}
+
+/****************************************************************************/
+
+/* Examine every entry of a directory and of all the directories
+ * within it. If requested, the contents of every file found are
+ * read, too, and copied to the output file, if there is one.
+ * Soft and hard links are not followed.
+ */
+static LONG
+process_directory(BPTR dir_lock, BOOL read_files, struct benchmark_context * bc)
+{
+	struct FileInfoBlock * fib;
+	BPTR old_dir, lock, file;
+	LONG num_bytes_read;
+	LONG error = OK;
+
+	fib = AllocDosObject(DOS_FIB, NULL);
+	if(fib == NULL)
+	{
+		error = ERROR_NO_FREE_STORE;
+		goto out;
+	}
+
+	if(CANNOT Examine(dir_lock, fib))
+	{
+		error = IoErr();
+		goto out;
+	}
+
+	old_dir = CurrentDir(dir_lock);
+
+	while(ExNext(dir_lock, fib))
+	{
+		if(CheckSignal(SIGBREAKF_CTRL_C))
+		{
+			error = ERROR_BREAK;
+			break;
+		}
+
+		if(fib->fib_DirEntryType == ST_USERDIR)
+		{
+			bc->bc_NumDirectories++;
+
+			lock = Lock(fib->fib_FileName, SHARED_LOCK);
+			if(lock == ZERO)
+			{
+				error = IoErr();
+				break;
+			}
+
+			error = process_directory(lock, read_files, bc);
+
+			UnLock(lock);
+
+			if(error != OK)
+				break;
+		}
+		else if(fib->fib_DirEntryType == ST_FILE)
+		{
+			bc->bc_NumFiles++;
+
+			if(read_files)
+			{
+				file = Open(fib->fib_FileName, MODE_OLDFILE);
+				if(file == ZERO)
+				{
+					error = IoErr();
+					break;
+				}
+
+				while((num_bytes_read = Read(file, bc->bc_Buffer, bc->bc_BufferSize)) > 0)
+				{
+					bc->bc_NumBytes += num_bytes_read;
+
+					if(bc->bc_Output != ZERO && Write(bc->bc_Output, bc->bc_Buffer, num_bytes_read) != num_bytes_read)
+					{
+						error = IoErr();
+						break;
+					}
+				}
+
+				if(num_bytes_read < 0 && error == OK)
+					error = IoErr();
+
+				Close(file);
+
+				if(error != OK)
+					break;
+			}
+		}
+	}
+
+	/* ExNext() fails with ERROR_NO_MORE_ENTRIES once the
+	 * last entry has been read.
+	 */
+	if(error == OK && IoErr() != ERROR_NO_MORE_ENTRIES)
+		error = IoErr();
+
+	CurrentDir(old_dir);
+
+ out:
+
+	if(fib != NULL)
+		FreeDosObject(DOS_FIB, fib);
+
+	return(error);
+}
+
+/****************************************************************************/
+
+/* These are used in the definition of the command line template below.
+ * Each type is the same size as a LONG, which is what ReadArgs() expects.
+ * The typedefs add a little bit of information to each parameter
+ * definition.
+ */
+typedef LONG	SWITCH;
+typedef STRPTR	KEY;
+typedef LONG *	NUMBER;
+
+/****************************************************************************/
+
+int
+main(int argc, char **argv)
+{
+	const TEXT template_string[] = "DIRECTORY=DIR/A,TO/K,BUFFERSIZE/K/N,SCANONLY/S";
+
+	struct
+	{
+		KEY		Directory;
+		KEY		To;
+		NUMBER	BufferSize;
+		SWITCH	ScanOnly;
+	} opts;
+
+	const TEXT * program_name = (TEXT *)argv[0];
+	struct benchmark_context bc;
+	struct DateStamp start, stop;
+	ULONG scan_ticks, copy_ticks;
+	TEXT error_message[256];
+	struct RDArgs * rda = NULL;
+	BPTR dir_lock = ZERO;
+	int result = RETURN_ERROR;
+	LONG error;
+
+	memset(&bc, 0, sizeof(bc));
+
+	if(((struct Library *)DOSBase)->lib_Version < 36)
+		goto out;
+
+	memset(&opts, 0, sizeof(opts));
+
+	rda = ReadArgs(template_string, (LONG *)&opts, NULL);
+	if(rda == NULL)
+	{
+		Fault(IoErr(), NULL, error_message, sizeof(error_message));
+
+		Printf("%s: %s\n", program_name, error_message);
+		goto out;
+	}
+
+	bc.bc_BufferSize = DEFAULT_BUFFER_SIZE;
+
+	if(opts.BufferSize != NULL)
+	{
+		bc.bc_BufferSize = (*opts.BufferSize);
+		if(bc.bc_BufferSize < 1)
+		{
+			Printf("%s: Buffer size must be 1 or higher.\n", program_name);
+			goto out;
+		}
+	}
+
+	dir_lock = Lock(opts.Directory, SHARED_LOCK);
+	if(dir_lock == ZERO)
+	{
+		Fault(IoErr(), NULL, error_message, sizeof(error_message));
+
+		Printf("%s: Cannot access \"%s\" (%s).\n", program_name, opts.Directory, error_message);
+		goto out;
+	}
+
+	if(NOT opts.ScanOnly)
+	{
+		bc.bc_Buffer = AllocVec(bc.bc_BufferSize, MEMF_ANY|MEMF_PUBLIC);
+		if(bc.bc_Buffer == NULL)
+		{
+			Printf("%s: Could not allocate buffer memory.\n", program_name);
+			goto out;
+		}
+
+		if(opts.To != NULL)
+		{
+			bc.bc_Output = Open(opts.To, MODE_NEWFILE);
+			if(bc.bc_Output == ZERO)
+			{
+				Fault(IoErr(), NULL, error_message, sizeof(error_message));
+
+				Printf("%s: Cannot create file \"%s\" (%s).\n", program_name, opts.To, error_message);
+				goto out;
+			}
+		}
+	}
+
+	/* First pass: examine all the directory entries. */
+	DateStamp(&start);
+
+	error = process_directory(dir_lock, FALSE, &bc);
+
+	DateStamp(&stop);
+
+	if(error != OK)
+	{
+		PrintFault(error, program_name);
+		goto out;
+	}
+
+	scan_ticks = get_elapsed_ticks(&start, &stop);
+
+	Printf("Directory scan: %lu directories, %lu files in ", bc.bc_NumDirectories, bc.bc_NumFiles);
+	print_elapsed_time(scan_ticks);
+	Printf("\n");
+
+	if(NOT opts.ScanOnly)
+	{
+		/* Second pass: read the contents of all the files. */
+		bc.bc_NumDirectories = bc.bc_NumFiles = 0;
+
+		DateStamp(&start);
+
+		error = process_directory(dir_lock, TRUE, &bc);
+
+		DateStamp(&stop);
+
+		if(error != OK)
+		{
+			PrintFault(error, program_name);
+			goto out;
+		}
+
+		copy_ticks = get_elapsed_ticks(&start, &stop);
+
+		Printf("File copy: %lu bytes in %lu files in ", bc.bc_NumBytes, bc.bc_NumFiles);
+		print_elapsed_time(copy_ticks);
+
+		if(copy_ticks > 0)
+			Printf(" (%lu bytes/second)", (bc.bc_NumBytes / copy_ticks) * TICKS_PER_SECOND);
+
+		Printf("\n");
+	}
+
+	result = RETURN_OK;
+
+ out:
+
+	if(bc.bc_Output != ZERO)
+		Close(bc.bc_Output);
+
+	if(bc.bc_Buffer != NULL)
+		FreeVec(bc.bc_Buffer);
+
+	if(dir_lock != ZERO)
+		UnLock(dir_lock);
+
+	if(rda != NULL)
+		FreeArgs(rda);
+
+	return(result);
+}
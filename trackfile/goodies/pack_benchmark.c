@@ -0,0 +1,215 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * cc -O2 -o pack_benchmark pack_benchmark.c
+ */
+
+/*
+ * This tool measures how well the track compression used by packed disk
+ * image files works for a set of ADF disk image files, and how fast it is.
+ * It runs on the host, using the very same code as the device and the
+ * DAPack shell command. Each track is packed, unpacked and compared with
+ * the original.
+ *
+ * Usage: pack_benchmark file.adf [file.adf ...]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/****************************************************************************/
+
+/* Just enough of <exec/types.h> for the track packer. */
+#define EXEC_TYPES_H
+
+typedef unsigned char	UBYTE;
+typedef unsigned short	UWORD;
+typedef long			LONG;
+typedef unsigned long	ULONG;
+typedef short			BOOL;
+
+#define TRUE	1
+#define FALSE	0
+
+#include "../track_packer.c"
+
+/****************************************************************************/
+
+#define TRACK_SIZE_DD	(11 * 512)
+#define TRACK_SIZE_HD	(22 * 512)
+#define NUM_TRACKS		(80 * 2)
+
+/* How often each track is unpacked, to get a measurable time. */
+#define NUM_UNPACK_ROUNDS 20
+
+/****************************************************************************/
+
+static double
+elapsed_seconds(clock_t start)
+{
+	return((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+/****************************************************************************/
+
+int
+main(int argc, char ** argv)
+{
+	static UWORD hash_table[PACK_HASH_TABLE_SIZE];
+	static UBYTE track[TRACK_SIZE_HD];
+	static UBYTE packed[TRACK_SIZE_HD];
+	static UBYTE unpacked[TRACK_SIZE_HD];
+
+	double total_in = 0, total_out = 0;
+	double pack_time = 0, unpack_time = 0, unpacked_bytes = 0;
+	long num_empty = 0, num_stored = 0, num_packed = 0;
+	int result = EXIT_FAILURE;
+	int i;
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s file.adf [file.adf ...]\n", argv[0]);
+		goto out;
+	}
+
+	for(i = 1 ; i < argc ; i++)
+	{
+		double file_out = 0;
+		long track_size, file_size;
+		FILE * in;
+		int t, r;
+
+		in = fopen(argv[i], "rb");
+		if(in == NULL)
+		{
+			perror(argv[i]);
+			goto out;
+		}
+
+		fseek(in, 0, SEEK_END);
+		file_size = ftell(in);
+		fseek(in, 0, SEEK_SET);
+
+		if(file_size == TRACK_SIZE_DD * NUM_TRACKS)
+		{
+			track_size = TRACK_SIZE_DD;
+		}
+		else if(file_size == TRACK_SIZE_HD * NUM_TRACKS)
+		{
+			track_size = TRACK_SIZE_HD;
+		}
+		else
+		{
+			fprintf(stderr, "%s: not a double density or high density disk image file\n", argv[i]);
+			fclose(in);
+			continue;
+		}
+
+		for(t = 0 ; t < NUM_TRACKS ; t++)
+		{
+			clock_t start;
+			LONG size;
+
+			if(fread(track, track_size, 1, in) != 1)
+			{
+				perror(argv[i]);
+				fclose(in);
+				goto out;
+			}
+
+			if(track_is_empty(track, track_size))
+			{
+				num_empty++;
+				continue;
+			}
+
+			start = clock();
+			size = pack_track(track, track_size, packed, track_size - 1, hash_table);
+			pack_time += elapsed_seconds(start);
+
+			if(size < 0)
+			{
+				num_stored++;
+				file_out += track_size;
+				continue;
+			}
+
+			num_packed++;
+			file_out += size;
+
+			start = clock();
+
+			for(r = 0 ; r < NUM_UNPACK_ROUNDS ; r++)
+			{
+				if(!unpack_track(packed, size, unpacked, track_size))
+					break;
+			}
+
+			unpack_time += elapsed_seconds(start);
+			unpacked_bytes += (double)track_size * NUM_UNPACK_ROUNDS;
+
+			if(r < NUM_UNPACK_ROUNDS || memcmp(track, unpacked, track_size) != 0)
+			{
+				fprintf(stderr, "%s: track %d did not survive packing and unpacking\n", argv[i], t);
+				fclose(in);
+				goto out;
+			}
+		}
+
+		fclose(in);
+
+		printf("%s: %ld -> %.0f bytes (%.1f%%)\n", argv[i], file_size, file_out, 100.0 * file_out / file_size);
+
+		total_in += file_size;
+		total_out += file_out;
+	}
+
+	if(total_in > 0)
+	{
+		printf("\nTotal: %.0f -> %.0f bytes (%.1f%%); %ld tracks packed, %ld stored, %ld empty\n",
+			total_in, total_out, 100.0 * total_out / total_in, num_packed, num_stored, num_empty);
+
+		if(pack_time > 0)
+			printf("Packing: %.1f MBytes/s\n", (total_in / (1024.0 * 1024.0)) / pack_time);
+
+		if(unpack_time > 0)
+			printf("Unpacking: %.1f MBytes/s\n", (unpacked_bytes / (1024.0 * 1024.0)) / unpack_time);
+	}
+
+	result = EXIT_SUCCESS;
+
+ out:
+
+	return(result);
+}
@@ -0,0 +1,129 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * cc -O2 -o track_reciprocal track_reciprocal.c
+ */
+
+/*
+ * This checks that the division-free track number conversion which the
+ * TRACK_FROM_OFFSET() and OFFSET_FROM_TRACK() macros in unit.h perform
+ * gives the same results as plain division. It runs on the host rather
+ * than on the Amiga and only uses the standard 'C' library.
+ *
+ * Every sector-aligned offset is checked for double density (11 sectors
+ * per track) and high density (22 sectors per track) disks, from the
+ * start of the disk up to the largest sector number for which the
+ * conversion is supposed to work (32767), which is far beyond the end
+ * of even a high density disk.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+/****************************************************************************/
+
+#define TD_SECTOR 512
+
+/* The conversion is exact for all sector numbers below this. */
+#define MAX_SECTORS 32768
+
+/****************************************************************************/
+
+typedef unsigned short	UWORD;
+typedef unsigned long	ULONG;
+typedef long			LONG;
+
+/****************************************************************************/
+
+/* These are the same as in unit.h, except that the unit data is
+ * replaced by its two fields which the conversion needs.
+ */
+#define TRACK_FROM_OFFSET(reciprocal, offset) \
+	((LONG)(((ULONG)((UWORD)((ULONG)(offset) / TD_SECTOR) * (reciprocal))) >> 16))
+
+#define OFFSET_FROM_TRACK(track_data_size, track) \
+	((LONG)((UWORD)(track) * (UWORD)(track_data_size)))
+
+/****************************************************************************/
+
+/* Compare the conversion with plain division for every sector-aligned
+ * offset, and print the first mismatches found. Returns the number of
+ * mismatches.
+ */
+static long
+check_sectors_per_track(int sectors_per_track)
+{
+	const LONG track_data_size = sectors_per_track * TD_SECTOR;
+	const UWORD reciprocal = (UWORD)((65536 + sectors_per_track - 1) / sectors_per_track);
+	long num_mismatches = 0;
+	LONG sector, offset, track, expected_track;
+
+	for(sector = 0 ; sector < MAX_SECTORS ; sector++)
+	{
+		offset = sector * TD_SECTOR;
+
+		expected_track = offset / track_data_size;
+
+		track = TRACK_FROM_OFFSET(reciprocal, offset);
+
+		if(track != expected_track ||
+		   OFFSET_FROM_TRACK(track_data_size, track) != expected_track * track_data_size ||
+		   offset - OFFSET_FROM_TRACK(track_data_size, track) != offset % track_data_size)
+		{
+			if(num_mismatches < 10)
+			{
+				printf("%d sectors per track: offset %ld (sector %ld) gives track %ld rather than %ld\n",
+					sectors_per_track, offset, sector, track, expected_track);
+			}
+
+			num_mismatches++;
+		}
+	}
+
+	printf("%d sectors per track (reciprocal %u): %ld offsets checked, %ld mismatches\n",
+		sectors_per_track, reciprocal, (long)MAX_SECTORS, num_mismatches);
+
+	return(num_mismatches);
+}
+
+/****************************************************************************/
+
+int
+main(void)
+{
+	long num_mismatches;
+
+	num_mismatches  = check_sectors_per_track(11);
+	num_mismatches += check_sectors_per_track(22);
+
+	return(num_mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
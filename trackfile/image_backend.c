@@ -0,0 +1,447 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+#include "unit.h"
+#include "tools.h"
+#include "image_backend.h"
+
+/****************************************************************************/
+
+#include <string.h>
+
+/****************************************************************************/
+
+/* Move to the given position in the disk image file, unless the file
+ * is already there. The file position is tracked for the unit, which
+ * avoids most of the Seek() calls when tracks are read in order.
+ */
+static LONG
+seek_image_file(struct TrackFileUnit * tfu, BPTR file, LONG offset)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG error = OK;
+
+	USE_DOS(tfd);
+
+	#if DEBUG
+	{
+		LONG current_file_position;
+
+		current_file_position = Seek(file, 0, OFFSET_CURRENT);
+
+		SHOWVALUE(tfu->tfu_FilePosition);
+		SHOWVALUE(current_file_position);
+		SHOWVALUE(offset);
+
+		ASSERT( tfu->tfu_FilePosition < 0 || tfu->tfu_FilePosition == current_file_position );
+	}
+	#endif /* DEBUG */
+
+	if(offset != tfu->tfu_FilePosition)
+	{
+		if(Seek(file, offset, OFFSET_BEGINNING) == -1)
+		{
+			error = IoErr();
+
+			D(("that seek didn't work (error=%ld)", error));
+
+			/* We probably don't know where we are now... */
+			tfu->tfu_FilePosition = -1;
+
+			goto out;
+		}
+
+		tfu->tfu_FilePosition = offset;
+	}
+
+ out:
+
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Read from the disk image file directly. */
+static LONG
+file_read(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG num_bytes_read;
+	LONG error;
+
+	USE_DOS(tfd);
+
+	error = seek_image_file(tfu, file, offset);
+	if(error != OK)
+	{
+		SetIoErr(error);
+
+		num_bytes_read = -1;
+		goto out;
+	}
+
+	D(("reading %ld bytes from file at position %ld", length, offset));
+
+	num_bytes_read = Read(file, data, length);
+	if(num_bytes_read == length)
+	{
+		ASSERT( tfu->tfu_FilePosition >= 0 );
+
+		tfu->tfu_FilePosition += num_bytes_read;
+	}
+	else
+	{
+		/* We probably don't know where we are now... */
+		tfu->tfu_FilePosition = -1;
+	}
+
+ out:
+
+	return(num_bytes_read);
+}
+
+/****************************************************************************/
+
+/* Write to the disk image file directly. */
+static LONG
+file_write(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	LONG num_bytes_written;
+	LONG error;
+
+	USE_DOS(tfd);
+
+	error = seek_image_file(tfu, file, offset);
+	if(error != OK)
+	{
+		SetIoErr(error);
+
+		num_bytes_written = -1;
+		goto out;
+	}
+
+	D(("writing %ld bytes to file at position %ld", length, offset));
+
+	num_bytes_written = Write(file, data, length);
+	if(num_bytes_written == length)
+	{
+		ASSERT( tfu->tfu_FilePosition >= 0 );
+
+		tfu->tfu_FilePosition += num_bytes_written;
+	}
+	else
+	{
+		/* We probably don't know where we are now... */
+		tfu->tfu_FilePosition = -1;
+	}
+
+ out:
+
+	return(num_bytes_written);
+}
+
+/****************************************************************************/
+
+/* This is the default: the unit accesses the disk image file itself. */
+const struct ImageBackend file_backend =
+{
+	"file",
+	file_read,
+	file_write
+};
+
+/****************************************************************************/
+
+/* Have the block server read or write the data, one track at a time. Up to
+ * MAX_BLOCK_REQUESTS_IN_FLIGHT requests are sent before the first one has
+ * to be returned, so that the server always has the next track request to
+ * work on while the previous one is being returned. The server may have
+ * gone away in the meantime, which is why its message port is looked up
+ * again for every request. The file position is no longer known after
+ * the server has used the file.
+ */
+static LONG
+block_server_transfer(struct TrackFileUnit * tfu, BPTR file, UWORD command, LONG offset, APTR data, LONG length)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct TrackFileBlockRequest requests[MAX_BLOCK_REQUESTS_IN_FLIGHT];
+	BOOL request_in_use[MAX_BLOCK_REQUESTS_IN_FLIGHT];
+	struct TrackFileBlockRequest * tfbr;
+	struct MsgPort * server_port;
+	struct MsgPort reply_port;
+	LONG request_size;
+	LONG num_in_flight = 0;
+	LONG num_bytes_sent = 0;
+	LONG num_bytes_transferred = 0;
+	LONG error = OK;
+	LONG i;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( command == TFBR_Read || command == TFBR_Write );
+	ASSERT( length > 0 );
+
+	tfu->tfu_FilePosition = -1;
+
+	/* Each request covers no more than one track. */
+	request_size = tfu->tfu_TrackDataSize;
+	if(request_size <= 0)
+		request_size = length;
+
+	memset(requests, 0, sizeof(requests));
+	memset(request_in_use, 0, sizeof(request_in_use));
+
+	/* We'll build the reply port locally. */
+	memset(&reply_port, 0, sizeof(reply_port));
+
+	init_msgport(&reply_port, FindTask(NULL), SIGB_SINGLE);
+
+	/* Important: clear SIGF_SINGLE before we
+	 *            eventually drop into WaitPort().
+	 */
+	SetSignal(0, (1UL << reply_port.mp_SigBit));
+
+	do
+	{
+		/* Keep the server busy. */
+		for(i = 0 ; i < MAX_BLOCK_REQUESTS_IN_FLIGHT && error == OK && num_bytes_sent < length ; i++)
+		{
+			if(request_in_use[i])
+				continue;
+
+			tfbr = &requests[i];
+
+			tfbr->tfbr_Message.mn_ReplyPort	= &reply_port;
+			tfbr->tfbr_Message.mn_Length	= sizeof(*tfbr);
+
+			tfbr->tfbr_Command	= command;
+			tfbr->tfbr_Unit		= tfu->tfu_UnitNumber;
+			tfbr->tfbr_File		= file;
+			tfbr->tfbr_Offset	= offset + num_bytes_sent;
+			tfbr->tfbr_Data		= &((UBYTE *)data)[num_bytes_sent];
+			tfbr->tfbr_Length	= length - num_bytes_sent;
+			tfbr->tfbr_Actual	= -1;
+			tfbr->tfbr_Error	= OK;
+
+			if(tfbr->tfbr_Length > request_size)
+				tfbr->tfbr_Length = request_size;
+
+			Forbid();
+
+			server_port = FindPort((STRPTR)tfu->tfu_BlockServerName);
+			if(server_port != NULL)
+				PutMsg(server_port, &tfbr->tfbr_Message);
+
+			Permit();
+
+			if(server_port == NULL)
+			{
+				D(("block server '%s' is gone", tfu->tfu_BlockServerName));
+
+				error = ERROR_OBJECT_NOT_FOUND;
+				break;
+			}
+
+			request_in_use[i] = TRUE;
+			num_in_flight++;
+
+			num_bytes_sent += tfbr->tfbr_Length;
+		}
+
+		if(num_in_flight == 0)
+			break;
+
+		WaitPort(&reply_port);
+
+		while((tfbr = (struct TrackFileBlockRequest *)GetMsg(&reply_port)) != NULL)
+		{
+			request_in_use[tfbr - requests] = FALSE;
+			num_in_flight--;
+
+			if(tfbr->tfbr_Actual == -1)
+			{
+				D(("block request at offset %ld failed (error=%ld)", tfbr->tfbr_Offset, tfbr->tfbr_Error));
+
+				if(error == OK)
+				{
+					error = tfbr->tfbr_Error;
+					if(error == OK)
+						error = ERROR_SEEK_ERROR;
+				}
+			}
+			else
+			{
+				num_bytes_transferred += tfbr->tfbr_Actual;
+
+				/* The next requests are of no use if this one came up
+				 * short, but the rest of them still have to return.
+				 */
+				if(tfbr->tfbr_Actual != tfbr->tfbr_Length)
+					num_bytes_sent = length;
+			}
+		}
+	}
+	while(num_in_flight > 0 || (error == OK && num_bytes_sent < length));
+
+	if(error != OK)
+	{
+		SetIoErr(error);
+
+		num_bytes_transferred = -1;
+	}
+
+	RETURN(num_bytes_transferred);
+	return(num_bytes_transferred);
+}
+
+/****************************************************************************/
+
+static LONG
+block_server_read(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length)
+{
+	return(block_server_transfer(tfu, file, TFBR_Read, offset, data, length));
+}
+
+/****************************************************************************/
+
+static LONG
+block_server_write(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length)
+{
+	return(block_server_transfer(tfu, file, TFBR_Write, offset, data, length));
+}
+
+/****************************************************************************/
+
+/* The unit sends its track requests to a block server process. */
+const struct ImageBackend block_server_backend =
+{
+	"block server",
+	block_server_read,
+	block_server_write
+};
+
+/****************************************************************************/
+
+/* Choose how the unit will access the disk image file which is about to be
+ * inserted: directly, or through the block server whose public message port
+ * has the given name. Returns an AmigaDOS error code if there is no such
+ * block server.
+ */
+LONG
+select_image_backend(struct TrackFileUnit * tfu, const TEXT * block_server_name)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct MsgPort * server_port;
+	LONG error = OK;
+
+	USE_EXEC(tfd);
+
+	ENTER();
+
+	tfu->tfu_ImageBackend = &file_backend;
+	tfu->tfu_BlockServerName[0] = '\0';
+
+	if(block_server_name != NULL)
+	{
+		if(strlen(block_server_name) >= sizeof(tfu->tfu_BlockServerName))
+		{
+			error = ERROR_OBJECT_NOT_FOUND;
+			goto out;
+		}
+
+		Forbid();
+		server_port = FindPort((STRPTR)block_server_name);
+		Permit();
+
+		if(server_port == NULL)
+		{
+			D(("block server '%s' not found", block_server_name));
+
+			error = ERROR_OBJECT_NOT_FOUND;
+			goto out;
+		}
+
+		strcpy(tfu->tfu_BlockServerName, block_server_name);
+
+		tfu->tfu_ImageBackend = &block_server_backend;
+	}
+
+	D(("unit %ld uses the %s backend", tfu->tfu_UnitNumber, tfu->tfu_ImageBackend->ib_Name));
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Read from the disk image file through the unit's backend. */
+LONG
+read_image_data(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length)
+{
+	ASSERT( tfu->tfu_ImageBackend != NULL );
+	ASSERT( file != ZERO && offset >= 0 && data != NULL );
+
+	return((*tfu->tfu_ImageBackend->ib_Read)(tfu, file, offset, data, length));
+}
+
+/****************************************************************************/
+
+/* Write to the disk image file through the unit's backend. */
+LONG
+write_image_data(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length)
+{
+	ASSERT( tfu->tfu_ImageBackend != NULL );
+	ASSERT( file != ZERO && offset >= 0 && data != NULL );
+
+	return((*tfu->tfu_ImageBackend->ib_Write)(tfu, file, offset, data, length));
+}
@@ -0,0 +1,79 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _IMAGE_BACKEND_H
+#define _IMAGE_BACKEND_H
+
+/****************************************************************************/
+
+#ifndef _UNIT_H
+#include "unit.h"
+#endif /* _UNIT_H */
+
+/****************************************************************************/
+
+/* The data of a plain disk image file is read and written through one of
+ * these backends. Both functions work like the dos.library Read() and
+ * Write() functions, except that they take the position in the disk image
+ * at which the data is found. They return the number of bytes transferred,
+ * or -1 in case of failure, with the AmigaDOS error code to be found in
+ * IoErr(). The file handle is passed in separately because the disk image
+ * is read before the unit takes control of it.
+ */
+struct ImageBackend
+{
+	const TEXT *	ib_Name;
+
+	LONG			(*ib_Read)(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length);
+	LONG			(*ib_Write)(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length);
+};
+
+/****************************************************************************/
+
+/* This many requests may be sent to a block server
+ * before the first of them has to be returned.
+ */
+#define MAX_BLOCK_REQUESTS_IN_FLIGHT 4
+
+/****************************************************************************/
+
+extern const struct ImageBackend file_backend;
+extern const struct ImageBackend block_server_backend;
+
+/****************************************************************************/
+
+LONG select_image_backend(struct TrackFileUnit * tfu, const TEXT * block_server_name);
+LONG read_image_data(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length);
+LONG write_image_data(struct TrackFileUnit * tfu, BPTR file, LONG offset, APTR data, LONG length);
+
+/****************************************************************************/
+
+#endif /* _IMAGE_BACKEND_H */
@@ -451,6 +451,11 @@ mfm_encode_sector(
 	mfm_encode_word(mcc, checksum);
 	mfm_encode_fix_clock_bit(mcc);
 
+	/* The next sector follows the last word of the sector data,
+	 * and not the data checksum which was encoded last.
+	 */
+	mcc->mcc_previous_byte = mcc->mcc_data[mcc->mcc_sector_position + mcc->mcc_sector_size - 1];
+
 	/* And move on to the next sector. */
 	mfm_encode_advance_sector(mcc);
 }
@@ -0,0 +1,269 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _SYSTEM_HEADERS_H
+#include "system_headers.h"
+#endif /* _SYSTEM_HEADERS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACKFILE_DEVICE_H
+#include "trackfile_device.h"
+#endif /* _TRACKFILE_DEVICE_H */
+
+/****************************************************************************/
+
+#include "assert.h"
+
+/****************************************************************************/
+
+#include "packed_image.h"
+
+/****************************************************************************/
+
+/* Release the memory allocated by examine_packed_image(). */
+VOID
+free_packed_image(struct TrackFileDevice * tfd, struct PackedImage * pi)
+{
+	USE_EXEC(tfd);
+
+	if(pi != NULL)
+	{
+		FreeVec(pi->pi_Buffer);
+		FreeVec(pi);
+	}
+}
+
+/****************************************************************************/
+
+/* Check if the file is a packed disk image file and, if it is, read
+ * its track index. For any other kind of file no error is returned,
+ * and the image pointer is set to NULL. The file must contain exactly
+ * as many tracks as requested, and these must either be double density
+ * or high density disk tracks. Note that this leaves the file position
+ * undefined.
+ */
+LONG
+examine_packed_image(
+	struct TrackFileDevice *	tfd,
+	BPTR						file,
+	LONG						num_tracks,
+	struct PackedImage **		pi_ptr)
+{
+	struct PackedImage * pi = NULL;
+	struct PackedImageHeader pih;
+	LONG num_bytes_read;
+	LONG index_size;
+	LONG error;
+	LONG i;
+
+	USE_EXEC(tfd);
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( num_tracks > 0 );
+
+	(*pi_ptr) = NULL;
+
+	if(Seek(file, 0, OFFSET_BEGINNING) == -1)
+	{
+		error = IoErr();
+
+		D(("could not seek to the start of the file (error=%ld)", error));
+		goto out;
+	}
+
+	num_bytes_read = Read(file, &pih, sizeof(pih));
+	if(num_bytes_read == -1)
+	{
+		error = IoErr();
+
+		D(("could not read the file header (error=%ld)", error));
+		goto out;
+	}
+
+	if(num_bytes_read != sizeof(pih) || pih.pih_Signature != PACKED_IMAGE_SIGNATURE)
+	{
+		SHOWMSG("this is not a packed disk image file");
+
+		error = OK;
+		goto out;
+	}
+
+	D(("packed disk image file version %ld with %ld tracks of %ld bytes each",
+		pih.pih_Version, pih.pih_NumTracks, pih.pih_TrackSize));
+
+	if(pih.pih_Version != PACKED_IMAGE_VERSION ||
+	   pih.pih_NumTracks != num_tracks ||
+	   (pih.pih_TrackSize != NUMSECS * TD_SECTOR && pih.pih_TrackSize != 2 * NUMSECS * TD_SECTOR))
+	{
+		SHOWMSG("this packed disk image file cannot be used");
+
+		error = TFERROR_InvalidFileSize;
+		goto out;
+	}
+
+	pi = AllocVec(sizeof(*pi) + sizeof(pi->pi_Tracks[0]) * (num_tracks - 1), MEMF_ANY|MEMF_PUBLIC|MEMF_CLEAR);
+	if(pi == NULL)
+	{
+		SHOWMSG("not enough memory");
+
+		error = TFERROR_OutOfMemory;
+		goto out;
+	}
+
+	pi->pi_NumTracks	= num_tracks;
+	pi->pi_TrackSize	= pih.pih_TrackSize;
+
+	/* Compressed tracks are always smaller than the unpacked
+	 * tracks, or they would have been stored as they are.
+	 */
+	pi->pi_Buffer = AllocVec(pi->pi_TrackSize, MEMF_ANY|MEMF_PUBLIC);
+	if(pi->pi_Buffer == NULL)
+	{
+		SHOWMSG("not enough memory");
+
+		error = TFERROR_OutOfMemory;
+		goto out;
+	}
+
+	/* The index follows the header directly. */
+	index_size = sizeof(pi->pi_Tracks[0]) * num_tracks;
+
+	num_bytes_read = Read(file, pi->pi_Tracks, index_size);
+	if(num_bytes_read != index_size)
+	{
+		error = (num_bytes_read == -1) ? IoErr() : TFERROR_InvalidFileSize;
+
+		D(("could not read the track index (error=%ld)", error));
+		goto out;
+	}
+
+	for(i = 0 ; i < num_tracks ; i++)
+	{
+		if(pi->pi_Tracks[i].pit_Size > (ULONG)pi->pi_TrackSize)
+		{
+			D(("track %ld is larger (%ld bytes) than the track size", i, pi->pi_Tracks[i].pit_Size));
+
+			error = TFERROR_InvalidFileSize;
+			goto out;
+		}
+	}
+
+	(*pi_ptr) = pi;
+	pi = NULL;
+
+	error = OK;
+
+ out:
+
+	free_packed_image(tfd, pi);
+
+	RETURN(error);
+	return(error);
+}
+
+/****************************************************************************/
+
+/* Read a track from a packed disk image file, unpacking it if necessary.
+ * This takes at most one seek and one read operation. Returns a
+ * trackdisk.device error code if the track could not be read or
+ * unpacked. The file position will be undefined afterwards.
+ */
+LONG
+read_packed_image_track(
+	struct TrackFileDevice *	tfd,
+	struct PackedImage *		pi,
+	BPTR						file,
+	LONG						which_track,
+	APTR						data,
+	LONG						data_size)
+{
+	const struct PackedImageTrack * pit;
+	LONG error;
+
+	USE_DOS(tfd);
+
+	ENTER();
+
+	ASSERT( 0 <= which_track && which_track < pi->pi_NumTracks );
+	ASSERT( data_size == pi->pi_TrackSize );
+
+	pit = &pi->pi_Tracks[which_track];
+
+	/* Nothing is stored for a track which contains only zeroes. */
+	if(pit->pit_Size == 0)
+	{
+		memset(data, 0, data_size);
+	}
+	else
+	{
+		APTR buffer;
+
+		/* Uncompressed tracks go straight into the track buffer. */
+		if(pit->pit_Size == (ULONG)data_size)
+			buffer = data;
+		else
+			buffer = pi->pi_Buffer;
+
+		if(Seek(file, pit->pit_Offset, OFFSET_BEGINNING) == -1)
+		{
+			D(("that seek didn't work (error=%ld)", IoErr()));
+
+			error = TDERR_NoSecHdr;
+			goto out;
+		}
+
+		if(Read(file, buffer, pit->pit_Size) != (LONG)pit->pit_Size)
+		{
+			D(("that read didn't work (error=%ld)", IoErr()));
+
+			error = TDERR_BadSecHdr;
+			goto out;
+		}
+
+		if(buffer != data && CANNOT unpack_track(buffer, pit->pit_Size, data, data_size))
+		{
+			D(("track %ld could not be unpacked", which_track));
+
+			error = TDERR_BadSecSum;
+			goto out;
+		}
+	}
+
+	error = OK;
+
+ out:
+
+	RETURN(error);
+	return(error);
+}
@@ -0,0 +1,72 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _PACKED_IMAGE_H
+#define _PACKED_IMAGE_H
+
+/****************************************************************************/
+
+#ifndef DOS_DOS_H
+#include <dos/dos.h>
+#endif /* DOS_DOS_H */
+
+/****************************************************************************/
+
+#ifndef _TRACK_PACKER_H
+#include "track_packer.h"
+#endif /* _TRACK_PACKER_H */
+
+/****************************************************************************/
+
+/* Everything needed to read the tracks of a packed disk image file. */
+struct PackedImage
+{
+	LONG					pi_NumTracks;		/* Number of tracks in use */
+	LONG					pi_TrackSize;		/* Size of an unpacked track */
+
+	UBYTE *					pi_Buffer;			/* Compressed data of one track */
+
+	struct PackedImageTrack	pi_Tracks[1];		/* One entry per track */
+};
+
+/****************************************************************************/
+
+struct TrackFileDevice;
+
+/****************************************************************************/
+
+LONG examine_packed_image(struct TrackFileDevice * tfd, BPTR file, LONG num_tracks, struct PackedImage ** pi_ptr);
+LONG read_packed_image_track(struct TrackFileDevice * tfd, struct PackedImage * pi, BPTR file, LONG which_track, APTR data, LONG data_size);
+VOID free_packed_image(struct TrackFileDevice * tfd, struct PackedImage * pi);
+
+/****************************************************************************/
+
+#endif /* _PACKED_IMAGE_H */
@@ -0,0 +1,263 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+/*
+ * The track compression used by packed disk image files. This has to be
+ * fast to unpack above all, since trackfile.device unpacks a track every
+ * time it is read from the file. It is a plain LZ77 variant without any
+ * entropy coding, along the lines of Ross Williams' LZRW1: a match is
+ * found by looking up the last position at which the same three bytes
+ * were seen, and unpacking only ever copies bytes.
+ *
+ * This file does not depend on anything but the Amiga data types, so that
+ * it can be used by the device, by the DAPack shell command and by host
+ * tools alike.
+ */
+
+#ifndef _TRACK_PACKER_H
+#include "track_packer.h"
+#endif /* _TRACK_PACKER_H */
+
+/****************************************************************************/
+
+/* Marks an unused hash table entry. */
+#define NO_POSITION 0xFFFF
+
+/* Which hash table entry the three bytes at the given
+ * position belong to.
+ */
+#define HASH_POSITION(p) \
+	((((ULONG)(p)[0] << 8) ^ ((ULONG)(p)[1] << 4) ^ (ULONG)(p)[2]) & (PACK_HASH_TABLE_SIZE - 1))
+
+/****************************************************************************/
+
+/* Check if the track contains nothing but zero bytes, in which case
+ * no data needs to be stored for it at all.
+ */
+BOOL
+track_is_empty(const UBYTE * data, LONG data_size)
+{
+	const ULONG * l = (const ULONG *)data;
+	LONG i;
+
+	for(i = 0 ; i < data_size / (LONG)sizeof(ULONG) ; i++)
+	{
+		if(l[i] != 0)
+			return(FALSE);
+	}
+
+	return(TRUE);
+}
+
+/****************************************************************************/
+
+/* Compress the track data. The hash table must have room for
+ * PACK_HASH_TABLE_SIZE entries, and the track must not be larger than
+ * 65535 bytes. Returns the size of the compressed data, or -1 if it
+ * would not fit into the destination buffer. Make the destination
+ * buffer smaller than the source data to find out if compressing the
+ * track is worth the trouble at all.
+ */
+LONG
+pack_track(
+	const UBYTE *	source,
+	LONG			source_size,
+	UBYTE *			destination,
+	LONG			destination_size,
+	UWORD *			hash_table)
+{
+	const UBYTE * from = source;
+	const UBYTE * from_end = source + source_size;
+	const UBYTE * match;
+	UBYTE * to = destination;
+	UBYTE * to_end = destination + destination_size;
+	UBYTE * control_word;
+	ULONG control_bit;
+	ULONG control;
+	LONG offset, length, max_length;
+	ULONG h;
+	LONG i;
+
+	for(i = 0 ; i < PACK_HASH_TABLE_SIZE ; i++)
+		hash_table[i] = NO_POSITION;
+
+	control_word = NULL;
+	control_bit = 0;
+	control = 0;
+
+	while(from < from_end)
+	{
+		/* Start a new group? Its control word is filled in
+		 * once all of its items have been stored.
+		 */
+		if(control_bit == 0)
+		{
+			if(control_word != NULL)
+			{
+				control_word[0] = (UBYTE)control;
+				control_word[1] = (UBYTE)(control >> 8);
+			}
+
+			/* Room for the control word and one match. */
+			if(to + 4 > to_end)
+				return(-1);
+
+			control_word = to;
+			to += 2;
+
+			control_bit = 1;
+			control = 0;
+		}
+		else if (to + 2 > to_end)
+		{
+			return(-1);
+		}
+
+		length = 0;
+
+		if(from_end - from >= PACK_MIN_MATCH)
+		{
+			h = HASH_POSITION(from);
+
+			offset = (from - source) - hash_table[h];
+
+			if(hash_table[h] != NO_POSITION && 0 < offset && offset <= PACK_MAX_OFFSET)
+			{
+				match = from - offset;
+
+				max_length = from_end - from;
+				if(max_length > PACK_MAX_MATCH)
+					max_length = PACK_MAX_MATCH;
+
+				while(length < max_length && match[length] == from[length])
+					length++;
+			}
+
+			hash_table[h] = (UWORD)(from - source);
+		}
+
+		if(length >= PACK_MIN_MATCH)
+		{
+			to[0] = (UBYTE)(((offset >> 4) & 0xF0) | (length - PACK_MIN_MATCH));
+			to[1] = (UBYTE)offset;
+			to += 2;
+
+			from += length;
+
+			control |= control_bit;
+		}
+		else
+		{
+			(*to++) = (*from++);
+		}
+
+		control_bit = (control_bit << 1) & 0xFFFF;
+	}
+
+	if(control_word != NULL)
+	{
+		control_word[0] = (UBYTE)control;
+		control_word[1] = (UBYTE)(control >> 8);
+	}
+
+	return(to - destination);
+}
+
+/****************************************************************************/
+
+/* Restore the track data compressed by pack_track(). Returns FALSE if the
+ * compressed data turns out to be corrupt, or if it does not unpack to
+ * exactly the expected number of bytes.
+ */
+BOOL
+unpack_track(
+	const UBYTE *	source,
+	LONG			source_size,
+	UBYTE *			destination,
+	LONG			destination_size)
+{
+	const UBYTE * from = source;
+	const UBYTE * from_end = source + source_size;
+	const UBYTE * match;
+	UBYTE * to = destination;
+	UBYTE * to_end = destination + destination_size;
+	ULONG control = 0;
+	int num_items = 0;
+	LONG offset, length;
+
+	while(from < from_end)
+	{
+		if(num_items == 0)
+		{
+			if(from + 2 > from_end)
+				return(FALSE);
+
+			control = from[0] | ((ULONG)from[1] << 8);
+			from += 2;
+
+			num_items = 16;
+		}
+
+		if(control & 1)
+		{
+			if(from + 2 > from_end)
+				return(FALSE);
+
+			offset = ((from[0] & 0xF0) << 4) | from[1];
+			length = (from[0] & 0x0F) + PACK_MIN_MATCH;
+			from += 2;
+
+			if(offset == 0 || offset > to - destination || length > to_end - to)
+				return(FALSE);
+
+			/* The match may overlap the bytes it produces,
+			 * which is why this needs to copy byte by byte.
+			 */
+			match = to - offset;
+
+			do
+				(*to++) = (*match++);
+			while(--length > 0);
+		}
+		else
+		{
+			if(to == to_end)
+				return(FALSE);
+
+			(*to++) = (*from++);
+		}
+
+		control >>= 1;
+		num_items--;
+	}
+
+	return((BOOL)(to == to_end));
+}
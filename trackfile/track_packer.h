@@ -0,0 +1,96 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _TRACK_PACKER_H
+#define _TRACK_PACKER_H
+
+/****************************************************************************/
+
+#ifndef EXEC_TYPES_H
+#include <exec/types.h>
+#endif /* EXEC_TYPES_H */
+
+/****************************************************************************/
+
+/* A packed disk image file holds the tracks of a disk, each compressed on
+ * its own, so that any track can be read with one seek and one short read.
+ * The file begins with a header, which is followed by an index with one
+ * entry per track, and then the track data. All numbers are stored in
+ * big-endian byte order.
+ *
+ * A track whose index entry gives a size of 0 consists of nothing but
+ * zero bytes, and has no data stored in the file. A track whose size
+ * matches the track size is stored uncompressed. All other tracks are
+ * compressed.
+ */
+#define PACKED_IMAGE_SIGNATURE	0x5446504B	/* 'TFPK' */
+#define PACKED_IMAGE_VERSION	1
+
+struct PackedImageHeader
+{
+	ULONG	pih_Signature;		/* Must be PACKED_IMAGE_SIGNATURE */
+	UWORD	pih_Version;		/* Must be PACKED_IMAGE_VERSION */
+	UWORD	pih_NumTracks;		/* Number of index entries to follow */
+	ULONG	pih_TrackSize;		/* Size of an unpacked track in bytes */
+};
+
+struct PackedImageTrack
+{
+	ULONG	pit_Offset;			/* Start of the track data in the file */
+	ULONG	pit_Size;			/* Number of bytes stored in the file */
+};
+
+/****************************************************************************/
+
+/* The compressed track data is a sequence of groups, each consisting of a
+ * 16 bit control word (least significant byte first), followed by up to 16
+ * items, one for each bit of the control word, starting with the least
+ * significant bit. If the bit is clear, the item is a literal byte. If it
+ * is set, the item consists of two bytes, which hold a 12 bit offset (1..4095)
+ * and a 4 bit length (3..18), telling how many bytes to copy from how far
+ * back in the data already unpacked.
+ */
+#define PACK_MIN_MATCH		3
+#define PACK_MAX_MATCH		(PACK_MIN_MATCH + 15)
+#define PACK_MAX_OFFSET		4095
+
+/* The packer needs a table of this many entries, to find matches. */
+#define PACK_HASH_TABLE_SIZE 4096
+
+/****************************************************************************/
+
+LONG pack_track(const UBYTE * source, LONG source_size, UBYTE * destination, LONG destination_size, UWORD * hash_table);
+BOOL unpack_track(const UBYTE * source, LONG source_size, UBYTE * destination, LONG destination_size);
+BOOL track_is_empty(const UBYTE * data, LONG data_size);
+
+/****************************************************************************/
+
+#endif /* _TRACK_PACKER_H */
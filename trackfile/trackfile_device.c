@@ -105,6 +105,7 @@ static const APTR function_table[] =
 	tf_free_unit_data,
 	tf_change_unit_taglist,
 	tf_examine_file_size,
+	tf_copy_unit_taglist,
 
 	/* Function table end marker */
 	(APTR)-1
@@ -619,12 +620,10 @@ dev_abort_io(
 	/* Sanity first... */
 	if(which_io->io_Device == (struct Device *)tfd && tfu != NULL)
 	{
-		struct IORequest * io;
-
 		/* Check if the request is still in the queue, waiting to be
-		 * processed; this *must* be done under Disable() conditions
-		 * because interrupt code can end up attaching I/O requests
-		 * to the unit port.
+		 * processed. The request itself tells whether it is, so the
+		 * queue does not need to be searched, and interrupts are
+		 * disabled only for as long as it takes to unlink it.
 		 *
 		 * Note that an active TD_ADDCHANGEINT command which has
 		 * been processed and has its I/O request queued in the
@@ -634,28 +633,16 @@ dev_abort_io(
 		 * whether the TD_ADDCHANGEINT command should be subject
 		 * to AbortIO().
 		 */
-		Disable();
-
-		for(io = (struct IORequest *)tfu->tfu_Unit.tdu_Unit.unit_MsgPort.mp_MsgList.lh_Head ;
-		    io->io_Message.mn_Node.ln_Succ != NULL ;
-		    io = (struct IORequest *)io->io_Message.mn_Node.ln_Succ)
+		if(abort_queued_unit_request(tfu, which_io))
 		{
-			if(io == which_io)
-			{
-				/* Remove it from the queue and tag it as aborted. */
-				Remove(&io->io_Message.mn_Node);
-
-				ASSERT( (io->io_Flags & IOF_QUICK) == 0 );
+			ASSERT( (which_io->io_Flags & IOF_QUICK) == 0 );
 
-				error = io->io_Error = IOERR_ABORTED;
+			/* Tag it as aborted. */
+			error = which_io->io_Error = IOERR_ABORTED;
 
-				/* Reply the message, as usual */
-				ReplyMsg(&io->io_Message);
-				break;
-			}
+			/* Reply the message, as usual */
+			ReplyMsg(&which_io->io_Message);
 		}
-
-		Enable();
 	}
 	else
 	{
@@ -773,6 +760,11 @@ dev_begin_io(
 	D(("io->io_Message.mn_Length = %ld (sizeof(struct IOStdReq) == %ld)", io->io_Message.mn_Length, sizeof(struct IOStdReq)));
 	D(("io->io_Command           = 0x%04lx->%s (from \"%s\")", io->io_Command, command_name, sender_name));
 
+	/* This bit is ours to use, and it must not be set until the
+	 * I/O request has been added to the unit's request queue.
+	 */
+	CLEAR_FLAG(io->io_Flags, IOF_QUEUED);
+
 	/* This makes sure that WaitIO() is guaranteed to work and
 	 * will not hang.
 	 */
@@ -835,28 +827,20 @@ dev_begin_io(
 		}
 		else
 		{
-			Forbid();
+			/* Mark the IORequest has having been queued. */
+			CLEAR_FLAG(io->io_Flags, IOF_QUICK);
 
 			/* Is this unit still online? */
-			if(tfu->tfu_Process != NULL)
+			if(queue_unit_request(tfu, io))
 			{
-				D(("sending this command to unit #%ld for processing (io=0x%08lx)", tfu->tfu_UnitNumber, io));
-
-				/* Mark the IORequest has having been queued. */
-				CLEAR_FLAG(io->io_Flags, IOF_QUICK);
-
-				PutMsg(&tfu->tfu_Unit.tdu_Unit.unit_MsgPort, &io->io_Message);
+				D(("sent this command to unit #%ld for processing (io=0x%08lx)", tfu->tfu_UnitNumber, io));
 
 				/* The unit Process is now responsible for it. */
 				io = NULL;
-
-				Permit();
 			}
 			/* Otherwise we'll have to cover for it. */
 			else
 			{
-				Permit();
-
 				D(("BEGIN: performing this command by proxy (io=0x%08lx)", io));
 
 				/* We pretend that this command was processed
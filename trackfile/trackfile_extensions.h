@@ -0,0 +1,286 @@
+/*
+ * :ts=4
+ *
+ * A trackdisk.device which uses ADF disk image files and its
+ * sidekick, the trusty DAControl shell command.
+ *
+ * Copyright (C) 2020 by Olaf Barthel <obarthel at gmx dot net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *****************************************************************************
+ *
+ * The secret of life is to enjoy the passage of time.
+ */
+
+#ifndef _TRACKFILE_EXTENSIONS_H
+#define _TRACKFILE_EXTENSIONS_H
+
+/****************************************************************************/
+
+/* Additions to the <devices/trackfile.h> API which trackfile.device and
+ * DAControl share. The tag values are chosen so as not to clash with
+ * those defined by <devices/trackfile.h>.
+ */
+
+/****************************************************************************/
+
+#ifndef UTILITY_TAGITEM_H
+#include <utility/tagitem.h>
+#endif /* UTILITY_TAGITEM_H */
+
+#ifndef DEVICES_TRACKFILE_H
+#include <devices/trackfile.h>
+#endif /* DEVICES_TRACKFILE_H */
+
+/****************************************************************************/
+
+#define TFX_Dummy (TAG_USER + 0x54468000)
+
+/* TFChangeUnitTagList(): reset the per-track access counters of the
+ * given unit, or of all units if TFUNIT_CONTROL is used (BOOL).
+ */
+#define TF_ResetTrackStatistics (TFX_Dummy + 1)
+
+/* TFInsertMediaTagList(): tracks to load into the cache in the background
+ * after the medium has been inserted, in this order (const UBYTE *), and
+ * the number of entries in this list (LONG). Pass the track access order
+ * which TFGetUnitData() reported for the same medium the last time it was
+ * used, so that these tracks are already in the cache when they are read.
+ * Ignored if TF_PrefillUnitCache is used or if the cache is disabled.
+ */
+#define TF_WarmupTracks		(TFX_Dummy + 2)
+#define TF_NumWarmupTracks	(TFX_Dummy + 3)
+
+/* Maximum number of tracks (80 cylinders, 2 heads) in the track access
+ * order and in the TF_WarmupTracks list.
+ */
+#define TF_MAX_WARMUP_TRACKS	(80 * 2)
+
+/* TFInsertMediaTagList(): learn which tracks tend to be read after which
+ * other tracks, and load the likely next tracks into the cache in the
+ * background (BOOL). Ignored if the cache is disabled.
+ */
+#define TF_PredictTracks	(TFX_Dummy + 4)
+
+/* TFInsertMediaTagList(): name of the public message port of a block
+ * server process which reads and writes the disk image file on behalf
+ * of the unit (STRPTR). The name is copied. Only plain disk image files
+ * are accessed this way; extended ADF files and packed disk image files
+ * are always read directly. Defaults to NULL.
+ */
+#define TF_BlockServer		(TFX_Dummy + 5)
+
+/* Maximum length of the TF_BlockServer name, including the terminating
+ * NUL character.
+ */
+#define TF_MAX_BLOCK_SERVER_NAME_LEN 32
+
+/* TFChangeUnitTagList(): take a checkpoint of the disk contents (TRUE),
+ * or discard it (FALSE), and restore the disk contents as of the last
+ * checkpoint (BOOL). Only the tracks changed since the checkpoint are
+ * copied to memory, and only these are restored.
+ */
+#define TF_Checkpoint		(TFX_Dummy + 6)
+#define TF_Rollback			(TFX_Dummy + 7)
+
+/****************************************************************************/
+
+/* The unit sends these messages to the block server's public message port,
+ * and the server replies each one once the data has been transferred. More
+ * than one request may be sent before the first one is returned, and the
+ * server may return them in any order. The file handle belongs to the
+ * unit, and its file position is not preserved. The server must return
+ * all the requests it receives.
+ */
+struct TrackFileBlockRequest
+{
+	struct Message	tfbr_Message;
+
+	UWORD			tfbr_Command;	/* TFBR_Read or TFBR_Write */
+	UWORD			tfbr_Unit;		/* Number of the unit which sent the request */
+	BPTR			tfbr_File;		/* Disk image file to access */
+	LONG			tfbr_Offset;	/* Where the data is found in the disk image file */
+	APTR			tfbr_Data;		/* Data to read or write */
+	LONG			tfbr_Length;	/* Number of bytes to read or write */
+
+	LONG			tfbr_Actual;	/* Number of bytes transferred, or -1 */
+	LONG			tfbr_Error;		/* AmigaDOS error code if tfbr_Actual is -1 */
+};
+
+#define TFBR_Read	1
+#define TFBR_Write	2
+
+/****************************************************************************/
+
+/* Per-track access counters, as maintained by each unit. */
+struct TrackFileTrackStatistics
+{
+	ULONG	tfts_Reads;		/* Number of times the track was loaded */
+	ULONG	tfts_Writes;	/* Number of times the track was written back */
+	ULONG	tfts_Misses;	/* Number of loads which had to read the file */
+};
+
+/****************************************************************************/
+
+/* Background jobs which each unit performs while it is idle. */
+#define TFJOB_Flush		0	/* Write back the track buffer, turn off the motor */
+#define TFJOB_Checksum	1	/* Update the disk checksum */
+#define TFJOB_Cache		2	/* Reclaim stale cache entries */
+#define TFJOB_Warmup	3	/* Load the TF_WarmupTracks into the cache */
+#define TFJOB_Predict	4	/* Load the predicted next tracks into the cache */
+
+#define NUM_TFJOBS		5
+
+/* Per-job counters, as maintained by each unit. */
+struct TrackFileJobStatistics
+{
+	ULONG	tfjs_Runs;		/* Number of time slices which the job was given */
+	ULONG	tfjs_Deferrals;	/* Number of times the job yielded before it was done */
+	ULONG	tfjs_Time;		/* Total time spent in the job, in milliseconds */
+};
+
+/****************************************************************************/
+
+/* Each group of unit statistics which TFGetUnitData() reports begins
+ * with this header. The groups are identified by their type, and fields
+ * are only ever added to the end of a group. Check that tfsg_Size is
+ * large enough before you access a field.
+ */
+struct TrackFileStatisticsGroup
+{
+	struct TrackFileStatisticsGroup *	tfsg_Next;	/* Next group, or NULL */
+	ULONG								tfsg_Type;	/* TFSG_Queue, etc. */
+	ULONG								tfsg_Size;	/* Size of the group, including this header */
+};
+
+#define TFSG_Queue			1	/* struct TrackFileQueueStatistics */
+#define TFSG_Chunks			2	/* struct TrackFileChunkStatistics */
+#define TFSG_Jobs			3	/* struct TrackFileJobGroup */
+#define TFSG_AccessOrder	4	/* struct TrackFileAccessOrder */
+#define TFSG_Prediction		5	/* struct TrackFilePredictionStatistics */
+#define TFSG_Memory			6	/* struct TrackFileMemoryStatistics */
+
+/* How busy the I/O request queue is. */
+struct TrackFileQueueStatistics
+{
+	struct TrackFileStatisticsGroup	tfqs_Group;
+
+	ULONG	tfqs_QueueDepth;			/* Number of I/O requests waiting to be processed */
+	ULONG	tfqs_MaxQueueDepth;			/* Most I/O requests which were waiting at a time */
+	ULONG	tfqs_NumRequestsAborted;	/* Number of waiting I/O requests which were aborted */
+};
+
+/* How large read and write requests were split into chunks. */
+struct TrackFileChunkStatistics
+{
+	struct TrackFileStatisticsGroup	tfcs_Group;
+
+	ULONG	tfcs_NumChunkedRequests;		/* Number of large requests which were performed in chunks */
+	ULONG	tfcs_NumRequestsBetweenChunks;	/* Number of requests performed in between these chunks */
+	ULONG	tfcs_MaxLatencyBetweenChunks;	/* Longest time such a request took to complete, in milliseconds */
+};
+
+/* How much time the unit spent on background work. */
+struct TrackFileJobGroup
+{
+	struct TrackFileStatisticsGroup	tfjg_Group;
+
+	struct TrackFileJobStatistics	tfjg_Jobs[NUM_TFJOBS];	/* Indexed by TFJOB_Flush, etc. */
+
+	ULONG	tfjg_NumPauses;		/* Number of times the CPU was given up between time slices */
+	ULONG	tfjg_PauseTime;		/* Total time given up to other tasks, in milliseconds */
+};
+
+/* Which tracks were read since the medium was inserted. */
+struct TrackFileAccessOrder
+{
+	struct TrackFileStatisticsGroup	tfao_Group;
+
+	LONG	tfao_NumTracksAccessed;							/* Number of entries in the table below */
+	UBYTE	tfao_TrackAccessOrder[TF_MAX_WARMUP_TRACKS];	/* Tracks read, in order of first access */
+};
+
+/* How well the track predictor did. */
+struct TrackFilePredictionStatistics
+{
+	struct TrackFileStatisticsGroup	tfps_Group;
+
+	ULONG	tfps_NumPredictions;			/* Number of times the next tracks to be read were predicted */
+	ULONG	tfps_NumCorrectPredictions;		/* Number of times the next track read was among those predicted */
+	ULONG	tfps_NumTracksPrefetched;		/* Number of predicted tracks loaded into the cache */
+	ULONG	tfps_NumPrefetchedTracksUsed;	/* Number of these which were read later */
+	ULONG	tfps_PrefetchBytesWasted;		/* Bytes loaded for predicted tracks which were not read (yet) */
+};
+
+/* Memory used by the unit, in bytes, as allocated. Cache nodes belong to
+ * the disk image file rather than to the unit, and all the units which
+ * use the same file share them. Each node consists of a header, followed
+ * by the track data.
+ */
+struct TrackFileMemoryStatistics
+{
+	struct TrackFileStatisticsGroup	tfms_Group;
+
+	ULONG	tfms_UnitMemory;			/* Unit data structure */
+	ULONG	tfms_TrackBufferMemory;		/* Track buffer, including alignment padding */
+	ULONG	tfms_ChecksumTableMemory;	/* Per-track checksum table */
+	ULONG	tfms_MFMCodeMemory;			/* MFM encoding context for TD_RAWREAD */
+	ULONG	tfms_StackMemory;			/* Unit process stack */
+	ULONG	tfms_CheckpointMemory;		/* Tracks preserved since the last checkpoint */
+
+	ULONG	tfms_NumCacheNodes;			/* Nodes holding tracks of the disk image file */
+	ULONG	tfms_NumCacheImageUsers;	/* Number of units which share these nodes */
+	ULONG	tfms_CacheNodeOverhead;		/* Size of a node header */
+	ULONG	tfms_CacheNodePayload;		/* Size of the track data in a node */
+	ULONG	tfms_TotalCacheNodes;		/* Nodes allocated for all units, including unused ones */
+};
+
+/****************************************************************************/
+
+/* TFGetUnitData() returns this extended structure. Check if tfud_Size
+ * is large enough before you access any of its fields beyond the
+ * TrackFileUnitData. This structure will not grow any further: more
+ * statistics are added as new groups, or as new fields at the end of
+ * the existing groups.
+ */
+struct TrackFileUnitDataExtension
+{
+	struct TrackFileUnitData			tfude_UnitData;
+
+	LONG								tfude_NumTracks;		/* Number of entries in the table below */
+	struct TrackFileTrackStatistics *	tfude_TrackStatistics;	/* Per-track counters; may be NULL */
+
+	struct TrackFileStatisticsGroup *	tfude_Groups;			/* List of statistics groups; may be NULL */
+};
+
+/****************************************************************************/
+
+/* TFCopyUnitTagList() copies the disk contents of one unit to another.
+ * It follows TFExamineFileSize() in the device's function table.
+ */
+LONG TFCopyUnitTagList(LONG from_unit, LONG to_unit, const struct TagItem * tags);
+
+#if defined(__SASC)
+#pragma libcall TrackFileBase TFCopyUnitTagList 5a 81003
+#endif /* __SASC */
+
+/****************************************************************************/
+
+#endif /* _TRACKFILE_EXTENSIONS_H */
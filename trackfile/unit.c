@@ -53,6 +53,7 @@
 #include "tools.h"
 #include "commands.h"
 #include "cache.h"
+#include "background_jobs.h"
 
 /****************************************************************************/
 
@@ -80,6 +81,275 @@ start_timer(struct TrackFileUnit * tfu)
 
 /****************************************************************************/
 
+/* Return the current system time in milliseconds, which is used for
+ * measuring how long I/O requests had to wait. The value wraps around
+ * every 49 days or so, which is harmless for calculating differences.
+ * Note that timer.device must have been opened by the unit Process.
+ */
+ULONG
+get_current_milliseconds(struct TrackFileUnit * tfu)
+{
+	struct Device * TimerBase = tfu->tfu_TimeRequest.tr_node.io_Device;
+	struct timeval tv;
+
+	ASSERT( TimerBase != NULL );
+
+	GetSysTime(&tv);
+
+	return(tv.tv_secs * 1000 + tv.tv_micro / 1000);
+}
+
+/****************************************************************************/
+
+/* Find the table entry of a queued read or write request. This must be
+ * called under Disable() conditions. Returns NULL if the request has
+ * no entry.
+ */
+static struct QueuedRequest *
+find_queued_request(struct TrackFileUnit * tfu, const struct IORequest * io)
+{
+	struct QueuedRequest * result = NULL;
+	int i;
+
+	for(i = 0 ; i < NUM_QUEUED_REQUESTS ; i++)
+	{
+		if(tfu->tfu_QueuedRequests[i].qr_Request == io)
+		{
+			result = &tfu->tfu_QueuedRequests[i];
+			break;
+		}
+	}
+
+	return(result);
+}
+
+/****************************************************************************/
+
+/* Remove an I/O request from the unit's request queue, and release its
+ * table entry, if it has one. This must be called under Disable()
+ * conditions.
+ */
+static VOID
+remove_queued_request(struct TrackFileUnit * tfu, struct IORequest * io)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct QueuedRequest * qr;
+
+	USE_EXEC(tfd);
+
+	ASSERT( FLAG_IS_SET(io->io_Flags, IOF_QUEUED) );
+	ASSERT( tfu->tfu_QueueDepth > 0 );
+
+	Remove(&io->io_Message.mn_Node);
+
+	CLEAR_FLAG(io->io_Flags, IOF_QUEUED);
+
+	tfu->tfu_QueueDepth--;
+
+	qr = find_queued_request(tfu, io);
+	if(qr != NULL)
+		qr->qr_Request = NULL;
+}
+
+/****************************************************************************/
+
+/* Remove the next I/O request from the unit's request queue, in the order
+ * in which the requests were queued. Returns NULL if the queue is empty.
+ */
+static struct IORequest *
+dequeue_unit_request(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	struct IORequest * io;
+
+	USE_EXEC(tfd);
+
+	Disable();
+
+	io = (struct IORequest *)tfu->tfu_Queue.lh_Head;
+	if(io->io_Message.mn_Node.ln_Succ != NULL)
+		remove_queued_request(tfu, io);
+	else
+		io = NULL;
+
+	Enable();
+
+	return(io);
+}
+
+/****************************************************************************/
+
+/* While a large read or write request is being performed in chunks, the
+ * requests waiting in the queue may be performed in between these chunks.
+ * This is limited to small read and write requests which do not conflict
+ * with the part of the disk which the large request has yet to cover,
+ * and requests are only ever taken from the head of the queue. Hence
+ * requests which overlap are still performed in the order in which
+ * they were queued.
+ *
+ * Which part of the disk a request covers was recorded when it was
+ * queued, so that interrupts need to be disabled only for as long as
+ * it takes to compare and unlink it. Requests which would fail the
+ * parameter checks do so before any data is transferred, which is why
+ * they may be performed early, too.
+ */
+static VOID
+perform_requests_between_chunks(
+	struct TrackFileUnit *	tfu,
+	ULONG					remaining_offset,
+	ULONG					remaining_length,
+	BOOL					remaining_is_write,
+	ULONG					chunk_size)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	const struct QueuedRequest * qr;
+	struct IORequest * io;
+	ULONG queue_time;
+	ULONG latency;
+	int count;
+
+	USE_EXEC(tfd);
+
+	for(count = 0 ; count < MAX_REQUESTS_BETWEEN_CHUNKS && NOT tfu->tfu_Stopped ; count++)
+	{
+		Disable();
+
+		io = (struct IORequest *)tfu->tfu_Queue.lh_Head;
+		if(io->io_Message.mn_Node.ln_Succ != NULL &&
+		   (qr = find_queued_request(tfu, io)) != NULL &&
+		   qr->qr_Length <= chunk_size &&
+		   ((NOT qr->qr_IsWrite && NOT remaining_is_write) ||
+		    qr->qr_Offset + qr->qr_Length <= remaining_offset ||
+		    remaining_offset + remaining_length <= qr->qr_Offset))
+		{
+			/* Only requests with a table entry get this far, so
+			 * the time at which it was queued is known.
+			 */
+			queue_time = qr->qr_Time;
+
+			remove_queued_request(tfu, io);
+		}
+		else
+		{
+			io = NULL;
+		}
+
+		Enable();
+
+		if(io == NULL)
+			break;
+
+		D(("unit #%ld performs this command in between chunks (io=0x%08lx)", tfu->tfu_UnitNumber, io));
+
+		perform_io((struct IOStdReq *)io);
+
+		ReplyMsg(&io->io_Message);
+
+		tfu->tfu_NumRequestsBetweenChunks++;
+
+		latency = get_current_milliseconds(tfu) - queue_time;
+
+		if(tfu->tfu_MaxLatencyBetweenChunks < latency)
+			tfu->tfu_MaxLatencyBetweenChunks = latency;
+	}
+}
+
+/****************************************************************************/
+
+/* Perform an I/O request on behalf of the unit Process. Read and write
+ * requests which cover more than NUM_TRACKS_PER_CHUNK tracks are split
+ * into chunks of that size, so that other requests need not wait until
+ * the entire transfer has completed. Only requests which are known to
+ * pass all the parameter checks are split, which means that a request
+ * which fails does so before any data has been transferred.
+ */
+static VOID
+perform_unit_request(struct TrackFileUnit * tfu, struct IOStdReq * io)
+{
+	struct IOExtTD * iotd = (struct IOExtTD *)io;
+	ULONG offset, length;
+	ULONG chunk_size;
+	ULONG num_bytes_done;
+	ULONG num_bytes;
+	ULONG sector_label = 0;
+	APTR data;
+	BOOL is_write;
+
+	if(NOT get_io_request_range(io, &offset, &length, &is_write))
+	{
+		perform_io(io);
+		return;
+	}
+
+	chunk_size = NUM_TRACKS_PER_CHUNK * tfu->tfu_TrackDataSize;
+
+	if(length <= chunk_size)
+	{
+		perform_io(io);
+		return;
+	}
+
+	D(("unit #%ld performs a %lu byte request in chunks of %lu bytes", tfu->tfu_UnitNumber, length, chunk_size));
+
+	tfu->tfu_NumChunkedRequests++;
+
+	data = io->io_Data;
+
+	/* ETD_READ fills in the sector label data, if requested,
+	 * which has to follow the chunk being read.
+	 */
+	if(io->io_Command == ETD_READ)
+		sector_label = iotd->iotd_SecLabel;
+
+	num_bytes_done = 0;
+
+	while(TRUE)
+	{
+		num_bytes = length - num_bytes_done;
+		if(num_bytes > chunk_size)
+			num_bytes = chunk_size;
+
+		io->io_Offset	= offset + num_bytes_done;
+		io->io_Length	= num_bytes;
+		io->io_Data		= &((UBYTE *)data)[num_bytes_done];
+
+		if(sector_label != 0)
+			iotd->iotd_SecLabel = sector_label + (num_bytes_done / TD_SECTOR) * TD_LABELSIZE;
+
+		io->io_Actual = 0;
+
+		perform_io(io);
+
+		/* Account for whatever the failed chunk
+		 * managed to transfer.
+		 */
+		if(io->io_Error != OK)
+		{
+			num_bytes_done += io->io_Actual;
+			break;
+		}
+
+		num_bytes_done += num_bytes;
+
+		if(num_bytes_done == length)
+			break;
+
+		perform_requests_between_chunks(tfu, offset + num_bytes_done, length - num_bytes_done, is_write, chunk_size);
+	}
+
+	/* Restore the request as the client submitted it. */
+	io->io_Offset	= offset;
+	io->io_Length	= length;
+	io->io_Data		= data;
+
+	if(sector_label != 0)
+		iotd->iotd_SecLabel = sector_label;
+
+	io->io_Actual = num_bytes_done;
+}
+
+/****************************************************************************/
+
 /* This is the process which handles all the I/O requests for a
  * unit which cannot be processed immediately in the device
  * BeginIO() function. It also receives control commands, such
@@ -140,6 +410,7 @@ UnitProcessEntry(VOID)
 	init_msgport(&tfu->tfu_Unit.tdu_Unit.unit_MsgPort, (struct Task *)this_process, SIGBREAKB_CTRL_D);
 	init_msgport(&tfu->tfu_ControlPort, (struct Task *)this_process, SIGBREAKB_CTRL_E);
 	init_msgport(&tfu->tfu_TimePort, (struct Task *)this_process, SIGBREAKB_CTRL_F);
+	init_msgport(&tfu->tfu_PausePort, (struct Task *)this_process, SIGBREAKB_CTRL_C);
 
 	/* Also set up the time request for the unit. */
 	tfu->tfu_TimeRequest.tr_node.io_Message.mn_Node.ln_Type	= NT_REPLYMSG;
@@ -155,6 +426,13 @@ UnitProcessEntry(VOID)
 		goto out;
 	}
 
+	/* The background jobs use a copy of the time request
+	 * which shares the same timer.device unit.
+	 */
+	tfu->tfu_PauseRequest = tfu->tfu_TimeRequest;
+	tfu->tfu_PauseRequest.tr_node.io_Message.mn_Node.ln_Type	= NT_REPLYMSG;
+	tfu->tfu_PauseRequest.tr_node.io_Message.mn_ReplyPort	= &tfu->tfu_PausePort;
+
 	SHOWMSG("returning the start message");
 
 	/* Indicate successful startup by filling in the
@@ -191,11 +469,24 @@ UnitProcessEntry(VOID)
 		 */
 		if(signals_received == 0)
 		{
-			/* D(("process for unit %ld is waiting for something to do...", tfu->tfu_UnitNumber)); */
+			/* Use the idle time for background work, if there
+			 * is any. The jobs yield as soon as an I/O request
+			 * or a control message arrives.
+			 */
+			if(tfu->tfu_PendingJobs != 0 && NOT tfu->tfu_Stopped)
+			{
+				signals_received = run_unit_jobs(tfu, io_mask | control_mask);
+
+				signals_received |= SetSignal(0, signal_mask) & signal_mask;
+			}
+			else
+			{
+				/* D(("process for unit %ld is waiting for something to do...", tfu->tfu_UnitNumber)); */
 
-			signals_received = Wait(signal_mask);
+				signals_received = Wait(signal_mask);
 
-			/* SHOWMSG("got something to do at last"); */
+				/* SHOWMSG("got something to do at last"); */
+			}
 		}
 		/* Just update the signals which are currently pending. */
 		else
@@ -210,7 +501,7 @@ UnitProcessEntry(VOID)
 			if(NOT tfu->tfu_Stopped)
 			{
 				/* Is there another IORequest in the queue? */
-				io = (struct IORequest *)GetMsg(&tfu->tfu_Unit.tdu_Unit.unit_MsgPort);
+				io = dequeue_unit_request(tfu);
 				if(io != NULL)
 				{
 					/* We are now busy. */
@@ -218,7 +509,7 @@ UnitProcessEntry(VOID)
 
 					D(("BEGIN: unit #%ld performs this command (io=0x%08lx)", tfu->tfu_UnitNumber, io));
 
-					perform_io((struct IOStdReq *)io);
+					perform_unit_request(tfu, (struct IOStdReq *)io);
 
 					D(("END: unit #%ld performs this command (io=0x%08lx)", tfu->tfu_UnitNumber, io));
 
@@ -267,44 +558,28 @@ UnitProcessEntry(VOID)
 			start_timer(tfu);
 
 			/* Should we write back any changes made to the
-			 * track buffer and turn off the motor?
+			 * track buffer and turn off the motor? This will
+			 * happen as soon as the unit is no longer busy.
+			 * There may be more commands to come.
 			 */
 			if(tfu->tfu_TurnMotorOff)
 			{
-				/* We only do this if the unit is not currently
-				 * busy. There may be more commands to come.
-				 */
-				if(FLAG_IS_CLEAR(tfu->tfu_Unit.tdu_Unit.unit_flags, UNITF_INTASK))
-				{
-					SHOWMSG("unit is not currently busy");
-
-					/* Write back any changes made to the
-					 * track buffer?
-					 */
-					if(tfu->tfu_TrackDataChanged)
-					{
-						SHOWMSG("changes were made to the track buffer; writing it back");
-
-						error = write_back_track_data(tfu);
-						if(error != OK)
-							D(("writing back the track buffer failed (error=%ld)", error));
-					}
-					else
-					{
-						SHOWMSG("no track buffer changes had to be written back");
-					}
-
-					SHOWMSG("turning off the motor");
-
-					turn_off_motor(tfu);
-				}
+				schedule_unit_job(tfu, TFJOB_Flush);
 
 				tfu->tfu_TurnMotorOff = FALSE;
 			}
-			else
+
+			/* Bring the disk checksum up to date? */
+			if(tfu->tfu_ChecksumUpdated)
+				schedule_unit_job(tfu, TFJOB_Checksum);
+
+			#if defined(ENABLE_CACHE)
 			{
-				/* SHOWMSG("no cleanup work necessary"); */
+				/* Reclaim the cache entries which were invalidated? */
+				if(tfd->tfd_CacheContext != NULL && NOT IsMinListEmpty(&tfd->tfd_CacheContext->cc_StaleList))
+					schedule_unit_job(tfu, TFJOB_Cache);
 			}
+			#endif /* ENABLE_CACHE */
 
 			CLEAR_FLAG(signals_received, time_mask);
 		}
@@ -341,7 +616,13 @@ UnitProcessEntry(VOID)
 						ObtainSemaphore(&tfu->tfu_Lock);
 						unit_is_locked = TRUE;
 
+						/* No further I/O requests will be queued
+						 * once the unit Process is gone.
+						 */
+						Disable();
 						tfu->tfu_Process = NULL;
+						Enable();
+
 						tfu->tfu_Stopped = FALSE;
 
 						free_aligned_memory(tfd, &tfu->tfu_TrackMemory);
@@ -447,6 +728,15 @@ UnitProcessEntry(VOID)
 
 							tfu->tfu_TrackDataSize = track_data_size;
 
+							/* Prepare for division-free offset to track
+							 * number conversion (see TRACK_FROM_OFFSET()).
+							 */
+							ASSERT( (track_data_size % TD_SECTOR) == 0 );
+							ASSERT( tfcm->tfcm_FileSize / TD_SECTOR < 32768 );
+
+							tfu->tfu_SectorsPerTrack = track_data_size / TD_SECTOR;
+							tfu->tfu_TrackReciprocal = (65536 + tfu->tfu_SectorsPerTrack - 1) / tfu->tfu_SectorsPerTrack;
+
 							tfu->tfu_TrackFileSystem = fh->fh_Type;
 
 							#if defined(ENABLE_MFM_ENCODING)
@@ -490,6 +780,50 @@ UnitProcessEntry(VOID)
 						tfu->tfu_WriteProtected	= tfcm->tfcm_WriteProtected;
 						tfu->tfu_File			= tfcm->tfcm_File;
 						tfu->tfu_FileSize		= tfcm->tfcm_FileSize;
+						tfu->tfu_ExtendedADF	= tfcm->tfcm_ExtendedADF;
+						tfu->tfu_PackedImage	= tfcm->tfcm_PackedImage;
+
+						/* The track access counters start over with each medium. */
+						memset(tfu->tfu_TrackStatistics, 0, sizeof(tfu->tfu_TrackStatistics));
+
+						/* So does the track access order. */
+						memset(tfu->tfu_TracksAccessed, 0, sizeof(tfu->tfu_TracksAccessed));
+						tfu->tfu_NumTracksAccessed = 0;
+
+						/* Load the tracks which the client expects to be
+						 * read soon into the cache while the unit is idle.
+						 */
+						#if defined(ENABLE_CACHE)
+						{
+							LONG i;
+
+							tfu->tfu_NumWarmupTracks = 0;
+							tfu->tfu_NextWarmupTrack = 0;
+
+							for(i = 0 ; i < tfcm->tfcm_NumWarmupTracks && tfu->tfu_NumWarmupTracks < NUM_STATISTICS_TRACKS ; i++)
+							{
+								if(tfcm->tfcm_WarmupTracks[i] < tfu->tfu_NumTracks)
+									tfu->tfu_WarmupTracks[tfu->tfu_NumWarmupTracks++] = tfcm->tfcm_WarmupTracks[i];
+							}
+
+							D(("%ld tracks to load into the cache", tfu->tfu_NumWarmupTracks));
+
+							if(tfu->tfu_NumWarmupTracks > 0)
+								schedule_unit_job(tfu, TFJOB_Warmup);
+
+							/* The track predictor learns anew for each medium. */
+							memset(tfu->tfu_TrackSuccessors, 0, sizeof(tfu->tfu_TrackSuccessors));
+							memset(tfu->tfu_PrefetchedTracks, 0, sizeof(tfu->tfu_PrefetchedTracks));
+
+							tfu->tfu_PreviousTrack				= -1;
+							tfu->tfu_NumPredictedTracks			= 0;
+							tfu->tfu_NextPredictedTrack			= 0;
+							tfu->tfu_NumPredictions				= 0;
+							tfu->tfu_NumCorrectPredictions		= 0;
+							tfu->tfu_NumTracksPrefetched		= 0;
+							tfu->tfu_NumPrefetchedTracksUsed	= 0;
+						}
+						#endif /* ENABLE_CACHE */
 
 						/* Change the file access mode to reflect
 						 * if write access is permitted. Note that
@@ -522,68 +856,6 @@ UnitProcessEntry(VOID)
 						/* Make no assumptsion about the current file position. */
 						tfu->tfu_FilePosition = -1;
 
-						/* Prefill the cache for this unit by reading the
-						 * entire disk image file first?
-						 */
-						#if defined(ENABLE_CACHE)
-						{
-							/* For now this only works for image files of
-							 * 80 track double density disks.
-							 */
-							SHOWPOINTER(tfd->tfd_CacheContext);
-							SHOWVALUE(tfu->tfu_CacheEnabled);
-							SHOWVALUE(tfu->tfu_DriveType);
-
-							if(tfu->tfu_PrefillCache && tfd->tfd_CacheContext->cc_MaxCacheSize < tfu->tfu_FileSize)
-							{
-								D(("cache cannot hold enough data (%ld bytes) for a complete prefill of unit #%ld (%ld bytes)",
-									tfd->tfd_CacheContext->cc_MaxCacheSize, tfu->tfu_UnitNumber, tfu->tfu_FileSize));
-
-								tfu->tfu_PrefillCache = FALSE;
-							}
-
-							SHOWVALUE(tfu->tfu_PrefillCache);
-
-							if(tfd->tfd_CacheContext != NULL &&
-							   tfu->tfu_CacheEnabled &&
-							   tfu->tfu_DriveType != DRIVE3_5_150RPM &&
-							   tfu->tfu_PrefillCache &&
-							   tfu->tfu_FileSize >= tfd->tfd_CacheContext->cc_MaxCacheSize)
-							{
-								D(("filling the cache for unit #%ld", tfu->tfu_UnitNumber));
-
-								tfu->tfu_FilePosition = -1;
-
-								/* Start from the top... */
-								if(Seek(tfu->tfu_File, 0, OFFSET_BEGINNING) != -1)
-								{
-									LONG num_track_bytes_read;
-									LONG which_track;
-
-									/* Read each track, then store it in the cache. */
-									for(which_track = 0 ; which_track < tfu->tfu_NumTracks ; which_track++)
-									{
-										num_track_bytes_read = Read(tfu->tfu_File, tfu->tfu_TrackData, tfu->tfu_TrackDataSize);
-										if(num_track_bytes_read == -1 || num_track_bytes_read < tfu->tfu_TrackDataSize)
-											break;
-
-										update_cache_contents(tfd->tfd_CacheContext,
-											tfu, which_track,
-											tfu->tfu_TrackData,
-											tfu->tfu_TrackDataSize,
-											UDN_Allocate);
-									}
-								}
-							}
-							else
-							{
-								D(("won't fill the cache for unit #%ld", tfu->tfu_UnitNumber));
-							}
-
-							tfu->tfu_PrefillCache = FALSE;
-						}
-						#endif /* ENABLE_CACHE */
-
 						trigger_change(tfu);
 
 						D(("process for unit %ld has performed a medium insertion", tfu->tfu_UnitNumber));
@@ -609,6 +881,17 @@ UnitProcessEntry(VOID)
 								break;
 							}
 
+							/* The medium cannot go away while it
+							 * is being copied.
+							 */
+							if(unit_is_being_copied(tfu))
+							{
+								SHOWMSG("medium is being copied");
+
+								tfcm->tfcm_Error = TDERR_DriveInUse;
+								break;
+							}
+
 							tfcm->tfcm_Error = eject_image_file(tfu);
 							if(tfcm->tfcm_Error != OK)
 							{
@@ -616,14 +899,18 @@ UnitProcessEntry(VOID)
 								break;
 							}
 
-							/* If the cache is enabled, drop all the cache entries
-							 * previously used by this disk image file. The entries
-							 * will be reused later.
+							/* This unit no longer uses the cache entries of the
+							 * disk image file. The entries may stay in the cache
+							 * so that they can be reused if the same file is
+							 * inserted again, into this unit or a different one.
 							 */
 							#if defined(ENABLE_CACHE)
 							{
-								if(tfd->tfd_CacheContext != NULL)
-									invalidate_cache_entries_for_unit(tfd->tfd_CacheContext, tfu);
+								if(tfd->tfd_CacheContext != NULL && tfu->tfu_CacheImage != NULL)
+								{
+									release_cache_image(tfd->tfd_CacheContext, tfu->tfu_CacheImage);
+									tfu->tfu_CacheImage = NULL;
+								}
 							}
 							#endif /* ENABLE_CACHE */
 
@@ -682,6 +969,19 @@ UnitProcessEntry(VOID)
 							break;
 						}
 
+						/* The tracks of an extended ADF file may have been
+						 * decoded from raw MFM data, and those of a packed
+						 * disk image file were unpacked. Neither can be
+						 * written back.
+						 */
+						if(NOT tfcm->tfcm_WriteProtected && TRACKS_ARE_INDEXED(tfu))
+						{
+							SHOWMSG("extended ADF files and packed disk image files are read-only");
+
+							tfcm->tfcm_Error = TFERROR_ReadOnlyFile;
+							break;
+						}
+
 						/* Check if we can actually remove the write protection,
 						 * since the volume on which the disk image file resides
 						 * may not be write-enabled, or the disk image file itself
@@ -770,7 +1070,9 @@ UnitProcessEntry(VOID)
 						if(NOT tfu->tfu_CacheEnabled && tfd->tfd_CacheContext != NULL)
 						{
 							D(("cache is disabled for unit %ld; also invalidating the unit cache", tfu->tfu_UnitNumber));
-							invalidate_cache_entries_for_unit(tfd->tfd_CacheContext, tfu);
+
+							if(tfu->tfu_CacheImage != NULL)
+								invalidate_cache_image_entries(tfd->tfd_CacheContext, tfu->tfu_CacheImage);
 
 							tfu->tfu_CacheAccesses	= 0;
 							tfu->tfu_CacheMisses	= 0;
@@ -780,6 +1082,156 @@ UnitProcessEntry(VOID)
 
 				#endif /* ENABLE_CACHE */
 
+					/* Provide the data of a run of tracks for
+					 * TFCopyUnitTagList()?
+					 */
+					case TFC_ReadTrackRun:
+
+						D(("TFC_ReadTrackRun: unit %ld needs to read %ld tracks, starting with track %ld",
+							tfu->tfu_UnitNumber,
+							tfcm->tfcm_TrackRun->tftr_NumTracks,
+							tfcm->tfcm_TrackRun->tftr_FirstTrack
+						));
+
+						if(NOT unit_medium_is_present(tfu))
+						{
+							D(("unit %ld currently has no medium inserted", tfu->tfu_UnitNumber));
+
+							tfcm->tfcm_Error = TFERROR_NoMediumPresent;
+							break;
+						}
+
+						tfcm->tfcm_Error = read_track_run(tfu, tfcm->tfcm_TrackRun);
+						break;
+
+					/* Store the data of a run of tracks on behalf
+					 * of TFCopyUnitTagList()?
+					 */
+					case TFC_WriteTrackRun:
+
+						D(("TFC_WriteTrackRun: unit %ld needs to write %ld tracks, starting with track %ld",
+							tfu->tfu_UnitNumber,
+							tfcm->tfcm_TrackRun->tftr_NumTracks,
+							tfcm->tfcm_TrackRun->tftr_FirstTrack
+						));
+
+						if(NOT unit_medium_is_present(tfu))
+						{
+							D(("unit %ld currently has no medium inserted", tfu->tfu_UnitNumber));
+
+							tfcm->tfcm_Error = TFERROR_NoMediumPresent;
+							break;
+						}
+
+						if(tfu->tfu_WriteProtected)
+						{
+							SHOWMSG("medium is write-protected");
+
+							tfcm->tfcm_Error = TDERR_WriteProt;
+							break;
+						}
+
+						/* The file system must not be using the medium
+						 * while its contents are replaced.
+						 */
+						if(unit_medium_is_busy(tfu))
+						{
+							SHOWMSG("motor is still turned on");
+
+							tfcm->tfcm_Error = TDERR_DriveInUse;
+							break;
+						}
+
+						tfcm->tfcm_Error = write_track_run(tfu, tfcm->tfcm_TrackRun);
+						break;
+
+					/* Take a checkpoint of the disk contents, or
+					 * discard it?
+					 */
+					case TFC_Checkpoint:
+
+						D(("TFC_Checkpoint: unit %ld needs to %s a checkpoint",
+							tfu->tfu_UnitNumber,
+							(tfcm->tfcm_Value != FALSE) ? "take" : "discard"
+						));
+
+						if(NOT unit_medium_is_present(tfu))
+						{
+							D(("unit %ld currently has no medium inserted", tfu->tfu_UnitNumber));
+
+							tfcm->tfcm_Error = TFERROR_NoMediumPresent;
+							break;
+						}
+
+						if(tfcm->tfcm_Value != FALSE)
+						{
+							/* Only disk image files which can be written
+							 * to can change later.
+							 */
+							if(TRACKS_ARE_INDEXED(tfu))
+							{
+								SHOWMSG("disk image file is read-only");
+
+								tfcm->tfcm_Error = TDERR_WriteProt;
+								break;
+							}
+
+							tfcm->tfcm_Error = take_checkpoint(tfu);
+						}
+						else
+						{
+							discard_checkpoint(tfu);
+						}
+
+						break;
+
+					/* Restore the disk contents as of the checkpoint? */
+					case TFC_Rollback:
+
+						D(("TFC_Rollback: unit %ld needs to restore %ld tracks",
+							tfu->tfu_UnitNumber,
+							tfu->tfu_NumCheckpointTracks
+						));
+
+						if(NOT unit_medium_is_present(tfu))
+						{
+							D(("unit %ld currently has no medium inserted", tfu->tfu_UnitNumber));
+
+							tfcm->tfcm_Error = TFERROR_NoMediumPresent;
+							break;
+						}
+
+						if(tfu->tfu_WriteProtected)
+						{
+							SHOWMSG("medium is write-protected");
+
+							tfcm->tfcm_Error = TDERR_WriteProt;
+							break;
+						}
+
+						/* The file system must not be using the medium
+						 * while its contents are restored.
+						 */
+						if(unit_medium_is_busy(tfu))
+						{
+							SHOWMSG("motor is still turned on");
+
+							tfcm->tfcm_Error = TDERR_DriveInUse;
+							break;
+						}
+
+						/* Nor must its contents be copied meanwhile. */
+						if(unit_is_being_copied(tfu))
+						{
+							SHOWMSG("medium is being copied");
+
+							tfcm->tfcm_Error = TDERR_DriveInUse;
+							break;
+						}
+
+						tfcm->tfcm_Error = roll_back_to_checkpoint(tfu);
+						break;
+
 					default:
 
 						D(("reject unknown action %ld", tfcm->tfcm_Type));
@@ -824,31 +1276,14 @@ UnitProcessEntry(VOID)
 		SHOWMSG("timer shut down.");
 	}
 
-	/* Note: We drop into Disable() and not into Forbid()
-	 *       because BeginIO() is sort of permitted to
-	 *       be called from interrupt code. This means
-	 *       our cleanup operation below, which discards
-	 *       any I/O requests that may have arrived
-	 *       since we started shutting down, must make
-	 *       sure that we don't miss anything.
-	 */
-	Disable();
-
-	if(unit_is_locked)
-	{
-		D(("releasing unit %ld lock", tfu->tfu_UnitNumber));
-		ReleaseSemaphore(&tfu->tfu_Lock);
-	}
-
-	/* Throw all the inbound IO requests away which
-	 * have accumulated since we entered Disable()
-	 * state.
+	/* Throw away the I/O requests which are still queued. No
+	 * new requests can be added since tfu->tfu_Process is NULL.
 	 */
 	SHOWMSG("bouncing all pending I/O requests");
 
 	ASSERT( NOT unit_medium_is_present(tfu) );
 
-	while((io = (struct IORequest *)GetMsg(&tfu->tfu_Unit.tdu_Unit.unit_MsgPort)) != NULL)
+	while((io = dequeue_unit_request(tfu)) != NULL)
 	{
 		D(("   .oOo.oOo.oOo. 0x%08lx...", io));
 
@@ -857,6 +1292,19 @@ UnitProcessEntry(VOID)
 		ReplyMsg(&io->io_Message);
 	}
 
+	/* Note: We drop into Disable() and not into Forbid()
+	 *       so that this Process cannot be interrupted
+	 *       while it replies the last messages and
+	 *       winds down.
+	 */
+	Disable();
+
+	if(unit_is_locked)
+	{
+		D(("releasing unit %ld lock", tfu->tfu_UnitNumber));
+		ReleaseSemaphore(&tfu->tfu_Lock);
+	}
+
 	SHOWMSG("bouncing all pending control requests");
 
 	while((tfcm = (struct TrackFileControlMsg *)GetMsg(&tfu->tfu_ControlPort)) != NULL)
@@ -891,20 +1339,14 @@ UnitProcessEntry(VOID)
 
 /****************************************************************************/
 
-/* Send a control command to a specific unit, such as for inserting
- * or ejecting a storage medium, or for the unit to shut down.
+/* Send a control message to a specific unit and wait for the
+ * unit to reply it. The message must have been filled in by the
+ * caller, except for the reply port.
  */
-LONG
-send_unit_control_command(
-	struct TrackFileUnit *	tfu,
-	LONG					type,
-	BPTR					file,
-	LONG					file_size,
-	BOOL					write_protected,
-	LONG					value)
+static LONG
+send_control_message(struct TrackFileUnit * tfu, struct TrackFileControlMsg * tfcm)
 {
 	struct TrackFileDevice * tfd = tfu->tfu_Device;
-	struct TrackFileControlMsg tfcm;
 	struct MsgPort mp;
 
 	USE_EXEC(tfd);
@@ -916,17 +1358,9 @@ send_unit_control_command(
 
 	init_msgport(&mp, FindTask(NULL), SIGB_SINGLE);
 
-	/* Now fill in the control command's message. */
-	memset(&tfcm, 0, sizeof(tfcm));
-
-	tfcm.tfcm_Message.mn_ReplyPort	= &mp;
-	tfcm.tfcm_Message.mn_Length		= sizeof(tfcm);
-	tfcm.tfcm_Type					= type;
-	tfcm.tfcm_Error					= OK;
-	tfcm.tfcm_File					= file;
-	tfcm.tfcm_FileSize				= file_size;
-	tfcm.tfcm_WriteProtected		= write_protected;
-	tfcm.tfcm_Value					= value;
+	tfcm->tfcm_Message.mn_ReplyPort	= &mp;
+	tfcm->tfcm_Message.mn_Length	= sizeof(*tfcm);
+	tfcm->tfcm_Error				= OK;
 
 	Forbid();
 
@@ -939,7 +1373,7 @@ send_unit_control_command(
 		 *            eventually drop into WaitPort().
 		 */
 		SetSignal(0, (1UL << mp.mp_SigBit));
-		PutMsg(&tfu->tfu_ControlPort, &tfcm.tfcm_Message);
+		PutMsg(&tfu->tfu_ControlPort, &tfcm->tfcm_Message);
 		WaitPort(&mp);
 
 		D(("control message for unit #%ld has been returned", tfu->tfu_UnitNumber));
@@ -947,12 +1381,95 @@ send_unit_control_command(
 	/* So the unit is no longer active. */
 	else
 	{
-		tfcm.tfcm_Error = TFERROR_UnitNotActive;
+		tfcm->tfcm_Error = TFERROR_UnitNotActive;
 	}
 
 	Permit();
 
-	return(tfcm.tfcm_Error);
+	return(tfcm->tfcm_Error);
+}
+
+/****************************************************************************/
+
+/* Send a control command to a specific unit, such as for inserting
+ * or ejecting a storage medium, or for the unit to shut down.
+ */
+LONG
+send_unit_control_command(
+	struct TrackFileUnit *	tfu,
+	LONG					type,
+	BPTR					file,
+	LONG					file_size,
+	BOOL					write_protected,
+	LONG					value)
+{
+	struct TrackFileControlMsg tfcm;
+
+	/* Now fill in the control command's message. */
+	memset(&tfcm, 0, sizeof(tfcm));
+
+	tfcm.tfcm_Type				= type;
+	tfcm.tfcm_File				= file;
+	tfcm.tfcm_FileSize			= file_size;
+	tfcm.tfcm_WriteProtected	= write_protected;
+	tfcm.tfcm_Value				= value;
+
+	return(send_control_message(tfu, &tfcm));
+}
+
+/****************************************************************************/
+
+/* Ask a unit to use a new medium. If the disk image file is an extended
+ * ADF file or a packed disk image file, the unit becomes responsible for
+ * the track information, but only if the medium was accepted. The unit
+ * copies the list of tracks to load into the cache, if one is given.
+ */
+LONG
+send_unit_insert_command(
+	struct TrackFileUnit *		tfu,
+	BPTR						file,
+	LONG						file_size,
+	BOOL						write_protected,
+	struct ExtendedADFImage *	eai,
+	struct PackedImage *		pi,
+	const UBYTE *				warmup_tracks,
+	LONG						num_warmup_tracks)
+{
+	struct TrackFileControlMsg tfcm;
+
+	memset(&tfcm, 0, sizeof(tfcm));
+
+	tfcm.tfcm_Type				= TFC_Insert;
+	tfcm.tfcm_File				= file;
+	tfcm.tfcm_FileSize			= file_size;
+	tfcm.tfcm_WriteProtected	= write_protected;
+	tfcm.tfcm_ExtendedADF		= eai;
+	tfcm.tfcm_PackedImage		= pi;
+	tfcm.tfcm_WarmupTracks		= warmup_tracks;
+	tfcm.tfcm_NumWarmupTracks	= num_warmup_tracks;
+
+	return(send_control_message(tfu, &tfcm));
+}
+
+/****************************************************************************/
+
+/* Ask a unit to either read or write a run of consecutive tracks,
+ * which is how TFCopyUnitTagList() moves data between units.
+ */
+LONG
+send_unit_track_run(struct TrackFileUnit * tfu, LONG type, struct TrackFileTrackRun * tftr)
+{
+	struct TrackFileControlMsg tfcm;
+
+	ASSERT( type == TFC_ReadTrackRun || type == TFC_WriteTrackRun );
+	ASSERT( tftr != NULL && 0 < tftr->tftr_NumTracks && tftr->tftr_NumTracks <= MAX_TRACK_RUN_LENGTH );
+
+	memset(&tfcm, 0, sizeof(tfcm));
+
+	tfcm.tfcm_Type		= type;
+	tfcm.tfcm_TrackRun	= tftr;
+
+	return(send_control_message(tfu, &tfcm));
 }
 
 /****************************************************************************/
@@ -1091,9 +1608,18 @@ eject_image_file(struct TrackFileUnit * tfu)
 		SHOWMSG("file is closed now.");
 	}
 
+	free_extended_adf(tfd, tfu->tfu_ExtendedADF);
+	tfu->tfu_ExtendedADF = NULL;
+
+	free_packed_image(tfd, tfu->tfu_PackedImage);
+	tfu->tfu_PackedImage = NULL;
+
 	mark_track_buffer_as_invalid(tfu);
 	turn_off_motor(tfu);
 
+	/* The checkpoint only applies to the file just closed. */
+	discard_checkpoint(tfu);
+
 	/* Any changes made to the unit file have been
 	 * accounted for now.
 	 */
@@ -1251,3 +1777,135 @@ unit_medium_is_busy(struct TrackFileUnit * tfu)
 
 	return(is_busy);
 }
+
+/****************************************************************************/
+
+/* Check if TFCopyUnitTagList() is currently copying from or to
+ * this unit.
+ */
+BOOL
+unit_is_being_copied(struct TrackFileUnit * tfu)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	BOOL is_copying;
+
+	USE_EXEC(tfd);
+
+	ASSERT( tfu != NULL );
+
+	D(("obtaining unit %ld lock", tfu->tfu_UnitNumber));
+	ObtainSemaphore(&tfu->tfu_Lock);
+
+	is_copying = tfu->tfu_Copying;
+
+	D(("releasing unit %ld lock", tfu->tfu_UnitNumber));
+	ReleaseSemaphore(&tfu->tfu_Lock);
+
+	return(is_copying);
+}
+
+/****************************************************************************/
+
+/* Add an I/O request to the end of the unit's request queue and wake up
+ * the unit Process, which will perform it. Returns FALSE if the unit
+ * Process is no longer active, in which case the request is not queued.
+ *
+ * Just like PutMsg(), this may be called from interrupt code and from
+ * within Forbid() or Disable(). The queue is therefore only ever
+ * accessed under Disable() conditions, for as long as it takes to
+ * link or unlink a request.
+ */
+BOOL
+queue_unit_request(struct TrackFileUnit * tfu, struct IORequest * io)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	const struct IOStdReq * iostd = (struct IOStdReq *)io;
+	struct QueuedRequest entry;
+	struct QueuedRequest * qr;
+	BOOL queued = FALSE;
+
+	USE_EXEC(tfd);
+
+	ASSERT( tfu != NULL && io != NULL );
+
+	/* Remember when this read or write request was queued,
+	 * so that its latency can be measured, and which part
+	 * of the disk it covers. This has to be done before
+	 * interrupts are disabled. A request whose range wraps
+	 * around will fail its parameter checks anyway.
+	 */
+	entry.qr_Request = NULL;
+
+	if(is_read_write_command(io) && NOT addition_overflows(iostd->io_Offset, iostd->io_Length))
+	{
+		entry.qr_Request	= io;
+		entry.qr_Time		= get_current_milliseconds(tfu);
+		entry.qr_Offset		= iostd->io_Offset;
+		entry.qr_Length		= iostd->io_Length;
+		entry.qr_IsWrite	= (BOOL)(io->io_Command == CMD_WRITE || io->io_Command == ETD_WRITE);
+	}
+
+	Disable();
+
+	if(tfu->tfu_Process != NULL)
+	{
+		if(entry.qr_Request != NULL)
+		{
+			/* Use the first unused entry, if any. */
+			qr = find_queued_request(tfu, NULL);
+			if(qr != NULL)
+				(*qr) = entry;
+		}
+
+		AddTail(&tfu->tfu_Queue, &io->io_Message.mn_Node);
+
+		SET_FLAG(io->io_Flags, IOF_QUEUED);
+
+		tfu->tfu_QueueDepth++;
+
+		if(tfu->tfu_MaxQueueDepth < tfu->tfu_QueueDepth)
+			tfu->tfu_MaxQueueDepth = tfu->tfu_QueueDepth;
+
+		Signal(&tfu->tfu_Process->pr_Task, (1UL << tfu->tfu_Unit.tdu_Unit.unit_MsgPort.mp_SigBit));
+
+		queued = TRUE;
+	}
+
+	Enable();
+
+	return(queued);
+}
+
+/****************************************************************************/
+
+/* Remove an I/O request from the unit's request queue if it has not been
+ * picked up by the unit Process yet. Whether the request is still in the
+ * queue is recorded in the request itself, so that the queue never needs
+ * to be searched. Returns TRUE if the request was removed, in which case
+ * the caller must reply it.
+ */
+BOOL
+abort_queued_unit_request(struct TrackFileUnit * tfu, struct IORequest * io)
+{
+	struct TrackFileDevice * tfd = tfu->tfu_Device;
+	BOOL removed = FALSE;
+
+	USE_EXEC(tfd);
+
+	ASSERT( tfu != NULL && io != NULL );
+
+	Disable();
+
+	if(io->io_Message.mn_Node.ln_Type == NT_MESSAGE && FLAG_IS_SET(io->io_Flags, IOF_QUEUED))
+	{
+		remove_queued_request(tfu, io);
+
+		tfu->tfu_NumRequestsAborted++;
+
+		removed = TRUE;
+	}
+
+	Enable();
+
+	return(removed);
+}
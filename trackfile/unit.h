@@ -46,6 +46,80 @@
 #include "cache.h"
 #endif /* _CACHE_H */
 
+#ifndef _EXTENDED_ADF_H
+#include "extended_adf.h"
+#endif /* _EXTENDED_ADF_H */
+
+#ifndef _PACKED_IMAGE_H
+#include "packed_image.h"
+#endif /* _PACKED_IMAGE_H */
+
+#ifndef _TRACKFILE_EXTENSIONS_H
+#include "trackfile_extensions.h"
+#endif /* _TRACKFILE_EXTENSIONS_H */
+
+/****************************************************************************/
+
+/* Per-track access counters are kept for up to 80 cylinders
+ * with two heads each (NUMCYLS * NUMHEADS).
+ */
+#define NUM_STATISTICS_TRACKS (80 * 2)
+
+/****************************************************************************/
+
+/* The track predictor remembers this many likely successors of each
+ * track, and a successor must have followed the track at least this
+ * often before it will be loaded into the cache ahead of time.
+ */
+#define NUM_TRACK_SUCCESSORS	2
+#define MIN_SUCCESSOR_COUNT		2
+
+/* A track which was loaded into the track buffer after another one, and
+ * how often this happened, relative to the other successors.
+ */
+struct TrackSuccessor
+{
+	UBYTE	ts_Track;
+	UBYTE	ts_Count;	/* 0 if this entry is unused */
+};
+
+/****************************************************************************/
+
+/* This io_Flags bit is set while an I/O request waits in the request
+ * queue of a unit. trackdisk.device does not use this bit.
+ */
+#define IOB_QUEUED	7
+#define IOF_QUEUED	(1<<IOB_QUEUED)
+
+/* For each read or write request in the request queue, the unit keeps
+ * the time at which it was queued and the part of the disk which it
+ * covers in a small table, rather than in the request, which belongs to
+ * the client. The table is filled in before the request is queued, so
+ * that no command needs to be examined while the queue is accessed under
+ * Disable() conditions. If the table is full, the request is queued
+ * without an entry: it is never performed in between the chunks of a
+ * large request, and its latency is not measured.
+ */
+#define NUM_QUEUED_REQUESTS 16
+
+struct QueuedRequest
+{
+	struct IORequest *	qr_Request;		/* NULL if this entry is unused */
+	ULONG				qr_Time;		/* When the request was queued, in milliseconds */
+	ULONG				qr_Offset;		/* io_Offset, as queued */
+	ULONG				qr_Length;		/* io_Length, as queued */
+	BOOL				qr_IsWrite;		/* TRUE for CMD_WRITE and ETD_WRITE */
+};
+
+/****************************************************************************/
+
+/* Read and write requests which cover more than this many tracks are
+ * performed in chunks of this size. In between these chunks up to
+ * MAX_REQUESTS_BETWEEN_CHUNKS other requests may be performed.
+ */
+#define NUM_TRACKS_PER_CHUNK		4
+#define MAX_REQUESTS_BETWEEN_CHUNKS	8
+
 /****************************************************************************/
 
 /* Each unit has its own state information and data to manage.
@@ -66,6 +140,20 @@ struct TrackFileUnit
 
 	BOOL							tfu_Stopped;				/* FALSE if the unit still processes commands, TRUE otherwise. */
 
+	struct List						tfu_Queue;					/* I/O requests waiting to be processed; access only under Disable() */
+	ULONG							tfu_QueueDepth;				/* Number of I/O requests in the queue */
+	struct QueuedRequest			tfu_QueuedRequests[NUM_QUEUED_REQUESTS];	/* Queued read and write requests; access only under Disable() */
+	ULONG							tfu_MaxQueueDepth;			/* Most I/O requests queued at a time */
+	ULONG							tfu_NumRequestsAborted;		/* Number of queued I/O requests which were aborted */
+	ULONG							tfu_NumChunkedRequests;		/* Number of large requests which were performed in chunks */
+	ULONG							tfu_NumRequestsBetweenChunks;	/* Number of requests performed in between these chunks */
+	ULONG							tfu_MaxLatencyBetweenChunks;	/* Longest time such a request took to complete, in milliseconds */
+
+	ULONG							tfu_PendingJobs;			/* Background jobs to run while idle; (1 << TFJOB_Flush), etc. */
+	struct TrackFileJobStatistics	tfu_JobStatistics[NUM_TFJOBS];	/* Per-job counters */
+	ULONG							tfu_NumJobPauses;			/* Number of times the CPU was given up between time slices */
+	ULONG							tfu_JobPauseTime;			/* Total time given up, in milliseconds */
+
 	struct SignalSemaphore			tfu_Lock;					/* Hold this to access certain fields of the unit data */
 
 	BOOL							tfu_TurnMotorOff;			/* Eventually, turn off the motor */
@@ -77,9 +165,17 @@ struct TrackFileUnit
 	struct MsgPort					tfu_TimePort;
 	UWORD							tfu_Pad1;
 
+	struct timerequest				tfu_PauseRequest;			/* So background jobs can give up the CPU between time slices */
+	struct MsgPort					tfu_PausePort;
+	UWORD							tfu_Pad2;
+
 	BPTR							tfu_File;					/* Will be ZERO if no medium is present */
 	LONG							tfu_FilePosition;			/* Current file seek position, or -1 if not known */
+	const struct ImageBackend *		tfu_ImageBackend;			/* Reads and writes the data of a plain disk image file */
+	TEXT							tfu_BlockServerName[TF_MAX_BLOCK_SERVER_NAME_LEN];	/* Used by the block server backend */
 	LONG							tfu_FileSize;				/* Needed for bounds checking in many commands */
+	struct ExtendedADFImage *		tfu_ExtendedADF;			/* Not NULL if the file is an extended ADF file */
+	struct PackedImage *			tfu_PackedImage;			/* Not NULL if the file is a packed disk image file */
 
 	LONG							tfu_DriveType;				/* Either a DD or HD 3.5" disk drive (see <devices/trackdisk.h>) */
 	LONG							tfu_NumCylinders;			/* 80 for a 3.5" disk drive for a 5.25" disk drive with 80 cylinders */
@@ -90,6 +186,8 @@ struct TrackFileUnit
 	struct MsgPort *				tfu_TrackFileSystem;		/* File system process responsible for the disk image file */
 	APTR							tfu_TrackData;				/* Read/write cache for this unit; holds exactly one track */
 	LONG							tfu_TrackDataSize;			/* Size of the read/write cache in bytes */
+	UWORD							tfu_SectorsPerTrack;		/* Number of sectors in a track, i.e. tfu_TrackDataSize / TD_SECTOR */
+	UWORD							tfu_TrackReciprocal;		/* 65536 / tfu_SectorsPerTrack, rounded up */
 	struct fletcher64_checksum		tfu_TrackDataChecksum;		/* Checksum for the track data */
 
 	struct fletcher64_checksum *	tfu_DiskChecksumTable;		/* If not NULL, individual track checksums. */
@@ -97,6 +195,7 @@ struct TrackFileUnit
 	struct fletcher64_checksum		tfu_DiskChecksum;			/* Checksum covering all the tracks. */
 
 	LONG							tfu_CurrentTrackNumber;		/* Which track is currently in the read/write cache; can be -1 */
+	ULONG							tfu_ValidSectors;			/* One bit for each sector in the read/write cache which holds valid data */
 
 	LONG							tfu_RootDirTrackNumber;
 	ULONG							tfu_FileSystemSignature;
@@ -112,11 +211,25 @@ struct TrackFileUnit
 	BOOL							tfu_TrackDataChanged;		/* True if the read/write cache contents have been modified */
 	BOOL							tfu_ChangesMade;			/* True if track data was ever written back to the file */
 	BOOL							tfu_WriteProtected;			/* True if the medium cannot be written to */
+	BOOL							tfu_Copying;				/* True while TFCopyUnitTagList() uses this unit; change it
+																 * only while holding both the device and the unit lock
+																 */
 	BOOL							tfu_ChecksumUpdated;		/* True if the track checksums were updated, but not the disk checksum */
 	BOOL							tfu_IgnoreTrackChecksum;	/* True if the current track checksum should be ignored when
 																 * writing back the track.
 																 */
 
+	struct TrackFileTrackStatistics	tfu_TrackStatistics[NUM_STATISTICS_TRACKS];	/* Per-track access counters */
+
+	UBYTE							tfu_TrackAccessOrder[NUM_STATISTICS_TRACKS];	/* Tracks read since the medium was inserted, in order of first access */
+	LONG							tfu_NumTracksAccessed;		/* Number of entries in tfu_TrackAccessOrder */
+	ULONG							tfu_TracksAccessed[(NUM_STATISTICS_TRACKS + 31) / 32];	/* One bit for each track in tfu_TrackAccessOrder */
+
+	BOOL							tfu_CheckpointActive;		/* True if tracks are preserved before they are changed */
+	APTR							tfu_CheckpointTracks[NUM_STATISTICS_TRACKS];		/* Track contents as of the checkpoint; NULL if unchanged */
+	struct fletcher64_checksum		tfu_CheckpointChecksums[NUM_STATISTICS_TRACKS];	/* Checksums of the preserved tracks */
+	LONG							tfu_NumCheckpointTracks;	/* Number of tracks preserved */
+
 	/************************************************************************/
 
 	#if defined(ENABLE_MFM_ENCODING)
@@ -130,17 +243,75 @@ struct TrackFileUnit
 
 	#if defined(ENABLE_CACHE)
 
-		struct MinList				tfu_CacheNodeList;			/* All the CacheNodes used by this unit */
+		struct CacheImage *			tfu_CacheImage;				/* Cache entries for the disk image file in use */
 		ULONG						tfu_CacheAccesses;			/* Total number cache accesses */
 		ULONG						tfu_CacheMisses;			/* Number of cache misses */
 		BOOL						tfu_CacheEnabled;			/* Is the cache currently active for this unit? */
-		BOOL						tfu_PrefillCache;			/* When loading a medium, fill the entire cache? */
+
+		UBYTE						tfu_WarmupTracks[NUM_STATISTICS_TRACKS];	/* Tracks to load into the cache after insertion */
+		LONG						tfu_NumWarmupTracks;		/* Number of entries in tfu_WarmupTracks */
+		LONG						tfu_NextWarmupTrack;		/* Index of the next entry to load */
+
+		BOOL						tfu_PredictTracks;			/* Load the likely next tracks into the cache? */
+		struct TrackSuccessor		tfu_TrackSuccessors[NUM_STATISTICS_TRACKS][NUM_TRACK_SUCCESSORS];	/* Most frequent successors of each track */
+		LONG						tfu_PreviousTrack;			/* Track last loaded into the track buffer, or -1 */
+		UBYTE						tfu_PredictedTracks[NUM_TRACK_SUCCESSORS];	/* Tracks likely to be loaded next */
+		LONG						tfu_NumPredictedTracks;		/* Number of entries in tfu_PredictedTracks */
+		LONG						tfu_NextPredictedTrack;		/* Index of the next entry to load */
+		ULONG						tfu_PrefetchedTracks[(NUM_STATISTICS_TRACKS + 31) / 32];	/* Predicted tracks loaded but not read yet */
+		ULONG						tfu_NumPredictions;			/* Number of times the next tracks were predicted */
+		ULONG						tfu_NumCorrectPredictions;	/* Number of times the next track was among them */
+		ULONG						tfu_NumTracksPrefetched;	/* Number of predicted tracks loaded into the cache */
+		ULONG						tfu_NumPrefetchedTracksUsed;	/* Number of these which were read later */
 
 	#endif /* ENABLE_CACHE */
 };
 
 /****************************************************************************/
 
+/* Convert between byte offsets into the disk image file and track numbers
+ * without resorting to 32 bit division and multiplication, which the
+ * 68000 can only perform through slow library calls. The sector number
+ * fits into 16 bits and is multiplied by the precomputed reciprocal of
+ * the number of sectors per track, which gives the exact quotient for
+ * all sector numbers below 32768. That is far more than the 3520 sectors
+ * of a high density disk. The track start offset is the product of two
+ * 16 bit numbers. Larger offsets silently produce wrong results, which
+ * is why the offset must have been checked against the disk size, e.g.
+ * by check_offset(), before TRACK_FROM_OFFSET() may be used. See
+ * goodies/track_reciprocal.c for a test which compares the results to
+ * those of plain division.
+ */
+#define TRACK_FROM_OFFSET(tfu, offset) \
+	((LONG)(((ULONG)((UWORD)((ULONG)(offset) / TD_SECTOR) * (tfu)->tfu_TrackReciprocal)) >> 16))
+
+#define OFFSET_FROM_TRACK(tfu, track) \
+	((LONG)((UWORD)(track) * (UWORD)(tfu)->tfu_TrackDataSize))
+
+/****************************************************************************/
+
+/* The tracks of extended ADF files and packed disk image files are not
+ * stored at fixed offsets in the file, and can only be read, not written.
+ */
+#define TRACKS_ARE_INDEXED(tfu) \
+	((tfu)->tfu_ExtendedADF != NULL || (tfu)->tfu_PackedImage != NULL)
+
+/****************************************************************************/
+
+/* A write operation which does not cover a complete track need not read
+ * the track first. Only the sectors written to are valid then, and the
+ * others are read later, if they are needed at all. These masks have one
+ * bit for each sector of the track buffer, with up to 22 sectors on a
+ * high density disk.
+ */
+#define ALL_SECTORS_VALID(tfu) \
+	((1UL << (tfu)->tfu_SectorsPerTrack) - 1)
+
+#define SECTOR_RANGE(first_sector, num_sectors) \
+	(((1UL << (num_sectors)) - 1) << (first_sector))
+
+/****************************************************************************/
+
 /* The unit process receives control messages which concern mainly whether
  * a medium should be ejected or inserted. But shutting down a unit process
  * so that it releases as much unit memory as possible is needed, too.
@@ -152,6 +323,29 @@ enum trackfilecontrol_msg_t
 	TFC_Eject,
 	TFC_ChangeWriteProtection,
 	TFC_ChangeEnableCache,
+	TFC_ReadTrackRun,
+	TFC_WriteTrackRun,
+	TFC_Checkpoint,
+	TFC_Rollback,
+};
+
+/****************************************************************************/
+
+/* TFCopyUnitTagList() copies the tracks of one unit to another in runs
+ * of consecutive tracks. The source unit fills in the track data and,
+ * if requested, the track checksums, both of which the destination unit
+ * then stores. A run must not be longer than MAX_TRACK_RUN_LENGTH tracks
+ * because the source unit keeps track of which tracks it still has to
+ * read from its disk image file in a 32 bit mask.
+ */
+#define MAX_TRACK_RUN_LENGTH 16
+
+struct TrackFileTrackRun
+{
+	APTR							tftr_Data;			/* Data of all the tracks in the run */
+	struct fletcher64_checksum *	tftr_Checksums;		/* One per track; can be NULL */
+	LONG							tftr_FirstTrack;	/* Number of the first track in the run */
+	LONG							tftr_NumTracks;		/* Number of tracks in the run */
 };
 
 /****************************************************************************/
@@ -169,22 +363,34 @@ struct TrackFileControlMsg
 
 	BPTR						tfcm_File;				/* This is needed by TFC_Insert */
 	LONG						tfcm_FileSize;			/* This is needed by TFC_Insert */
+	struct ExtendedADFImage *	tfcm_ExtendedADF;		/* This is needed by TFC_Insert */
+	struct PackedImage *		tfcm_PackedImage;		/* This is needed by TFC_Insert */
+	const UBYTE *				tfcm_WarmupTracks;		/* This is needed by TFC_Insert */
+	LONG						tfcm_NumWarmupTracks;	/* This is needed by TFC_Insert */
 
 	BOOL						tfcm_WriteProtected;	/* This is needed by TFC_Insert and TFC_ChangeWriteProtection */
 
-	BOOL						tfcm_Value;				/* This is needed by TFC_ChangeEnableCache */
+	BOOL						tfcm_Value;				/* This is needed by TFC_ChangeEnableCache and TFC_Checkpoint */
+
+	struct TrackFileTrackRun *	tfcm_TrackRun;			/* This is needed by TFC_ReadTrackRun and TFC_WriteTrackRun */
 };
 
 /****************************************************************************/
 
 VOID UnitProcessEntry(VOID);
 LONG send_unit_control_command(struct TrackFileUnit *tfu, LONG type, BPTR file, LONG file_size, BOOL write_protected, LONG value);
+LONG send_unit_insert_command(struct TrackFileUnit * tfu, BPTR file, LONG file_size, BOOL write_protected, struct ExtendedADFImage * eai, struct PackedImage * pi, const UBYTE * warmup_tracks, LONG num_warmup_tracks);
+LONG send_unit_track_run(struct TrackFileUnit * tfu, LONG type, struct TrackFileTrackRun * tftr);
 struct TrackFileUnit * find_unit_by_number(struct TrackFileDevice * tfd, LONG unit_number);
 LONG eject_image_file(struct TrackFileUnit * tfu);
 VOID trigger_change(struct TrackFileUnit * tfu);
 BOOL unit_is_active(struct TrackFileUnit *tfu);
 BOOL unit_medium_is_present(struct TrackFileUnit *tfu);
 BOOL unit_medium_is_busy(struct TrackFileUnit * tfu);
+BOOL unit_is_being_copied(struct TrackFileUnit * tfu);
+BOOL queue_unit_request(struct TrackFileUnit * tfu, struct IORequest * io);
+BOOL abort_queued_unit_request(struct TrackFileUnit * tfu, struct IORequest * io);
+ULONG get_current_milliseconds(struct TrackFileUnit * tfu);
 
 /****************************************************************************/
 